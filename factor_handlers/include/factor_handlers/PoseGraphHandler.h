@@ -11,6 +11,7 @@
 #include <factor_handlers/LampDataHandlerBase.h>
 #include <unordered_map>
 #include <unordered_set>
+#include <lamp_utils/KeyedScanCodec.h>
 #include <lamp_utils/PointCloudUtils.h>
 
 namespace pu = parameter_utils;
@@ -43,6 +44,8 @@ class PoseGraphHandler : public LampDataHandlerBase {
     // Input callbacks
     void PoseGraphCallback(const pose_graph_msgs::PoseGraph::ConstPtr& msg);
     void KeyedScanCallback(const pose_graph_msgs::KeyedScan::ConstPtr& msg);
+    void CompressedKeyedScanCallback(
+        const pose_graph_msgs::CompressedKeyedScan::ConstPtr& msg);
 
     // Publishers
     ros::Publisher keyed_scan_pub_;
@@ -68,6 +71,9 @@ class PoseGraphHandler : public LampDataHandlerBase {
     // Parameters when recomputing normals for republishing keyed scans on base
     lamp_utils::NormalComputeParams normals_compute_params_;
 
+    // Receive the compressed keyed scans of the robots
+    bool b_compressed_keyed_scans_;
+
   private:
 
 };
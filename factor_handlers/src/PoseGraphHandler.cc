@@ -51,6 +51,9 @@ bool PoseGraphHandler::LoadParameters(const ros::NodeHandle& n) {
                normals_compute_params_.num_threads))
     return false;
 
+  b_compressed_keyed_scans_ = false;
+  pu::Get("scan_compression/b_enable", b_compressed_keyed_scans_);
+
   return true;
 }
 
@@ -87,11 +90,19 @@ bool PoseGraphHandler::RegisterCallbacks(const ros::NodeHandle& n) {
         this);
 
     // Keyed scans
-    keyed_scan_sub = nl.subscribe<pose_graph_msgs::KeyedScan>(
-        "/" + robot + "/lamp/keyed_scans",
-        100000,
-        &PoseGraphHandler::KeyedScanCallback,
-        this);
+    if (b_compressed_keyed_scans_) {
+      keyed_scan_sub = nl.subscribe<pose_graph_msgs::CompressedKeyedScan>(
+          "/" + robot + "/lamp/keyed_scans_compressed",
+          100000,
+          &PoseGraphHandler::CompressedKeyedScanCallback,
+          this);
+    } else {
+      keyed_scan_sub = nl.subscribe<pose_graph_msgs::KeyedScan>(
+          "/" + robot + "/lamp/keyed_scans",
+          100000,
+          &PoseGraphHandler::KeyedScanCallback,
+          this);
+    }
 
     // Store the subscribers
     subscribers_posegraph.push_back(pose_graph_sub);
@@ -179,6 +190,17 @@ void PoseGraphHandler::PoseGraphCallback(const pose_graph_msgs::PoseGraph::Const
   }
 }
 
+void PoseGraphHandler::CompressedKeyedScanCallback(
+    const pose_graph_msgs::CompressedKeyedScan::ConstPtr& msg) {
+  pose_graph_msgs::KeyedScan::Ptr keyed_scan(new pose_graph_msgs::KeyedScan);
+  if (!lamp_utils::DecodeKeyedScan(*msg, keyed_scan.get())) {
+    ROS_ERROR_STREAM("PoseGraphHandler: Failed to decompress keyed scan for key "
+                     << msg->key);
+    return;
+  }
+  KeyedScanCallback(keyed_scan);
+}
+
 void PoseGraphHandler::KeyedScanCallback(const pose_graph_msgs::KeyedScan::ConstPtr& msg) {
 
   data_.b_has_data = true;
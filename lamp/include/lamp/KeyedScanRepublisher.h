@@ -0,0 +1,94 @@
+/*
+KeyedScanRepublisher.h
+Asynchronous, rate limited republishing of keyed scans
+*/
+
+#ifndef KEYED_SCAN_REPUBLISHER_H
+#define KEYED_SCAN_REPUBLISHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <ros/ros.h>
+
+#include <gtsam/inference/Symbol.h>
+
+#include <lamp_utils/KeyedScanCodec.h>
+#include <lamp_utils/PointCloudTypes.h>
+
+struct KeyedScanRepublisherParams {
+  // Sustained rate (bytes/s) and burst size (bytes) of the token bucket
+  double rate = 2.5e7;
+  double burst = 5.0e6;
+};
+
+// Republishes keyed scans from a worker thread. Scans are serialized on the
+// worker and paced by a token bucket on their serialized size. The queued
+// scan with the highest priority is sent first, and keys can be requested
+// to jump the queue.
+class KeyedScanRepublisher {
+public:
+  KeyedScanRepublisher();
+  ~KeyedScanRepublisher();
+
+  // Starts the worker. Compressed scans are also published when
+  // compressed_pub is valid.
+  void Initialize(const ros::Publisher& pub,
+                  const ros::Publisher& compressed_pub,
+                  const KeyedScanRepublisherParams& params,
+                  const lamp_utils::ScanCodecParams& codec_params);
+
+  // Queues a scan. A key that is already queued keeps its highest priority.
+  void Enqueue(const gtsam::Symbol& key,
+               const PointCloud::ConstPtr& scan,
+               double priority);
+
+  // Sends the scans of these keys before all others, the latest request
+  // first. Keys that are not queued are looked up in scans and queued, keys
+  // without a scan are skipped.
+  void Request(const std::vector<gtsam::Key>& keys,
+               const std::map<gtsam::Symbol, PointCloud::ConstPtr>& scans);
+
+  // Pausing keeps the queue, cancelling drops it
+  void Pause();
+  void Resume();
+  void Cancel();
+
+  size_t NumPending() const;
+
+private:
+  void Run();
+  void Stop();
+
+  // Waits until the bucket holds the bytes. Returns false if the queue was
+  // cancelled or the worker stopped meanwhile.
+  bool WaitForTokens(double bytes, unsigned int generation);
+
+  ros::Publisher pub_;
+  ros::Publisher compressed_pub_;
+  KeyedScanRepublisherParams params_;
+  lamp_utils::ScanCodecParams codec_params_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  // Queued scans and their priority, ordered by priority
+  std::map<gtsam::Key, std::pair<PointCloud::ConstPtr, double>> pending_;
+  std::set<std::pair<double, gtsam::Key>> order_;
+  double request_priority_;
+  unsigned int generation_;
+  bool b_paused_;
+  bool b_running_;
+  std::thread worker_;
+
+  // Token bucket
+  double tokens_;
+  std::chrono::steady_clock::time_point last_refill_;
+};
+
+#endif
@@ -23,6 +23,7 @@
 #include <gtsam/slam/InitializePose3.h>
 #include <gtsam/slam/PriorFactor.h>
 
+#include <pose_graph_msgs/CompressedKeyedScan.h>
 #include <pose_graph_msgs/KeyedScan.h>
 #include <pose_graph_msgs/PoseGraph.h>
 #include <pose_graph_msgs/PoseGraphEdge.h>
@@ -42,11 +43,17 @@
 
 #include <lamp_utils/CommonFunctions.h>
 #include <lamp_utils/CommonStructs.h>
+#include <lamp_utils/KeyedScanCodec.h>
 #include <lamp_utils/PoseGraph.h>
 #include <lamp_utils/PrefixHandling.h>
 
+#include <lamp/KeyedScanRepublisher.h>
+
 #include <math.h>
 
+#include <atomic>
+#include <mutex>
+
 // Services
 
 // Class definition
@@ -101,13 +108,21 @@ protected:
   // Functions to publish
   bool PublishPoseGraph(bool b_publish_incremental = true);
   bool PublishPoseGraphForOptimizer();
+  // Sends the new part of the graph, robots may queue it on the link
+  virtual void PublishIncrementalPoseGraph(
+      const pose_graph_msgs::PoseGraphConstPtr& msg);
 
   // Generate map from keyed scans
   bool ReGenerateMapPointCloud();
+  // Called with the map lock held once the map has been regenerated
+  virtual void OnMapRegenerated(const PointCloud::ConstPtr& map);
   bool CombineKeyedScansWorld(PointCloud* points);
   bool GetTransformedPointCloudWorld(const gtsam::Symbol key,
                                      PointCloud* points);
   bool AddTransformedPointCloudToMap(const gtsam::Symbol key);
+  static void TransformScanToWorld(const gtsam::Pose3& pose,
+                                   const PointCloud& scan,
+                                   PointCloud* points);
 
   // Placeholder for setting fixed noise
   gtsam::SharedNoiseModel SetFixedNoiseModels(std::string type);
@@ -121,8 +136,19 @@ protected:
   void OptimizerUpdateCallback(const pose_graph_msgs::PoseGraphConstPtr& msg);
   void MergeOptimizedGraph(const pose_graph_msgs::PoseGraphConstPtr& msg);
 
+  // Queues all keyed scans on the paced republisher, the most recent first
   void PublishAllKeyedScans();
 
+  // Keyed scan compression for the radio link and republishing pace
+  void LoadKeyedScanParameters();
+  bool CompressKeyedScan(const gtsam::Symbol& key,
+                         const PointCloud& scan,
+                         bool with_normals,
+                         pose_graph_msgs::CompressedKeyedScan* msg) const;
+  void PublishCompressedKeyedScan(const gtsam::Symbol& key,
+                                  const PointCloud& scan,
+                                  bool with_normals);
+
   // Pose graph structure storing values, factors and meta data.
   PoseGraph pose_graph_;
 
@@ -134,6 +160,7 @@ protected:
   ros::Publisher pose_graph_incremental_pub_;
   ros::Publisher pose_graph_to_optimize_pub_;
   ros::Publisher keyed_scan_pub_;
+  ros::Publisher keyed_scan_compressed_pub_;
 
   // Subscribers
   ros::Subscriber back_end_pose_graph_sub_;
@@ -152,6 +179,14 @@ protected:
   bool b_use_fixed_covariances_;
   bool b_repub_values_after_optimization_;
   bool b_have_received_first_pg_{false};
+  bool b_compress_keyed_scans_{false};
+
+  // Keyed scan compression settings
+  lamp_utils::ScanCodecParams scan_codec_params_;
+
+  // Sends keyed scans in the background at a bounded rate
+  KeyedScanRepublisherParams keyed_scan_repub_params_;
+  KeyedScanRepublisher keyed_scan_republisher_;
 
   // Frames.
   std::string base_frame_id_;
@@ -162,6 +197,13 @@ protected:
   // Mapper
   IPointCloudMapper::Ptr mapper_;
 
+  // Guards the mapper when scans are inserted from a worker thread
+  std::mutex map_mutex_;
+
+  // Incremented whenever the map is regenerated from all keyed scans, so
+  // scans queued before that are not inserted twice
+  std::atomic<unsigned int> map_generation_{0};
+
   // Precisions
   double attitude_sigma_;
   double position_sigma_;
@@ -13,9 +13,20 @@
 #include <factor_handlers/PoseGraphHandler.h>
 #include <factor_handlers/RobotPoseHandler.h>
 
+#include <geometry_msgs/PointStamped.h>
+#include <lamp_utils/TiledMap.h>
 #include <point_cloud_mapper/SimplePointCloudMapper.h>
+#include <pose_graph_msgs/MapTileArray.h>
 #include <std_msgs/Bool.h>
 #include <std_msgs/String.h>
+#include <std_msgs/UInt64MultiArray.h>
+
+#include <boost/lockfree/spsc_queue.hpp>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 
 // Services
 
@@ -59,6 +70,29 @@ protected:
   // Process keyed scan candidates to add to the map
   void AddKeyedScanCandidatesToMap();
 
+  // Map ingest worker: transforms queued keyed scans and inserts them into
+  // the map in batches, off the pose graph processing thread
+  void MapIngestLoop();
+  void StopMapIngest();
+
+  // Blocks until every queued keyed scan has been inserted into the map
+  void WaitForMapIngest() const;
+
+  // Level-of-detail map: publishes the tiles that changed since the last
+  // call, at the coarse level everywhere and at the fine level near robots
+  // and requested points
+  void PublishMapTiles();
+  // Keys whose scans the loop closure or operator tools need first
+  void KeyedScanRequestCallback(
+      const std_msgs::UInt64MultiArray::ConstPtr& msg);
+  void MapTileRequestCallback(
+      const geometry_msgs::PointStamped::ConstPtr& msg);
+  void OnMapRegenerated(const PointCloud::ConstPtr& map) override;
+
+  // Combine all graphs received from the same robot into a single graph
+  std::map<char, pose_graph_msgs::PoseGraphConstPtr> CoalesceGraphsByRobot(
+      const std::vector<pose_graph_msgs::PoseGraph::ConstPtr>& graphs) const;
+
   // Robots that the base station subscribes to
   std::vector<std::string> robot_names_;
 
@@ -74,10 +108,13 @@ protected:
   // Subscribers
   ros::Subscriber debug_sub_;
   ros::Subscriber remove_robot_sub_;
+  ros::Subscriber map_tile_request_sub_;
+  ros::Subscriber keyed_scan_request_sub_;
 
   // Publishers
   std::map<char, ros::Publisher> publishers_pose_;
   ros::Publisher lamp_pgo_reset_pub_;
+  ros::Publisher map_tiles_pub_;
 
   // Booleans
   bool b_published_initial_node_;
@@ -91,8 +128,56 @@ private:
   // Track latest pose from each robot
   std::map<char, std::pair<gtsam::Key, gtsam::Pose3>> latest_node_pose_;
 
-  // Vector list of keyed scans to add to map
-  std::vector<gtsam::Symbol> keyed_scan_candidates_;
+  // Keyed scans to add to map once their node is in the pose graph
+  std::unordered_set<gtsam::Key> keyed_scan_candidates_;
+
+  // Keyed scan ready to be inserted into the map
+  struct MapIngestJob {
+    gtsam::Key key;
+    gtsam::Pose3 pose;
+    PointCloud::ConstPtr scan;
+    unsigned int generation;
+  };
+
+  // Single producer (pose graph processing) / single consumer (map ingest
+  // worker) queue of keyed scans to insert into the map
+  boost::lockfree::spsc_queue<MapIngestJob> map_ingest_queue_{4096};
+  std::thread map_ingest_thread_;
+  // The worker waits on map_ingest_cv_ while the queue is empty, waiters for
+  // the queued jobs on map_ingest_done_cv_
+  mutable std::mutex map_ingest_mutex_;
+  std::condition_variable map_ingest_cv_;
+  mutable std::condition_variable map_ingest_done_cv_;
+  std::atomic<bool> b_run_map_ingest_{false};
+  std::atomic<bool> b_map_updated_{false};
+  std::atomic<size_t> map_jobs_queued_{0};
+  std::atomic<size_t> map_jobs_done_{0};
+
+  // Level-of-detail map over references to the keyed scans, guarded by
+  // map_mutex_
+  lamp_utils::TiledMap tiled_map_;
+  bool b_map_lod_{false};
+  unsigned int lod_fine_level_{0};
+  double lod_fine_radius_{30.0};
+  double lod_request_timeout_{60.0};
+  // Period of the full resolution map publication in LOD mode (0 disables)
+  double full_map_period_{30.0};
+  bool b_full_map_pending_{false};
+  ros::Time last_full_map_time_;
+
+  // Points the operator asked to see at the fine level, and when
+  std::vector<std::pair<gtsam::Point3, ros::Time>> map_tile_requests_;
+
+  // Tile revisions already sent to the subscribers
+  std::unordered_map<lamp_utils::TileIndex,
+                     uint32_t,
+                     lamp_utils::TileIndexHash>
+      published_coarse_tiles_;
+  std::unordered_map<lamp_utils::TileIndex,
+                     uint32_t,
+                     lamp_utils::TileIndexHash>
+      published_fine_tiles_;
+  size_t num_map_tile_subscribers_{0};
 
   // Last pose graph publish time
   ros::Time last_pg_update_time_;
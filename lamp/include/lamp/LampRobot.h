@@ -9,6 +9,7 @@
 
 // Includes
 #include <lamp/LampBase.h>
+#include <lamp/LinkScheduler.h>
 
 #include <factor_handlers/OdometryHandler.h>
 #include <factor_handlers/StationaryHandler.h>
@@ -58,8 +59,15 @@ class LampRobot : public LampBase {
 
   void UpdateAndPublishOdom();
 
+  // Queues the incremental graph on the link scheduler when enabled
+  void PublishIncrementalPoseGraph(
+      const pose_graph_msgs::PoseGraphConstPtr& msg) override;
+
+  void PublishLinkStatus(const ros::TimerEvent& ev);
+
   // Publishers
   ros::Publisher pose_pub_;
+  ros::Publisher link_status_pub_;
 
  private:
   // Overwrite base classs functions where needed
@@ -116,6 +124,13 @@ class LampRobot : public LampBase {
    // Point cloud filter
    LampPcldFilter filter_;
    LampPcldFilterParams filter_params_;
+
+   // Prioritized sending of graph, artifacts and scans to the base
+   bool b_use_link_scheduler_;
+   LinkSchedulerParams link_params_;
+   LinkScheduler link_scheduler_;
+   std::vector<std::string> link_artifact_topics_;
+   ros::Timer link_status_timer_;
 };
 
 #endif
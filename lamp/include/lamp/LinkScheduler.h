@@ -0,0 +1,116 @@
+/*
+LinkScheduler.h
+Prioritized, rate limited sending of robot data over the link to the base
+*/
+
+#ifndef LINK_SCHEDULER_H
+#define LINK_SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ros/ros.h>
+#include <topic_tools/shape_shifter.h>
+
+#include <pose_graph_msgs/LinkQueueStatus.h>
+
+struct LinkSchedulerParams {
+  // Sustained rate (bytes/s) and burst size (bytes) of the link budget
+  double rate = 1.0e6;
+  double burst = 2.5e5;
+  // Time a queued message waits before moving up one class (s)
+  double promotion_time = 10.0;
+};
+
+// Sends messages from a worker thread in priority classes under a token
+// bucket budget. Graph messages always go first and may overdraw the bucket
+// by one burst, so they are never held back by a backlog of scans. Lower
+// classes are promoted with age, but never to the graph class.
+class LinkScheduler {
+public:
+  enum Class { GRAPH = 0, ARTIFACT = 1, SCAN = 2, NUM_CLASSES = 3 };
+
+  LinkScheduler();
+  ~LinkScheduler();
+
+  void Initialize(const LinkSchedulerParams& params);
+
+  // Queues a message of the given serialized size, send is called when the
+  // budget allows it
+  void Submit(Class c, size_t bytes, const std::function<void()>& send);
+
+  template <class M>
+  void Submit(Class c,
+              const ros::Publisher& pub,
+              const boost::shared_ptr<M const>& msg) {
+    Submit(c, ros::serialization::serializationLength(*msg), [pub, msg]() {
+      pub.publish(msg);
+    });
+  }
+
+  // Forwards messages of any type from in_topic to out_topic in class c
+  void Relay(ros::NodeHandle& nh,
+             const std::string& in_topic,
+             const std::string& out_topic,
+             Class c);
+
+  void Pause();
+  void Resume();
+
+  size_t NumQueued(Class c) const;
+  void GetStatus(pose_graph_msgs::LinkQueueStatus* status) const;
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Item {
+    size_t bytes;
+    std::function<void()> send;
+    Clock::time_point queued;
+  };
+
+  struct RelayTopic {
+    Class c;
+    ros::NodeHandle nh;
+    std::string out_topic;
+    ros::Subscriber sub;
+    ros::Publisher pub;
+  };
+
+  void Run();
+  void Stop();
+
+  // Queue to send from next and its class after promotion, -1 if empty
+  int NextQueue(const Clock::time_point& now) const;
+  void Refill(const Clock::time_point& now);
+
+  void RelayCallback(
+      RelayTopic* relay,
+      const ros::MessageEvent<topic_tools::ShapeShifter const>& event);
+
+  LinkSchedulerParams params_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Item> queues_[NUM_CLASSES];
+  size_t queued_bytes_[NUM_CLASSES];
+  size_t sent_bytes_[NUM_CLASSES];
+  bool b_paused_;
+  bool b_running_;
+  std::thread worker_;
+
+  // Token bucket
+  double tokens_;
+  Clock::time_point last_refill_;
+
+  std::vector<std::shared_ptr<RelayTopic>> relays_;
+};
+
+#endif
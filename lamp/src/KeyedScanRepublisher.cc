@@ -0,0 +1,195 @@
+/*
+KeyedScanRepublisher.cc
+Asynchronous, rate limited republishing of keyed scans
+*/
+
+#include <lamp/KeyedScanRepublisher.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include <pcl_conversions/pcl_conversions.h>
+#include <pose_graph_msgs/CompressedKeyedScan.h>
+#include <pose_graph_msgs/KeyedScan.h>
+
+namespace {
+// Requested keys are placed above any stamp used as a priority
+const double kRequestPriority = 1e12;
+} // namespace
+
+KeyedScanRepublisher::KeyedScanRepublisher()
+  : request_priority_(kRequestPriority),
+    generation_(0),
+    b_paused_(false),
+    b_running_(false),
+    tokens_(0.0) {}
+
+KeyedScanRepublisher::~KeyedScanRepublisher() {
+  Stop();
+}
+
+void KeyedScanRepublisher::Initialize(
+    const ros::Publisher& pub,
+    const ros::Publisher& compressed_pub,
+    const KeyedScanRepublisherParams& params,
+    const lamp_utils::ScanCodecParams& codec_params) {
+  Stop();
+  pub_ = pub;
+  compressed_pub_ = compressed_pub;
+  params_ = params;
+  codec_params_ = codec_params;
+  tokens_ = params_.burst;
+  last_refill_ = std::chrono::steady_clock::now();
+  b_running_ = true;
+  worker_ = std::thread(&KeyedScanRepublisher::Run, this);
+}
+
+void KeyedScanRepublisher::Enqueue(const gtsam::Symbol& key,
+                                   const PointCloud::ConstPtr& scan,
+                                   double priority) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = pending_.find(key);
+  if (it != pending_.end()) {
+    order_.erase(std::make_pair(it->second.second, key.key()));
+    priority = std::max(priority, it->second.second);
+  }
+  pending_[key] = std::make_pair(scan, priority);
+  order_.insert(std::make_pair(priority, key.key()));
+  cv_.notify_all();
+}
+
+void KeyedScanRepublisher::Request(
+    const std::vector<gtsam::Key>& keys,
+    const std::map<gtsam::Symbol, PointCloud::ConstPtr>& scans) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& key : keys) {
+    auto it = pending_.find(key);
+    if (it == pending_.end()) {
+      auto scan = scans.find(gtsam::Symbol(key));
+      if (scan == scans.end() || !scan->second) {
+        ROS_WARN_STREAM("Requested keyed scan "
+                        << gtsam::DefaultKeyFormatter(key)
+                        << " is not available");
+        continue;
+      }
+      it = pending_.emplace(key, std::make_pair(scan->second, 0.0)).first;
+    } else {
+      order_.erase(std::make_pair(it->second.second, key));
+    }
+    // Latest request first
+    it->second.second = ++request_priority_;
+    order_.insert(std::make_pair(it->second.second, key));
+  }
+  cv_.notify_all();
+}
+
+void KeyedScanRepublisher::Pause() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  b_paused_ = true;
+}
+
+void KeyedScanRepublisher::Resume() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  b_paused_ = false;
+  cv_.notify_all();
+}
+
+void KeyedScanRepublisher::Cancel() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  pending_.clear();
+  order_.clear();
+  generation_++;
+  cv_.notify_all();
+}
+
+size_t KeyedScanRepublisher::NumPending() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_.size();
+}
+
+void KeyedScanRepublisher::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    b_running_ = false;
+    cv_.notify_all();
+  }
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+}
+
+void KeyedScanRepublisher::Run() {
+  while (true) {
+    gtsam::Key key;
+    PointCloud::ConstPtr scan;
+    unsigned int generation;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] {
+        return !b_running_ || (!b_paused_ && !order_.empty());
+      });
+      if (!b_running_)
+        return;
+      key = order_.rbegin()->second;
+      order_.erase(std::prev(order_.end()));
+      scan = pending_.at(key).first;
+      pending_.erase(key);
+      generation = generation_;
+    }
+
+    // Serialize before waiting for the bucket
+    pose_graph_msgs::KeyedScan::Ptr msg(new pose_graph_msgs::KeyedScan);
+    msg->key = key;
+    pcl::toROSMsg(*scan, msg->scan);
+    double bytes = ros::serialization::serializationLength(*msg);
+    pose_graph_msgs::CompressedKeyedScan::Ptr compressed_msg;
+    if (compressed_pub_) {
+      compressed_msg.reset(new pose_graph_msgs::CompressedKeyedScan);
+      if (lamp_utils::EncodeKeyedScan(
+              key, *scan, codec_params_, true, compressed_msg.get())) {
+        bytes += ros::serialization::serializationLength(*compressed_msg);
+      } else {
+        ROS_ERROR_STREAM("Failed to compress keyed scan "
+                         << gtsam::DefaultKeyFormatter(key));
+        compressed_msg.reset();
+      }
+    }
+
+    if (!WaitForTokens(bytes, generation))
+      continue;
+    pub_.publish(msg);
+    if (compressed_msg)
+      compressed_pub_.publish(compressed_msg);
+  }
+}
+
+bool KeyedScanRepublisher::WaitForTokens(double bytes,
+                                         unsigned int generation) {
+  // A scan larger than the burst only waits for a full bucket
+  const double needed = std::min(bytes, params_.burst);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    if (!b_running_ || generation != generation_)
+      return false;
+    // Unlimited rate
+    if (params_.rate <= 0.0 && !b_paused_)
+      return true;
+
+    auto now = std::chrono::steady_clock::now();
+    double elapsed =
+        std::chrono::duration<double>(now - last_refill_).count();
+    tokens_ = std::min(params_.burst, tokens_ + elapsed * params_.rate);
+    last_refill_ = now;
+
+    if (!b_paused_ && tokens_ >= needed) {
+      tokens_ -= bytes;
+      return true;
+    }
+
+    // Sleep until the bucket holds enough, or until resumed or cancelled
+    double wait = b_paused_ || params_.rate <= 0.0
+        ? 1.0
+        : (needed - tokens_) / params_.rate;
+    cv_.wait_for(lock, std::chrono::duration<double>(wait));
+  }
+}
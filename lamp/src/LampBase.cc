@@ -80,6 +80,15 @@ bool LampBase::CreatePublishers(const ros::NodeHandle& n) {
   // Published keyed scans (for GT processing)
   keyed_scan_pub_ =
       nl.advertise<pose_graph_msgs::KeyedScan>("keyed_scans", 10, true);
+  if (b_compress_keyed_scans_) {
+    keyed_scan_compressed_pub_ =
+        nl.advertise<pose_graph_msgs::CompressedKeyedScan>(
+            "keyed_scans_compressed", 10, true);
+  }
+  keyed_scan_republisher_.Initialize(keyed_scan_pub_,
+                                     keyed_scan_compressed_pub_,
+                                     keyed_scan_repub_params_,
+                                     scan_codec_params_);
 
   return true;
 }
@@ -120,15 +129,15 @@ void LampBase::MergeOptimizedGraph(
   gtsam::Values new_values;
   gtsam::Symbol key;
 
-  // Update the internal LAMP graph using the one stored by the merger
-  pose_graph_msgs::PoseGraphConstPtr fused_graph(
-      new pose_graph_msgs::PoseGraph(merger_.GetCurrentGraph()));
-
-  // update the LAMP internal values_ and factors
-  pose_graph_.UpdateFromMsg(fused_graph);
+  // Update the internal LAMP values_ and factors using the graph stored by
+  // the merger
+  pose_graph_.UpdateFromMsg(merger_.GetCurrentGraph());
 
-  // prune outliers given optimized graph
-  pose_graph_.UpdateLoopClosures(msg);
+  // prune outliers given optimized graph. Incremental optimizer graphs only
+  // carry edges when they changed.
+  if (!msg->incremental || !msg->edges.empty()) {
+    pose_graph_.UpdateLoopClosures(msg);
+  }
 
   // ROS_DEBUG_STREAM("Pose graph after update: ");
   // for (auto n : pose_graph_.GetNodes()) {
@@ -195,6 +204,9 @@ LampBase::ChangeCovarianceInMessage(pose_graph_msgs::PoseGraph msg,
 //------------------------------------------------------------------------------------------
 
 bool LampBase::ReGenerateMapPointCloud() {
+  std::lock_guard<std::mutex> lock(map_mutex_);
+  ++map_generation_;
+
   // Reset the map
   mapper_->Reset();
 
@@ -206,9 +218,13 @@ bool LampBase::ReGenerateMapPointCloud() {
   PointCloud::Ptr unused(new PointCloud);
   mapper_->InsertPoints(regenerated_map, unused.get());
 
+  OnMapRegenerated(regenerated_map);
+  return true;
+}
+
+void LampBase::OnMapRegenerated(const PointCloud::ConstPtr& map) {
   // Publish map
   mapper_->PublishMap();
-  return true;
 }
 
 // For combining all the scans together
@@ -260,28 +276,36 @@ bool LampBase::GetTransformedPointCloudWorld(const gtsam::Symbol key,
     return false;
   }
 
-  const gu::Transform3 pose = lamp_utils::ToGu(pose_graph_.GetPose(key));
+  // Transform the body-frame scan into world frame.
+  TransformScanToWorld(
+      pose_graph_.GetPose(key), *pose_graph_.keyed_scans[key], points);
+
+  // ROS_INFO_STREAM("Points size is: " << points->points.size()
+  //                                    << ", in
+  //                                    GetTransformedPointCloudWorld");
+  return true;
+}
+
+void LampBase::TransformScanToWorld(const gtsam::Pose3& pose,
+                                    const PointCloud& scan,
+                                    PointCloud* points) {
+  const gu::Transform3 gu_pose = lamp_utils::ToGu(pose);
   Eigen::Matrix4d b2w;
   b2w.setZero();
-  b2w.block(0, 0, 3, 3) = pose.rotation.Eigen();
-  b2w.block(0, 3, 3, 1) = pose.translation.Eigen();
+  b2w.block(0, 0, 3, 3) = gu_pose.rotation.Eigen();
+  b2w.block(0, 3, 3, 1) = gu_pose.translation.Eigen();
   b2w(3, 3) = 1;
 
-  Eigen::Quaterniond quat(pose.rotation.Eigen());
+  Eigen::Quaterniond quat(gu_pose.rotation.Eigen());
   quat.normalize();
   b2w.block(0, 0, 3, 3) = quat.matrix();
 
   // ROS_INFO_STREAM("TRANSFORMATION MATRIX (rotation det: " <<
-  // pose.rotation.Eigen().determinant() << ")"); Eigen::IOFormat CleanFmt(4, 0,
-  // ", ", "\n", "[", "]"); ROS_INFO_STREAM("\n" << b2w.format(CleanFmt));
+  // gu_pose.rotation.Eigen().determinant() << ")"); Eigen::IOFormat CleanFmt(4,
+  // 0, ", ", "\n", "[", "]"); ROS_INFO_STREAM("\n" << b2w.format(CleanFmt));
 
   // Transform the body-frame scan into world frame.
-  pcl::transformPointCloud(*pose_graph_.keyed_scans[key], *points, b2w);
-
-  // ROS_INFO_STREAM("Points size is: " << points->points.size()
-  //                                    << ", in
-  //                                    GetTransformedPointCloudWorld");
-  return true;
+  pcl::transformPointCloud(scan, *points, b2w);
 }
 
 // For adding one scan to the map
@@ -295,6 +319,7 @@ bool LampBase::AddTransformedPointCloudToMap(const gtsam::Symbol key) {
 
   // Add to the map
   PointCloud::Ptr unused(new PointCloud);
+  std::lock_guard<std::mutex> lock(map_mutex_);
   mapper_->InsertPoints(points, unused.get());
 
   return true;
@@ -324,7 +349,7 @@ bool LampBase::PublishPoseGraph(bool b_publish_incremental) {
                        << g_inc->edges.size() << " edges");
 
       // Publish
-      pose_graph_incremental_pub_.publish(*g_inc);
+      PublishIncrementalPoseGraph(g_inc);
 
       // Reset new tracking
       pose_graph_.ClearIncrementalMessages();
@@ -338,7 +363,7 @@ bool LampBase::PublishPoseGraph(bool b_publish_incremental) {
   pose_graph_msgs::PoseGraphConstPtr g_full = pose_graph_.ToMsg();
 
   // Publish
-  pose_graph_pub_.publish(*g_full);
+  pose_graph_pub_.publish(g_full);
   ROS_DEBUG_STREAM("Publishing full graph with "
                    << g_full->nodes.size() << " nodes and "
                    << g_full->edges.size() << " edges");
@@ -346,6 +371,11 @@ bool LampBase::PublishPoseGraph(bool b_publish_incremental) {
   return true;
 }
 
+void LampBase::PublishIncrementalPoseGraph(
+    const pose_graph_msgs::PoseGraphConstPtr& msg) {
+  pose_graph_incremental_pub_.publish(msg);
+}
+
 bool LampBase::PublishPoseGraphForOptimizer() {
   // TODO incremental publishing instead of full graph?
 
@@ -355,13 +385,13 @@ bool LampBase::PublishPoseGraphForOptimizer() {
   // ROS_DEBUG_STREAM("Publishing pose graph for optimizer with "
   //                 << g->nodes.size() << " nodes and " << g->edges.size()
   //                 << " edges");
-  for (auto v : g->nodes) {
+  for (const auto& v : g->nodes) {
     ROS_DEBUG_STREAM(
         "PublishedPGForOptimizer Key : " << gtsam::DefaultKeyFormatter(v.key));
   }
 
   // Publish
-  pose_graph_to_optimize_pub_.publish(*g);
+  pose_graph_to_optimize_pub_.publish(g);
 
   return true;
 }
@@ -413,23 +443,59 @@ std::string LampBase::MapSymbolToId(gtsam::Symbol key) const {
   }
 }
 
+void LampBase::LoadKeyedScanParameters() {
+  // Optional, scans are only sent uncompressed by default
+  pu::Get("scan_compression/b_enable", b_compress_keyed_scans_);
+  pu::Get("scan_compression/position_resolution",
+          scan_codec_params_.position_resolution);
+  pu::Get("scan_compression/intensity_resolution",
+          scan_codec_params_.intensity_resolution);
+  pu::Get("scan_compression/normal_bits", scan_codec_params_.normal_bits);
+
+  pu::Get("keyed_scan_repub/rate", keyed_scan_repub_params_.rate);
+  pu::Get("keyed_scan_repub/burst", keyed_scan_repub_params_.burst);
+}
+
+bool LampBase::CompressKeyedScan(
+    const gtsam::Symbol& key,
+    const PointCloud& scan,
+    bool with_normals,
+    pose_graph_msgs::CompressedKeyedScan* msg) const {
+  if (!lamp_utils::EncodeKeyedScan(
+          key, scan, scan_codec_params_, with_normals, msg)) {
+    ROS_ERROR_STREAM("Failed to compress keyed scan "
+                     << gtsam::DefaultKeyFormatter(key));
+    return false;
+  }
+  return true;
+}
+
+void LampBase::PublishCompressedKeyedScan(const gtsam::Symbol& key,
+                                          const PointCloud& scan,
+                                          bool with_normals) {
+  if (!b_compress_keyed_scans_)
+    return;
+
+  pose_graph_msgs::CompressedKeyedScan compressed_msg;
+  if (!CompressKeyedScan(key, scan, with_normals, &compressed_msg))
+    return;
+  keyed_scan_compressed_pub_.publish(compressed_msg);
+}
+
 void LampBase::PublishAllKeyedScans() {
   if (pose_graph_.keyed_scans.size() == 0) {
     ROS_WARN("No keyed scans and you are trying to publish all keyed scans");
     return;
   }
 
-  // ROS_INFO("Publishing All Keyed Scans");
-  pose_graph_msgs::KeyedScan keyed_scan_msg;
-
-  for (auto it = pose_graph_.keyed_scans.begin();
-       it != pose_graph_.keyed_scans.end();
-       ++it) {
-    ROS_INFO_ONCE("Publishing Keyed Scans... WAIT UNTIL DONE");
-    keyed_scan_msg.key = it->first;
-    pcl::toROSMsg(*it->second, keyed_scan_msg.scan);
-    keyed_scan_pub_.publish(keyed_scan_msg);
-
-    ros::Duration(0.01).sleep();
+  // Most recent scans first
+  for (const auto& entry : pose_graph_.keyed_scans) {
+    double priority = 0.0;
+    auto stamp = pose_graph_.keyed_stamps.find(entry.first);
+    if (stamp != pose_graph_.keyed_stamps.end())
+      priority = stamp->second.toSec();
+    keyed_scan_republisher_.Enqueue(entry.first, entry.second, priority);
   }
+  ROS_INFO_STREAM("Queued keyed scans for republishing, "
+                  << keyed_scan_republisher_.NumPending() << " pending");
 }
@@ -7,6 +7,8 @@
 // Includes
 #include <lamp/LampBaseStation.h>
 
+#include <algorithm>
+
 // #include <math.h>
 // #include <ctime>
 
@@ -23,7 +25,9 @@ LampBaseStation::LampBaseStation()
 }
 
 // Destructor
-LampBaseStation::~LampBaseStation() {}
+LampBaseStation::~LampBaseStation() {
+  StopMapIngest();
+}
 
 // Initialization - override for Base Station Setup
 bool LampBaseStation::Initialize(const ros::NodeHandle& n) {
@@ -58,6 +62,12 @@ bool LampBaseStation::Initialize(const ros::NodeHandle& n) {
     ROS_ERROR("%s: Failed to initialize handlers.", name_.c_str());
     return false;
   }
+
+  // Start the map ingest worker
+  if (!b_run_map_ingest_) {
+    b_run_map_ingest_ = true;
+    map_ingest_thread_ = std::thread(&LampBaseStation::MapIngestLoop, this);
+  }
   return true;
 }
 
@@ -86,6 +96,28 @@ bool LampBaseStation::LoadParameters(const ros::NodeHandle& n) {
   // Initialize frame IDs
   pose_graph_.fixed_frame_id = "world";
 
+  // Level-of-detail map (optional, defaults are kept when not set)
+  lamp_utils::TiledMapParams tile_params;
+  int num_levels = tile_params.num_levels;
+  int fine_level = lod_fine_level_;
+  pu::Get("map_lod/b_enable", b_map_lod_);
+  pu::Get("map_lod/tile_size", tile_params.tile_size);
+  pu::Get("map_lod/resolution", tile_params.resolution);
+  pu::Get("map_lod/num_levels", num_levels);
+  pu::Get("map_lod/fine_level", fine_level);
+  pu::Get("map_lod/fine_radius", lod_fine_radius_);
+  pu::Get("map_lod/request_timeout", lod_request_timeout_);
+  pu::Get("map_lod/full_map_period", full_map_period_);
+  if (num_levels < 1 || fine_level < 0 || fine_level >= num_levels) {
+    ROS_ERROR("%s: Invalid map level-of-detail levels.", name_.c_str());
+    return false;
+  }
+  tile_params.num_levels = num_levels;
+  lod_fine_level_ = fine_level;
+  tiled_map_ = lamp_utils::TiledMap(tile_params);
+
+  LoadKeyedScanParameters();
+
   // Initialize booleans
   b_run_optimization_ = false;
   b_has_new_factor_ = false;
@@ -120,6 +152,17 @@ bool LampBaseStation::RegisterCallbacks(const ros::NodeHandle& n) {
                                    &LampBaseStation::RemoveRobotCallback,
                                    this);
 
+  map_tile_request_sub_ =
+      nl.subscribe("map_tile_request",
+                   10,
+                   &LampBaseStation::MapTileRequestCallback,
+                   this);
+  keyed_scan_request_sub_ =
+      nl.subscribe("keyed_scan_request",
+                   10,
+                   &LampBaseStation::KeyedScanRequestCallback,
+                   this);
+
   // Uncomment when needed for debugging
   debug_sub_ = nl.subscribe("debug", 1, &LampBaseStation::DebugCallback, this);
 
@@ -137,6 +180,8 @@ bool LampBaseStation::CreatePublishers(const ros::NodeHandle& n) {
   pose_graph_to_optimize_pub_ = nl.advertise<pose_graph_msgs::PoseGraph>(
       "pose_graph_to_optimize", 10, true);
   lamp_pgo_reset_pub_ = nl.advertise<std_msgs::Bool>("reset_pgo", 10, true);
+  map_tiles_pub_ =
+      nl.advertise<pose_graph_msgs::MapTileArray>("map_tiles", 10, false);
 
   // Robot pose publishers
   ros::Publisher pose_pub_;
@@ -201,11 +246,34 @@ void LampBaseStation::ProcessTimerCallback(const ros::TimerEvent& ev) {
     b_has_new_factor_ = false;
   }
 
-  if (b_has_new_scan_) {
-    mapper_->PublishMapInfo();
-    mapper_->PublishMap();
-
-    b_has_new_scan_ = false;
+  // Publish the map once the ingest worker has inserted new scans. Skip this
+  // update if the worker is busy inserting rather than waiting for it. In
+  // level-of-detail mode the changed tiles are sent every update, as the
+  // fine tiles follow the robots, and the full map only periodically.
+  bool b_map_updated = b_map_updated_.exchange(false);
+  if (b_map_updated || b_map_lod_) {
+    std::unique_lock<std::mutex> lock(map_mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      if (b_map_updated)
+        b_map_updated_ = true;
+    } else if (!b_map_lod_) {
+      mapper_->PublishMapInfo();
+      mapper_->PublishMap();
+    } else {
+      if (b_map_updated) {
+        mapper_->PublishMapInfo();
+        b_full_map_pending_ = true;
+      }
+      PublishMapTiles();
+
+      ros::Time now = ros::Time::now();
+      if (b_full_map_pending_ && full_map_period_ > 0 &&
+          (now - last_full_map_time_).toSec() > full_map_period_) {
+        mapper_->PublishMap();
+        last_full_map_time_ = now;
+        b_full_map_pending_ = false;
+      }
+    }
   }
 
   last_pg_update_time_ = ros::Time::now();
@@ -229,30 +297,29 @@ bool LampBaseStation::ProcessPoseGraphData(std::shared_ptr<FactorData> data) {
                   << pose_graph_data->scans.size() << " scans ");
   b_has_new_factor_ = true;
 
-  pose_graph_msgs::PoseGraph::Ptr graph_ptr;
+  // Merge all graphs received since the last update in a single pass: the
+  // current (slow) graph is handed to the merger once, each robot's graphs
+  // are fused as one fast graph and the internal graph is updated once
+  if (!pose_graph_data->graphs.empty()) {
+    std::map<char, pose_graph_msgs::PoseGraphConstPtr> robot_graphs =
+        CoalesceGraphsByRobot(pose_graph_data->graphs);
 
-  gtsam::Values new_values;
+    merger_.OnSlowGraphMsg(pose_graph_.ToMsg());
+    for (const auto& robot_graph : robot_graphs) {
+      merger_.OnFastGraphMsg(robot_graph.second);
+    }
+
+    // Update the internal pose graph using the merger output
+    pose_graph_.UpdateFromMsg(merger_.GetCurrentGraph());
+  }
 
-  for (auto g : pose_graph_data->graphs) {
+  for (const auto& g : pose_graph_data->graphs) {
     ROS_DEBUG_STREAM("LampBase new graph with "
                      << g->nodes.size() << " nodes and " << g->edges.size()
                      << " edges");
 
-    // Register new data - this will cause pose graph to publish
-    b_has_new_factor_ = true;
-
-    // Merge the current (slow) graph before processing incoming graphs
-    merger_.OnSlowGraphMsg(pose_graph_.ToMsg());
-    merger_.OnFastGraphMsg(g);
-
-    // Update the internal pose graph using the merger output
-    pose_graph_msgs::PoseGraphConstPtr fused_graph(
-        new pose_graph_msgs::PoseGraph(merger_.GetCurrentGraph()));
-    // ROS_INFO_STREAM("Fused Graph: UpdateFromMsg");
-    pose_graph_.UpdateFromMsg(fused_graph);
-
     // Check for new loop closure edges
-    for (pose_graph_msgs::PoseGraphEdge e : g->edges) {
+    for (const pose_graph_msgs::PoseGraphEdge& e : g->edges) {
       // Optimize on loop closures, IMU factors and artifact loop closures
       if (e.type == pose_graph_msgs::PoseGraphEdge::LOOPCLOSE) {
         // Run optimization to update the base station graph afterwards
@@ -265,7 +332,7 @@ bool LampBaseStation::ProcessPoseGraphData(std::shared_ptr<FactorData> data) {
     }
 
     // Store the pose at the most recent node for each robot
-    for (pose_graph_msgs::PoseGraphNode n : g->nodes) {
+    for (const pose_graph_msgs::PoseGraphNode& n : g->nodes) {
       char prefix = gtsam::Symbol(n.key).chr();
       if (!lamp_utils::IsRobotPrefix(prefix))
         continue;
@@ -288,9 +355,6 @@ bool LampBaseStation::ProcessPoseGraphData(std::shared_ptr<FactorData> data) {
 
   // Update from stored keyed scans
   for (auto s : pose_graph_data->scans) {
-    // Register new data - this will cause map to publish
-    b_has_new_scan_ = true;
-
     // Create new PCL pointer
     PointCloud::Ptr scan_ptr(new PointCloud);
 
@@ -301,7 +365,7 @@ bool LampBaseStation::ProcessPoseGraphData(std::shared_ptr<FactorData> data) {
                                 scan_ptr); // TODO: add overloaded function
 
     // Add key to the list of scan candidates to add to the map
-    keyed_scan_candidates_.push_back(s->key);
+    keyed_scan_candidates_.insert(s->key);
 
     ROS_DEBUG_STREAM("Added new point cloud to map, " << scan_ptr->points.size()
                                                      << " points");
@@ -313,27 +377,315 @@ bool LampBaseStation::ProcessPoseGraphData(std::shared_ptr<FactorData> data) {
   return true;
 }
 
+std::map<char, pose_graph_msgs::PoseGraphConstPtr>
+LampBaseStation::CoalesceGraphsByRobot(
+    const std::vector<pose_graph_msgs::PoseGraph::ConstPtr>& graphs) const {
+  // Group the graphs by the robot they were received from
+  std::map<char, std::vector<pose_graph_msgs::PoseGraph::ConstPtr>> grouped;
+  for (const auto& g : graphs) {
+    char robot = 0;
+    for (const auto& n : g->nodes) {
+      char prefix = gtsam::Symbol(n.key).chr();
+      if (lamp_utils::IsRobotPrefix(prefix)) {
+        robot = prefix;
+        break;
+      }
+    }
+    if (robot == 0 && !g->edges.empty()) {
+      char prefix = gtsam::Symbol(g->edges.front().key_from).chr();
+      if (lamp_utils::IsRobotPrefix(prefix))
+        robot = prefix;
+    }
+    grouped[robot].push_back(g);
+  }
+
+  // Concatenate the graphs of each robot in the order they were received
+  std::map<char, pose_graph_msgs::PoseGraphConstPtr> coalesced;
+  for (const auto& group : grouped) {
+    if (group.second.size() == 1) {
+      coalesced[group.first] = group.second.front();
+      continue;
+    }
+
+    size_t num_nodes = 0, num_edges = 0;
+    for (const auto& g : group.second) {
+      num_nodes += g->nodes.size();
+      num_edges += g->edges.size();
+    }
+
+    pose_graph_msgs::PoseGraphPtr combined(new pose_graph_msgs::PoseGraph);
+    combined->header = group.second.back()->header;
+    combined->nodes.reserve(num_nodes);
+    combined->edges.reserve(num_edges);
+    // A node sent again by a later graph keeps only its newest copy
+    std::unordered_set<gtsam::Key> node_keys;
+    for (auto g = group.second.rbegin(); g != group.second.rend(); ++g) {
+      for (auto n = (*g)->nodes.rbegin(); n != (*g)->nodes.rend(); ++n) {
+        if (node_keys.insert(n->key).second)
+          combined->nodes.push_back(*n);
+      }
+    }
+    std::reverse(combined->nodes.begin(), combined->nodes.end());
+    for (const auto& g : group.second) {
+      combined->edges.insert(
+          combined->edges.end(), g->edges.begin(), g->edges.end());
+    }
+    ROS_DEBUG_STREAM("Coalesced " << group.second.size()
+                                  << " graphs from robot " << group.first);
+    coalesced[group.first] = combined;
+  }
+  return coalesced;
+}
+
 void LampBaseStation::AddKeyedScanCandidatesToMap() {
-  // Loop through list of candidates
+  // Queue every candidate whose node is in the pose-graph for the map ingest
+  // worker
   auto key_it = keyed_scan_candidates_.begin();
   int scan_count = 0;
 
   while (key_it != keyed_scan_candidates_.end()) {
-    // Add to map if the key exists in the nodes in the pose-graph
-    if (pose_graph_.HasKey(*key_it)) {
-      // Add keyed scan to map
-      AddTransformedPointCloudToMap(*key_it);
+    gtsam::Symbol key(*key_it);
+    if (!pose_graph_.HasKey(key) || !pose_graph_.HasScan(key)) {
+      ++key_it;
+      continue;
+    }
 
-      // Erase this from the list and increment the iterator
-      key_it = keyed_scan_candidates_.erase(key_it);
+    MapIngestJob job;
+    job.key = key;
+    job.pose = pose_graph_.GetPose(key);
+    job.scan = pose_graph_.keyed_scans[key];
+    job.generation = map_generation_;
+    if (!map_ingest_queue_.push(job)) {
+      // Queue is full - keep the rest for the next update
+      ROS_DEBUG("Map ingest queue full, deferring keyed scans");
+      break;
+    }
+    ++map_jobs_queued_;
 
-      scan_count++;
-    } else {
-      // Increment key_it
-      ++key_it;
+    // Erase this from the list and increment the iterator
+    key_it = keyed_scan_candidates_.erase(key_it);
+    scan_count++;
+  }
+  ROS_DEBUG_STREAM("Queued " << scan_count << " scans for the map.");
+
+  if (scan_count > 0) {
+    // Taking the lock orders the pushes before the worker's wait
+    { std::lock_guard<std::mutex> lock(map_ingest_mutex_); }
+    map_ingest_cv_.notify_one();
+  }
+}
+
+void LampBaseStation::MapIngestLoop() {
+  // Upper bound on scans combined into one mapper insertion
+  const size_t max_batch_size = 256;
+
+  std::vector<MapIngestJob> batch;
+  batch.reserve(max_batch_size);
+
+  while (b_run_map_ingest_) {
+    batch.clear();
+    MapIngestJob job;
+    while (batch.size() < max_batch_size && map_ingest_queue_.pop(job)) {
+      batch.push_back(job);
+    }
+
+    if (batch.empty()) {
+      std::unique_lock<std::mutex> lock(map_ingest_mutex_);
+      map_ingest_cv_.wait(lock, [this] {
+        return !b_run_map_ingest_ || map_ingest_queue_.read_available() > 0;
+      });
+      continue;
+    }
+
+    // Transform outside of the map lock
+    PointCloud::Ptr points(new PointCloud);
+    PointCloud scan_world;
+    unsigned int generation = map_generation_;
+    for (const auto& j : batch) {
+      // Scans queued before the map was regenerated are already in the map
+      if (j.generation != generation)
+        continue;
+      TransformScanToWorld(j.pose, *j.scan, &scan_world);
+      *points += scan_world;
     }
+
+    {
+      std::lock_guard<std::mutex> lock(map_mutex_);
+      // The map may have been regenerated while transforming
+      if (generation == map_generation_ && !points->empty()) {
+        PointCloud::Ptr unused(new PointCloud);
+        mapper_->InsertPoints(points, unused.get());
+        if (b_map_lod_) {
+          // The tiled map references the shared body-frame scans
+          for (const auto& j : batch) {
+            if (j.generation != generation)
+              continue;
+            tiled_map_.InsertScan(j.key, j.scan, j.pose);
+          }
+        }
+        b_map_updated_ = true;
+      }
+    }
+
+    ROS_DEBUG_STREAM("Map ingest worker added " << batch.size()
+                                                << " scans to the map.");
+    {
+      std::lock_guard<std::mutex> lock(map_ingest_mutex_);
+      map_jobs_done_ += batch.size();
+    }
+    map_ingest_done_cv_.notify_all();
+  }
+}
+
+void LampBaseStation::StopMapIngest() {
+  {
+    std::lock_guard<std::mutex> lock(map_ingest_mutex_);
+    b_run_map_ingest_ = false;
+  }
+  map_ingest_cv_.notify_all();
+  map_ingest_done_cv_.notify_all();
+  if (map_ingest_thread_.joinable()) {
+    map_ingest_thread_.join();
   }
-  ROS_DEBUG_STREAM("Added " << scan_count << " scans to the map.");
+}
+
+void LampBaseStation::WaitForMapIngest() const {
+  std::unique_lock<std::mutex> lock(map_ingest_mutex_);
+  map_ingest_done_cv_.wait(lock, [this] {
+    return !b_run_map_ingest_ || map_jobs_done_ >= map_jobs_queued_;
+  });
+}
+
+void LampBaseStation::OnMapRegenerated(const PointCloud::ConstPtr& map) {
+  if (!b_map_lod_) {
+    mapper_->PublishMap();
+    return;
+  }
+
+  // Scans whose node left the graph (removed robot, loaded graph) are dropped
+  std::vector<gtsam::Key> tiled_keys;
+  tiled_map_.GetScanKeys(&tiled_keys);
+  for (const auto& key : tiled_keys) {
+    if (!pose_graph_.HasKey(key) || !pose_graph_.HasScan(key))
+      tiled_map_.RemoveScan(key);
+  }
+
+  // Only the scans whose node moved change their tiles
+  for (const auto& keyed_pose : pose_graph_.GetValues()) {
+    const gtsam::Symbol key = keyed_pose.key;
+    if (!pose_graph_.HasScan(key))
+      continue;
+    const gtsam::Pose3 pose = pose_graph_.GetPose(key);
+    if (!tiled_map_.UpdatePose(key, pose))
+      tiled_map_.InsertScan(key, pose_graph_.keyed_scans[key], pose);
+  }
+  b_map_updated_ = true;
+}
+
+void LampBaseStation::MapTileRequestCallback(
+    const geometry_msgs::PointStamped::ConstPtr& msg) {
+  map_tile_requests_.emplace_back(
+      gtsam::Point3(msg->point.x, msg->point.y, msg->point.z),
+      ros::Time::now());
+}
+
+void LampBaseStation::PublishMapTiles() {
+  // New subscribers need every tile, nothing is sent without subscribers
+  size_t num_subscribers = map_tiles_pub_.getNumSubscribers();
+  if (num_subscribers > num_map_tile_subscribers_) {
+    published_coarse_tiles_.clear();
+    published_fine_tiles_.clear();
+  }
+  num_map_tile_subscribers_ = num_subscribers;
+  if (num_subscribers == 0)
+    return;
+
+  // Tiles near the robots or near a recent request are sent at the fine level
+  ros::Time now = ros::Time::now();
+  std::vector<gtsam::Point3> centers;
+  for (const auto& robot : latest_node_pose_) {
+    centers.push_back(robot.second.second.translation());
+  }
+  auto request = map_tile_requests_.begin();
+  while (request != map_tile_requests_.end()) {
+    if ((now - request->second).toSec() > lod_request_timeout_) {
+      request = map_tile_requests_.erase(request);
+      continue;
+    }
+    centers.push_back(request->first);
+    ++request;
+  }
+
+  std::unordered_set<lamp_utils::TileIndex, lamp_utils::TileIndexHash>
+      fine_tiles;
+  std::vector<lamp_utils::TileIndex> tiles;
+  for (const auto& c : centers) {
+    tiled_map_.GetTilesInRadius(
+        Eigen::Vector3f(c.x(), c.y(), c.z()), lod_fine_radius_, &tiles);
+    fine_tiles.insert(tiles.begin(), tiles.end());
+  }
+
+  pose_graph_msgs::MapTileArray msg;
+  msg.header.frame_id = pose_graph_.fixed_frame_id;
+  msg.header.stamp = now;
+
+  auto add_tile = [&](const lamp_utils::TileIndex& index,
+                      unsigned int level,
+                      uint32_t revision,
+                      const PointCloud::ConstPtr& points) {
+    pose_graph_msgs::MapTile tile;
+    tile.x = index.x;
+    tile.y = index.y;
+    tile.z = index.z;
+    tile.tile_size = tiled_map_.GetTileSize();
+    tile.level = level;
+    tile.resolution = tiled_map_.GetResolution(level);
+    tile.revision = revision;
+    if (points != nullptr)
+      pcl::toROSMsg(*points, tile.cloud);
+    tile.cloud.header = msg.header;
+    msg.tiles.push_back(tile);
+  };
+
+  const unsigned int coarse_level = tiled_map_.GetNumLevels() - 1;
+  std::vector<std::pair<lamp_utils::TileIndex, uint32_t>> revisions;
+  tiled_map_.GetTileRevisions(&revisions);
+  for (const auto& r : revisions) {
+    PointCloud::ConstPtr points;
+
+    // Coarse level of every changed tile
+    auto coarse = published_coarse_tiles_.find(r.first);
+    bool b_coarse_sent = coarse != published_coarse_tiles_.end();
+    if (!b_coarse_sent || coarse->second != r.second) {
+      tiled_map_.GetTileCloud(r.first, coarse_level, &points);
+      // Empty tiles the subscribers never received need no removal
+      if (!points->empty() || b_coarse_sent)
+        add_tile(r.first, coarse_level, r.second, points);
+      published_coarse_tiles_[r.first] = r.second;
+    }
+
+    if (lod_fine_level_ == coarse_level)
+      continue;
+
+    // Fine level of the changed tiles in the fine set, removal of the fine
+    // level for tiles that left it
+    auto fine = published_fine_tiles_.find(r.first);
+    if (fine_tiles.count(r.first)) {
+      if (fine == published_fine_tiles_.end() || fine->second != r.second) {
+        tiled_map_.GetTileCloud(r.first, lod_fine_level_, &points);
+        add_tile(r.first, lod_fine_level_, r.second, points);
+        published_fine_tiles_[r.first] = r.second;
+      }
+    } else if (fine != published_fine_tiles_.end()) {
+      add_tile(r.first, lod_fine_level_, r.second, nullptr);
+      published_fine_tiles_.erase(fine);
+    }
+  }
+
+  if (msg.tiles.empty())
+    return;
+  ROS_DEBUG_STREAM("Publishing " << msg.tiles.size() << " map tiles");
+  map_tiles_pub_.publish(msg);
 }
 
 bool LampBaseStation::ProcessRobotPoseData(std::shared_ptr<FactorData> data) {
@@ -427,6 +779,12 @@ void LampBaseStation::RemoveRobotCallback(const std_msgs::String msg) {
   PublishPoseGraphForOptimizer();
 }
 
+void LampBaseStation::KeyedScanRequestCallback(
+    const std_msgs::UInt64MultiArray::ConstPtr& msg) {
+  std::vector<gtsam::Key> keys(msg->data.begin(), msg->data.end());
+  keyed_scan_republisher_.Request(keys, pose_graph_.keyed_scans);
+}
+
 void LampBaseStation::DebugCallback(const std_msgs::String msg) {
   ROS_INFO_STREAM("Debug message received: " << msg.data);
 
@@ -442,6 +800,7 @@ void LampBaseStation::DebugCallback(const std_msgs::String msg) {
   // Freeze the current point cloud map on the visualizer
   if (cmd == "freeze") {
     ROS_INFO_STREAM("Publishing frozen map");
+    std::lock_guard<std::mutex> lock(map_mutex_);
     mapper_->PublishMapFrozen();
   }
 
@@ -475,7 +834,17 @@ void LampBaseStation::DebugCallback(const std_msgs::String msg) {
 
     PublishAllKeyedScans(); // So the loop closure module has all the keyed
                             // scans
-    ROS_INFO_STREAM("Done publishing keyed scans");
+  }
+
+  // Control the keyed scan republishing
+  else if (cmd == "pause_scans") {
+    keyed_scan_republisher_.Pause();
+  } else if (cmd == "resume_scans") {
+    keyed_scan_republisher_.Resume();
+  } else if (cmd == "cancel_scans") {
+    keyed_scan_republisher_.Cancel();
+  } else if (cmd == "publish_scans") {
+    PublishAllKeyedScans();
   }
 
   else if (msg.data == "optimize") {
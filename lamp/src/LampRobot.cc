@@ -34,7 +34,8 @@ using gtsam::Values;
 using gtsam::Vector3;
 
 // Constructor
-LampRobot::LampRobot() : b_init_pg_pub_(false), init_count_(0) {
+LampRobot::LampRobot()
+  : b_init_pg_pub_(false), init_count_(0), b_use_link_scheduler_(false) {
   b_run_optimization_ = false;
   mapper_ = std::make_shared<PointCloudMapper>();
 }
@@ -104,6 +105,16 @@ bool LampRobot::LoadParameters(const ros::NodeHandle& n) {
 
   if (!pu::Get("time_threshold", pose_graph_.time_threshold))
     return false;
+
+  LoadKeyedScanParameters();
+
+  // Optional, data is published directly by default
+  pu::Get("link_scheduler/b_enable", b_use_link_scheduler_);
+  pu::Get("link_scheduler/rate", link_params_.rate);
+  pu::Get("link_scheduler/burst", link_params_.burst);
+  pu::Get("link_scheduler/promotion_time", link_params_.promotion_time);
+  pu::Get("link_scheduler/artifact_topics", link_artifact_topics_);
+
   // Load filtering parameters.
   if (!pu::Get("filtering/adaptive_grid_filter",
                filter_params_.adaptive_grid_filter))
@@ -209,6 +220,19 @@ bool LampRobot::CreatePublishers(const ros::NodeHandle& n) {
   // Publishers
   pose_pub_ = nl.advertise<geometry_msgs::PoseStamped>("lamp_pose", 10, false);
 
+  if (b_use_link_scheduler_) {
+    link_scheduler_.Initialize(link_params_);
+    // Artifacts come from other nodes, they are forwarded on <topic>_scheduled
+    for (const auto& topic : link_artifact_topics_) {
+      link_scheduler_.Relay(
+          nl, topic, topic + "_scheduled", LinkScheduler::ARTIFACT);
+    }
+    link_status_pub_ = nl.advertise<pose_graph_msgs::LinkQueueStatus>(
+        "link_queue_status", 10, false);
+    link_status_timer_ = nl.createTimer(
+        ros::Duration(1.0), &LampRobot::PublishLinkStatus, this);
+  }
+
   return true;
 }
 
@@ -553,7 +577,47 @@ void LampRobot::AddKeyedScanAndPublish(PointCloud::Ptr new_scan,
   PointXyziCloud::Ptr pub_scan(new PointXyziCloud);
   lamp_utils::ConvertPointCloud(new_scan, pub_scan);
   pcl::toROSMsg(*pub_scan, keyed_scan_msg.scan);
-  keyed_scan_pub_.publish(keyed_scan_msg);
+  if (!b_use_link_scheduler_) {
+    keyed_scan_pub_.publish(keyed_scan_msg);
+    PublishCompressedKeyedScan(current_key, *new_scan, false);
+    return;
+  }
+
+  // Scans are sent last, behind graph updates and artifacts. Only one form
+  // of each scan goes over the link, the compressed one when enabled.
+  if (b_compress_keyed_scans_) {
+    pose_graph_msgs::CompressedKeyedScan::Ptr compressed_msg(
+        new pose_graph_msgs::CompressedKeyedScan);
+    if (CompressKeyedScan(
+            current_key, *new_scan, false, compressed_msg.get())) {
+      link_scheduler_.Submit(
+          LinkScheduler::SCAN,
+          keyed_scan_compressed_pub_,
+          pose_graph_msgs::CompressedKeyedScan::ConstPtr(compressed_msg));
+      return;
+    }
+  }
+  link_scheduler_.Submit(
+      LinkScheduler::SCAN,
+      keyed_scan_pub_,
+      pose_graph_msgs::KeyedScan::ConstPtr(
+          new pose_graph_msgs::KeyedScan(keyed_scan_msg)));
+}
+
+void LampRobot::PublishIncrementalPoseGraph(
+    const pose_graph_msgs::PoseGraphConstPtr& msg) {
+  if (!b_use_link_scheduler_) {
+    LampBase::PublishIncrementalPoseGraph(msg);
+    return;
+  }
+  link_scheduler_.Submit(
+      LinkScheduler::GRAPH, pose_graph_incremental_pub_, msg);
+}
+
+void LampRobot::PublishLinkStatus(const ros::TimerEvent& ev) {
+  pose_graph_msgs::LinkQueueStatus status;
+  link_scheduler_.GetStatus(&status);
+  link_status_pub_.publish(status);
 }
 
 // Odometry update
@@ -0,0 +1,206 @@
+/*
+LinkScheduler.cc
+Prioritized, rate limited sending of robot data over the link to the base
+*/
+
+#include <lamp/LinkScheduler.h>
+
+#include <algorithm>
+
+namespace {
+const char* kClassNames[] = {"graph", "artifact", "scan"};
+} // namespace
+
+LinkScheduler::LinkScheduler()
+  : b_paused_(false), b_running_(false), tokens_(0.0) {
+  for (int c = 0; c < NUM_CLASSES; c++) {
+    queued_bytes_[c] = 0;
+    sent_bytes_[c] = 0;
+  }
+}
+
+LinkScheduler::~LinkScheduler() {
+  Stop();
+}
+
+void LinkScheduler::Initialize(const LinkSchedulerParams& params) {
+  Stop();
+  params_ = params;
+  tokens_ = params_.burst;
+  last_refill_ = Clock::now();
+  b_running_ = true;
+  worker_ = std::thread(&LinkScheduler::Run, this);
+}
+
+void LinkScheduler::Submit(Class c,
+                           size_t bytes,
+                           const std::function<void()>& send) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  queues_[c].push_back(Item{bytes, send, Clock::now()});
+  queued_bytes_[c] += bytes;
+  cv_.notify_all();
+}
+
+void LinkScheduler::Relay(ros::NodeHandle& nh,
+                          const std::string& in_topic,
+                          const std::string& out_topic,
+                          Class c) {
+  std::shared_ptr<RelayTopic> relay(new RelayTopic);
+  relay->c = c;
+  relay->nh = nh;
+  relay->out_topic = out_topic;
+  // The output is advertised with the type and latching of the first message
+  boost::function<void(
+      const ros::MessageEvent<topic_tools::ShapeShifter const>&)>
+      callback =
+          boost::bind(&LinkScheduler::RelayCallback, this, relay.get(), _1);
+  relay->sub = nh.subscribe<topic_tools::ShapeShifter>(in_topic, 10, callback);
+  relays_.push_back(relay);
+}
+
+void LinkScheduler::RelayCallback(
+    RelayTopic* relay,
+    const ros::MessageEvent<topic_tools::ShapeShifter const>& event) {
+  const topic_tools::ShapeShifter::ConstPtr& msg = event.getMessage();
+  if (!relay->pub) {
+    // Latched like the input publisher, as topic_tools relay does
+    bool latch = false;
+    if (event.getConnectionHeaderPtr()) {
+      auto it = event.getConnectionHeader().find("latching");
+      latch = it != event.getConnectionHeader().end() && it->second == "1";
+    }
+    relay->pub = msg->advertise(relay->nh, relay->out_topic, 10, latch);
+  }
+  ros::Publisher pub = relay->pub;
+  Submit(relay->c, msg->size(), [pub, msg]() { pub.publish(msg); });
+}
+
+void LinkScheduler::Pause() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  b_paused_ = true;
+}
+
+void LinkScheduler::Resume() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  b_paused_ = false;
+  cv_.notify_all();
+}
+
+size_t LinkScheduler::NumQueued(Class c) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queues_[c].size();
+}
+
+void LinkScheduler::GetStatus(pose_graph_msgs::LinkQueueStatus* status) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Clock::time_point now = Clock::now();
+  status->header.stamp = ros::Time::now();
+  status->classes.clear();
+  status->queued.clear();
+  status->queued_bytes.clear();
+  status->oldest_age.clear();
+  status->sent_bytes.clear();
+  for (int c = 0; c < NUM_CLASSES; c++) {
+    status->classes.push_back(kClassNames[c]);
+    status->queued.push_back(queues_[c].size());
+    status->queued_bytes.push_back(queued_bytes_[c]);
+    status->oldest_age.push_back(
+        queues_[c].empty()
+            ? 0.0
+            : std::chrono::duration<double>(now - queues_[c].front().queued)
+                  .count());
+    status->sent_bytes.push_back(sent_bytes_[c]);
+  }
+}
+
+void LinkScheduler::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    b_running_ = false;
+    cv_.notify_all();
+  }
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+}
+
+int LinkScheduler::NextQueue(const Clock::time_point& now) const {
+  int best = -1;
+  int best_class = NUM_CLASSES;
+  for (int c = 0; c < NUM_CLASSES; c++) {
+    if (queues_[c].empty())
+      continue;
+    // Promote by one class per promotion time waited, up to the artifacts
+    int promoted = c;
+    if (c != GRAPH && params_.promotion_time > 0.0) {
+      double age =
+          std::chrono::duration<double>(now - queues_[c].front().queued)
+              .count();
+      promoted = std::max<int>(
+          ARTIFACT, c - static_cast<int>(age / params_.promotion_time));
+    }
+    // Older message first within the same class
+    if (promoted < best_class ||
+        (promoted == best_class &&
+         queues_[c].front().queued < queues_[best].front().queued)) {
+      best = c;
+      best_class = promoted;
+    }
+  }
+  return best;
+}
+
+void LinkScheduler::Refill(const Clock::time_point& now) {
+  double elapsed = std::chrono::duration<double>(now - last_refill_).count();
+  tokens_ = std::min(params_.burst, tokens_ + elapsed * params_.rate);
+  last_refill_ = now;
+}
+
+void LinkScheduler::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this] {
+      if (!b_running_)
+        return true;
+      if (b_paused_)
+        return false;
+      for (int c = 0; c < NUM_CLASSES; c++) {
+        if (!queues_[c].empty())
+          return true;
+      }
+      return false;
+    });
+    if (!b_running_)
+      return;
+
+    const Clock::time_point now = Clock::now();
+    Refill(now);
+    int c = NextQueue(now);
+
+    if (params_.rate > 0.0) {
+      // Graph messages may overdraw the bucket by one burst, the others wait
+      // for a full bucket at most
+      double needed = c == GRAPH
+          ? -params_.burst
+          : std::min<double>(queues_[c].front().bytes, params_.burst);
+      if (tokens_ < needed) {
+        // Woken early by new messages, which may be of a higher class
+        cv_.wait_for(lock,
+                     std::chrono::duration<double>((needed - tokens_) /
+                                                   params_.rate));
+        continue;
+      }
+    }
+
+    Item item = queues_[c].front();
+    queues_[c].pop_front();
+    queued_bytes_[c] -= item.bytes;
+    sent_bytes_[c] += item.bytes;
+    if (params_.rate > 0.0)
+      tokens_ -= item.bytes;
+
+    lock.unlock();
+    item.send();
+    lock.lock();
+  }
+}
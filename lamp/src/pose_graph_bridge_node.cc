@@ -0,0 +1,59 @@
+/*
+pose_graph_bridge_node.cc
+Converts pose graphs to and from the compact wire format, to run on both
+ends of a low bandwidth link
+*/
+
+#include <ros/ros.h>
+
+#include <lamp_utils/PoseGraphCodec.h>
+
+int main(int argc, char** argv) {
+  ros::init(argc, argv, "pose_graph_bridge");
+  ros::NodeHandle n("~");
+
+  std::string mode;
+  lamp_utils::PoseGraphCodecParams params;
+  n.param<std::string>("mode", mode, "encode");
+  n.param("position_resolution",
+          params.position_resolution,
+          params.position_resolution);
+
+  ros::Publisher pub;
+  ros::Subscriber sub;
+  if (mode == "encode") {
+    pub = n.advertise<pose_graph_msgs::CompactPoseGraph>("output", 10, false);
+    sub = n.subscribe<pose_graph_msgs::PoseGraph>(
+        "input", 10, [&](const pose_graph_msgs::PoseGraph::ConstPtr& msg) {
+          pose_graph_msgs::CompactPoseGraph compact;
+          if (!lamp_utils::EncodePoseGraph(*msg, params, &compact)) {
+            ROS_ERROR("%s: Failed to encode pose graph",
+                      ros::this_node::getName().c_str());
+            return;
+          }
+          pub.publish(compact);
+        });
+  } else if (mode == "decode") {
+    pub = n.advertise<pose_graph_msgs::PoseGraph>("output", 10, false);
+    sub = n.subscribe<pose_graph_msgs::CompactPoseGraph>(
+        "input",
+        10,
+        [&](const pose_graph_msgs::CompactPoseGraph::ConstPtr& msg) {
+          pose_graph_msgs::PoseGraph graph;
+          if (!lamp_utils::DecodePoseGraph(*msg, &graph)) {
+            ROS_ERROR("%s: Failed to decode pose graph",
+                      ros::this_node::getName().c_str());
+            return;
+          }
+          pub.publish(graph);
+        });
+  } else {
+    ROS_ERROR("%s: Unknown mode %s, expected encode or decode",
+              ros::this_node::getName().c_str(),
+              mode.c_str());
+    return EXIT_FAILURE;
+  }
+  ros::spin();
+
+  return EXIT_SUCCESS;
+}
@@ -3,10 +3,14 @@
  *
  */
 
+#include <atomic>
+#include <mutex>
+
 #include <gtest/gtest.h>
 
 #include "lamp/LampBaseStation.h"
 #include "lamp/LampRobot.h"
+#include "lamp/LinkScheduler.h"
 
 class TestLampBase : public ::testing::Test {
 public:
@@ -82,9 +86,25 @@ public:
   }
 
   int GetMapDataSize() {
+    // Scans are added to the map by the map ingest worker
+    lb.WaitForMapIngest();
     return lb.mapper_->GetMapData()->size();
   }
 
+  std::map<char, pose_graph_msgs::PoseGraphConstPtr> CoalesceGraphsByRobot(
+      const std::vector<pose_graph_msgs::PoseGraph::ConstPtr>& graphs) {
+    return lb.CoalesceGraphsByRobot(graphs);
+  }
+
+  void EnableMapLod() { lb.b_map_lod_ = true; }
+
+  lamp_utils::TiledMap& GetTiledMap() { return lb.tiled_map_; }
+
+  void RegenerateMap() {
+    lb.WaitForMapIngest();
+    lb.OnMapRegenerated(PointCloud::ConstPtr(new PointCloud));
+  }
+
   LampBaseStation lb;
 
   PoseGraphData data_;
@@ -136,6 +156,62 @@ TEST_F(TestLampBase, AddScansBeforePoseNodes) {
   EXPECT_TRUE(GetMapDataSize() > 0);
 }
 
+TEST_F(TestLampBase, BatchedRobotGraphs) {
+  ros::NodeHandle nh, pnh("~");
+  lb.Initialize(pnh);
+
+  // Two graphs from one robot and one from another arrive in the same update
+  pose_graph_msgs::PoseGraph g0, g1, g2;
+  g0.nodes.push_back(n0);
+  g1.nodes.push_back(n1);
+  g1.edges.push_back(e0);
+
+  pose_graph_msgs::PoseGraphNode m0 = n0;
+  m0.key = gtsam::Symbol('b', 0);
+  g2.nodes.push_back(m0);
+
+  data_.b_has_data = true;
+  data_.graphs.push_back(
+      pose_graph_msgs::PoseGraph::ConstPtr(new pose_graph_msgs::PoseGraph(g0)));
+  data_.graphs.push_back(
+      pose_graph_msgs::PoseGraph::ConstPtr(new pose_graph_msgs::PoseGraph(g2)));
+  data_.graphs.push_back(
+      pose_graph_msgs::PoseGraph::ConstPtr(new pose_graph_msgs::PoseGraph(g1)));
+
+  EXPECT_TRUE(ProcessPoseGraphData(std::make_shared<PoseGraphData>(data_)));
+
+  EXPECT_TRUE(lb.graph().HasKey(gtsam::Symbol('a', 0)));
+  EXPECT_TRUE(lb.graph().HasKey(gtsam::Symbol('a', 1)));
+  EXPECT_TRUE(lb.graph().HasKey(gtsam::Symbol('b', 0)));
+  EXPECT_EQ(1, lb.graph().GetEdges().size());
+}
+
+TEST_F(TestLampBase, CoalescedGraphsKeepNewestNode) {
+  // a0 is sent again with a new pose by a later graph
+  pose_graph_msgs::PoseGraph g0, g1;
+  g0.nodes.push_back(n0);
+  g0.nodes.push_back(n1);
+  pose_graph_msgs::PoseGraphNode moved = n0;
+  moved.pose.position.x = 5.0;
+  g1.nodes.push_back(moved);
+  g1.edges.push_back(e0);
+
+  std::vector<pose_graph_msgs::PoseGraph::ConstPtr> graphs;
+  graphs.push_back(
+      pose_graph_msgs::PoseGraph::ConstPtr(new pose_graph_msgs::PoseGraph(g0)));
+  graphs.push_back(
+      pose_graph_msgs::PoseGraph::ConstPtr(new pose_graph_msgs::PoseGraph(g1)));
+
+  auto coalesced = CoalesceGraphsByRobot(graphs);
+  ASSERT_EQ(1, coalesced.count('a'));
+  const auto& nodes = coalesced['a']->nodes;
+  ASSERT_EQ(2, nodes.size());
+  EXPECT_EQ(n1.key, nodes[0].key);
+  EXPECT_EQ(n0.key, nodes[1].key);
+  EXPECT_EQ(5.0, nodes[1].pose.position.x);
+  EXPECT_EQ(1, coalesced['a']->edges.size());
+}
+
 TEST_F(TestLampBase, PoseGraphUpdateAfterOptimization) {
   // float zero_noise = 0.001;
   // gtsam::Vector6 noise;
@@ -212,6 +288,211 @@ TEST_F(TestLampBase, PoseGraphUpdateAfterOptimization) {
   EXPECT_TRUE(true);
 }
 
+TEST_F(TestLampBase, KeyedScanRepublisherOrder) {
+  ros::Publisher pub =
+      nh_.advertise<pose_graph_msgs::KeyedScan>("test_keyed_scans", 10, false);
+  std::vector<gtsam::Key> received;
+  ros::Subscriber sub = nh_.subscribe<pose_graph_msgs::KeyedScan>(
+      "test_keyed_scans",
+      10,
+      [&received](const pose_graph_msgs::KeyedScan::ConstPtr& msg) {
+        received.push_back(msg->key);
+      });
+
+  KeyedScanRepublisher republisher;
+  republisher.Pause();
+  republisher.Initialize(pub,
+                         ros::Publisher(),
+                         KeyedScanRepublisherParams(),
+                         lamp_utils::ScanCodecParams());
+  republisher.Enqueue(gtsam::Symbol('a', 0), scan_, 1.0);
+  republisher.Enqueue(gtsam::Symbol('a', 1), scan_, 2.0);
+  republisher.Enqueue(gtsam::Symbol('a', 2), scan_, 3.0);
+  // Requested keys that are not queued are taken from the keyed scans
+  std::map<gtsam::Symbol, PointCloud::ConstPtr> keyed_scans;
+  keyed_scans[gtsam::Symbol('a', 3)] = scan_;
+  republisher.Request({gtsam::Symbol('a', 0), gtsam::Symbol('a', 3)},
+                      keyed_scans);
+  // Keys without a scan are skipped
+  republisher.Request({gtsam::Symbol('a', 4)}, keyed_scans);
+  EXPECT_EQ(4, republisher.NumPending());
+
+  ros::WallTime start = ros::WallTime::now();
+  while (pub.getNumSubscribers() == 0 &&
+         (ros::WallTime::now() - start).toSec() < 5.0) {
+    ros::WallDuration(0.01).sleep();
+  }
+  republisher.Resume();
+  while (received.size() < 4 && (ros::WallTime::now() - start).toSec() < 10.0) {
+    ros::spinOnce();
+    ros::WallDuration(0.01).sleep();
+  }
+
+  // Requested first, latest request first, then by priority
+  ASSERT_EQ(4, received.size());
+  EXPECT_EQ(gtsam::Symbol('a', 3), received[0]);
+  EXPECT_EQ(gtsam::Symbol('a', 0), received[1]);
+  EXPECT_EQ(gtsam::Symbol('a', 2), received[2]);
+  EXPECT_EQ(gtsam::Symbol('a', 1), received[3]);
+}
+
+TEST_F(TestLampBase, KeyedScanRepublisherCancel) {
+  ros::Publisher pub =
+      nh_.advertise<pose_graph_msgs::KeyedScan>("test_keyed_scans", 10, false);
+  KeyedScanRepublisher republisher;
+  republisher.Pause();
+  republisher.Initialize(pub,
+                         ros::Publisher(),
+                         KeyedScanRepublisherParams(),
+                         lamp_utils::ScanCodecParams());
+  republisher.Enqueue(gtsam::Symbol('a', 0), scan_, 1.0);
+  // Queuing a key again keeps a single entry
+  republisher.Enqueue(gtsam::Symbol('a', 0), scan_, 2.0);
+  republisher.Enqueue(gtsam::Symbol('a', 1), scan_, 1.0);
+  EXPECT_EQ(2, republisher.NumPending());
+
+  republisher.Cancel();
+  EXPECT_EQ(0, republisher.NumPending());
+}
+
+TEST_F(TestLampBase, LinkSchedulerPriority) {
+  std::mutex mutex;
+  std::vector<int> sent;
+  auto send = [&mutex, &sent](int id) {
+    return [&mutex, &sent, id]() {
+      std::lock_guard<std::mutex> lock(mutex);
+      sent.push_back(id);
+    };
+  };
+
+  LinkScheduler scheduler;
+  scheduler.Pause();
+  scheduler.Initialize(LinkSchedulerParams());
+  scheduler.Submit(LinkScheduler::SCAN, 100, send(0));
+  scheduler.Submit(LinkScheduler::ARTIFACT, 100, send(1));
+  scheduler.Submit(LinkScheduler::SCAN, 100, send(2));
+  scheduler.Submit(LinkScheduler::GRAPH, 100, send(3));
+  EXPECT_EQ(2, scheduler.NumQueued(LinkScheduler::SCAN));
+  scheduler.Resume();
+
+  ros::WallTime start = ros::WallTime::now();
+  while ((ros::WallTime::now() - start).toSec() < 5.0) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (sent.size() == 4)
+        break;
+    }
+    ros::WallDuration(0.01).sleep();
+  }
+
+  // By class, then in order of submission
+  std::lock_guard<std::mutex> lock(mutex);
+  ASSERT_EQ(4, sent.size());
+  EXPECT_EQ(3, sent[0]);
+  EXPECT_EQ(1, sent[1]);
+  EXPECT_EQ(0, sent[2]);
+  EXPECT_EQ(2, sent[3]);
+}
+
+TEST_F(TestLampBase, LinkSchedulerGraphNotBlockedByScans) {
+  std::atomic<int> scans_sent(0);
+  std::atomic<bool> graph_sent(false);
+
+  LinkSchedulerParams params;
+  params.rate = 1000.0;
+  params.burst = 1000.0;
+  LinkScheduler scheduler;
+  scheduler.Initialize(params);
+  // Ten seconds of scans
+  for (int i = 0; i < 10; i++) {
+    scheduler.Submit(
+        LinkScheduler::SCAN, 1000, [&scans_sent]() { scans_sent++; });
+  }
+  scheduler.Submit(
+      LinkScheduler::GRAPH, 500, [&graph_sent]() { graph_sent = true; });
+
+  ros::WallTime start = ros::WallTime::now();
+  while (!graph_sent && (ros::WallTime::now() - start).toSec() < 5.0) {
+    ros::WallDuration(0.01).sleep();
+  }
+  EXPECT_TRUE(graph_sent);
+  EXPECT_LT((ros::WallTime::now() - start).toSec(), 0.5);
+  EXPECT_LT(scans_sent, 10);
+
+  pose_graph_msgs::LinkQueueStatus status;
+  scheduler.GetStatus(&status);
+  ASSERT_EQ(3, status.classes.size());
+  EXPECT_EQ(0, status.queued[LinkScheduler::GRAPH]);
+  EXPECT_EQ(500, status.sent_bytes[LinkScheduler::GRAPH]);
+  EXPECT_EQ(10 - scans_sent, status.queued[LinkScheduler::SCAN]);
+}
+
+TEST_F(TestLampBase, LinkSchedulerPromotion) {
+  std::mutex mutex;
+  std::vector<int> sent;
+
+  LinkSchedulerParams params;
+  params.promotion_time = 0.05;
+  LinkScheduler scheduler;
+  scheduler.Pause();
+  scheduler.Initialize(params);
+  scheduler.Submit(LinkScheduler::SCAN, 100, [&mutex, &sent]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    sent.push_back(LinkScheduler::SCAN);
+  });
+  // Long enough to move up to the artifacts, and not beyond
+  ros::WallDuration(0.2).sleep();
+  scheduler.Submit(LinkScheduler::ARTIFACT, 100, [&mutex, &sent]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    sent.push_back(LinkScheduler::ARTIFACT);
+  });
+  scheduler.Submit(LinkScheduler::GRAPH, 100, [&mutex, &sent]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    sent.push_back(LinkScheduler::GRAPH);
+  });
+  scheduler.Resume();
+
+  ros::WallTime start = ros::WallTime::now();
+  while ((ros::WallTime::now() - start).toSec() < 5.0) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (sent.size() == 3)
+        break;
+    }
+    ros::WallDuration(0.01).sleep();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  ASSERT_EQ(3, sent.size());
+  EXPECT_EQ(LinkScheduler::GRAPH, sent[0]);
+  EXPECT_EQ(LinkScheduler::SCAN, sent[1]);
+  EXPECT_EQ(LinkScheduler::ARTIFACT, sent[2]);
+}
+
+TEST_F(TestLampBase, MapTilesDropRemovedKeys) {
+  ros::NodeHandle nh, pnh("~");
+  lb.Initialize(pnh);
+  EnableMapLod();
+
+  // a0 is in the graph with its scan
+  scan_msg_.key = gtsam::Symbol('a', 0);
+  pcl::toROSMsg(*scan_, scan_msg_.scan);
+  graph_.nodes.push_back(n0);
+  data_.b_has_data = true;
+  data_.scans.push_back(pose_graph_msgs::KeyedScan::ConstPtr(
+      new pose_graph_msgs::KeyedScan(scan_msg_)));
+  data_.graphs.push_back(pose_graph_msgs::PoseGraph::ConstPtr(
+      new pose_graph_msgs::PoseGraph(graph_)));
+  EXPECT_TRUE(ProcessPoseGraphData(std::make_shared<PoseGraphData>(data_)));
+
+  // a5 left the graph, e.g. with a removed robot
+  GetTiledMap().InsertScan(gtsam::Symbol('a', 5), scan_, gtsam::Pose3());
+  RegenerateMap();
+
+  EXPECT_TRUE(GetTiledMap().HasScan(gtsam::Symbol('a', 0)));
+  EXPECT_FALSE(GetTiledMap().HasScan(gtsam::Symbol('a', 5)));
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
   ros::init(argc, argv, "test_lamp_base");
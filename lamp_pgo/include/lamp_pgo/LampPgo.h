@@ -7,8 +7,14 @@ Interface for ROS and KimeraRPGO
 #ifndef LAMP_PGO_H_
 #define LAMP_PGO_H_
 
+#include <map>
+#include <memory>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
 
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/nonlinear/ISAM2.h>
 #include <gtsam/nonlinear/Marginals.h>
 #include <gtsam/nonlinear/NonlinearFactorGraph.h>
 #include <gtsam/nonlinear/Values.h>
@@ -18,6 +24,8 @@ Interface for ROS and KimeraRPGO
 #include <std_msgs/Bool.h>
 #include <std_msgs/String.h>
 
+#include <pose_graph_msgs/FactorResiduals.h>
+#include <pose_graph_msgs/GetMarginals.h>
 #include <pose_graph_msgs/PoseGraph.h>
 #include <pose_graph_msgs/PoseGraphEdge.h>
 
@@ -37,6 +45,7 @@ class LampPgo {
   // define publishers and subscribers
   ros::Publisher optimized_pub_;
   ros::Publisher ignored_list_pub_;
+  ros::Publisher residuals_pub_;
 
   ros::Subscriber input_sub_;
 
@@ -50,7 +59,13 @@ class LampPgo {
   // reset subscriber
   ros::Subscriber reset_sub_;
 
-  void PublishValues() const;
+  // Marginal covariances of requested keys
+  ros::ServiceServer marginals_srv_;
+
+  // Publishes the optimized values. With delta publication only values that
+  // moved since they were last published are sent, with a full graph every
+  // full_publish_period and whenever a subscriber joins.
+  void PublishValues();
 
   void InputCallback(const pose_graph_msgs::PoseGraph::ConstPtr& graph_msg);
 
@@ -70,6 +85,69 @@ class LampPgo {
 
   void PublishIgnoredList() const;
 
+  // Publishes the error of every factor of the optimized graph
+  void PublishResiduals(const std::vector<double>& errors) const;
+
+  // Error of each factor at the given values, evaluated in parallel
+  std::vector<double> FactorErrors(const gtsam::NonlinearFactorGraph& factors,
+                                   const gtsam::Values& values) const;
+
+  // Node message with the optimized pose of a key
+  pose_graph_msgs::PoseGraphNode NodeMsg(const gtsam::Key& key) const;
+
+  bool GetMarginalsCallback(pose_graph_msgs::GetMarginals::Request& request,
+                            pose_graph_msgs::GetMarginals::Response& response);
+
+  // Marginal covariance of a key, computed on demand and cached until the
+  // graph is solved again
+  bool GetMarginalCovariance(const gtsam::Key& key,
+                             gtsam::Matrix66* covariance);
+
+  // Drops the cached marginals after values changed
+  void InvalidateMarginals();
+
+  // Brings the marginals solver up to date with nfg_, only the factors added
+  // or removed since the last sync are given to it
+  bool SyncMarginals();
+
+  // True if the factors only grow the graph as a tree of robot odometry: each
+  // factor links one existing pose to one new pose. The optimum of the
+  // existing poses is then unchanged by the update. If given, attachments
+  // lists each new key with the index of the factor that adds it.
+  bool IsOdometryExtension(
+      const gtsam::NonlinearFactorGraph& factors,
+      const gtsam::Values& values,
+      std::vector<std::pair<gtsam::Key, size_t>>* attachments = NULL) const;
+
+  // Full robust (PCM/GNC) pass, including odometry deferred by incremental
+  // updates
+  void UpdateRobust(const gtsam::NonlinearFactorGraph& factors,
+                    const gtsam::Values& values);
+
+  // Takes the inlier factors of the robust solver and their estimate. When
+  // chains are presolved, the inliers are solved here starting from initial,
+  // since the robust solver does not optimize.
+  void UpdateFromSolver(const gtsam::Values& initial);
+
+  // Odometry only update solved by ISAM2, deferred for the robust solver
+  void UpdateIncremental(const gtsam::NonlinearFactorGraph& factors,
+                         const gtsam::Values& values);
+
+  // Noise of the prior factor of the robot of a key, used to anchor existing
+  // poses in the incremental solver
+  gtsam::SharedNoiseModel AnchorNoise(const gtsam::Key& key);
+
+  // Hands deferred odometry to the robust solver before it is queried
+  void FlushPendingOdometry();
+
+  // Solves the graph with every robot odometry chain condensed into one
+  // relative factor between the poses other factors attach to. Chains are
+  // condensed and expanded back in parallel, one robot per OpenMP thread.
+  // Returns false if the condensed graph could not be solved.
+  bool PresolveChains(const gtsam::NonlinearFactorGraph& factors,
+                      const gtsam::Values& initial,
+                      gtsam::Values* result) const;
+
  private:
   // Optimizer parameters
   KimeraRPGO::RobustSolverParams rpgo_params_;
@@ -92,6 +170,55 @@ class LampPgo {
 
   // Max loop closure factor error
   double max_lc_error_;
+
+  // Threads evaluating factor errors (0 for all cores)
+  int error_threads_;
+
+  // Solve odometry only updates incrementally with ISAM2
+  bool b_use_isam2_odometry_;
+  gtsam::ISAM2Params isam2_params_;
+  // Reset by every robust pass, existing poses are anchored at its estimate
+  std::unique_ptr<gtsam::ISAM2> isam2_;
+  // Prior noise per robot prefix, from the prior factors of the graph
+  std::map<char, gtsam::SharedNoiseModel> anchor_noise_;
+  // Odometry not yet given to the robust solver
+  gtsam::NonlinearFactorGraph pending_factors_;
+  gtsam::Values pending_values_;
+
+  // Solve the inliers of the robust solver with condensed odometry chains
+  // instead of its full optimization
+  bool b_presolve_chains_;
+
+  // Cached marginals. An ISAM2 copy of nfg_ is synced on the first request
+  // after the graph changed, and answers from its Bayes tree, so only the
+  // cliques touched by the change are refactorized. Poses added by odometry
+  // extensions do not change the marginals of existing poses, their
+  // covariance is propagated from the pose they attach to:
+  // cov = A * cov_parent * A' + Q.
+  struct OdometryExtension {
+    gtsam::Key parent;
+    gtsam::Matrix66 A;
+    gtsam::Matrix66 Q;
+  };
+  std::unique_ptr<gtsam::ISAM2> marginals_isam2_;
+  // Slot in the marginals solver of each factor of nfg_
+  std::unordered_map<const gtsam::NonlinearFactor*, size_t> marginal_slots_;
+  bool b_marginals_stale_;
+  std::unordered_map<gtsam::Key, gtsam::Matrix66> covariance_cache_;
+  std::unordered_map<gtsam::Key, OdometryExtension> odometry_extensions_;
+
+  // Delta publication of the optimized values
+  bool b_publish_delta_;
+  double delta_translation_epsilon_;
+  double delta_rotation_epsilon_;
+  double full_publish_period_;
+  ros::Time last_full_publish_;
+  size_t last_num_subscribers_;
+  // Poses as last published, and the published edges
+  std::unordered_map<gtsam::Key, gtsam::Pose3> published_poses_;
+  std::vector<std::tuple<gtsam::Key, gtsam::Key, int>> published_edges_;
+
+  friend class TestLampPgo;
 };
 
 #endif  // LAMP_PGO_H_
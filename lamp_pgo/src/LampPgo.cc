@@ -6,12 +6,23 @@ Interface for ROS and KimeraRPGO
 
 #include "lamp_pgo/LampPgo.h"
 
+#include <algorithm>
+#include <functional>
+#include <map>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
+#include <omp.h>
+
 #include <gtsam/geometry/Point3.h>
 #include <gtsam/geometry/Pose3.h>
 #include <gtsam/geometry/Rot3.h>
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/linear/NoiseModel.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
 
 #include <parameter_utils/ParameterUtils.h>
 #include <lamp_utils/CommonFunctions.h>
@@ -23,6 +34,112 @@ using gtsam::Values;
 
 namespace pu = parameter_utils;
 
+namespace {
+
+// Odometry between consecutive poses of a robot, with Gaussian noise
+bool IsOdometryFactor(const gtsam::NonlinearFactor::shared_ptr& factor) {
+  auto between =
+      boost::dynamic_pointer_cast<gtsam::BetweenFactor<gtsam::Pose3>>(factor);
+  if (!between)
+    return false;
+  return lamp_utils::IsRobotPrefix(gtsam::Symbol(between->front()).chr()) &&
+      lamp_utils::IsRobotPrefix(gtsam::Symbol(between->back()).chr()) &&
+      (between->back() == between->front() + 1 ||
+       between->front() == between->back() + 1) &&
+      boost::dynamic_pointer_cast<gtsam::noiseModel::Gaussian>(
+          between->noiseModel());
+}
+
+// Odometry from a pose to the next one of the same robot
+struct OdometryStep {
+  gtsam::Key to;
+  gtsam::Pose3 measured;
+  gtsam::Matrix66 covariance;
+};
+
+// Run of odometry between two poses that stay in the condensed graph
+struct ChainSegment {
+  std::vector<gtsam::Key> keys;
+  // Measured motion from each pose to the next
+  std::vector<gtsam::Pose3> steps;
+  // Uncertainty accumulated from the first pose, to spread the correction
+  std::vector<double> weights;
+};
+
+// Condenses the odometry of one robot between the anchor poses
+void CondenseChain(const std::map<gtsam::Key, OdometryStep>& odometry,
+                   const std::unordered_set<gtsam::Key>& anchors,
+                   std::vector<ChainSegment>* segments,
+                   NonlinearFactorGraph* condensed) {
+  std::unordered_set<gtsam::Key> incoming;
+  for (const auto& step : odometry) {
+    incoming.insert(step.second.to);
+  }
+  auto is_anchor = [&](const gtsam::Key& key) {
+    return anchors.count(key) || !incoming.count(key) || !odometry.count(key);
+  };
+
+  for (const auto& start : odometry) {
+    if (!is_anchor(start.first))
+      continue;
+    ChainSegment segment;
+    segment.keys.push_back(start.first);
+    segment.weights.push_back(0.0);
+    gtsam::Pose3 relative;
+    gtsam::Matrix66 covariance = gtsam::Matrix66::Zero();
+    auto it = odometry.find(start.first);
+    while (true) {
+      const OdometryStep& step = it->second;
+      // Covariance of the composed motion, in the frame of the newest pose
+      const gtsam::Matrix66 adjoint = step.measured.inverse().AdjointMap();
+      covariance =
+          adjoint * covariance * adjoint.transpose() + step.covariance;
+      relative = relative * step.measured;
+      segment.keys.push_back(step.to);
+      segment.steps.push_back(step.measured);
+      segment.weights.push_back(covariance.trace());
+      if (is_anchor(step.to))
+        break;
+      it = odometry.find(step.to);
+    }
+    condensed->add(gtsam::BetweenFactor<gtsam::Pose3>(
+        segment.keys.front(),
+        segment.keys.back(),
+        relative,
+        gtsam::noiseModel::Gaussian::Covariance(covariance)));
+    segments->push_back(segment);
+  }
+}
+
+// Places the inner poses of the segments between their solved end poses.
+// Dead reckoning from the first pose leaves a misfit at the last one, which
+// is spread along the chain in proportion to the accumulated uncertainty.
+void ExpandChain(const std::vector<ChainSegment>& segments,
+                 const Values& solved,
+                 Values* expanded) {
+  for (const auto& segment : segments) {
+    const size_t n = segment.steps.size();
+    std::vector<gtsam::Pose3> reckoned(n + 1);
+    reckoned[0] = solved.at<gtsam::Pose3>(segment.keys.front());
+    for (size_t i = 0; i < n; ++i) {
+      reckoned[i + 1] = reckoned[i] * segment.steps[i];
+    }
+    const gtsam::Vector6 misfit = gtsam::Pose3::Logmap(reckoned[n].between(
+        solved.at<gtsam::Pose3>(segment.keys.back())));
+    for (size_t i = 1; i < n; ++i) {
+      double alpha = segment.weights[n] > 0
+          ? segment.weights[i] / segment.weights[n]
+          : double(i) / n;
+      const gtsam::Vector6 correction =
+          reckoned[i].between(reckoned[n]).AdjointMap() * misfit;
+      expanded->insert(segment.keys[i],
+                       reckoned[i] * gtsam::Pose3::Expmap(alpha * correction));
+    }
+  }
+}
+
+} // namespace
+
 LampPgo::LampPgo() {}
 LampPgo::~LampPgo() {}
 
@@ -37,6 +154,8 @@ bool LampPgo::Initialize(const ros::NodeHandle& n) {
   // "back_end_pose_graph"(lamp)
   ignored_list_pub_ =
       nl.advertise<std_msgs::String>("ignored_robots", 10, true);
+  residuals_pub_ = nl.advertise<pose_graph_msgs::FactorResiduals>(
+      "factor_residuals", 10, false);
 
   // Subscriber
   input_sub_ = nl.subscribe<pose_graph_msgs::PoseGraph>(
@@ -52,6 +171,10 @@ bool LampPgo::Initialize(const ros::NodeHandle& n) {
   reset_sub_ =
       nl.subscribe<std_msgs::Bool>("reset", 1, &LampPgo::ResetCallback, this);
 
+  // Service
+  marginals_srv_ = nl.advertiseService(
+      "get_marginals", &LampPgo::GetMarginalsCallback, this);
+
   // Parse parameters
   // Optimizer backend
   ROS_INFO_STREAM("PGO NODE NAMESPACE: " << n.getNamespace());
@@ -61,6 +184,7 @@ bool LampPgo::Initialize(const ros::NodeHandle& n) {
   bool b_use_outlier_rejection;
   if (!pu::Get(param_ns_ + "/b_use_outlier_rejection", b_use_outlier_rejection))
     return false;
+  bool b_use_gnc = false;
   if (b_use_outlier_rejection) {
     // outlier rejection on: set up PCM params
     double trans_threshold, rot_threshold, gnc_alpha;
@@ -75,6 +199,7 @@ bool LampPgo::Initialize(const ros::NodeHandle& n) {
     rpgo_params_.setPcmSimple3DParams(
         trans_threshold, rot_threshold, KimeraRPGO::Verbosity::VERBOSE);
     if (gnc_alpha > 0 && gnc_alpha < 1) {
+      b_use_gnc = true;
       rpgo_params_.setGncInlierCostThresholdsAtProbability(gnc_alpha);
       if (b_gnc_bias_odom)
         rpgo_params_.gncBiasOdom();
@@ -106,6 +231,39 @@ bool LampPgo::Initialize(const ros::NodeHandle& n) {
   if (!pu::Get(param_ns_ + "/max_lc_error", max_lc_error_))
     return false;
 
+  b_marginals_stale_ = true;
+
+  b_use_isam2_odometry_ = false;
+  pu::Get(param_ns_ + "/b_use_isam2_odometry", b_use_isam2_odometry_);
+  if (b_use_isam2_odometry_) {
+    ROS_INFO("Solving odometry only updates incrementally with ISAM2");
+  }
+
+  error_threads_ = 0;
+  pu::Get(param_ns_ + "/error_threads", error_threads_);
+
+  b_presolve_chains_ = false;
+  pu::Get(param_ns_ + "/b_presolve_chains", b_presolve_chains_);
+  if (b_presolve_chains_ && b_use_gnc) {
+    // GNC rejects outliers within the optimization of the robust solver
+    ROS_WARN("Presolving chains is not supported with GNC, disabled");
+    b_presolve_chains_ = false;
+  }
+  if (b_presolve_chains_) {
+    ROS_INFO("Solving the graph with condensed odometry chains");
+  }
+
+  b_publish_delta_ = false;
+  delta_translation_epsilon_ = 0.01;
+  delta_rotation_epsilon_ = 0.005;
+  full_publish_period_ = 10.0;
+  pu::Get(param_ns_ + "/b_publish_delta", b_publish_delta_);
+  pu::Get(param_ns_ + "/delta_translation_epsilon",
+          delta_translation_epsilon_);
+  pu::Get(param_ns_ + "/delta_rotation_epsilon", delta_rotation_epsilon_);
+  pu::Get(param_ns_ + "/full_publish_period", full_publish_period_);
+  last_num_subscribers_ = 0;
+
   std::string log_path;
   if (pu::Get("log_path", log_path)) {
     rpgo_params_.logOutput(log_path);
@@ -121,12 +279,12 @@ bool LampPgo::Initialize(const ros::NodeHandle& n) {
 }
 
 void LampPgo::RemoveLastLoopClosure(char prefix_1, char prefix_2) {
+  FlushPendingOdometry();
   KimeraRPGO::EdgePtr removed_edge =
       pgo_solver_->removeLastLoopClosure(prefix_1, prefix_2);
   if (removed_edge != NULL) {
     // Extract the optimized values
-    values_ = pgo_solver_->calculateEstimate();
-    nfg_ = pgo_solver_->getFactorsUnsafe();
+    UpdateFromSolver(values_);
 
     ROS_INFO_STREAM("Removed last loop closure between "
                     << gtsam::DefaultKeyFormatter(removed_edge->from_key)
@@ -141,11 +299,11 @@ void LampPgo::RemoveLastLoopClosure(char prefix_1, char prefix_2) {
 }
 
 void LampPgo::RemoveLastLoopClosure() {
+  FlushPendingOdometry();
   KimeraRPGO::EdgePtr removed_edge = pgo_solver_->removeLastLoopClosure();
   if (removed_edge != NULL) {
     // Extract the optimized values
-    values_ = pgo_solver_->calculateEstimate();
-    nfg_ = pgo_solver_->getFactorsUnsafe();
+    UpdateFromSolver(values_);
 
     ROS_INFO_STREAM("Removed last loop closure between "
                     << gtsam::DefaultKeyFormatter(removed_edge->from_key)
@@ -179,6 +337,16 @@ void LampPgo::ResetCallback(const std_msgs::Bool::ConstPtr& msg) {
     values_ = Values();
     nfg_ = NonlinearFactorGraph();
     nfg_all_ = NonlinearFactorGraph();
+    isam2_.reset();
+    marginals_isam2_.reset();
+    marginal_slots_.clear();
+    InvalidateMarginals();
+    pending_factors_ = NonlinearFactorGraph();
+    pending_values_.clear();
+    // Next publication is a full graph
+    published_poses_.clear();
+    published_edges_.clear();
+    last_full_publish_ = ros::Time();
   }
 }
 
@@ -220,6 +388,7 @@ void LampPgo::InputCallback(
   temp_values.insert(new_values);
 
   // Extract the new factors
+  NonlinearFactorGraph loop_closures;
   for (size_t i = 0; i < all_factors.size(); i++) {
     bool factor_exists = false;
     for (size_t j = 0; j < nfg_all_.size(); j++) {
@@ -237,15 +406,21 @@ void LampPgo::InputCallback(
       if (!loop_closure) {
         new_factors.add(all_factors[i]);
       } else {
-        if (all_factors[i]->error(temp_values) < max_lc_error_)
-          new_factors.add(all_factors[i]);
-        else {
-          ROS_WARN("Loop closure discarded because of large error. ");
-        }
+        loop_closures.add(all_factors[i]);
       }
     }
   }
 
+  // Discard loop closures with a large error at the initial values
+  std::vector<double> lc_errors = FactorErrors(loop_closures, temp_values);
+  for (size_t i = 0; i < loop_closures.size(); i++) {
+    if (lc_errors[i] < max_lc_error_)
+      new_factors.add(loop_closures[i]);
+    else {
+      ROS_WARN("Loop closure discarded because of large error. ");
+    }
+  }
+
   ROS_DEBUG_STREAM("PGO adding new values " << new_values.size());
   for (auto k : new_values) {
     ROS_DEBUG_STREAM("\t" << gtsam::DefaultKeyFormatter(k.key));
@@ -256,20 +431,28 @@ void LampPgo::InputCallback(
 
   ROS_DEBUG_STREAM("FACTORS BEFORE");
 
-  // Run the optimizer
-  pgo_solver_->update(new_factors, new_values);
   // Track all the added factors (including rejected ones)
   nfg_all_.add(new_factors);
 
-  // Extract the optimized values
-  values_ = pgo_solver_->calculateEstimate();
-  nfg_ = pgo_solver_->getFactorsUnsafe();
+  // Pure odometry extensions skip the robust solver
+  if (b_use_isam2_odometry_ &&
+      IsOdometryExtension(new_factors, new_values)) {
+    UpdateIncremental(new_factors, new_values);
+    ROS_DEBUG_STREAM("PGO extended odometry incrementally, stored values of "
+                     "size " << values_.size());
+    PublishValues();
+    if (residuals_pub_.getNumSubscribers() > 0)
+      PublishResiduals(FactorErrors(nfg_, values_));
+    return;
+  }
+
+  // Run the optimizer
+  UpdateRobust(new_factors, new_values);
 
   ROS_DEBUG_STREAM("FACTORS AFTER");
+  std::vector<double> errors = FactorErrors(nfg_, values_);
   std::vector<double> bad_errors;
-  for (auto f : nfg_) {
-    // f->printKeys();
-    double error = f->error(values_);
+  for (const double& error : errors) {
     ROS_DEBUG_STREAM("Error: " << error);
     if (error > 10.0){
       bad_errors.push_back(error);
@@ -281,6 +464,7 @@ void LampPgo::InputCallback(
 
   // publish posegraph
   PublishValues();
+  PublishResiduals(errors);
 
   if (!bad_errors.empty()) {
     ROS_WARN_STREAM("After optimization, "
@@ -289,77 +473,345 @@ void LampPgo::InputCallback(
   }
 }
 
-// TODO - check that this is ok including just the positions in the message
-void LampPgo::PublishValues() const {
-  pose_graph_msgs::PoseGraph pose_graph_msg;
-  int iter_debug = 0;
-  // Then store the values as nodes
-  gtsam::KeyVector key_list = values_.keys();
-  // Extract the marginal/covariances of the optimized values
+bool LampPgo::IsOdometryExtension(
+    const NonlinearFactorGraph& factors,
+    const Values& values,
+    std::vector<std::pair<gtsam::Key, size_t>>* attachments) const {
+  // Every factor has to add exactly one new pose
+  if (factors.empty() || factors.size() != values.size())
+    return false;
 
-  // gtsam::Marginals marginal(nfg_, values_);
-  // marginal.print();
-  // marginal.bayesTree_.print("Bayes Tree: ");
+  std::vector<bool> added(factors.size(), false);
+  std::unordered_set<gtsam::Key> new_keys;
+  size_t num_added = 0;
+  bool progress = true;
+  // Factors may come in any order, so grow the tree until nothing attaches
+  while (progress && num_added < factors.size()) {
+    progress = false;
+    for (size_t i = 0; i < factors.size(); i++) {
+      if (added[i])
+        continue;
+      if (!boost::dynamic_pointer_cast<gtsam::BetweenFactor<gtsam::Pose3>>(
+              factors[i]))
+        return false;
+      gtsam::Key front = factors[i]->front();
+      gtsam::Key back = factors[i]->back();
+      if (!lamp_utils::IsRobotPrefix(gtsam::Symbol(front).chr()) ||
+          !lamp_utils::IsRobotPrefix(gtsam::Symbol(back).chr()))
+        return false;
+
+      bool front_known = values_.exists(front) || new_keys.count(front);
+      bool back_known = values_.exists(back) || new_keys.count(back);
+      if (front_known && back_known)
+        return false; // Closes a cycle
+      if (!front_known && !back_known)
+        continue; // Not attached yet
+
+      gtsam::Key new_key = front_known ? back : front;
+      if (!values.exists(new_key))
+        return false;
+      new_keys.insert(new_key);
+      if (attachments)
+        attachments->emplace_back(new_key, i);
+      added[i] = true;
+      num_added++;
+      progress = true;
+    }
+  }
+  return num_added == factors.size();
+}
 
+void LampPgo::UpdateRobust(const NonlinearFactorGraph& factors,
+                           const Values& values) {
+  NonlinearFactorGraph robust_factors = pending_factors_;
+  robust_factors.add(factors);
+  // Deferred poses start from their incremental estimate
+  Values robust_values = values;
+  for (const auto& key : pending_values_.keys()) {
+    robust_values.insert(key, values_.at(key));
+  }
+  pending_factors_ = NonlinearFactorGraph();
+  pending_values_.clear();
+
+  if (b_presolve_chains_) {
+    // The robust solver only checks the new loop closures, the inliers are
+    // then solved with every odometry chain condensed
+    pgo_solver_->update(robust_factors, robust_values, false);
+    Values initial = values_;
+    initial.insert(values);
+    UpdateFromSolver(initial);
+  } else {
+    pgo_solver_->update(robust_factors, robust_values);
+    UpdateFromSolver(values_);
+  }
+}
 
-  for (const auto& key : key_list) {
-    pose_graph_msgs::PoseGraphNode node;
-    node.key = key;
-    if (key_to_id_map_.count(key)) {
-      node.ID = key_to_id_map_.at(key);
+void LampPgo::UpdateFromSolver(const Values& initial) {
+  nfg_ = pgo_solver_->getFactorsUnsafe();
+  InvalidateMarginals();
+  // Anchors of the incremental solver are stale now
+  isam2_.reset();
+
+  if (!b_presolve_chains_) {
+    values_ = pgo_solver_->calculateEstimate();
+    return;
+  }
+
+  // The estimate of the robust solver is left at its initial values, which
+  // only seed its next optimization
+  Values presolved;
+  if (PresolveChains(nfg_, initial, &presolved)) {
+    values_ = presolved;
+    return;
+  }
+  try {
+    values_ = gtsam::LevenbergMarquardtOptimizer(nfg_, initial).optimize();
+  } catch (std::exception& e) {
+    ROS_ERROR_STREAM("PGO failed to optimize: " << e.what());
+    values_ = initial;
+  }
+}
+
+void LampPgo::UpdateIncremental(const NonlinearFactorGraph& factors,
+                                const Values& values) {
+  if (!isam2_) {
+    isam2_.reset(new gtsam::ISAM2(isam2_params_));
+  }
+
+  // Existing poses the new odometry attaches to are anchored at their current
+  // estimate, which an odometry extension does not change. The anchors take
+  // the prior noise of their robot, so the incremental problem is conditioned
+  // as the full one.
+  NonlinearFactorGraph isam2_factors;
+  Values isam2_values = values;
+  for (const auto& factor : factors) {
+    for (const gtsam::Key& key : factor->keys()) {
+      if (isam2_values.exists(key) || isam2_->valueExists(key))
+        continue;
+      isam2_factors.add(gtsam::PriorFactor<gtsam::Pose3>(
+          key, values_.at<gtsam::Pose3>(key), AnchorNoise(key)));
+      isam2_values.insert(key, values_.at(key));
+    }
+  }
+  isam2_factors.add(factors);
+  isam2_->update(isam2_factors, isam2_values);
+
+  // Remember how the new poses attach, for their marginals
+  std::vector<std::pair<gtsam::Key, size_t>> attachments;
+  IsOdometryExtension(factors, values, &attachments);
+  for (const auto& attachment : attachments) {
+    auto between =
+        boost::dynamic_pointer_cast<gtsam::BetweenFactor<gtsam::Pose3>>(
+            factors[attachment.second]);
+    auto gaussian = boost::dynamic_pointer_cast<gtsam::noiseModel::Gaussian>(
+        between->noiseModel());
+    if (!gaussian)
+      continue; // Left to the full marginals
+    const gtsam::Matrix66 measured_covariance = gaussian->covariance();
+    OdometryExtension extension;
+    if (between->back() == attachment.first) {
+      // child = parent * measured
+      extension.parent = between->front();
+      extension.A = between->measured().inverse().AdjointMap();
+      extension.Q = measured_covariance;
     } else {
-      ROS_ERROR_STREAM("PGO: ID not found for node key");
+      // child = parent * measured^-1
+      extension.parent = between->back();
+      extension.A = between->measured().AdjointMap();
+      extension.Q =
+          extension.A * measured_covariance * extension.A.transpose();
     }
-    // pose - translation
-    node.pose.position.x = values_.at<gtsam::Pose3>(key).translation().x();
-    node.pose.position.y = values_.at<gtsam::Pose3>(key).translation().y();
-    node.pose.position.z = values_.at<gtsam::Pose3>(key).translation().z();
-    // pose - rotation (to quaternion)
-    node.pose.orientation.x =
-        values_.at<gtsam::Pose3>(key).rotation().toQuaternion().x();
-    node.pose.orientation.y =
-        values_.at<gtsam::Pose3>(key).rotation().toQuaternion().y();
-    node.pose.orientation.z =
-        values_.at<gtsam::Pose3>(key).rotation().toQuaternion().z();
-    node.pose.orientation.w =
-        values_.at<gtsam::Pose3>(key).rotation().toQuaternion().w();
+    odometry_extensions_[attachment.first] = extension;
+  }
 
+  for (const auto& key : values.keys()) {
+    values_.insert(key, isam2_->calculateEstimate<gtsam::Pose3>(key));
+  }
+  nfg_.add(factors);
+  b_marginals_stale_ = true;
 
+  pending_factors_.add(factors);
+  pending_values_.insert(values);
+}
+
+gtsam::SharedNoiseModel LampPgo::AnchorNoise(const gtsam::Key& key) {
+  const char prefix = gtsam::Symbol(key).chr();
+  auto it = anchor_noise_.find(prefix);
+  if (it != anchor_noise_.end())
+    return it->second;
+
+  gtsam::SharedNoiseModel noise;
+  for (const auto& factor : nfg_) {
+    auto prior =
+        boost::dynamic_pointer_cast<gtsam::PriorFactor<gtsam::Pose3>>(factor);
+    if (!prior || gtsam::Symbol(prior->key()).chr() != prefix)
+      continue;
+    noise = prior->noiseModel();
+    break;
+  }
+  if (!noise) {
+    // Robots without a prior in the graph use the initial pose sigmas of lamp
+    // (lamp_init_noise.yaml)
+    gtsam::Vector6 sigmas;
+    sigmas << 0.041, 0.041, 0.00041, 0.0016, 0.0016, 0.0016;
+    noise = gtsam::noiseModel::Diagonal::Sigmas(sigmas);
+    return noise;
+  }
+  anchor_noise_[prefix] = noise;
+  return noise;
+}
+
+bool LampPgo::PresolveChains(const NonlinearFactorGraph& factors,
+                             const Values& initial,
+                             Values* result) const {
+  // Split the odometry per robot, directed from each pose to the next
+  std::map<char, std::map<gtsam::Key, OdometryStep>> odometry;
+  NonlinearFactorGraph reduced;
+  for (const auto& factor : factors) {
+    if (!IsOdometryFactor(factor)) {
+      reduced.add(factor);
+      continue;
+    }
+    auto between =
+        boost::dynamic_pointer_cast<gtsam::BetweenFactor<gtsam::Pose3>>(factor);
+    gtsam::Matrix66 covariance =
+        boost::dynamic_pointer_cast<gtsam::noiseModel::Gaussian>(
+            between->noiseModel())
+            ->covariance();
+    OdometryStep step;
+    gtsam::Key from;
+    if (between->back() == between->front() + 1) {
+      from = between->front();
+      step.to = between->back();
+      step.measured = between->measured();
+      step.covariance = covariance;
+    } else {
+      from = between->back();
+      step.to = between->front();
+      step.measured = between->measured().inverse();
+      const gtsam::Matrix66 adjoint = between->measured().AdjointMap();
+      step.covariance = adjoint * covariance * adjoint.transpose();
+    }
+    auto& chain = odometry[gtsam::Symbol(from).chr()];
+    if (chain.count(from)) {
+      // Parallel odometry is kept as a plain factor
+      reduced.add(factor);
+      continue;
+    }
+    chain.emplace(from, step);
+  }
 
-    // ROS_WARN_STREAM("Debug get covariance");
+  // Poses that other factors attach to are kept
+  std::unordered_set<gtsam::Key> anchors;
+  for (const auto& factor : reduced) {
+    anchors.insert(factor->keys().begin(), factor->keys().end());
+  }
 
-    pose_graph_msg.nodes.push_back(node);
+  // Chains are condensed and expanded in parallel, one robot per iteration
+  std::vector<const std::map<gtsam::Key, OdometryStep>*> chains;
+  for (const auto& chain : odometry) {
+    chains.push_back(&chain.second);
   }
+  const int num_robots = chains.size();
+  std::vector<std::vector<ChainSegment>> segments(num_robots);
+  std::vector<NonlinearFactorGraph> condensed(num_robots);
+#pragma omp parallel for schedule(dynamic)
+  for (int robot = 0; robot < num_robots; ++robot) {
+    CondenseChain(
+        *chains[robot], anchors, &segments[robot], &condensed[robot]);
+  }
+  for (const auto& chain_factors : condensed) {
+    reduced.add(chain_factors);
+  }
+
+  Values reduced_values;
+  for (const auto& key : reduced.keys()) {
+    if (!initial.exists(key)) {
+      ROS_WARN_STREAM("PGO presolve missing value for "
+                      << gtsam::DefaultKeyFormatter(key));
+      return false;
+    }
+    reduced_values.insert(key, initial.at(key));
+  }
+
+  Values solved;
   try {
-    gtsam::Marginals marginal(nfg_, values_);
-    for (size_t k = 0 ; k < key_list.size(); ++k) {
-      auto key = key_list[k];
-      auto node = pose_graph_msg.nodes[k];
-      // covariance
-      try {
-        auto cov_matrix = marginal.marginalCovariance(gtsam::Symbol(key));
-        int iter = 0;
-        for (int i = 0; i < 6; i++) {
-          for (int j = 0; j < 6; j++) {
-            node.covariance[iter] = cov_matrix(i, j);
-            iter++;
-          }
-        }
-      }
-      catch (std::exception& e) {
-        ROS_WARN_STREAM("Key is not found in the clique"
-                        << gtsam::DefaultKeyFormatter(key));
-      }
+    solved = gtsam::LevenbergMarquardtOptimizer(reduced, reduced_values)
+                 .optimize();
+  } catch (std::exception& e) {
+    ROS_WARN_STREAM("PGO presolve failed: " << e.what());
+    return false;
+  }
+  ROS_DEBUG_STREAM("PGO presolved " << reduced_values.size() << " of "
+                                    << initial.size() << " values");
+
+  std::vector<Values> expanded(num_robots);
+#pragma omp parallel for schedule(dynamic)
+  for (int robot = 0; robot < num_robots; ++robot) {
+    ExpandChain(segments[robot], solved, &expanded[robot]);
+  }
+
+  *result = initial;
+  result->update(solved);
+  for (const auto& robot_values : expanded) {
+    result->update(robot_values);
+  }
+  return true;
+}
+
+void LampPgo::FlushPendingOdometry() {
+  if (pending_factors_.empty())
+    return;
+  UpdateRobust(NonlinearFactorGraph(), Values());
+}
+
+// TODO - check that this is ok including just the positions in the message
+void LampPgo::PublishValues() {
+  pose_graph_msgs::PoseGraph pose_graph_msg;
+
+  // Send the full graph periodically and when someone subscribes, so that
+  // late joiners get all values
+  bool publish_full = true;
+  if (b_publish_delta_) {
+    size_t num_subscribers = optimized_pub_.getNumSubscribers();
+    ros::Time now = ros::Time::now();
+    publish_full = num_subscribers > last_num_subscribers_ ||
+        (now - last_full_publish_).toSec() >= full_publish_period_;
+    last_num_subscribers_ = num_subscribers;
+    if (publish_full) {
+      last_full_publish_ = now;
+      published_poses_.clear();
     }
-  } catch (gtsam::IndeterminantLinearSystemException e) {
-    ROS_ERROR_STREAM("LampPgo System is indeterminant, not computing covariance");
-      boost::array<float, 36> default_covariance;
-      default_covariance.assign(1e-4);
-      for (size_t k = 0 ; k < key_list.size(); ++k) {
-          auto node = pose_graph_msg.nodes[k];
-          node.covariance = default_covariance;
-        }
   }
+  pose_graph_msg.incremental = !publish_full;
+
+  // Then store the values as nodes, skipping the ones that did not move since
+  // they were last published
+  gtsam::KeyVector key_list;
+  for (const auto& key : values_.keys()) {
+    if (!b_publish_delta_) {
+      key_list.push_back(key);
+      continue;
+    }
+    const gtsam::Pose3& pose = values_.at<gtsam::Pose3>(key);
+    auto published = published_poses_.find(key);
+    if (published != published_poses_.end()) {
+      gtsam::Pose3 delta = published->second.between(pose);
+      if (delta.translation().norm() <= delta_translation_epsilon_ &&
+          gtsam::Rot3::Logmap(delta.rotation()).norm() <=
+              delta_rotation_epsilon_)
+        continue;
+      published->second = pose;
+    } else {
+      published_poses_.emplace(key, pose);
+    }
+    key_list.push_back(key);
+  }
+
+  for (const auto& key : key_list) {
+    pose_graph_msg.nodes.push_back(NodeMsg(key));
+  }
+
   for (const auto& factor : nfg_) {
     if (boost::dynamic_pointer_cast<gtsam::BetweenFactor<gtsam::Pose3>>(factor)) {
       pose_graph_msgs::PoseGraphEdge edge;
@@ -389,20 +841,219 @@ void LampPgo::PublishValues() const {
     }
   }
 
-  ROS_DEBUG_STREAM("PGO publishing graph with " << pose_graph_msg.nodes.size()
-                                                << " values");
+  if (b_publish_delta_) {
+    // Edges are sent in full, but only when they changed
+    std::vector<std::tuple<gtsam::Key, gtsam::Key, int>> edge_ids;
+    edge_ids.reserve(pose_graph_msg.edges.size());
+    for (const auto& edge : pose_graph_msg.edges) {
+      edge_ids.emplace_back(edge.key_from, edge.key_to, edge.type);
+    }
+    if (!publish_full && edge_ids == published_edges_) {
+      pose_graph_msg.edges.clear();
+      if (pose_graph_msg.nodes.empty()) {
+        ROS_DEBUG("PGO values did not change, nothing to publish");
+        return;
+      }
+    }
+    published_edges_.swap(edge_ids);
+  }
+
+  ROS_DEBUG_STREAM("PGO publishing " << (publish_full ? "full" : "delta")
+                                     << " graph with "
+                                     << pose_graph_msg.nodes.size()
+                                     << " values");
   optimized_pub_.publish(pose_graph_msg);
 }
 
+pose_graph_msgs::PoseGraphNode LampPgo::NodeMsg(const gtsam::Key& key) const {
+  pose_graph_msgs::PoseGraphNode node;
+  node.key = key;
+  if (key_to_id_map_.count(key)) {
+    node.ID = key_to_id_map_.at(key);
+  } else {
+    ROS_ERROR_STREAM("PGO: ID not found for node key");
+  }
+  const gtsam::Pose3& pose = values_.at<gtsam::Pose3>(key);
+  // pose - translation
+  node.pose.position.x = pose.translation().x();
+  node.pose.position.y = pose.translation().y();
+  node.pose.position.z = pose.translation().z();
+  // pose - rotation (to quaternion)
+  const auto quaternion = pose.rotation().toQuaternion();
+  node.pose.orientation.x = quaternion.x();
+  node.pose.orientation.y = quaternion.y();
+  node.pose.orientation.z = quaternion.z();
+  node.pose.orientation.w = quaternion.w();
+  return node;
+}
+
+bool LampPgo::GetMarginalsCallback(
+    pose_graph_msgs::GetMarginals::Request& request,
+    pose_graph_msgs::GetMarginals::Response& response) {
+  // Odometry waiting for a robust pass is already in values_ and nfg_, so the
+  // estimate served here is the one last published
+  std::vector<gtsam::Key> keys(request.keys.begin(), request.keys.end());
+  if (request.latest_robot_poses) {
+    std::map<char, gtsam::Key> latest;
+    for (const auto& key : values_.keys()) {
+      char prefix = gtsam::Symbol(key).chr();
+      if (!lamp_utils::IsRobotPrefix(prefix))
+        continue;
+      auto it = latest.find(prefix);
+      if (it == latest.end() ||
+          gtsam::Symbol(key).index() > gtsam::Symbol(it->second).index()) {
+        latest[prefix] = key;
+      }
+    }
+    for (const auto& robot : latest) {
+      keys.push_back(robot.second);
+    }
+  }
+
+  response.success = true;
+  for (const auto& key : keys) {
+    if (!values_.exists(key)) {
+      ROS_WARN_STREAM("PGO: marginals requested for unknown key "
+                      << gtsam::DefaultKeyFormatter(key));
+      response.success = false;
+      continue;
+    }
+    pose_graph_msgs::PoseGraphNode node = NodeMsg(key);
+    gtsam::Matrix66 covariance;
+    if (GetMarginalCovariance(key, &covariance)) {
+      int iter = 0;
+      for (int i = 0; i < 6; i++) {
+        for (int j = 0; j < 6; j++) {
+          node.covariance[iter] = covariance(i, j);
+          iter++;
+        }
+      }
+    } else {
+      response.success = false;
+    }
+    response.nodes.push_back(node);
+  }
+  return true;
+}
+
+bool LampPgo::GetMarginalCovariance(const gtsam::Key& key,
+                                    gtsam::Matrix66* covariance) {
+  // Walk up the odometry extensions until a key with a known covariance, or
+  // one that needs the full marginals
+  std::vector<gtsam::Key> chain;
+  gtsam::Key root = key;
+  while (!covariance_cache_.count(root)) {
+    auto extension = odometry_extensions_.find(root);
+    if (extension == odometry_extensions_.end())
+      break;
+    chain.push_back(root);
+    root = extension->second.parent;
+  }
+
+  if (!covariance_cache_.count(root)) {
+    if (!SyncMarginals())
+      return false;
+    try {
+      covariance_cache_[root] = marginals_isam2_->marginalCovariance(root);
+    } catch (std::exception& e) {
+      ROS_WARN_STREAM("Key is not found in the clique"
+                      << gtsam::DefaultKeyFormatter(root));
+      return false;
+    }
+  }
+
+  // Propagate back down through the extensions
+  for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+    const OdometryExtension& extension = odometry_extensions_.at(*it);
+    const gtsam::Matrix66& parent = covariance_cache_.at(extension.parent);
+    covariance_cache_[*it] =
+        extension.A * parent * extension.A.transpose() + extension.Q;
+  }
+
+  *covariance = covariance_cache_.at(key);
+  return true;
+}
+
+void LampPgo::InvalidateMarginals() {
+  b_marginals_stale_ = true;
+  covariance_cache_.clear();
+  odometry_extensions_.clear();
+}
+
+bool LampPgo::SyncMarginals() {
+  if (marginals_isam2_ && !b_marginals_stale_)
+    return true;
+
+  // Factors are matched by pointer, the robust solver keeps the factors it
+  // was given
+  std::unordered_set<const gtsam::NonlinearFactor*> current;
+  for (const auto& factor : nfg_) {
+    if (factor)
+      current.insert(factor.get());
+  }
+  gtsam::FactorIndices removed;
+  for (auto it = marginal_slots_.begin(); it != marginal_slots_.end();) {
+    if (current.count(it->first)) {
+      ++it;
+      continue;
+    }
+    removed.push_back(it->second);
+    it = marginal_slots_.erase(it);
+  }
+
+  // A mostly replaced graph is cheaper to factorize from scratch
+  if (!marginals_isam2_ || removed.size() > current.size() / 2) {
+    gtsam::ISAM2Params params = isam2_params_;
+    // Relinearize every update, the estimate may have moved a lot since the
+    // last query
+    params.relinearizeSkip = 1;
+    marginals_isam2_.reset(new gtsam::ISAM2(params));
+    marginal_slots_.clear();
+    removed.clear();
+  }
+
+  NonlinearFactorGraph added;
+  Values added_values;
+  try {
+    for (const auto& factor : nfg_) {
+      if (!factor || marginal_slots_.count(factor.get()))
+        continue;
+      added.add(factor);
+      for (const gtsam::Key& key : factor->keys()) {
+        if (!marginals_isam2_->valueExists(key) && !added_values.exists(key))
+          added_values.insert(key, values_.at(key));
+      }
+    }
+    const gtsam::ISAM2Result result =
+        marginals_isam2_->update(added, added_values, removed);
+    for (size_t i = 0; i < added.size(); ++i) {
+      marginal_slots_[added[i].get()] = result.newFactorsIndices[i];
+    }
+  } catch (gtsam::IndeterminantLinearSystemException& e) {
+    ROS_ERROR_STREAM(
+        "LampPgo System is indeterminant, not computing covariance");
+    marginals_isam2_.reset();
+    marginal_slots_.clear();
+    return false;
+  } catch (std::exception& e) {
+    ROS_ERROR_STREAM("LampPgo failed to update the marginals: " << e.what());
+    marginals_isam2_.reset();
+    marginal_slots_.clear();
+    return false;
+  }
+  b_marginals_stale_ = false;
+  return true;
+}
+
 void LampPgo::IgnoreRobotLoopClosures(const std_msgs::String::ConstPtr& msg) {
+  FlushPendingOdometry();
   // First convert string "huskyn" to char prefix
   char prefix = lamp_utils::GetRobotPrefix(msg->data);
 
   pgo_solver_->ignorePrefix(prefix);
 
   // Extract the optimized values
-  values_ = pgo_solver_->calculateEstimate();
-  nfg_ = pgo_solver_->getFactorsUnsafe();
+  UpdateFromSolver(values_);
 
   // Double check that it is actually ignored
   std::vector<char> ignored_prefixes = pgo_solver_->getIgnoredPrefixes();
@@ -426,14 +1077,14 @@ void LampPgo::IgnoreRobotLoopClosures(const std_msgs::String::ConstPtr& msg) {
 }
 
 void LampPgo::ReviveRobotLoopClosures(const std_msgs::String::ConstPtr& msg) {
+  FlushPendingOdometry();
   // First convert string "huskyn" to char prefix
   char prefix = lamp_utils::GetRobotPrefix(msg->data);
 
   pgo_solver_->revivePrefix(prefix);
 
   // Extract the optimized values
-  values_ = pgo_solver_->calculateEstimate();
-  nfg_ = pgo_solver_->getFactorsUnsafe();
+  UpdateFromSolver(values_);
 
   // Double check that it is actually revived
   std::vector<char> ignored_prefixes = pgo_solver_->getIgnoredPrefixes();
@@ -458,6 +1109,43 @@ void LampPgo::ReviveRobotLoopClosures(const std_msgs::String::ConstPtr& msg) {
   PublishIgnoredList();
 }
 
+std::vector<double>
+LampPgo::FactorErrors(const NonlinearFactorGraph& factors,
+                      const Values& values) const {
+  std::vector<double> errors(factors.size(), 0.0);
+  // Small graphs are not worth the threads
+  static const long kMinParallelFactors = 1000;
+  const long num_factors = factors.size();
+  const int num_threads =
+      error_threads_ > 0 ? error_threads_ : omp_get_max_threads();
+#pragma omp parallel for schedule(static) num_threads(num_threads) if ( \
+    num_factors >= kMinParallelFactors)
+  for (long i = 0; i < num_factors; i++) {
+    if (factors[i])
+      errors[i] = factors[i]->error(values);
+  }
+  return errors;
+}
+
+void LampPgo::PublishResiduals(const std::vector<double>& errors) const {
+  if (residuals_pub_.getNumSubscribers() == 0)
+    return;
+
+  pose_graph_msgs::FactorResiduals msg;
+  msg.header.stamp = ros::Time::now();
+  msg.key_from.reserve(nfg_.size());
+  msg.key_to.reserve(nfg_.size());
+  msg.error.reserve(nfg_.size());
+  for (size_t i = 0; i < nfg_.size(); i++) {
+    if (!nfg_[i])
+      continue;
+    msg.key_from.push_back(nfg_[i]->front());
+    msg.key_to.push_back(nfg_[i]->back());
+    msg.error.push_back(errors[i]);
+  }
+  residuals_pub_.publish(msg);
+}
+
 void LampPgo::PublishIgnoredList() const {
   std::string list_str = "";
   for (size_t i = 0; i < ignored_list_.size(); i++) {
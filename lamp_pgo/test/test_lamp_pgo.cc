@@ -0,0 +1,268 @@
+/**
+ *  @brief Testing the LAMP pose graph optimizer
+ *
+ */
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <gtsam/base/TestableAssertions.h>
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <gtsam/nonlinear/Marginals.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <ros/ros.h>
+
+#include "lamp_pgo/LampPgo.h"
+
+using gtsam::NonlinearFactorGraph;
+using gtsam::Pose3;
+using gtsam::Symbol;
+using gtsam::Values;
+
+class TestLampPgo : public ::testing::Test {
+public:
+  static const size_t kNumSteps = 60;
+
+  TestLampPgo() {
+    system("rosparam load $(rospack find lamp_pgo)/config/pgo_parameters.yaml");
+    // Loop closures are taken as they are, so that the estimates can be
+    // compared with a plain solve of the same graph
+    system("rosparam set base/b_use_outlier_rejection false");
+    system("rosparam set base/b_presolve_chains false");
+    system("rosparam set base/b_use_isam2_odometry false");
+
+    gtsam::Vector6 sigmas;
+    sigmas << 0.01, 0.01, 0.01, 0.1, 0.1, 0.1;
+    odom_noise_ = gtsam::noiseModel::Diagonal::Sigmas(sigmas);
+    prior_noise_ = gtsam::noiseModel::Isotropic::Sigma(6, 0.001);
+
+    // Square of 15 m sides, turning left at the corners, with noisy odometry
+    std::mt19937 random(42);
+    std::normal_distribution<double> rotation_noise(0.0, 5e-4);
+    std::normal_distribution<double> translation_noise(0.0, 1e-2);
+    truth_.push_back(Pose3());
+    for (size_t i = 0; i < kNumSteps; i++) {
+      const Pose3 step(gtsam::Rot3::Yaw(i % 15 == 14 ? M_PI / 2 : 0.0),
+                       gtsam::Point3(1.0, 0.0, 0.0));
+      truth_.push_back(truth_.back() * step);
+      gtsam::Vector6 noise;
+      for (int j = 0; j < 3; j++) {
+        noise(j) = rotation_noise(random);
+        noise(j + 3) = translation_noise(random);
+      }
+      measured_.push_back(step * Pose3::Expmap(noise));
+    }
+  }
+  ~TestLampPgo() {}
+
+protected:
+  // Odometry from pose first to pose last of robot a, with the new poses
+  // dead reckoned from start. A yaw bias per step makes them drift further.
+  void AddOdometry(size_t first,
+                   size_t last,
+                   const Pose3& start,
+                   NonlinearFactorGraph* factors,
+                   Values* values,
+                   double yaw_bias = 0.0) const {
+    Pose3 pose = start;
+    for (size_t i = first; i < last; i++) {
+      factors->add(gtsam::BetweenFactor<Pose3>(
+          Symbol('a', i), Symbol('a', i + 1), measured_[i], odom_noise_));
+      pose = pose * measured_[i] *
+          Pose3(gtsam::Rot3::Yaw(yaw_bias), gtsam::Point3(0, 0, 0));
+      values->insert(Symbol('a', i + 1), pose);
+    }
+  }
+
+  // Prior on a0 and the odometry up to pose last
+  void MakeChain(size_t last,
+                 NonlinearFactorGraph* factors,
+                 Values* values,
+                 double yaw_bias = 0.0) const {
+    factors->add(
+        gtsam::PriorFactor<Pose3>(Symbol('a', 0), Pose3(), prior_noise_));
+    values->insert(Symbol('a', 0), Pose3());
+    AddOdometry(0, last, Pose3(), factors, values, yaw_bias);
+  }
+
+  gtsam::BetweenFactor<Pose3> LoopClosure(size_t i, size_t j) const {
+    return gtsam::BetweenFactor<Pose3>(Symbol('a', i),
+                                       Symbol('a', j),
+                                       truth_[i].between(truth_[j]),
+                                       odom_noise_);
+  }
+
+  Values Solve(const NonlinearFactorGraph& factors,
+               const Values& initial) const {
+    return gtsam::LevenbergMarquardtOptimizer(factors, initial).optimize();
+  }
+
+  // Solves a loop of 30 poses with the robust solver, then extends it by 15
+  // poses of odometry with ISAM2. Returns the whole graph and its initial
+  // values.
+  void SolveWithExtension(NonlinearFactorGraph* factors, Values* initial) {
+    MakeChain(30, factors, initial);
+    factors->add(LoopClosure(0, 30));
+    UpdateRobust(*factors, *initial);
+
+    NonlinearFactorGraph extension;
+    Values extension_values;
+    AddOdometry(30,
+                45,
+                GetValues().at<Pose3>(Symbol('a', 30)),
+                &extension,
+                &extension_values);
+    ASSERT_TRUE(IsOdometryExtension(extension, extension_values));
+    UpdateIncremental(extension, extension_values);
+
+    factors->add(extension);
+    initial->insert(extension_values);
+  }
+
+  bool Initialize() {
+    ros::NodeHandle pnh("~");
+    return pgo_.Initialize(pnh);
+  }
+
+  void UpdateRobust(const NonlinearFactorGraph& factors,
+                    const Values& values) {
+    pgo_.UpdateRobust(factors, values);
+  }
+
+  bool PresolveChains(const NonlinearFactorGraph& factors,
+                      const Values& initial,
+                      Values* result) const {
+    return pgo_.PresolveChains(factors, initial, result);
+  }
+
+  void UpdateIncremental(const NonlinearFactorGraph& factors,
+                         const Values& values) {
+    pgo_.UpdateIncremental(factors, values);
+  }
+
+  bool IsOdometryExtension(const NonlinearFactorGraph& factors,
+                           const Values& values) const {
+    return pgo_.IsOdometryExtension(factors, values);
+  }
+
+  void RemoveLastLoopClosure() { pgo_.RemoveLastLoopClosure(); }
+
+  bool GetMarginalCovariance(const gtsam::Key& key,
+                             gtsam::Matrix66* covariance) {
+    return pgo_.GetMarginalCovariance(key, covariance);
+  }
+
+  const Values& GetValues() const { return pgo_.values_; }
+
+  LampPgo pgo_;
+  gtsam::SharedNoiseModel odom_noise_;
+  gtsam::SharedNoiseModel prior_noise_;
+  std::vector<Pose3> truth_;
+  // Measured motion from each pose to the next
+  std::vector<Pose3> measured_;
+};
+
+TEST_F(TestLampPgo, PresolveMatchesFullSolve) {
+  NonlinearFactorGraph factors;
+  Values initial;
+  MakeChain(kNumSteps, &factors, &initial);
+  factors.add(LoopClosure(0, kNumSteps));
+  factors.add(LoopClosure(15, 45));
+
+  const Values full = Solve(factors, initial);
+  Values presolved;
+  ASSERT_TRUE(PresolveChains(factors, initial, &presolved));
+  ASSERT_EQ(full.size(), presolved.size());
+
+  // The poses the loop closures attach to are solved in the condensed graph
+  for (const size_t i : {0, 15, 45, 60}) {
+    EXPECT_TRUE(gtsam::assert_equal(full.at<Pose3>(Symbol('a', i)),
+                                    presolved.at<Pose3>(Symbol('a', i)),
+                                    1e-2));
+  }
+  // The poses in between are placed back along their chains
+  for (const auto& key : full.keys()) {
+    EXPECT_TRUE(gtsam::assert_equal(
+        full.at<Pose3>(key), presolved.at<Pose3>(key), 5e-2));
+  }
+}
+
+TEST_F(TestLampPgo, PresolvedEstimateAfterRemovingLoopClosure) {
+  system("rosparam set base/b_presolve_chains true");
+  ASSERT_TRUE(Initialize());
+
+  // Initial values far from the solution
+  NonlinearFactorGraph factors;
+  Values initial;
+  MakeChain(kNumSteps, &factors, &initial, 0.01);
+  factors.add(LoopClosure(0, kNumSteps));
+  UpdateRobust(factors, initial);
+
+  NonlinearFactorGraph loop_closure;
+  loop_closure.add(LoopClosure(15, 45));
+  UpdateRobust(loop_closure, Values());
+
+  // The estimate is solved again without the removed loop closure, not read
+  // from the robust solver
+  RemoveLastLoopClosure();
+  const Values expected = Solve(factors, initial);
+  ASSERT_EQ(expected.size(), GetValues().size());
+  for (const auto& key : expected.keys()) {
+    EXPECT_TRUE(gtsam::assert_equal(
+        expected.at<Pose3>(key), GetValues().at<Pose3>(key), 5e-2));
+  }
+}
+
+TEST_F(TestLampPgo, IncrementalMatchesBatch) {
+  system("rosparam set base/b_use_isam2_odometry true");
+  ASSERT_TRUE(Initialize());
+
+  NonlinearFactorGraph factors;
+  Values initial;
+  SolveWithExtension(&factors, &initial);
+
+  const Values expected = Solve(factors, initial);
+  ASSERT_EQ(expected.size(), GetValues().size());
+  for (const auto& key : expected.keys()) {
+    EXPECT_TRUE(gtsam::assert_equal(
+        expected.at<Pose3>(key), GetValues().at<Pose3>(key), 1e-3));
+  }
+}
+
+TEST_F(TestLampPgo, MarginalsMatchGtsam) {
+  system("rosparam set base/b_use_isam2_odometry true");
+  ASSERT_TRUE(Initialize());
+
+  NonlinearFactorGraph factors;
+  Values initial;
+  SolveWithExtension(&factors, &initial);
+
+  // a5 and a30 are answered by the marginals solver, a40 and a45 are
+  // propagated along the odometry extension
+  const gtsam::Marginals marginals(factors, GetValues());
+  for (const size_t i : {5, 30, 40, 45}) {
+    gtsam::Matrix66 covariance;
+    ASSERT_TRUE(GetMarginalCovariance(Symbol('a', i), &covariance));
+    EXPECT_TRUE(gtsam::assert_equal(
+        marginals.marginalCovariance(Symbol('a', i)),
+        gtsam::Matrix(covariance),
+        1e-6));
+  }
+
+  // Cached covariances are served again unchanged
+  gtsam::Matrix66 first, second;
+  ASSERT_TRUE(GetMarginalCovariance(Symbol('a', 45), &first));
+  ASSERT_TRUE(GetMarginalCovariance(Symbol('a', 45), &second));
+  EXPECT_TRUE(gtsam::assert_equal(gtsam::Matrix(first), gtsam::Matrix(second)));
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "test_lamp_pgo");
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,47 @@
+/*
+KeyedScanCodec.h
+Compression of keyed scans for the robot to base station link. Positions are
+quantized in the scan frame and delta coded along the scan, normals are
+quantized octahedrally, and everything is entropy coded with an adaptive
+binary range coder.
+*/
+
+#ifndef KEYED_SCAN_CODEC_H_
+#define KEYED_SCAN_CODEC_H_
+
+#include <gtsam/inference/Key.h>
+
+#include <pose_graph_msgs/CompressedKeyedScan.h>
+#include <pose_graph_msgs/KeyedScan.h>
+
+#include <lamp_utils/PointCloudTypes.h>
+
+namespace lamp_utils {
+
+struct ScanCodecParams {
+  // Quantization step of the positions (m)
+  double position_resolution = 0.005;
+  // Quantization step of the intensity
+  double intensity_resolution = 1.0;
+  // Bits per octahedral normal coordinate (1 to 16)
+  int normal_bits = 8;
+};
+
+// Compresses the scan of a key. Non-finite points are dropped. Without
+// normals only positions and intensities are sent.
+bool EncodeKeyedScan(gtsam::Key key,
+                     const PointCloud& scan,
+                     const ScanCodecParams& params,
+                     bool with_normals,
+                     pose_graph_msgs::CompressedKeyedScan* msg);
+
+// Decompresses a scan, returns false if the data is corrupted
+bool DecodeKeyedScan(const pose_graph_msgs::CompressedKeyedScan& msg,
+                     PointCloud* scan);
+
+// Decompresses into the uncompressed keyed scan message
+bool DecodeKeyedScan(const pose_graph_msgs::CompressedKeyedScan& msg,
+                     pose_graph_msgs::KeyedScan* keyed_scan);
+
+} // namespace lamp_utils
+#endif
@@ -111,6 +111,39 @@ void ComputeAp_ForPoint2PlaneICP(const PointCloud::Ptr query_normalized,
                                  const Eigen::Matrix4f& T,
                                  Eigen::Matrix<double, 6, 6>& Ap);
 
+// Point to plane information matrix read straight from the reference point
+// normals (computed if any matched reference point has none) with the query
+// normalized on the fly, as NormalizePCloud would. Parallel over the
+// correspondences.
+void ComputeAp_ForPoint2PlaneICP(const PointCloud::ConstPtr& query,
+                                 const PointCloud::ConstPtr& reference,
+                                 const std::vector<size_t>& correspondences,
+                                 const Eigen::Matrix4f& T,
+                                 const int& num_threads,
+                                 Eigen::Matrix<double, 6, 6>& Ap);
+
+// Sums a symmetric 6x6 information matrix over the elements [0, n). Each
+// thread accumulates into its own matrix, accumulate(i, &local) adds element
+// i and only needs to fill the upper triangle.
+template <typename AccumulateFunction>
+Eigen::Matrix<double, 6, 6>
+ReduceInformationMatrix(size_t n,
+                        int num_threads,
+                        const AccumulateFunction& accumulate) {
+  Eigen::Matrix<double, 6, 6> total = Eigen::Matrix<double, 6, 6>::Zero();
+  const long count = static_cast<long>(n);
+#pragma omp parallel num_threads(num_threads) if (num_threads > 1)
+  {
+    Eigen::Matrix<double, 6, 6> local = Eigen::Matrix<double, 6, 6>::Zero();
+#pragma omp for schedule(static) nowait
+    for (long i = 0; i < count; ++i)
+      accumulate(static_cast<size_t>(i), &local);
+#pragma omp critical
+    total += local;
+  }
+  return total.selfadjointView<Eigen::Upper>();
+}
+
 void ConvertPointCloud(const PointCloud::ConstPtr& point_normal_cloud,
                        PointXyziCloud::Ptr point_cloud);
 
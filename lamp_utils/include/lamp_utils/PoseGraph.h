@@ -176,15 +176,18 @@ class PoseGraph {
   bool Load(const std::string& zipFilename,
             const std::string& pose_graph_topic_name = "pose_graph");
 
-  // Convert entire pose graph to message.
+  // Convert entire pose graph to message. The returned message is cached and
+  // shared between callers until the graph changes, so it must not be
+  // modified.
   GraphMsgPtr ToMsg() const;
 
   // Generates message from factors and values that were modified since the
-  // last update.
+  // last update. Shares the same caching rules as ToMsg().
   GraphMsgPtr ToIncrementalMsg() const;
 
   // Incremental update from pose graph message.
   void UpdateFromMsg(const GraphMsgPtr& msg);
+  void UpdateFromMsg(const pose_graph_msgs::PoseGraph& msg);
 
   // Update all values_new_ so the incremental publisher republishes the whole
   // graph
@@ -195,11 +198,15 @@ class PoseGraph {
     nodes_new_.clear();
     priors_new_.clear();
     values_new_.clear();
+    // Start an empty incremental message that new edges and nodes are
+    // appended to as they are tracked
+    incremental_msg_.reset(new pose_graph_msgs::PoseGraph);
   }
 
   // Clears entire pose graph (values, factors, meta data)
   inline void Reset() {
     ClearIncrementalMessages();
+    full_msg_.reset();
     edges_.clear();
     nodes_.clear();
     priors_.clear();
@@ -247,11 +254,23 @@ class PoseGraph {
   NodeSet nodes_new_;
   EdgeSet priors_new_;
 
+  // Messages handed out by ToMsg() and ToIncrementalMsg(). Newly tracked
+  // edges, nodes and priors are appended to them in place as long as no
+  // caller holds a reference; any other change drops the cache, which is
+  // then rebuilt from the sets above on the next request.
+  mutable pose_graph_msgs::PoseGraphPtr full_msg_;
+  mutable pose_graph_msgs::PoseGraphPtr incremental_msg_;
+
+  // Insert messages into the full and incremental sets and keep the cached
+  // messages in sync.
+  void InsertEdgeMsg(EdgeSet& all, EdgeSet& fresh, const EdgeMessage& msg);
+  void InsertNodeMsg(const NodeMessage& msg);
+
   // Convert incremental pose graph with given values, edges and priors to
   // message.
-  GraphMsgPtr ToMsg_(const EdgeSet& edges,
-                     const NodeSet& nodes,
-                     const EdgeSet& priors) const;
+  pose_graph_msgs::PoseGraphPtr ToMsg_(const EdgeSet& edges,
+                                       const NodeSet& nodes,
+                                       const EdgeSet& priors) const;
 };
 
 #endif
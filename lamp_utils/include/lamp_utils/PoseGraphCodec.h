@@ -0,0 +1,32 @@
+/*
+PoseGraphCodec.h
+Compact binary encoding of pose graph messages for the robot to base station
+link. Nodes share the message header, keys are delta coded, positions and
+rotations are quantized and covariances are sent as float upper triangles,
+or not at all when zero or equal to the previous one.
+*/
+
+#ifndef POSE_GRAPH_CODEC_H_
+#define POSE_GRAPH_CODEC_H_
+
+#include <pose_graph_msgs/CompactPoseGraph.h>
+#include <pose_graph_msgs/PoseGraph.h>
+
+namespace lamp_utils {
+
+struct PoseGraphCodecParams {
+  // Quantization step of node and edge translations (m). Rotations are
+  // quantized to 16 bits per quaternion component.
+  double position_resolution = 1e-4;
+};
+
+bool EncodePoseGraph(const pose_graph_msgs::PoseGraph& graph,
+                     const PoseGraphCodecParams& params,
+                     pose_graph_msgs::CompactPoseGraph* compact);
+
+// Returns false if the data is corrupted
+bool DecodePoseGraph(const pose_graph_msgs::CompactPoseGraph& compact,
+                     pose_graph_msgs::PoseGraph* graph);
+
+} // namespace lamp_utils
+#endif
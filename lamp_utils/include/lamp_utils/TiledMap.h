@@ -0,0 +1,122 @@
+/*
+TiledMap.h
+Multi-resolution world map split into fixed size tiles. The points are kept
+in a VoxelHashMap of keyed scans, and a tile is the group of its voxels whose
+index falls in the tile. Each tile builds its levels on demand, every level
+halving the resolution of the previous one as in an octree. Tiles carry a
+revision so that only changed tiles need to be sent to subscribers.
+*/
+
+#ifndef TILED_MAP_H_
+#define TILED_MAP_H_
+
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/inference/Key.h>
+
+#include <lamp_utils/PointCloudTypes.h>
+#include <lamp_utils/VoxelHashMap.h>
+
+namespace lamp_utils {
+
+struct TiledMapParams {
+  // Edge length of a tile, rounded to a whole number of voxels
+  double tile_size = 20.0;
+  // Resolution of the finest level (level 0), also the voxel size
+  double resolution = 0.1;
+  // Number of levels, level l has resolution * 2^l
+  unsigned int num_levels = 4;
+  // Points per voxel used to build the levels
+  size_t max_points_per_voxel = 4;
+};
+
+typedef VoxelIndex TileIndex;
+typedef VoxelIndexHash TileIndexHash;
+
+class TiledMap {
+public:
+  explicit TiledMap(const TiledMapParams& params = TiledMapParams());
+
+  // Inserts the body-frame scan of a key at the given pose. A scan that is
+  // already stored for the key is replaced.
+  void InsertScan(gtsam::Key key,
+                  const PointCloud::ConstPtr& scan,
+                  const gtsam::Pose3& pose);
+
+  // Moves the points of a key, only the tiles it leaves or enters change.
+  // Returns false if no scan is stored for the key.
+  bool UpdatePose(gtsam::Key key, const gtsam::Pose3& pose);
+
+  // Removes the points of a key. Returns false if no scan is stored for it.
+  bool RemoveScan(gtsam::Key key);
+
+  // Empties every tile. Emptied tiles keep a new revision so that their
+  // removal can be published.
+  void Clear();
+
+  TileIndex ToTileIndex(const Eigen::Vector3f& p) const;
+
+  // Non empty tiles intersecting the sphere
+  void GetTilesInRadius(const Eigen::Vector3f& center,
+                        double radius,
+                        std::vector<TileIndex>* tiles) const;
+
+  // All tiles, including emptied ones, with their revision
+  void GetTileRevisions(
+      std::vector<std::pair<TileIndex, uint32_t>>* revisions) const;
+
+  // Revision of a tile, 0 for tiles that were never filled
+  uint32_t GetRevision(const TileIndex& tile) const;
+
+  // Points of a tile at the given level. Returns false for unknown tiles or
+  // levels. Emptied tiles return true with an empty cloud.
+  bool GetTileCloud(const TileIndex& tile,
+                    unsigned int level,
+                    PointCloud::ConstPtr* points);
+
+  double GetResolution(unsigned int level) const;
+  double GetTileSize() const;
+  inline unsigned int GetNumLevels() const { return params_.num_levels; }
+  inline size_t GetNumTiles() const { return tiles_.size(); }
+  // Points of the finest level, one per voxel
+  inline size_t GetNumPoints() const { return map_.NumVoxels(); }
+  inline bool HasScan(gtsam::Key key) const { return map_.HasScan(key); }
+  inline void GetScanKeys(std::vector<gtsam::Key>* keys) const {
+    map_.GetScanKeys(keys);
+  }
+  inline bool IsAtPose(gtsam::Key key, const gtsam::Pose3& pose) const {
+    return map_.IsAtPose(key, pose);
+  }
+
+private:
+  struct Tile {
+    std::unordered_set<VoxelIndex, VoxelIndexHash> voxels;
+    uint32_t revision = 0;
+    // Level clouds and the revision they were built at
+    std::vector<PointCloud::ConstPtr> levels;
+    std::vector<uint32_t> level_revisions;
+  };
+
+  TileIndex ToTileIndex(const VoxelIndex& voxel) const;
+  // Moves the tile membership of the voxels a scan held before and holds
+  // after a change, and gives the changed tiles a new revision
+  void UpdateTiles(const std::vector<VoxelIndex>& before,
+                   const std::vector<VoxelIndex>& after);
+  PointCloud::Ptr BuildLevel(const Tile& tile, unsigned int level) const;
+
+  TiledMapParams params_;
+  // Tile edge length in voxels
+  int tile_voxels_;
+  uint32_t revision_counter_;
+  VoxelHashMap map_;
+  std::unordered_map<TileIndex, Tile, TileIndexHash> tiles_;
+};
+
+} // namespace lamp_utils
+#endif
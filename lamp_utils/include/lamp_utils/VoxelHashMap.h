@@ -0,0 +1,133 @@
+/*
+VoxelHashMap.h
+Persistent world map that hashes points into voxels and keeps, for every
+stored point, a reference to the keyed scan it came from. Points of a single
+scan can be moved when its pose changes without rebuilding the whole map.
+*/
+
+#ifndef VOXEL_HASH_MAP_H_
+#define VOXEL_HASH_MAP_H_
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/inference/Key.h>
+
+#include <lamp_utils/PointCloudTypes.h>
+
+namespace lamp_utils {
+
+struct VoxelHashMapParams {
+  // Edge length of the storage voxels
+  double voxel_size = 0.1;
+  // Points kept per voxel from each scan, and read out per voxel. The points
+  // of every scan are kept, so that the points of other scans show again
+  // when a scan leaves the voxel.
+  size_t max_points_per_voxel = 4;
+};
+
+struct VoxelIndex {
+  int x, y, z;
+  bool operator==(const VoxelIndex& other) const {
+    return x == other.x && y == other.y && z == other.z;
+  }
+};
+
+struct VoxelIndexHash {
+  size_t operator()(const VoxelIndex& v) const {
+    return (size_t(v.x) * 73856093) ^ (size_t(v.y) * 19349669) ^
+        (size_t(v.z) * 83492791);
+  }
+};
+
+class VoxelHashMap {
+public:
+  typedef std::shared_ptr<VoxelHashMap> Ptr;
+
+  explicit VoxelHashMap(
+      const VoxelHashMapParams& params = VoxelHashMapParams());
+
+  // Inserts the body-frame scan of a key at the given pose. A scan that is
+  // already stored for the key is replaced.
+  void InsertScan(gtsam::Key key,
+                  const PointCloud::ConstPtr& scan,
+                  const gtsam::Pose3& pose);
+
+  // Moves the points of a key to a new pose. Returns false if no scan is
+  // stored for the key.
+  bool UpdatePose(gtsam::Key key, const gtsam::Pose3& pose);
+
+  // Removes all points of a key. Returns false if no scan is stored for it.
+  bool RemoveScan(gtsam::Key key);
+
+  // Returns the world-frame map. With a resolution coarser than the voxel
+  // size, the points in each cell are averaged into a single point.
+  void GetMap(PointCloud* points, double resolution = 0.0) const;
+
+  // Appends the world-frame points read out from a voxel
+  void GetVoxelPoints(const VoxelIndex& voxel, PointCloud* points) const;
+
+  // Voxels holding points of a key, empty if no scan is stored for it
+  void GetScanVoxels(gtsam::Key key, std::vector<VoxelIndex>* voxels) const;
+
+  // Keys with a stored scan
+  void GetScanKeys(std::vector<gtsam::Key>* keys) const;
+
+  // True if the scan of the key is stored at exactly this pose
+  bool IsAtPose(gtsam::Key key, const gtsam::Pose3& pose) const;
+
+  VoxelIndex ToVoxelIndex(const Eigen::Vector3f& p, double size) const;
+
+  inline bool HasScan(gtsam::Key key) const {
+    return scans_.find(key) != scans_.end();
+  }
+  inline bool HasVoxel(const VoxelIndex& voxel) const {
+    return voxels_.find(voxel) != voxels_.end();
+  }
+  inline double GetVoxelSize() const { return params_.voxel_size; }
+  inline size_t NumScans() const { return scans_.size(); }
+  inline size_t NumVoxels() const { return voxels_.size(); }
+  // Points of the full resolution map
+  size_t NumPoints() const;
+  // Point references stored over all voxels
+  size_t NumRefs() const;
+
+  void Clear();
+
+private:
+  // Compact reference to a point of a keyed scan
+  struct PointRef {
+    gtsam::Key key;
+    uint32_t index;
+  };
+
+  struct ScanEntry {
+    PointCloud::ConstPtr scan;
+    // Body to world transform of the scan
+    Eigen::Matrix3f rotation;
+    Eigen::Vector3f translation;
+    // Voxels holding at least one point of this scan
+    std::vector<VoxelIndex> voxels;
+  };
+
+  void SetPose(ScanEntry& entry, const gtsam::Pose3& pose) const;
+  void AddPoints(gtsam::Key key, ScanEntry& entry);
+  void RemovePoints(gtsam::Key key, ScanEntry& entry);
+  Point ToWorld(const ScanEntry& entry, uint32_t index) const;
+  // References of a voxel that are read out
+  size_t NumReadout(const std::vector<PointRef>& refs) const;
+
+  VoxelHashMapParams params_;
+
+  std::unordered_map<VoxelIndex, std::vector<PointRef>, VoxelIndexHash>
+      voxels_;
+  std::unordered_map<gtsam::Key, ScanEntry> scans_;
+};
+
+} // namespace lamp_utils
+#endif
@@ -129,6 +129,7 @@ public:
       mahalanobis_(0),
       max_inner_iterations_(20) {
     min_number_correspondences_ = 4;
+    use_float_kernel_ = true;
     reg_name_ = "MultithreadedGeneralizedIterativeClosestPoint";
     max_iterations_ = 200;
     transformation_epsilon_ = 5e-4;
@@ -185,7 +186,26 @@ public:
       input[i].data[3] = 1.0;
 
     pcl::IterativeClosestPoint<PointSource, PointTarget>::setInputSource(cloud);
-    input_covariances_.reset();
+    releaseCovariances(input_covariances_);
+  }
+
+  /** \brief Same as setInputSource, but keeps the source covariances and
+   * search tree when the cloud is the source already set, so that one source
+   * can be aligned against several targets. The cloud must not be changed in
+   * place while cached, call invalidateSource() after such a change.
+   * \param cloud the const boost shared pointer to a PointCloud message
+   */
+  inline void setInputSourceCached(const PointCloudSourceConstPtr& cloud) {
+    if (cloud == input_ && input_covariances_ && !input_covariances_->empty())
+      return;
+    setInputSource(cloud);
+  }
+
+  /** \brief Drops the covariances of the input source, so that the next
+   * setInputSourceCached call recomputes them
+   */
+  inline void invalidateSource() {
+    releaseCovariances(input_covariances_);
   }
 
   /** \brief Provide a pointer to the covariances of the input source (if
@@ -205,7 +225,7 @@ public:
   inline void setInputTarget(const PointCloudTargetConstPtr& target) {
     pcl::IterativeClosestPoint<PointSource, PointTarget>::setInputTarget(
         target);
-    target_covariances_.reset();
+    releaseCovariances(target_covariances_);
   }
 
   /** \brief Provide a pointer to the covariances of the input target (if
@@ -293,6 +313,33 @@ public:
     return (max_inner_iterations_);
   }
 
+  /** \brief Nearest target point of every source point at the final
+   * transformation, -1 where the search failed. The match is kept even when
+   * it lies beyond the maximum correspondence distance.
+   */
+  inline const std::vector<int>& getFinalCorrespondences() const {
+    return (final_correspondences_);
+  }
+
+  /** \brief Squared distances of the final correspondences, in the same order
+   * as getFinalCorrespondences().
+   */
+  inline const std::vector<float>& getFinalCorrespondenceDistances() const {
+    return (final_correspondence_distances_);
+  }
+
+  /** \brief Evaluate the cost and gradient of the BFGS optimization with the
+   * single precision structure-of-arrays kernel (default) or with the double
+   * precision per-point loop.
+   */
+  void setUseFloatKernel(bool use) {
+    use_float_kernel_ = use;
+  }
+
+  bool getUseFloatKernel() const {
+    return (use_float_kernel_);
+  }
+
   void RecomputeTargetCovariance(bool recalculate) {
     recompute_target_cov_ = recalculate;
   }
@@ -341,9 +388,49 @@ protected:
   /** \brief Mahalanobis matrices holder. */
   std::vector<Eigen::Matrix3d> mahalanobis_;
 
+  /** \brief Correspondence buffers of computeTransformation, kept across
+   * iterations and alignments. */
+  std::vector<int> source_indices_;
+  std::vector<int> target_indices_;
+
+  /** \brief Nearest neighbours of the source points at the final transform. */
+  std::vector<int> final_correspondences_;
+  std::vector<float> final_correspondence_distances_;
+
+  /** \brief Empties covariances owned by this instance, keeping their
+   * capacity for the next cloud, and drops covariances shared with the
+   * caller.
+   */
+  inline void releaseCovariances(MatricesVectorPtr& covariances) {
+    if (covariances && covariances.use_count() == 1) {
+      covariances->clear();
+    } else {
+      covariances.reset();
+    }
+  }
+
   /** \brief maximum number of optimizations */
   int max_inner_iterations_;
 
+  /** \brief Whether the BFGS functor uses the float kernel. */
+  bool use_float_kernel_;
+
+  /** \brief Correspondences of the current optimization for the float kernel,
+   * reused across iterations. */
+  GicpCorrespondencesSoA correspondences_soa_;
+
+  /** \brief Inverse of the base transformation, maps the transformation being
+   * optimized to the base frame of the packed source points. */
+  Eigen::Matrix4f base_transformation_inverse_;
+
+  /** \brief Packs the correspondences and mahalanobis matrices of the current
+   * optimization into correspondences_soa_.
+   */
+  void packCorrespondences(const PointCloudSource& cloud_src,
+                           const std::vector<int>& indices_src,
+                           const PointCloudTarget& cloud_tgt,
+                           const std::vector<int>& indices_tgt);
+
   /** \brief compute points covariances matrices according to the K nearest
    * neighbors. K is set via setCorrespondenceRandomness() methode.
    * \param cloud pointer to point cloud
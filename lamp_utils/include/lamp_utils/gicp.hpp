@@ -43,6 +43,7 @@
 #include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <limits>
 #include <omp.h>
 #include <pcl/features/feature.h>
 #include <pcl/registration/boost.h>
@@ -245,6 +246,9 @@ void pcl::MultithreadedGeneralizedIterativeClosestPoint<PointSource,
   tmp_tgt_ = &cloud_tgt;
   tmp_idx_src_ = &indices_src;
   tmp_idx_tgt_ = &indices_tgt;
+  if (use_float_kernel_) {
+    packCorrespondences(cloud_src, indices_src, cloud_tgt, indices_tgt);
+  }
 
   // Optimize using forward-difference approximation LM
   const double gradient_tol = 1e-2;
@@ -286,6 +290,41 @@ void pcl::MultithreadedGeneralizedIterativeClosestPoint<PointSource,
   }
 }
 
+////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointSource, typename PointTarget>
+void pcl::MultithreadedGeneralizedIterativeClosestPoint<PointSource,
+                                                        PointTarget>::
+    packCorrespondences(const PointCloudSource& cloud_src,
+                        const std::vector<int>& indices_src,
+                        const PointCloudTarget& cloud_tgt,
+                        const std::vector<int>& indices_tgt) {
+  base_transformation_inverse_ = base_transformation_.inverse();
+  const Eigen::Matrix3f R = base_transformation_.topLeftCorner<3, 3>();
+  const Eigen::Vector3f t = base_transformation_.topRightCorner<3, 1>();
+
+  GicpCorrespondencesSoA& c = correspondences_soa_;
+  const int m = static_cast<int>(indices_src.size());
+  c.resize(m);
+  for (int i = 0; i < m; ++i) {
+    const Eigen::Vector3f p =
+        R * cloud_src.points[indices_src[i]].getVector3fMap() + t;
+    const auto& q = cloud_tgt.points[indices_tgt[i]];
+    const Eigen::Matrix3d& M = mahalanobis(indices_src[i]);
+    c.sx[i] = p[0];
+    c.sy[i] = p[1];
+    c.sz[i] = p[2];
+    c.tx[i] = q.x;
+    c.ty[i] = q.y;
+    c.tz[i] = q.z;
+    c.m00[i] = M(0, 0);
+    c.m01[i] = 0.5 * (M(0, 1) + M(1, 0));
+    c.m02[i] = 0.5 * (M(0, 2) + M(2, 0));
+    c.m11[i] = M(1, 1);
+    c.m12[i] = 0.5 * (M(1, 2) + M(2, 1));
+    c.m22[i] = M(2, 2);
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////
 template <typename PointSource, typename PointTarget>
 inline double
@@ -295,6 +334,15 @@ pcl::MultithreadedGeneralizedIterativeClosestPoint<PointSource, PointTarget>::
   gicp_->applyState(transformation_matrix, x);
   double f = 0;
   int m = static_cast<int>(gicp_->tmp_idx_src_->size());
+  if (gicp_->use_float_kernel_) {
+    EvaluateGicpKernel<false>(
+        gicp_->correspondences_soa_,
+        transformation_matrix * gicp_->base_transformation_inverse_,
+        &f,
+        nullptr,
+        nullptr);
+    return f / m;
+  }
   for (int i = 0; i < m; ++i) {
     // The last coordinate, p_src[3] is guaranteed to be set to 1.0 in
     // registration.hpp
@@ -328,6 +376,20 @@ pcl::MultithreadedGeneralizedIterativeClosestPoint<PointSource, PointTarget>::
   // Eigen::Vector3d g_t = g.head<3> ();
   Eigen::Matrix3d R = Eigen::Matrix3d::Zero();
   int m = static_cast<int>(gicp_->tmp_idx_src_->size());
+  if (gicp_->use_float_kernel_) {
+    double f;
+    Eigen::Vector3d g_t;
+    EvaluateGicpKernel<true>(
+        gicp_->correspondences_soa_,
+        transformation_matrix * gicp_->base_transformation_inverse_,
+        &f,
+        &g_t,
+        &R);
+    g.head<3>() = g_t * (2.0 / m);
+    R *= 2.0 / m;
+    gicp_->computeRDerivative(x, R, g);
+    return;
+  }
   for (int i = 0; i < m; ++i) {
     // The last coordinate, p_src[3] is guaranteed to be set to 1.0 in
     // registration.hpp
@@ -370,6 +432,20 @@ pcl::MultithreadedGeneralizedIterativeClosestPoint<PointSource, PointTarget>::
   g.setZero();
   Eigen::Matrix3d R = Eigen::Matrix3d::Zero();
   const int m = static_cast<const int>(gicp_->tmp_idx_src_->size());
+  if (gicp_->use_float_kernel_) {
+    Eigen::Vector3d g_t;
+    EvaluateGicpKernel<true>(
+        gicp_->correspondences_soa_,
+        transformation_matrix * gicp_->base_transformation_inverse_,
+        &f,
+        &g_t,
+        &R);
+    f /= double(m);
+    g.head<3>() = g_t * (2.0 / m);
+    R *= 2.0 / m;
+    gicp_->computeRDerivative(x, R, g);
+    return;
+  }
   for (int i = 0; i < m; ++i) {
     // The last coordinate, p_src[3] is guaranteed to be set to 1.0 in
     // registration.hpp
@@ -420,13 +496,15 @@ pcl::MultithreadedGeneralizedIterativeClosestPoint<PointSource, PointTarget>::
   // Compute target cloud covariance matrices
   auto start_covariances = std::chrono::steady_clock::now();
   if ((!target_covariances_) || (target_covariances_->empty())) {
-    target_covariances_.reset(new MatricesVector);
+    if (!target_covariances_)
+      target_covariances_.reset(new MatricesVector);
     computeCovariances<PointTarget>(
         target_, tree_, *target_covariances_, recompute_target_cov_);
   }
   // Compute input cloud covariance matrices
   if ((!input_covariances_) || (input_covariances_->empty())) {
-    input_covariances_.reset(new MatricesVector);
+    if (!input_covariances_)
+      input_covariances_.reset(new MatricesVector);
     computeCovariances<PointSource>(
         input_, tree_reciprocal_, *input_covariances_, recompute_source_cov);
   }
@@ -442,9 +520,11 @@ pcl::MultithreadedGeneralizedIterativeClosestPoint<PointSource, PointTarget>::
   double delta = 0.;
 
   auto start_iterations = std::chrono::steady_clock::now();
+  std::vector<int>& source_indices = source_indices_;
+  std::vector<int>& target_indices = target_indices_;
   while (!converged_) {
-    std::vector<int> source_indices(indices_->size(), -1);
-    std::vector<int> target_indices(indices_->size(), -1);
+    source_indices.assign(indices_->size(), -1);
+    target_indices.assign(indices_->size(), -1);
 
     // guess corresponds to base_t and transformation_ to t
     Eigen::Matrix4d transform_R = Eigen::Matrix4d::Zero();
@@ -585,6 +665,21 @@ pcl::MultithreadedGeneralizedIterativeClosestPoint<PointSource, PointTarget>::
   // Transform the point cloud
   pcl::transformPointCloud(*input_, output, final_transformation_);
 
+  // The last iteration matched at the transform before its update, so the
+  // correspondences are searched again at the final one
+  final_correspondences_.assign(N, -1);
+  final_correspondence_distances_.assign(N,
+                                         std::numeric_limits<float>::max());
+#pragma omp parallel for schedule(dynamic, 1) if (1 < k_num_threads_)
+  for (size_t i = 0; i < N; i++) {
+    std::vector<int> nn_indices(1);
+    std::vector<float> nn_dists(1);
+    if (searchForNeighbors(output[i], nn_indices, nn_dists)) {
+      final_correspondences_[i] = nn_indices[0];
+      final_correspondence_distances_[i] = nn_dists[0];
+    }
+  }
+
   auto end_gicp = std::chrono::steady_clock::now();
   if (k_enable_timing_output_) {
     double iteration_time =
@@ -1,8 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <omp.h>
 #include <pcl_ros/point_cloud.h>
 #include <vector>
+// The AVX2/FMA kernel is compiled for its own target and picked at run time,
+// so that the package does not need to be built with -mavx2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GICP_AVX2_DISPATCH 1
+#include <immintrin.h>
+#endif
 
 typedef pcl::PointXYZINormal PointF;
 typedef pcl::PointCloud<PointF> PointCloudF;
@@ -59,4 +66,246 @@ void CalculateCovarianceFromNormals(const PointCloudF::ConstPtr& point_cloud,
     cloud_covariances[i] =
         PCLTwoPlaneVectorsFromNormal<T>(point_cloud->points[i]);
   }
-}
\ No newline at end of file
+}
+
+/** \brief Correspondences of one GICP optimization step packed as single
+ * precision structure of arrays, so that the cost and gradient loops run over
+ * contiguous memory and vectorize. Source points are expressed in the base
+ * frame of the optimization, the mahalanobis matrices are symmetric and only
+ * their upper triangle is stored.
+ */
+struct GicpCorrespondencesSoA {
+  std::vector<float> sx, sy, sz;
+  std::vector<float> tx, ty, tz;
+  std::vector<float> m00, m01, m02, m11, m12, m22;
+
+  // Keeps the capacity so that the buffers are reused across iterations
+  void resize(size_t n) {
+    for (auto* v : {&sx, &sy, &sz, &tx, &ty, &tz, &m00, &m01, &m02, &m11,
+                    &m12, &m22}) {
+      v->resize(n);
+    }
+  }
+
+  size_t size() const {
+    return sx.size();
+  }
+};
+
+/** \brief Accumulates the GICP cost (acc[0]), translation gradient
+ * (acc[1..3]) and rotation gradient accumulator R = sum(p * (M * res)^T)
+ * (acc[4..12], row major) over the correspondences [begin, end). A is the row
+ * major 3x4 transform from the base frame to the target frame. The range is
+ * summed in single precision and added to the double accumulators.
+ */
+template <bool kGradient>
+inline void AccumulateGicpScalar(const GicpCorrespondencesSoA& c,
+                                 const float* A,
+                                 size_t begin,
+                                 size_t end,
+                                 double* acc) {
+  float f = 0, g0 = 0, g1 = 0, g2 = 0;
+  float r00 = 0, r01 = 0, r02 = 0, r10 = 0, r11 = 0, r12 = 0, r20 = 0,
+        r21 = 0, r22 = 0;
+
+  // Written to auto-vectorize
+#pragma omp simd reduction(+ : f, g0, g1, g2, r00, r01, r02, r10, r11, r12) \
+    reduction(+ : r20, r21, r22)
+  for (size_t j = begin; j < end; ++j) {
+    const float px = c.sx[j], py = c.sy[j], pz = c.sz[j];
+    const float rx = A[0] * px + A[1] * py + A[2] * pz + A[3] - c.tx[j];
+    const float ry = A[4] * px + A[5] * py + A[6] * pz + A[7] - c.ty[j];
+    const float rz = A[8] * px + A[9] * py + A[10] * pz + A[11] - c.tz[j];
+    const float t0 = c.m00[j] * rx + c.m01[j] * ry + c.m02[j] * rz;
+    const float t1 = c.m01[j] * rx + c.m11[j] * ry + c.m12[j] * rz;
+    const float t2 = c.m02[j] * rx + c.m12[j] * ry + c.m22[j] * rz;
+    f += rx * t0 + ry * t1 + rz * t2;
+    if (kGradient) {
+      g0 += t0;
+      g1 += t1;
+      g2 += t2;
+      r00 += px * t0;
+      r01 += px * t1;
+      r02 += px * t2;
+      r10 += py * t0;
+      r11 += py * t1;
+      r12 += py * t2;
+      r20 += pz * t0;
+      r21 += pz * t1;
+      r22 += pz * t2;
+    }
+  }
+
+  acc[0] += f;
+  if (kGradient) {
+    acc[1] += g0;
+    acc[2] += g1;
+    acc[3] += g2;
+    acc[4] += r00;
+    acc[5] += r01;
+    acc[6] += r02;
+    acc[7] += r10;
+    acc[8] += r11;
+    acc[9] += r12;
+    acc[10] += r20;
+    acc[11] += r21;
+    acc[12] += r22;
+  }
+}
+
+#ifdef GICP_AVX2_DISPATCH
+inline bool GicpCpuHasAvx2() {
+  static const bool has_avx2 = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  }();
+  return has_avx2;
+}
+
+__attribute__((target("avx2,fma"))) inline float
+GicpHorizontalSum(__m256 v) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_hadd_ps(s, s);
+  s = _mm_hadd_ps(s, s);
+  return _mm_cvtss_f32(s);
+}
+
+/** \brief AVX2/FMA version of AccumulateGicpScalar over the largest multiple
+ * of 8 correspondences from begin. Returns the first correspondence left.
+ */
+template <bool kGradient>
+__attribute__((target("avx2,fma"))) size_t
+AccumulateGicpAvx2(const GicpCorrespondencesSoA& c,
+                   const float* A,
+                   size_t begin,
+                   size_t end,
+                   double* acc) {
+  const __m256 a00 = _mm256_set1_ps(A[0]), a01 = _mm256_set1_ps(A[1]),
+               a02 = _mm256_set1_ps(A[2]), a03 = _mm256_set1_ps(A[3]),
+               a10 = _mm256_set1_ps(A[4]), a11 = _mm256_set1_ps(A[5]),
+               a12 = _mm256_set1_ps(A[6]), a13 = _mm256_set1_ps(A[7]),
+               a20 = _mm256_set1_ps(A[8]), a21 = _mm256_set1_ps(A[9]),
+               a22 = _mm256_set1_ps(A[10]), a23 = _mm256_set1_ps(A[11]);
+  __m256 vf = _mm256_setzero_ps();
+  __m256 vg0 = vf, vg1 = vf, vg2 = vf;
+  __m256 vr00 = vf, vr01 = vf, vr02 = vf, vr10 = vf, vr11 = vf, vr12 = vf,
+         vr20 = vf, vr21 = vf, vr22 = vf;
+  size_t i = begin;
+  for (; i + 8 <= end; i += 8) {
+    const __m256 px = _mm256_loadu_ps(&c.sx[i]);
+    const __m256 py = _mm256_loadu_ps(&c.sy[i]);
+    const __m256 pz = _mm256_loadu_ps(&c.sz[i]);
+    // res = A * p - q
+    __m256 rx = _mm256_fmadd_ps(a00, px, a03);
+    rx = _mm256_fmadd_ps(a01, py, rx);
+    rx = _mm256_fmadd_ps(a02, pz, rx);
+    rx = _mm256_sub_ps(rx, _mm256_loadu_ps(&c.tx[i]));
+    __m256 ry = _mm256_fmadd_ps(a10, px, a13);
+    ry = _mm256_fmadd_ps(a11, py, ry);
+    ry = _mm256_fmadd_ps(a12, pz, ry);
+    ry = _mm256_sub_ps(ry, _mm256_loadu_ps(&c.ty[i]));
+    __m256 rz = _mm256_fmadd_ps(a20, px, a23);
+    rz = _mm256_fmadd_ps(a21, py, rz);
+    rz = _mm256_fmadd_ps(a22, pz, rz);
+    rz = _mm256_sub_ps(rz, _mm256_loadu_ps(&c.tz[i]));
+    // temp = M * res
+    const __m256 m00 = _mm256_loadu_ps(&c.m00[i]);
+    const __m256 m01 = _mm256_loadu_ps(&c.m01[i]);
+    const __m256 m02 = _mm256_loadu_ps(&c.m02[i]);
+    const __m256 m11 = _mm256_loadu_ps(&c.m11[i]);
+    const __m256 m12 = _mm256_loadu_ps(&c.m12[i]);
+    const __m256 m22 = _mm256_loadu_ps(&c.m22[i]);
+    const __m256 t0 = _mm256_fmadd_ps(
+        m02, rz, _mm256_fmadd_ps(m01, ry, _mm256_mul_ps(m00, rx)));
+    const __m256 t1 = _mm256_fmadd_ps(
+        m12, rz, _mm256_fmadd_ps(m11, ry, _mm256_mul_ps(m01, rx)));
+    const __m256 t2 = _mm256_fmadd_ps(
+        m22, rz, _mm256_fmadd_ps(m12, ry, _mm256_mul_ps(m02, rx)));
+    vf = _mm256_fmadd_ps(rx, t0, vf);
+    vf = _mm256_fmadd_ps(ry, t1, vf);
+    vf = _mm256_fmadd_ps(rz, t2, vf);
+    if (kGradient) {
+      vg0 = _mm256_add_ps(vg0, t0);
+      vg1 = _mm256_add_ps(vg1, t1);
+      vg2 = _mm256_add_ps(vg2, t2);
+      vr00 = _mm256_fmadd_ps(px, t0, vr00);
+      vr01 = _mm256_fmadd_ps(px, t1, vr01);
+      vr02 = _mm256_fmadd_ps(px, t2, vr02);
+      vr10 = _mm256_fmadd_ps(py, t0, vr10);
+      vr11 = _mm256_fmadd_ps(py, t1, vr11);
+      vr12 = _mm256_fmadd_ps(py, t2, vr12);
+      vr20 = _mm256_fmadd_ps(pz, t0, vr20);
+      vr21 = _mm256_fmadd_ps(pz, t1, vr21);
+      vr22 = _mm256_fmadd_ps(pz, t2, vr22);
+    }
+  }
+
+  acc[0] += GicpHorizontalSum(vf);
+  if (kGradient) {
+    acc[1] += GicpHorizontalSum(vg0);
+    acc[2] += GicpHorizontalSum(vg1);
+    acc[3] += GicpHorizontalSum(vg2);
+    acc[4] += GicpHorizontalSum(vr00);
+    acc[5] += GicpHorizontalSum(vr01);
+    acc[6] += GicpHorizontalSum(vr02);
+    acc[7] += GicpHorizontalSum(vr10);
+    acc[8] += GicpHorizontalSum(vr11);
+    acc[9] += GicpHorizontalSum(vr12);
+    acc[10] += GicpHorizontalSum(vr20);
+    acc[11] += GicpHorizontalSum(vr21);
+    acc[12] += GicpHorizontalSum(vr22);
+  }
+  return i;
+}
+#endif
+
+/** \brief Accumulates the correspondences [begin, end) with the AVX2/FMA
+ * kernel when the CPU has it and the scalar kernel for the rest.
+ */
+template <bool kGradient>
+inline void AccumulateGicpRange(const GicpCorrespondencesSoA& c,
+                                const float* A,
+                                size_t begin,
+                                size_t end,
+                                double* acc) {
+  size_t i = begin;
+#ifdef GICP_AVX2_DISPATCH
+  if (GicpCpuHasAvx2())
+    i = AccumulateGicpAvx2<kGradient>(c, A, begin, end, acc);
+#endif
+  AccumulateGicpScalar<kGradient>(c, A, i, end, acc);
+}
+
+/** \brief Evaluates the (unnormalized) GICP cost and, if requested, the
+ * translation gradient sum(M * res) and rotation accumulator
+ * sum(p * (M * res)^T) for the transform T from the base frame to the target.
+ */
+template <bool kGradient>
+inline void EvaluateGicpKernel(const GicpCorrespondencesSoA& c,
+                               const Eigen::Matrix4f& T,
+                               double* f,
+                               Eigen::Vector3d* g,
+                               Eigen::Matrix3d* R) {
+  float A[12];
+  for (int r = 0; r < 3; ++r) {
+    for (int col = 0; col < 4; ++col) {
+      A[4 * r + col] = T(r, col);
+    }
+  }
+
+  // Blocks bound the single precision round-off of the partial sums
+  const size_t block_size = 1024;
+  double acc[13] = {0};
+  const size_t n = c.size();
+  for (size_t begin = 0; begin < n; begin += block_size) {
+    AccumulateGicpRange<kGradient>(
+        c, A, begin, std::min(n, begin + block_size), acc);
+  }
+
+  *f = acc[0];
+  if (kGradient) {
+    *g << acc[1], acc[2], acc[3];
+    *R << acc[4], acc[5], acc[6], acc[7], acc[8], acc[9], acc[10], acc[11],
+        acc[12];
+  }
+}
@@ -0,0 +1,382 @@
+/*
+KeyedScanCodec.cc
+Keyed scan compression with quantization and adaptive range coding
+*/
+#include "lamp_utils/KeyedScanCodec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <pcl/common/io.h>
+#include <pcl/common/point_tests.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+namespace lamp_utils {
+
+namespace {
+
+// Binary adaptive range coder, as in LZMA
+const int kProbabilityBits = 11;
+const uint32_t kProbabilityInit = 1u << (kProbabilityBits - 1);
+const int kAdaptationShift = 5;
+const uint32_t kTopValue = 1u << 24;
+
+class RangeEncoder {
+public:
+  explicit RangeEncoder(std::vector<uint8_t>* out) : out_(out) {}
+
+  void EncodeBit(uint16_t* probability, uint32_t bit) {
+    uint32_t bound = (range_ >> kProbabilityBits) * *probability;
+    if (bit == 0) {
+      range_ = bound;
+      *probability +=
+          ((1u << kProbabilityBits) - *probability) >> kAdaptationShift;
+    } else {
+      low_ += bound;
+      range_ -= bound;
+      *probability -= *probability >> kAdaptationShift;
+    }
+    Normalize();
+  }
+
+  // Bits with an even probability, most significant first
+  void EncodeDirectBits(uint32_t value, int num_bits) {
+    while (num_bits > 0) {
+      num_bits--;
+      range_ >>= 1;
+      if ((value >> num_bits) & 1)
+        low_ += range_;
+      Normalize();
+    }
+  }
+
+  void Flush() {
+    for (int i = 0; i < 5; ++i) {
+      ShiftLow();
+    }
+  }
+
+private:
+  void Normalize() {
+    while (range_ < kTopValue) {
+      range_ <<= 8;
+      ShiftLow();
+    }
+  }
+
+  void ShiftLow() {
+    if (static_cast<uint32_t>(low_) < 0xFF000000u || (low_ >> 32) != 0) {
+      uint8_t carry = static_cast<uint8_t>(low_ >> 32);
+      uint8_t byte = cache_;
+      do {
+        out_->push_back(static_cast<uint8_t>(byte + carry));
+        byte = 0xFF;
+      } while (--cache_size_ != 0);
+      cache_ = static_cast<uint8_t>(low_ >> 24);
+    }
+    cache_size_++;
+    low_ = (low_ & 0x00FFFFFFu) << 8;
+  }
+
+  std::vector<uint8_t>* out_;
+  uint64_t low_ = 0;
+  uint32_t range_ = 0xFFFFFFFFu;
+  uint8_t cache_ = 0;
+  uint64_t cache_size_ = 1;
+};
+
+class RangeDecoder {
+public:
+  RangeDecoder(const uint8_t* data, size_t size)
+    : data_(data), size_(size) {
+    for (int i = 0; i < 5; ++i) {
+      code_ = (code_ << 8) | NextByte();
+    }
+  }
+
+  uint32_t DecodeBit(uint16_t* probability) {
+    uint32_t bound = (range_ >> kProbabilityBits) * *probability;
+    uint32_t bit;
+    if (code_ < bound) {
+      range_ = bound;
+      *probability +=
+          ((1u << kProbabilityBits) - *probability) >> kAdaptationShift;
+      bit = 0;
+    } else {
+      code_ -= bound;
+      range_ -= bound;
+      *probability -= *probability >> kAdaptationShift;
+      bit = 1;
+    }
+    Normalize();
+    return bit;
+  }
+
+  uint32_t DecodeDirectBits(int num_bits) {
+    uint32_t value = 0;
+    while (num_bits > 0) {
+      num_bits--;
+      range_ >>= 1;
+      uint32_t bit = code_ >= range_ ? 1 : 0;
+      if (bit)
+        code_ -= range_;
+      value = (value << 1) | bit;
+      Normalize();
+    }
+    return value;
+  }
+
+  // True if the decoder read past the end of the data
+  bool Overrun() const {
+    return overrun_;
+  }
+
+private:
+  void Normalize() {
+    while (range_ < kTopValue) {
+      range_ <<= 8;
+      code_ = (code_ << 8) | NextByte();
+    }
+  }
+
+  uint8_t NextByte() {
+    if (position_ < size_)
+      return data_[position_++];
+    overrun_ = true;
+    return 0;
+  }
+
+  const uint8_t* data_;
+  size_t size_;
+  size_t position_ = 0;
+  uint32_t code_ = 0;
+  uint32_t range_ = 0xFFFFFFFFu;
+  bool overrun_ = false;
+};
+
+// Adaptive model of unsigned integers: the bit length is coded with a bit
+// tree, the bits below the leading one are sent as they are
+class UIntModel {
+public:
+  UIntModel() {
+    std::fill(std::begin(length_), std::end(length_), kProbabilityInit);
+  }
+
+  void Encode(RangeEncoder* encoder, uint32_t value) {
+    int length = 0;
+    while (length < 32 && (value >> length) != 0) {
+      length++;
+    }
+    uint32_t node = 1;
+    for (int i = 5; i >= 0; --i) {
+      uint32_t bit = (length >> i) & 1;
+      encoder->EncodeBit(&length_[node], bit);
+      node = (node << 1) | bit;
+    }
+    if (length > 1)
+      encoder->EncodeDirectBits(value, length - 1);
+  }
+
+  uint32_t Decode(RangeDecoder* decoder) {
+    uint32_t node = 1;
+    for (int i = 5; i >= 0; --i) {
+      node = (node << 1) | decoder->DecodeBit(&length_[node]);
+    }
+    int length = std::min<int>(node - 64, 32);
+    if (length <= 1)
+      return length;
+    return (1u << (length - 1)) | decoder->DecodeDirectBits(length - 1);
+  }
+
+private:
+  uint16_t length_[64];
+};
+
+inline uint32_t ZigZag(int32_t value) {
+  return (static_cast<uint32_t>(value) << 1) ^
+      static_cast<uint32_t>(value >> 31);
+}
+
+inline int32_t UnZigZag(uint32_t value) {
+  return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+inline int32_t Quantize(double value, double step) {
+  double q = std::round(value / step);
+  q = std::max<double>(q, std::numeric_limits<int32_t>::min());
+  q = std::min<double>(q, std::numeric_limits<int32_t>::max());
+  return static_cast<int32_t>(q);
+}
+
+inline float SignNotZero(float value) {
+  return value < 0.0f ? -1.0f : 1.0f;
+}
+
+// Unit normal to the octahedron unfolded on [-1, 1]^2
+void OctahedralEncode(float x, float y, float z, float* u, float* v) {
+  float norm = std::abs(x) + std::abs(y) + std::abs(z);
+  *u = x / norm;
+  *v = y / norm;
+  if (z < 0.0f) {
+    float fold_u = (1.0f - std::abs(*v)) * SignNotZero(*u);
+    float fold_v = (1.0f - std::abs(*u)) * SignNotZero(*v);
+    *u = fold_u;
+    *v = fold_v;
+  }
+}
+
+void OctahedralDecode(float u, float v, float* x, float* y, float* z) {
+  *z = 1.0f - std::abs(u) - std::abs(v);
+  if (*z < 0.0f) {
+    float unfold_u = (1.0f - std::abs(v)) * SignNotZero(u);
+    float unfold_v = (1.0f - std::abs(u)) * SignNotZero(v);
+    u = unfold_u;
+    v = unfold_v;
+  }
+  *x = u;
+  *y = v;
+  float norm = std::sqrt(*x * *x + *y * *y + *z * *z);
+  *x /= norm;
+  *y /= norm;
+  *z /= norm;
+}
+
+// Models of the point fields
+struct ScanModels {
+  UIntModel position[3];
+  UIntModel intensity;
+  uint16_t has_normal = kProbabilityInit;
+  UIntModel normal[2];
+};
+
+} // namespace
+
+bool EncodeKeyedScan(gtsam::Key key,
+                     const PointCloud& scan,
+                     const ScanCodecParams& params,
+                     bool with_normals,
+                     pose_graph_msgs::CompressedKeyedScan* msg) {
+  if (msg == nullptr || params.position_resolution <= 0.0 ||
+      params.intensity_resolution <= 0.0)
+    return false;
+  if (with_normals && (params.normal_bits < 1 || params.normal_bits > 16))
+    return false;
+
+  msg->key = key;
+  msg->position_resolution = params.position_resolution;
+  msg->intensity_resolution = params.intensity_resolution;
+  msg->normal_bits = with_normals ? params.normal_bits : 0;
+  msg->data.clear();
+  // Typically a few bytes per point
+  msg->data.reserve(scan.size() * 6);
+
+  const float normal_max = (1u << msg->normal_bits) - 1;
+  ScanModels models;
+  RangeEncoder encoder(&msg->data);
+  int32_t previous[4] = {0, 0, 0, 0};
+  uint32_t num_points = 0;
+  for (const auto& point : scan) {
+    if (!pcl::isFinite(point))
+      continue;
+    // Scan points are close to their predecessor, send the difference
+    int32_t current[4] = {
+        Quantize(point.x, msg->position_resolution),
+        Quantize(point.y, msg->position_resolution),
+        Quantize(point.z, msg->position_resolution),
+        Quantize(point.intensity, msg->intensity_resolution)};
+    for (int i = 0; i < 3; ++i) {
+      models.position[i].Encode(
+          &encoder, ZigZag(static_cast<int32_t>(
+                        static_cast<uint32_t>(current[i]) -
+                        static_cast<uint32_t>(previous[i]))));
+    }
+    models.intensity.Encode(
+        &encoder, ZigZag(static_cast<int32_t>(
+                      static_cast<uint32_t>(current[3]) -
+                      static_cast<uint32_t>(previous[3]))));
+    std::copy(current, current + 4, previous);
+
+    if (with_normals) {
+      float norm = std::abs(point.normal_x) + std::abs(point.normal_y) +
+          std::abs(point.normal_z);
+      bool has_normal = std::isfinite(norm) && norm > 0.0f;
+      encoder.EncodeBit(&models.has_normal, has_normal);
+      if (has_normal) {
+        float u, v;
+        OctahedralEncode(
+            point.normal_x, point.normal_y, point.normal_z, &u, &v);
+        models.normal[0].Encode(
+            &encoder, std::lround((u + 1.0f) * 0.5f * normal_max));
+        models.normal[1].Encode(
+            &encoder, std::lround((v + 1.0f) * 0.5f * normal_max));
+      }
+    }
+    num_points++;
+  }
+  encoder.Flush();
+  msg->num_points = num_points;
+  return true;
+}
+
+bool DecodeKeyedScan(const pose_graph_msgs::CompressedKeyedScan& msg,
+                     PointCloud* scan) {
+  if (scan == nullptr || msg.normal_bits > 16)
+    return false;
+
+  scan->clear();
+  // The point count is not trusted until the data is decoded
+  scan->reserve(std::min<size_t>(msg.num_points, msg.data.size() * 8));
+  const float normal_max = (1u << msg.normal_bits) - 1;
+  ScanModels models;
+  RangeDecoder decoder(msg.data.data(), msg.data.size());
+  int32_t previous[4] = {0, 0, 0, 0};
+  for (uint32_t n = 0; n < msg.num_points; ++n) {
+    for (int i = 0; i < 3; ++i) {
+      previous[i] = static_cast<int32_t>(
+          static_cast<uint32_t>(previous[i]) +
+          static_cast<uint32_t>(UnZigZag(models.position[i].Decode(&decoder))));
+    }
+    previous[3] = static_cast<int32_t>(
+        static_cast<uint32_t>(previous[3]) +
+        static_cast<uint32_t>(UnZigZag(models.intensity.Decode(&decoder))));
+
+    Point point;
+    point.x = previous[0] * msg.position_resolution;
+    point.y = previous[1] * msg.position_resolution;
+    point.z = previous[2] * msg.position_resolution;
+    point.intensity = previous[3] * msg.intensity_resolution;
+    point.normal_x = point.normal_y = point.normal_z = 0.0f;
+    point.curvature = 0.0f;
+    if (msg.normal_bits > 0 && decoder.DecodeBit(&models.has_normal)) {
+      float u = models.normal[0].Decode(&decoder) / normal_max * 2.0f - 1.0f;
+      float v = models.normal[1].Decode(&decoder) / normal_max * 2.0f - 1.0f;
+      OctahedralDecode(u, v, &point.normal_x, &point.normal_y, &point.normal_z);
+    }
+    if (decoder.Overrun())
+      return false;
+    scan->push_back(point);
+  }
+  return true;
+}
+
+bool DecodeKeyedScan(const pose_graph_msgs::CompressedKeyedScan& msg,
+                     pose_graph_msgs::KeyedScan* keyed_scan) {
+  PointCloud scan;
+  if (keyed_scan == nullptr || !DecodeKeyedScan(msg, &scan))
+    return false;
+  keyed_scan->key = msg.key;
+  if (msg.normal_bits > 0) {
+    pcl::toROSMsg(scan, keyed_scan->scan);
+  } else {
+    // Same fields as the uncompressed scans sent without normals
+    PointXyziCloud xyzi;
+    pcl::copyPointCloud(scan, xyzi);
+    pcl::toROSMsg(xyzi, keyed_scan->scan);
+  }
+  return true;
+}
+
+} // namespace lamp_utils
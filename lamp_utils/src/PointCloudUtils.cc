@@ -5,6 +5,8 @@ Some utility functions for wokring with Point Clouds
 */
 #include "lamp_utils/PointCloudUtils.h"
 
+#include <algorithm>
+
 #include <geometry_utils/Transform3.h>
 #include <pcl/features/fpfh_omp.h>
 #include <pcl/filters/voxel_grid.h>
@@ -162,6 +164,77 @@ void ComputeAp_ForPoint2PlaneICP(const PointCloud::Ptr query_normalized,
   }
 }
 
+void ComputeAp_ForPoint2PlaneICP(const PointCloud::ConstPtr& query,
+                                 const PointCloud::ConstPtr& reference,
+                                 const std::vector<size_t>& correspondences,
+                                 const Eigen::Matrix4f& T,
+                                 const int& num_threads,
+                                 Eigen::Matrix<double, 6, 6>& Ap) {
+  Ap = Eigen::Matrix<double, 6, 6>::Zero();
+  if (query == NULL || reference == NULL || query->empty() ||
+      reference->empty())
+    return;
+
+  // Centroid and scale of the query normalization
+  Eigen::Vector4f centroid_4d;
+  pcl::compute3DCentroid(*query, centroid_4d);
+  const Eigen::Vector3d centroid = centroid_4d.head<3>().cast<double>();
+  const long num_points = static_cast<long>(query->size());
+  double dist = 0;
+#pragma omp parallel for reduction(+ : dist) num_threads(num_threads) if ( \
+    num_threads > 1)
+  for (long i = 0; i < num_points; ++i) {
+    const Point& p = query->points[i];
+    dist += (Eigen::Vector3d(p.x, p.y, p.z) - centroid).norm();
+  }
+  const double factor = query->size() / dist;
+
+  // Normals are only computed if a reference point used by a correspondence
+  // carries no valid normal
+  const size_t n = std::min(query->size(), correspondences.size());
+  bool b_has_normals = true;
+  for (size_t i = 0; i < n && b_has_normals; ++i) {
+    const size_t j = correspondences[i];
+    if (j >= reference->size())
+      continue;
+    const Eigen::Vector3f normal = reference->points[j].getNormalVector3fMap();
+    b_has_normals = normal.allFinite() && !normal.isZero(0);
+  }
+  Normals::Ptr computed_normals;
+  if (!b_has_normals) {
+    NormalComputeParams params;
+    params.num_threads = num_threads;
+    computed_normals.reset(new Normals);
+    ComputeNormals<Point>(reference, params, computed_normals);
+  }
+
+  const Eigen::Matrix3d R = T.block<3, 3>(0, 0).cast<double>();
+  Ap = ReduceInformationMatrix(
+      n, num_threads, [&](size_t i, Eigen::Matrix<double, 6, 6>* local) {
+        const size_t j = correspondences[i];
+        if (j >= reference->size())
+          return;
+        const Point& q = query->points[i];
+        Eigen::Vector3d a_i =
+            factor * (Eigen::Vector3d(q.x, q.y, q.z) - centroid);
+        Eigen::Vector3d n_i;
+        if (computed_normals) {
+          const pcl::Normal& normal = computed_normals->points[j];
+          n_i << normal.normal_x, normal.normal_y, normal.normal_z;
+        } else {
+          const Point& normal = reference->points[j];
+          n_i << normal.normal_x, normal.normal_y, normal.normal_z;
+        }
+        if (a_i.hasNaN() || n_i.hasNaN())
+          return;
+
+        Eigen::Matrix<double, 6, 1> h;
+        h.head<3>() = a_i.cross(R * n_i);
+        h.tail<3>() = R * n_i;
+        local->selfadjointView<Eigen::Upper>().rankUpdate(h);
+      });
+}
+
 void ComputeIcpObservability(PointCloud::ConstPtr cloud,
                              Eigen::Matrix<double, 3, 1>* eigenvalues,
                              const NormalComputeParams& params) {
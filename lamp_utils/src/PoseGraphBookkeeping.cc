@@ -71,8 +71,7 @@ bool PoseGraph::TrackFactor(const EdgeMessage& msg) {
   }
 
   if (success) {
-    edges_.insert(msg);
-    edges_new_.insert(msg);
+    InsertEdgeMsg(edges_, edges_new_, msg);
   }
   return success;
 }
@@ -104,8 +103,7 @@ bool PoseGraph::TrackFactor(const gtsam::Symbol& key_from,
                                        << " already exists.");
       return false;
     }
-    edges_.insert(msg);
-    edges_new_.insert(msg);
+    InsertEdgeMsg(edges_, edges_new_, msg);
   }
 
   if (type == pose_graph_msgs::PoseGraphEdge::ODOM) {
@@ -179,8 +177,7 @@ bool PoseGraph::TrackUWBFactor(const gtsam::Symbol& key_from,
     }
     msg.range = range;
     msg.range_error = range_error;
-    edges_.insert(msg);
-    edges_new_.insert(msg);
+    InsertEdgeMsg(edges_, edges_new_, msg);
   }
 
   nfg_.add(gtsam::RangeFactor<gtsam::Pose3, gtsam::Pose3>(
@@ -217,8 +214,7 @@ bool PoseGraph::TrackIMUFactor(const gtsam::Symbol& key_to,
     }
     msg.pose.position = meas;
     // msg.covariance[0] =
-    edges_.insert(msg);
-    edges_new_.insert(msg);
+    InsertEdgeMsg(edges_, edges_new_, msg);
   }
 
   nfg_.add(factor);
@@ -275,6 +271,7 @@ bool PoseGraph::TrackArtifactFactor(const gtsam::Symbol& key_from,
       ROS_DEBUG_STREAM(
           "TrackArtifactFactor: Found and Removing Loop CLosure Edge (Hack)");
       edges_.erase(loopclose_msg_found);
+      full_msg_.reset();
     }
 
     if (!diff_position && !diff_covariance) {
@@ -286,11 +283,13 @@ bool PoseGraph::TrackArtifactFactor(const gtsam::Symbol& key_from,
 
     // Remove existing artifact edge message in edge_
     edges_.erase(msg_found);
+    full_msg_.reset();
 
     // Remove existing artifact edge message in edges_new
     auto new_msg_found = edges_new_.find(msg);
     if (new_msg_found != edges_new_.end()) {
       edges_new_.erase(new_msg_found);
+      incremental_msg_.reset();
     }
 
     // Remove edge factor
@@ -313,8 +312,7 @@ bool PoseGraph::TrackArtifactFactor(const gtsam::Symbol& key_from,
   }
 
   if (create_msg) {
-    edges_.insert(msg);
-    edges_new_.insert(msg);
+    InsertEdgeMsg(edges_, edges_new_, msg);
   }
 
   // Add the updated edge factor
@@ -324,6 +322,43 @@ bool PoseGraph::TrackArtifactFactor(const gtsam::Symbol& key_from,
   return true;
 }
 
+namespace {
+
+// Appends an edge or node to a cached message. Messages that a caller still
+// holds are immutable, so the cache is dropped and rebuilt on demand instead.
+template <typename MessageT>
+void AppendToCachedMsg(pose_graph_msgs::PoseGraphPtr& cache,
+                       std::vector<MessageT> pose_graph_msgs::PoseGraph::*field,
+                       const MessageT& msg) {
+  if (!cache)
+    return;
+  if (cache.use_count() > 1) {
+    cache.reset();
+    return;
+  }
+  ((*cache).*field).push_back(msg);
+}
+
+} // namespace
+
+void PoseGraph::InsertEdgeMsg(EdgeSet& all,
+                              EdgeSet& fresh,
+                              const EdgeMessage& msg) {
+  if (all.insert(msg).second)
+    AppendToCachedMsg(full_msg_, &pose_graph_msgs::PoseGraph::edges, msg);
+  if (fresh.insert(msg).second)
+    AppendToCachedMsg(
+        incremental_msg_, &pose_graph_msgs::PoseGraph::edges, msg);
+}
+
+void PoseGraph::InsertNodeMsg(const NodeMessage& msg) {
+  if (nodes_.insert(msg).second)
+    AppendToCachedMsg(full_msg_, &pose_graph_msgs::PoseGraph::nodes, msg);
+  if (nodes_new_.insert(msg).second)
+    AppendToCachedMsg(
+        incremental_msg_, &pose_graph_msgs::PoseGraph::nodes, msg);
+}
+
 bool PoseGraph::TrackNode(const Node& node) {
   return TrackNode(node.stamp, node.key, node.pose, node.covariance);
 }
@@ -342,11 +377,11 @@ bool PoseGraph::TrackNode(const NodeMessage& msg) {
     NodeMessage m = msg;
     if (m.ID.empty() && !symbol_id_map.empty())
       m.ID = symbol_id_map(msg.key);
-    nodes_.insert(m);
-    nodes_new_.insert(m);
+    InsertNodeMsg(m);
   } else {
     nodes_.erase(msg_found);
     nodes_.insert(msg);
+    full_msg_.reset();
   }
   return true;
 }
@@ -381,12 +416,11 @@ bool PoseGraph::TrackNode(const ros::Time& stamp,
     // make copy to modify ID
     auto msg_found = nodes_.find(msg);
     if (msg_found == nodes_.end()) {
-      NodeMessage m = msg;
-      nodes_.insert(m);
-      nodes_new_.insert(m);
+      InsertNodeMsg(msg);
     } else {
       nodes_.erase(msg_found);
       nodes_.insert(msg);
+      full_msg_.reset();
     }
   }
 
@@ -419,8 +453,7 @@ bool PoseGraph::TrackPrior(const EdgeMessage& msg) {
   if (!TrackPrior(gtsam::Symbol(msg.key_from), delta, noise, false))
     return false;
 
-  priors_new_.insert(msg);
-  priors_.insert(msg);
+  InsertEdgeMsg(priors_, priors_new_, msg);
   return true;
 }
 
@@ -446,8 +479,7 @@ bool PoseGraph::TrackPrior(const gtsam::Symbol& key,
                                        << " already exists.");
       return false;
     }
-    priors_new_.insert(msg);
-    priors_.insert(msg);
+    InsertEdgeMsg(priors_, priors_new_, msg);
   }
   ROS_DEBUG_STREAM("Adding prior factor for key "
                    << gtsam::DefaultKeyFormatter(key));
@@ -512,6 +544,7 @@ void PoseGraph::UpdateLoopClosures(const GraphMsgPtr& msg) {
 
   edges_ = new_edges;
   nfg_ = new_nfg;
+  full_msg_.reset();
 }
 
 void PoseGraph::RemoveEdgesWithPrefix(unsigned char prefix){
@@ -541,6 +574,7 @@ void PoseGraph::RemoveEdgesWithPrefix(unsigned char prefix){
     p++;
   }
   priors_ = new_priors;
+  full_msg_.reset();
 
   ROS_DEBUG("Removing edges gtsam");
   // Remove edge factors
@@ -575,6 +609,7 @@ void PoseGraph::RemoveValuesWithPrefix(unsigned char prefix){
   }
 
   nodes_ = new_nodes;
+  full_msg_.reset();
 
   ROS_DEBUG("Removing values gtsam");
   // Remove gtsam values
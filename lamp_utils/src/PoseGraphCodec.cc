@@ -0,0 +1,473 @@
+/*
+PoseGraphCodec.cc
+Compact binary encoding of pose graph messages
+*/
+#include "lamp_utils/PoseGraphCodec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lamp_utils {
+
+namespace {
+
+const uint8_t kVersion = 1;
+
+// Item flags
+const uint8_t kZeroCovariance = 1 << 0;
+const uint8_t kSameCovariance = 1 << 1;
+const uint8_t kInvalidRotation = 1 << 2;
+// Node only
+const uint8_t kOtherFrame = 1 << 3;
+const uint8_t kHasId = 1 << 6;
+// Edge only
+const uint8_t kHasRange = 1 << 3;
+// Index of the largest quaternion component in bits 4 and 5
+const int kLargestShift = 4;
+
+const double kQuaternionScale = 65535.0;
+
+inline uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+      static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+class ByteWriter {
+public:
+  explicit ByteWriter(std::vector<uint8_t>* out) : out_(out) {}
+
+  void PutByte(uint8_t value) {
+    out_->push_back(value);
+  }
+
+  void PutVarint(uint64_t value) {
+    while (value >= 0x80) {
+      out_->push_back(static_cast<uint8_t>(value | 0x80));
+      value >>= 7;
+    }
+    out_->push_back(static_cast<uint8_t>(value));
+  }
+
+  void PutSigned(int64_t value) {
+    PutVarint(ZigZag(value));
+  }
+
+  template <typename T>
+  void PutRaw(T value) {
+    uint8_t bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    out_->insert(out_->end(), bytes, bytes + sizeof(T));
+  }
+
+  void PutString(const std::string& value) {
+    PutVarint(value.size());
+    out_->insert(out_->end(), value.begin(), value.end());
+  }
+
+private:
+  std::vector<uint8_t>* out_;
+};
+
+class ByteReader {
+public:
+  explicit ByteReader(const std::vector<uint8_t>& data) : data_(data) {}
+
+  bool GetByte(uint8_t* value) {
+    if (position_ >= data_.size())
+      return false;
+    *value = data_[position_++];
+    return true;
+  }
+
+  bool GetVarint(uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte;
+      if (!GetByte(&byte))
+        return false;
+      *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  bool GetSigned(int64_t* value) {
+    uint64_t zigzag;
+    if (!GetVarint(&zigzag))
+      return false;
+    *value = UnZigZag(zigzag);
+    return true;
+  }
+
+  template <typename T>
+  bool GetRaw(T* value) {
+    if (data_.size() - position_ < sizeof(T))
+      return false;
+    std::memcpy(value, &data_[position_], sizeof(T));
+    position_ += sizeof(T);
+    return true;
+  }
+
+  bool GetString(std::string* value) {
+    uint64_t size;
+    if (!GetVarint(&size) || data_.size() - position_ < size)
+      return false;
+    value->assign(data_.begin() + position_, data_.begin() + position_ + size);
+    position_ += size;
+    return true;
+  }
+
+private:
+  const std::vector<uint8_t>& data_;
+  size_t position_ = 0;
+};
+
+inline int64_t Quantize(double value, double step) {
+  double q = std::round(value / step);
+  q = std::max<double>(q, std::numeric_limits<int64_t>::min());
+  q = std::min<double>(q, std::numeric_limits<int64_t>::max());
+  return static_cast<int64_t>(q);
+}
+
+// Quaternion as its three smallest components, the largest one is recovered
+// from the unit norm. Returns the flags of the rotation.
+uint8_t PutRotation(const geometry_msgs::Quaternion& q, ByteWriter* writer) {
+  double c[4] = {q.x, q.y, q.z, q.w};
+  double norm = std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2] + c[3] * c[3]);
+  if (!(norm > 1e-9))
+    return kInvalidRotation;
+  int largest = 0;
+  for (int i = 1; i < 4; ++i) {
+    if (std::abs(c[i]) > std::abs(c[largest]))
+      largest = i;
+  }
+  // q and -q are the same rotation, keep the largest component positive
+  double sign = c[largest] < 0.0 ? -1.0 : 1.0;
+  for (int i = 0; i < 4; ++i) {
+    if (i == largest)
+      continue;
+    double v = sign * c[i] / norm * M_SQRT2;
+    v = std::min(1.0, std::max(-1.0, v));
+    writer->PutRaw<uint16_t>(
+        static_cast<uint16_t>(std::lround((v + 1.0) * 0.5 * kQuaternionScale)));
+  }
+  return static_cast<uint8_t>(largest << kLargestShift);
+}
+
+bool GetRotation(uint8_t flags,
+                 ByteReader* reader,
+                 geometry_msgs::Quaternion* q) {
+  double c[4] = {0.0, 0.0, 0.0, 0.0};
+  if (!(flags & kInvalidRotation)) {
+    int largest = (flags >> kLargestShift) & 3;
+    double sum = 0.0;
+    for (int i = 0; i < 4; ++i) {
+      if (i == largest)
+        continue;
+      uint16_t u;
+      if (!reader->GetRaw(&u))
+        return false;
+      c[i] = (u / kQuaternionScale * 2.0 - 1.0) / M_SQRT2;
+      sum += c[i] * c[i];
+    }
+    c[largest] = std::sqrt(std::max(0.0, 1.0 - sum));
+  }
+  q->x = c[0];
+  q->y = c[1];
+  q->z = c[2];
+  q->w = c[3];
+  return true;
+}
+
+// Flags of a covariance given the previous one of the same item type
+uint8_t CovarianceFlags(const boost::array<double, 36>& covariance,
+                        const boost::array<double, 36>* previous) {
+  if (std::all_of(covariance.begin(), covariance.end(), [](double v) {
+        return v == 0.0;
+      }))
+    return kZeroCovariance;
+  if (previous && *previous == covariance)
+    return kSameCovariance;
+  return 0;
+}
+
+void PutCovariance(const boost::array<double, 36>& covariance,
+                   ByteWriter* writer) {
+  for (int i = 0; i < 6; ++i) {
+    for (int j = i; j < 6; ++j) {
+      writer->PutRaw<float>(covariance[6 * i + j]);
+    }
+  }
+}
+
+bool GetCovariance(uint8_t flags,
+                   const boost::array<double, 36>* previous,
+                   ByteReader* reader,
+                   boost::array<double, 36>* covariance) {
+  if (flags & kZeroCovariance) {
+    covariance->fill(0.0);
+    return true;
+  }
+  if (flags & kSameCovariance) {
+    if (!previous)
+      return false;
+    *covariance = *previous;
+    return true;
+  }
+  for (int i = 0; i < 6; ++i) {
+    for (int j = i; j < 6; ++j) {
+      float value;
+      if (!reader->GetRaw(&value))
+        return false;
+      (*covariance)[6 * i + j] = value;
+      (*covariance)[6 * j + i] = value;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+bool EncodePoseGraph(const pose_graph_msgs::PoseGraph& graph,
+                     const PoseGraphCodecParams& params,
+                     pose_graph_msgs::CompactPoseGraph* compact) {
+  if (compact == nullptr || params.position_resolution <= 0.0)
+    return false;
+
+  compact->header = graph.header;
+  compact->incremental = graph.incremental;
+  compact->num_nodes = graph.nodes.size();
+  compact->num_edges = graph.edges.size();
+  compact->data.clear();
+  ByteWriter writer(&compact->data);
+  writer.PutByte(kVersion);
+  writer.PutRaw<double>(params.position_resolution);
+
+  // Node IDs and frames that differ from the header, sent once
+  std::vector<std::string> strings;
+  std::unordered_map<std::string, uint64_t> string_index;
+  auto index_of = [&](const std::string& s) {
+    auto it = string_index.find(s);
+    if (it != string_index.end())
+      return it->second;
+    string_index[s] = strings.size();
+    strings.push_back(s);
+    return strings.size() - 1;
+  };
+  for (const auto& node : graph.nodes) {
+    if (!node.ID.empty())
+      index_of(node.ID);
+    if (node.header.frame_id != graph.header.frame_id)
+      index_of(node.header.frame_id);
+  }
+  writer.PutVarint(strings.size());
+  for (const auto& s : strings) {
+    writer.PutString(s);
+  }
+
+  const double resolution = params.position_resolution;
+  uint64_t previous_key = 0;
+  uint64_t previous_stamp = graph.header.stamp.toNSec();
+  int64_t previous_position[3] = {0, 0, 0};
+  const boost::array<double, 36>* previous_covariance = nullptr;
+  for (const auto& node : graph.nodes) {
+    writer.PutSigned(static_cast<int64_t>(node.key - previous_key));
+    previous_key = node.key;
+
+    // Flags go before the rotation, which sets some of them
+    std::vector<uint8_t> rotation;
+    ByteWriter rotation_writer(&rotation);
+    uint8_t flags = PutRotation(node.pose.orientation, &rotation_writer);
+    flags |= CovarianceFlags(node.covariance, previous_covariance);
+    if (node.header.frame_id != graph.header.frame_id)
+      flags |= kOtherFrame;
+    if (!node.ID.empty())
+      flags |= kHasId;
+    writer.PutByte(flags);
+    if (flags & kOtherFrame)
+      writer.PutVarint(string_index.at(node.header.frame_id));
+    if (flags & kHasId)
+      writer.PutVarint(string_index.at(node.ID));
+
+    uint64_t stamp = node.header.stamp.toNSec();
+    writer.PutSigned(static_cast<int64_t>(stamp - previous_stamp));
+    previous_stamp = stamp;
+
+    // Consecutive nodes are close, send the difference
+    int64_t position[3] = {Quantize(node.pose.position.x, resolution),
+                           Quantize(node.pose.position.y, resolution),
+                           Quantize(node.pose.position.z, resolution)};
+    for (int i = 0; i < 3; ++i) {
+      writer.PutSigned(position[i] - previous_position[i]);
+      previous_position[i] = position[i];
+    }
+    compact->data.insert(compact->data.end(), rotation.begin(), rotation.end());
+
+    if (!(flags & (kZeroCovariance | kSameCovariance)))
+      PutCovariance(node.covariance, &writer);
+    previous_covariance = &node.covariance;
+  }
+
+  uint64_t previous_from = 0;
+  previous_covariance = nullptr;
+  for (const auto& edge : graph.edges) {
+    writer.PutSigned(static_cast<int64_t>(edge.key_from - previous_from));
+    writer.PutSigned(static_cast<int64_t>(edge.key_to - edge.key_from));
+    previous_from = edge.key_from;
+    writer.PutSigned(edge.type);
+
+    std::vector<uint8_t> rotation;
+    ByteWriter rotation_writer(&rotation);
+    uint8_t flags = PutRotation(edge.pose.orientation, &rotation_writer);
+    flags |= CovarianceFlags(edge.covariance, previous_covariance);
+    if (edge.range != 0.0 || edge.range_error != 0.0)
+      flags |= kHasRange;
+    writer.PutByte(flags);
+
+    // Edge translations are already relative
+    writer.PutSigned(Quantize(edge.pose.position.x, resolution));
+    writer.PutSigned(Quantize(edge.pose.position.y, resolution));
+    writer.PutSigned(Quantize(edge.pose.position.z, resolution));
+    compact->data.insert(compact->data.end(), rotation.begin(), rotation.end());
+
+    if (!(flags & (kZeroCovariance | kSameCovariance)))
+      PutCovariance(edge.covariance, &writer);
+    previous_covariance = &edge.covariance;
+
+    if (flags & kHasRange) {
+      writer.PutRaw<double>(edge.range);
+      writer.PutRaw<double>(edge.range_error);
+    }
+  }
+  return true;
+}
+
+bool DecodePoseGraph(const pose_graph_msgs::CompactPoseGraph& compact,
+                     pose_graph_msgs::PoseGraph* graph) {
+  if (graph == nullptr)
+    return false;
+
+  ByteReader reader(compact.data);
+  uint8_t version;
+  double resolution;
+  if (!reader.GetByte(&version) || version != kVersion ||
+      !reader.GetRaw(&resolution))
+    return false;
+
+  uint64_t num_strings;
+  if (!reader.GetVarint(&num_strings) || num_strings > compact.data.size())
+    return false;
+  std::vector<std::string> strings(num_strings);
+  for (auto& s : strings) {
+    if (!reader.GetString(&s))
+      return false;
+  }
+  auto get_string = [&](std::string* s) {
+    uint64_t index;
+    if (!reader.GetVarint(&index) || index >= strings.size())
+      return false;
+    *s = strings[index];
+    return true;
+  };
+
+  graph->header = compact.header;
+  graph->incremental = compact.incremental;
+  graph->nodes.clear();
+  graph->edges.clear();
+  // Counts are not trusted until the data is decoded
+  graph->nodes.reserve(std::min<size_t>(compact.num_nodes, compact.data.size()));
+  graph->edges.reserve(std::min<size_t>(compact.num_edges, compact.data.size()));
+
+  uint64_t key = 0;
+  uint64_t stamp = compact.header.stamp.toNSec();
+  int64_t position[3] = {0, 0, 0};
+  for (uint32_t n = 0; n < compact.num_nodes; ++n) {
+    pose_graph_msgs::PoseGraphNode node;
+    int64_t delta;
+    uint8_t flags;
+    if (!reader.GetSigned(&delta) || !reader.GetByte(&flags))
+      return false;
+    key += static_cast<uint64_t>(delta);
+    node.key = key;
+
+    node.header.frame_id = compact.header.frame_id;
+    if ((flags & kOtherFrame) && !get_string(&node.header.frame_id))
+      return false;
+    if ((flags & kHasId) && !get_string(&node.ID))
+      return false;
+
+    if (!reader.GetSigned(&delta))
+      return false;
+    stamp += static_cast<uint64_t>(delta);
+    node.header.stamp.fromNSec(stamp);
+
+    for (int i = 0; i < 3; ++i) {
+      if (!reader.GetSigned(&delta))
+        return false;
+      position[i] += delta;
+    }
+    node.pose.position.x = position[0] * resolution;
+    node.pose.position.y = position[1] * resolution;
+    node.pose.position.z = position[2] * resolution;
+    if (!GetRotation(flags, &reader, &node.pose.orientation))
+      return false;
+
+    const boost::array<double, 36>* previous =
+        graph->nodes.empty() ? nullptr : &graph->nodes.back().covariance;
+    if (!GetCovariance(flags, previous, &reader, &node.covariance))
+      return false;
+    graph->nodes.push_back(node);
+  }
+
+  uint64_t key_from = 0;
+  for (uint32_t n = 0; n < compact.num_edges; ++n) {
+    pose_graph_msgs::PoseGraphEdge edge;
+    int64_t delta, type;
+    uint8_t flags;
+    if (!reader.GetSigned(&delta))
+      return false;
+    key_from += static_cast<uint64_t>(delta);
+    edge.key_from = key_from;
+    if (!reader.GetSigned(&delta) || !reader.GetSigned(&type) ||
+        !reader.GetByte(&flags))
+      return false;
+    edge.key_to = key_from + static_cast<uint64_t>(delta);
+    edge.type = static_cast<int32_t>(type);
+
+    int64_t translation[3];
+    for (int i = 0; i < 3; ++i) {
+      if (!reader.GetSigned(&translation[i]))
+        return false;
+    }
+    edge.pose.position.x = translation[0] * resolution;
+    edge.pose.position.y = translation[1] * resolution;
+    edge.pose.position.z = translation[2] * resolution;
+    if (!GetRotation(flags, &reader, &edge.pose.orientation))
+      return false;
+
+    const boost::array<double, 36>* previous =
+        graph->edges.empty() ? nullptr : &graph->edges.back().covariance;
+    if (!GetCovariance(flags, previous, &reader, &edge.covariance))
+      return false;
+
+    if (flags & kHasRange) {
+      if (!reader.GetRaw(&edge.range) || !reader.GetRaw(&edge.range_error))
+        return false;
+    }
+    graph->edges.push_back(edge);
+  }
+  return true;
+}
+
+} // namespace lamp_utils
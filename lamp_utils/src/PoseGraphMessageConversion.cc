@@ -8,19 +8,40 @@
 namespace gu = geometry_utils;
 namespace gr = gu::ros;
 
+namespace {
+
+// Refreshes the header of a cached message before it is handed out. Messages
+// that are still referenced by an earlier caller are left untouched.
+void RefreshHeader(const pose_graph_msgs::PoseGraphPtr& msg,
+                   const std::string& frame_id) {
+  if (msg.use_count() > 1)
+    return;
+  msg->header.frame_id = frame_id;
+  // Set timestamp to now
+  msg->header.stamp = ros::Time::now();
+}
+
+} // namespace
+
 GraphMsgPtr PoseGraph::ToMsg() const {
-  return ToMsg_(edges_, nodes_, priors_);
+  if (!full_msg_)
+    full_msg_ = ToMsg_(edges_, nodes_, priors_);
+  RefreshHeader(full_msg_, fixed_frame_id);
+  return full_msg_;
 }
 
 GraphMsgPtr PoseGraph::ToIncrementalMsg() const {
-  return ToMsg_(edges_new_, nodes_new_, priors_new_);
+  if (!incremental_msg_)
+    incremental_msg_ = ToMsg_(edges_new_, nodes_new_, priors_new_);
+  RefreshHeader(incremental_msg_, fixed_frame_id);
+  return incremental_msg_;
 }
 
-GraphMsgPtr PoseGraph::ToMsg_(const EdgeSet& edges,
-                              const NodeSet& nodes,
-                              const EdgeSet& priors) const {
+pose_graph_msgs::PoseGraphPtr PoseGraph::ToMsg_(const EdgeSet& edges,
+                                                const NodeSet& nodes,
+                                                const EdgeSet& priors) const {
   // Create the Pose Graph Message
-  auto* msg = new pose_graph_msgs::PoseGraph;
+  pose_graph_msgs::PoseGraphPtr msg(new pose_graph_msgs::PoseGraph);
   msg->header.frame_id = fixed_frame_id;
   // Set timestamp to now
   msg->header.stamp = ros::Time::now();
@@ -45,14 +66,18 @@ GraphMsgPtr PoseGraph::ToMsg_(const EdgeSet& edges,
   for (const auto& prior : priors)
     msg->edges.emplace_back(prior);
 
-  return GraphMsgPtr(msg);
+  return msg;
 }
 
 void PoseGraph::UpdateFromMsg(const GraphMsgPtr& msg) {
-  for (const auto& edge : msg->edges) {
+  UpdateFromMsg(*msg);
+}
+
+void PoseGraph::UpdateFromMsg(const pose_graph_msgs::PoseGraph& msg) {
+  for (const auto& edge : msg.edges) {
     TrackFactor(edge);
   }
-  for (const auto& node : msg->nodes) {
+  for (const auto& node : msg.nodes) {
     TrackNode(node);
   }
 }
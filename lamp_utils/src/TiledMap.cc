@@ -0,0 +1,232 @@
+/*
+TiledMap.cc
+Multi-resolution tiled world map
+*/
+#include "lamp_utils/TiledMap.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace lamp_utils {
+
+namespace {
+
+VoxelHashMapParams ToVoxelParams(const TiledMapParams& params) {
+  VoxelHashMapParams voxel_params;
+  voxel_params.voxel_size = params.resolution;
+  voxel_params.max_points_per_voxel = params.max_points_per_voxel;
+  return voxel_params;
+}
+
+// Integer division rounding towards negative infinity
+int FloorDiv(int a, int b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+} // namespace
+
+TiledMap::TiledMap(const TiledMapParams& params)
+  : params_(params),
+    tile_voxels_(std::max(
+        1L, std::lround(params.tile_size / params.resolution))),
+    revision_counter_(0),
+    map_(ToVoxelParams(params)) {
+  if (params_.num_levels == 0)
+    params_.num_levels = 1;
+}
+
+void TiledMap::InsertScan(gtsam::Key key,
+                          const PointCloud::ConstPtr& scan,
+                          const gtsam::Pose3& pose) {
+  std::vector<VoxelIndex> before, after;
+  map_.GetScanVoxels(key, &before);
+  map_.InsertScan(key, scan, pose);
+  map_.GetScanVoxels(key, &after);
+  UpdateTiles(before, after);
+}
+
+bool TiledMap::UpdatePose(gtsam::Key key, const gtsam::Pose3& pose) {
+  if (!map_.HasScan(key))
+    return false;
+  // Unchanged poses leave the tile revisions as they are
+  if (map_.IsAtPose(key, pose))
+    return true;
+  std::vector<VoxelIndex> before, after;
+  map_.GetScanVoxels(key, &before);
+  map_.UpdatePose(key, pose);
+  map_.GetScanVoxels(key, &after);
+  UpdateTiles(before, after);
+  return true;
+}
+
+bool TiledMap::RemoveScan(gtsam::Key key) {
+  std::vector<VoxelIndex> before;
+  map_.GetScanVoxels(key, &before);
+  if (!map_.RemoveScan(key))
+    return false;
+  UpdateTiles(before, std::vector<VoxelIndex>());
+  return true;
+}
+
+void TiledMap::Clear() {
+  map_.Clear();
+  ++revision_counter_;
+  for (auto& t : tiles_) {
+    Tile& tile = t.second;
+    if (tile.voxels.empty())
+      continue;
+    tile.voxels.clear();
+    tile.levels.clear();
+    tile.level_revisions.clear();
+    tile.revision = revision_counter_;
+  }
+}
+
+TileIndex TiledMap::ToTileIndex(const Eigen::Vector3f& p) const {
+  return ToTileIndex(map_.ToVoxelIndex(p, params_.resolution));
+}
+
+TileIndex TiledMap::ToTileIndex(const VoxelIndex& voxel) const {
+  return TileIndex{FloorDiv(voxel.x, tile_voxels_),
+                   FloorDiv(voxel.y, tile_voxels_),
+                   FloorDiv(voxel.z, tile_voxels_)};
+}
+
+void TiledMap::UpdateTiles(const std::vector<VoxelIndex>& before,
+                           const std::vector<VoxelIndex>& after) {
+  // Voxels left by the scan change even when other scans keep them filled
+  std::unordered_set<TileIndex, TileIndexHash> changed;
+  for (const auto& v : before) {
+    const TileIndex t = ToTileIndex(v);
+    changed.insert(t);
+    if (!map_.HasVoxel(v))
+      tiles_[t].voxels.erase(v);
+  }
+  for (const auto& v : after) {
+    const TileIndex t = ToTileIndex(v);
+    changed.insert(t);
+    tiles_[t].voxels.insert(v);
+  }
+
+  // One revision per change, shared by all changed tiles
+  if (!changed.empty())
+    ++revision_counter_;
+  for (const auto& t : changed) {
+    tiles_[t].revision = revision_counter_;
+  }
+}
+
+void TiledMap::GetTilesInRadius(const Eigen::Vector3f& center,
+                                double radius,
+                                std::vector<TileIndex>* tiles) const {
+  tiles->clear();
+  const double size = GetTileSize();
+  const Eigen::Vector3f extent =
+      Eigen::Vector3f::Constant(static_cast<float>(radius));
+  const TileIndex lo = ToTileIndex(Eigen::Vector3f(center - extent));
+  const TileIndex hi = ToTileIndex(Eigen::Vector3f(center + extent));
+  for (int x = lo.x; x <= hi.x; ++x) {
+    for (int y = lo.y; y <= hi.y; ++y) {
+      for (int z = lo.z; z <= hi.z; ++z) {
+        const TileIndex t{x, y, z};
+        auto it = tiles_.find(t);
+        if (it == tiles_.end() || it->second.voxels.empty())
+          continue;
+        // Distance from the center to the closest point of the tile
+        const Eigen::Vector3d c = center.cast<double>();
+        const Eigen::Vector3d lower(x * size, y * size, z * size);
+        const Eigen::Vector3d closest =
+            c.cwiseMax(lower).cwiseMin(lower + Eigen::Vector3d::Constant(size));
+        if ((closest - c).norm() <= radius)
+          tiles->push_back(t);
+      }
+    }
+  }
+}
+
+void TiledMap::GetTileRevisions(
+    std::vector<std::pair<TileIndex, uint32_t>>* revisions) const {
+  revisions->clear();
+  revisions->reserve(tiles_.size());
+  for (const auto& t : tiles_) {
+    revisions->emplace_back(t.first, t.second.revision);
+  }
+}
+
+uint32_t TiledMap::GetRevision(const TileIndex& tile) const {
+  auto it = tiles_.find(tile);
+  if (it == tiles_.end())
+    return 0;
+  return it->second.revision;
+}
+
+bool TiledMap::GetTileCloud(const TileIndex& tile,
+                            unsigned int level,
+                            PointCloud::ConstPtr* points) {
+  auto it = tiles_.find(tile);
+  if (it == tiles_.end() || level >= params_.num_levels)
+    return false;
+
+  Tile& t = it->second;
+  if (t.levels.size() != params_.num_levels) {
+    t.levels.assign(params_.num_levels, nullptr);
+    t.level_revisions.assign(params_.num_levels, 0);
+  }
+  if (t.levels[level] == nullptr || t.level_revisions[level] != t.revision) {
+    t.levels[level] = BuildLevel(t, level);
+    t.level_revisions[level] = t.revision;
+  }
+  *points = t.levels[level];
+  return true;
+}
+
+double TiledMap::GetResolution(unsigned int level) const {
+  return params_.resolution * std::pow(2.0, level);
+}
+
+double TiledMap::GetTileSize() const {
+  return tile_voxels_ * params_.resolution;
+}
+
+PointCloud::Ptr TiledMap::BuildLevel(const Tile& tile,
+                                     unsigned int level) const {
+  // Average the points read out from the voxels into the cells of the level,
+  // the cells of level 0 being the voxels themselves
+  struct Cell {
+    Eigen::Vector3f position = Eigen::Vector3f::Zero();
+    Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+    float intensity = 0;
+    size_t count = 0;
+  };
+  const double resolution = GetResolution(level);
+  std::unordered_map<VoxelIndex, Cell, VoxelIndexHash> cells;
+  PointCloud voxel_points;
+  for (const auto& v : tile.voxels) {
+    voxel_points.clear();
+    map_.GetVoxelPoints(v, &voxel_points);
+    for (const auto& p : voxel_points) {
+      Cell& cell =
+          cells[level == 0 ? v
+                           : map_.ToVoxelIndex(p.getVector3fMap(), resolution)];
+      cell.position += p.getVector3fMap();
+      cell.normal += p.getNormalVector3fMap();
+      cell.intensity += p.intensity;
+      cell.count++;
+    }
+  }
+
+  PointCloud::Ptr cloud(new PointCloud);
+  cloud->reserve(cells.size());
+  for (const auto& c : cells) {
+    const Cell& cell = c.second;
+    Point p;
+    p.getVector3fMap() = cell.position / cell.count;
+    p.getNormalVector3fMap() = cell.normal.stableNormalized();
+    p.intensity = cell.intensity / cell.count;
+    p.curvature = 0;
+    cloud->push_back(p);
+  }
+  return cloud;
+}
+
+} // namespace lamp_utils
@@ -0,0 +1,221 @@
+/*
+VoxelHashMap.cc
+Persistent voxel hashed world map with per-point keyed scan references
+*/
+#include "lamp_utils/VoxelHashMap.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <pcl/common/point_tests.h>
+
+namespace lamp_utils {
+
+VoxelHashMap::VoxelHashMap(const VoxelHashMapParams& params)
+  : params_(params) {
+  if (params_.max_points_per_voxel == 0)
+    params_.max_points_per_voxel = 1;
+}
+
+void VoxelHashMap::InsertScan(gtsam::Key key,
+                              const PointCloud::ConstPtr& scan,
+                              const gtsam::Pose3& pose) {
+  RemoveScan(key);
+  if (scan == nullptr)
+    return;
+  ScanEntry& entry = scans_[key];
+  entry.scan = scan;
+  SetPose(entry, pose);
+  AddPoints(key, entry);
+}
+
+bool VoxelHashMap::UpdatePose(gtsam::Key key, const gtsam::Pose3& pose) {
+  auto it = scans_.find(key);
+  if (it == scans_.end())
+    return false;
+  RemovePoints(key, it->second);
+  SetPose(it->second, pose);
+  AddPoints(key, it->second);
+  return true;
+}
+
+bool VoxelHashMap::RemoveScan(gtsam::Key key) {
+  auto it = scans_.find(key);
+  if (it == scans_.end())
+    return false;
+  RemovePoints(key, it->second);
+  scans_.erase(it);
+  return true;
+}
+
+void VoxelHashMap::GetMap(PointCloud* points, double resolution) const {
+  points->clear();
+  if (resolution <= params_.voxel_size) {
+    points->reserve(NumPoints());
+    for (const auto& voxel : voxels_) {
+      const std::vector<PointRef>& refs = voxel.second;
+      for (size_t i = 0; i < NumReadout(refs); ++i) {
+        points->push_back(ToWorld(scans_.at(refs[i].key), refs[i].index));
+      }
+    }
+    return;
+  }
+
+  // Average the read out points falling into each output cell
+  struct Cell {
+    Eigen::Vector3f position = Eigen::Vector3f::Zero();
+    Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+    float intensity = 0;
+    size_t count = 0;
+  };
+  std::unordered_map<VoxelIndex, Cell, VoxelIndexHash> cells;
+  for (const auto& voxel : voxels_) {
+    const std::vector<PointRef>& refs = voxel.second;
+    for (size_t i = 0; i < NumReadout(refs); ++i) {
+      const Point p = ToWorld(scans_.at(refs[i].key), refs[i].index);
+      Cell& cell = cells[ToVoxelIndex(p.getVector3fMap(), resolution)];
+      cell.position += p.getVector3fMap();
+      cell.normal += p.getNormalVector3fMap();
+      cell.intensity += p.intensity;
+      cell.count++;
+    }
+  }
+
+  points->reserve(cells.size());
+  for (const auto& c : cells) {
+    const Cell& cell = c.second;
+    Point p;
+    p.getVector3fMap() = cell.position / cell.count;
+    p.getNormalVector3fMap() = cell.normal.stableNormalized();
+    p.intensity = cell.intensity / cell.count;
+    p.curvature = 0;
+    points->push_back(p);
+  }
+}
+
+void VoxelHashMap::GetVoxelPoints(const VoxelIndex& voxel,
+                                  PointCloud* points) const {
+  auto it = voxels_.find(voxel);
+  if (it == voxels_.end())
+    return;
+  const std::vector<PointRef>& refs = it->second;
+  for (size_t i = 0; i < NumReadout(refs); ++i) {
+    points->push_back(ToWorld(scans_.at(refs[i].key), refs[i].index));
+  }
+}
+
+void VoxelHashMap::GetScanVoxels(gtsam::Key key,
+                                 std::vector<VoxelIndex>* voxels) const {
+  voxels->clear();
+  auto it = scans_.find(key);
+  if (it != scans_.end())
+    *voxels = it->second.voxels;
+}
+
+void VoxelHashMap::GetScanKeys(std::vector<gtsam::Key>* keys) const {
+  keys->clear();
+  keys->reserve(scans_.size());
+  for (const auto& scan : scans_) {
+    keys->push_back(scan.first);
+  }
+}
+
+bool VoxelHashMap::IsAtPose(gtsam::Key key, const gtsam::Pose3& pose) const {
+  auto it = scans_.find(key);
+  if (it == scans_.end())
+    return false;
+  ScanEntry moved;
+  SetPose(moved, pose);
+  return moved.rotation == it->second.rotation &&
+      moved.translation == it->second.translation;
+}
+
+size_t VoxelHashMap::NumPoints() const {
+  size_t num_points = 0;
+  for (const auto& voxel : voxels_) {
+    num_points += NumReadout(voxel.second);
+  }
+  return num_points;
+}
+
+size_t VoxelHashMap::NumRefs() const {
+  size_t num_refs = 0;
+  for (const auto& voxel : voxels_) {
+    num_refs += voxel.second.size();
+  }
+  return num_refs;
+}
+
+void VoxelHashMap::Clear() {
+  voxels_.clear();
+  scans_.clear();
+}
+
+VoxelIndex VoxelHashMap::ToVoxelIndex(const Eigen::Vector3f& p,
+                                      double size) const {
+  VoxelIndex v;
+  v.x = static_cast<int>(std::floor(p.x() / size));
+  v.y = static_cast<int>(std::floor(p.y() / size));
+  v.z = static_cast<int>(std::floor(p.z() / size));
+  return v;
+}
+
+void VoxelHashMap::SetPose(ScanEntry& entry, const gtsam::Pose3& pose) const {
+  entry.rotation = pose.rotation().matrix().cast<float>();
+  entry.translation = Eigen::Vector3d(
+      pose.translation().x(), pose.translation().y(), pose.translation().z())
+                          .cast<float>();
+}
+
+void VoxelHashMap::AddPoints(gtsam::Key key, ScanEntry& entry) {
+  const PointCloud& scan = *entry.scan;
+  entry.voxels.clear();
+  for (uint32_t i = 0; i < scan.size(); ++i) {
+    if (!pcl::isFinite(scan.points[i]))
+      continue;
+    const Eigen::Vector3f p =
+        entry.rotation * scan.points[i].getVector3fMap() + entry.translation;
+    const VoxelIndex v = ToVoxelIndex(p, params_.voxel_size);
+    std::vector<PointRef>& refs = voxels_[v];
+    // Record each voxel once per scan (its refs are appended contiguously)
+    if (refs.empty() || refs.back().key != key) {
+      entry.voxels.push_back(v);
+    } else if (refs.size() >= params_.max_points_per_voxel &&
+               refs[refs.size() - params_.max_points_per_voxel].key == key) {
+      // The scan already holds its share of the voxel
+      continue;
+    }
+    refs.push_back({key, i});
+  }
+}
+
+void VoxelHashMap::RemovePoints(gtsam::Key key, ScanEntry& entry) {
+  for (const auto& v : entry.voxels) {
+    auto it = voxels_.find(v);
+    if (it == voxels_.end())
+      continue;
+    std::vector<PointRef>& refs = it->second;
+    refs.erase(std::remove_if(refs.begin(),
+                              refs.end(),
+                              [key](const PointRef& ref) {
+                                return ref.key == key;
+                              }),
+               refs.end());
+    if (refs.empty())
+      voxels_.erase(it);
+  }
+  entry.voxels.clear();
+}
+
+Point VoxelHashMap::ToWorld(const ScanEntry& entry, uint32_t index) const {
+  Point p = entry.scan->points[index];
+  p.getVector3fMap() = entry.rotation * p.getVector3fMap() + entry.translation;
+  p.getNormalVector3fMap() = entry.rotation * p.getNormalVector3fMap();
+  return p;
+}
+
+size_t VoxelHashMap::NumReadout(const std::vector<PointRef>& refs) const {
+  return std::min(refs.size(), params_.max_points_per_voxel);
+}
+
+} // namespace lamp_utils
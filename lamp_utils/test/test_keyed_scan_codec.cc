@@ -0,0 +1,122 @@
+/**
+ *  @brief Testing the keyed scan compression
+ *
+ */
+
+#include <cmath>
+#include <limits>
+
+#include <gtest/gtest.h>
+
+#include <gtsam/inference/Symbol.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <ros/ros.h>
+
+#include <lamp_utils/KeyedScanCodec.h>
+
+#include "test_artifacts.h"
+
+namespace lamp_utils {
+
+class TestKeyedScanCodec : public ::testing::Test {
+public:
+  TestKeyedScanCodec() {
+    params_.position_resolution = 0.005;
+    params_.intensity_resolution = 1.0;
+    params_.normal_bits = 8;
+    key_ = gtsam::Symbol('a', 12);
+
+    scan_ = GenerateBox();
+    for (size_t i = 0; i < scan_->size(); i++) {
+      scan_->points[i].intensity = float(i % 100);
+    }
+  }
+  ~TestKeyedScanCodec() {}
+
+protected:
+  ScanCodecParams params_;
+  gtsam::Key key_;
+  PointCloud::Ptr scan_;
+};
+
+TEST_F(TestKeyedScanCodec, RoundTripWithinResolution) {
+  pose_graph_msgs::CompressedKeyedScan msg;
+  ASSERT_TRUE(EncodeKeyedScan(key_, *scan_, params_, true, &msg));
+  EXPECT_EQ(key_, msg.key);
+  EXPECT_EQ(scan_->size(), msg.num_points);
+
+  PointCloud decoded;
+  ASSERT_TRUE(DecodeKeyedScan(msg, &decoded));
+  ASSERT_EQ(scan_->size(), decoded.size());
+  // Octahedral quantization error with 8 bits is around one degree
+  const double max_normal_angle = 2.0 * M_PI / 180.0;
+  for (size_t i = 0; i < decoded.size(); i++) {
+    const Point& p = scan_->points[i];
+    const Point& q = decoded.points[i];
+    EXPECT_NEAR(p.x, q.x, 0.5 * params_.position_resolution + 1e-6);
+    EXPECT_NEAR(p.y, q.y, 0.5 * params_.position_resolution + 1e-6);
+    EXPECT_NEAR(p.z, q.z, 0.5 * params_.position_resolution + 1e-6);
+    EXPECT_NEAR(p.intensity, q.intensity, 0.5 * params_.intensity_resolution);
+    double dot = p.normal_x * q.normal_x + p.normal_y * q.normal_y +
+        p.normal_z * q.normal_z;
+    EXPECT_LT(std::acos(std::min(1.0, dot)), max_normal_angle);
+  }
+}
+
+TEST_F(TestKeyedScanCodec, SmallerThanRawScan) {
+  pose_graph_msgs::CompressedKeyedScan msg;
+  ASSERT_TRUE(EncodeKeyedScan(key_, *scan_, params_, true, &msg));
+  pose_graph_msgs::KeyedScan raw = PointCloudToKeyedScan(scan_, key_);
+  EXPECT_LT(msg.data.size() * 4, raw.scan.data.size());
+}
+
+TEST_F(TestKeyedScanCodec, WithoutNormals) {
+  pose_graph_msgs::CompressedKeyedScan msg;
+  ASSERT_TRUE(EncodeKeyedScan(key_, *scan_, params_, false, &msg));
+  EXPECT_EQ(0, msg.normal_bits);
+
+  // Decodes to the fields of the scans published without normals
+  pose_graph_msgs::KeyedScan keyed_scan;
+  ASSERT_TRUE(DecodeKeyedScan(msg, &keyed_scan));
+  EXPECT_EQ(key_, keyed_scan.key);
+  PointXyziCloud decoded;
+  pcl::fromROSMsg(keyed_scan.scan, decoded);
+  ASSERT_EQ(scan_->size(), decoded.size());
+  EXPECT_NEAR(scan_->points.back().x,
+              decoded.points.back().x,
+              params_.position_resolution);
+}
+
+TEST_F(TestKeyedScanCodec, DropsNonFinitePoints) {
+  Point invalid;
+  invalid.x = std::numeric_limits<float>::quiet_NaN();
+  scan_->push_back(invalid);
+  pose_graph_msgs::CompressedKeyedScan msg;
+  ASSERT_TRUE(EncodeKeyedScan(key_, *scan_, params_, true, &msg));
+  EXPECT_EQ(scan_->size() - 1, msg.num_points);
+}
+
+TEST_F(TestKeyedScanCodec, TruncatedDataFails) {
+  pose_graph_msgs::CompressedKeyedScan msg;
+  ASSERT_TRUE(EncodeKeyedScan(key_, *scan_, params_, true, &msg));
+  msg.data.resize(msg.data.size() / 2);
+  PointCloud decoded;
+  EXPECT_FALSE(DecodeKeyedScan(msg, &decoded));
+}
+
+TEST_F(TestKeyedScanCodec, EmptyScan) {
+  pose_graph_msgs::CompressedKeyedScan msg;
+  ASSERT_TRUE(EncodeKeyedScan(key_, PointCloud(), params_, true, &msg));
+  EXPECT_EQ(0, msg.num_points);
+  PointCloud decoded;
+  EXPECT_TRUE(DecodeKeyedScan(msg, &decoded));
+  EXPECT_TRUE(decoded.empty());
+}
+
+} // namespace lamp_utils
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "test_keyed_scan_codec");
+  return RUN_ALL_TESTS();
+}
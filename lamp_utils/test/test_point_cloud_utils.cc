@@ -230,6 +230,57 @@ TEST_F(TestPointCloudUtils, ComputeAp_ForPoint2PlaneICP) {
   EXPECT_NEAR(Ap(5, 5), 100, tolerance_);
 }
 
+TEST_F(TestPointCloudUtils, ComputeAp_ForPoint2PlaneICPParallel) {
+  PointCloud::Ptr plane = GeneratePlane();
+  Normals::Ptr plane_normals(new Normals);
+  PointCloud::Ptr plane_normalized(new PointCloud);
+  ExtractNormals(plane, plane_normals);
+  NormalizePCloud(plane, plane_normalized);
+  std::vector<size_t> correspondences(plane->size());
+  std::iota(std::begin(correspondences), std::end(correspondences), 0);
+
+  Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+  T.block<3, 3>(0, 0) =
+      Eigen::AngleAxisf(0.3, Eigen::Vector3f::UnitZ()).toRotationMatrix();
+  Eigen::Matrix<double, 6, 6> Ap_serial, Ap_parallel;
+  ComputeAp_ForPoint2PlaneICP(
+      plane_normalized, plane_normals, correspondences, T, Ap_serial);
+  ComputeAp_ForPoint2PlaneICP(plane, plane, correspondences, T, 4, Ap_parallel);
+
+  for (size_t i = 0; i < 6; i++) {
+    for (size_t j = 0; j < 6; j++) {
+      // The serial version normalizes the query in single precision
+      EXPECT_NEAR(Ap_serial(i, j), Ap_parallel(i, j), 1e-4);
+    }
+  }
+}
+
+TEST_F(TestPointCloudUtils, ComputeAp_ForPoint2PlaneICPMissingNormal) {
+  PointCloud::Ptr plane = GeneratePlane();
+  std::vector<size_t> correspondences(plane->size());
+  std::iota(std::begin(correspondences), std::end(correspondences), 0);
+  Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+  Eigen::Matrix<double, 6, 6> Ap_computed, Ap_carried, Ap_missing;
+  ComputeAp_ForPoint2PlaneICP(plane, plane, correspondences, T, 1, Ap_computed);
+
+  // Carried normals differ from the computed ones and are used as they are
+  PointCloud::Ptr carried(new PointCloud(*plane));
+  for (auto& p : carried->points) {
+    p.normal_x = 1;
+    p.normal_y = 0;
+    p.normal_z = 0;
+  }
+  ComputeAp_ForPoint2PlaneICP(
+      plane, carried, correspondences, T, 1, Ap_carried);
+  EXPECT_FALSE(Ap_carried.isApprox(Ap_computed, 1e-3));
+
+  // One matched point without a normal, not the first, computes them all
+  carried->points[7].normal_x = 0;
+  ComputeAp_ForPoint2PlaneICP(
+      plane, carried, correspondences, T, 1, Ap_missing);
+  EXPECT_TRUE(Ap_missing.isApprox(Ap_computed, 1e-6));
+}
+
 } // namespace lamp_utils
 
 int main(int argc, char** argv) {
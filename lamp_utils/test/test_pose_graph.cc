@@ -243,6 +243,45 @@ TEST_F(TestPoseGraphClass, RemoveRobotFromGraph){
   EXPECT_EQ(pose_graph_back.GetPriors().size(), 1);
 }
 
+TEST_F(TestPoseGraphClass, ToMsgIsCachedUntilChange) {
+  ros::Time::init();
+  gtsam::noiseModel::Diagonal::shared_ptr covariance(
+    gtsam::noiseModel::Diagonal::Sigmas(initial_noise_));
+
+  pose_graph_.Initialize(initial_key_, gtsam::Pose3(), covariance);
+  pose_graph_.TrackNode(n0);
+
+  GraphMsgPtr msg = pose_graph_.ToMsg();
+  EXPECT_EQ(msg->nodes.size(), 2);
+  EXPECT_EQ(msg->edges.size(), 1);
+
+  // Unchanged graph hands out the same message
+  EXPECT_EQ(pose_graph_.ToMsg().get(), msg.get());
+
+  // Tracking new data must not modify the message that is still referenced
+  pose_graph_.TrackNode(n1);
+  pose_graph_.TrackFactor(e0);
+  GraphMsgPtr updated = pose_graph_.ToMsg();
+  EXPECT_NE(updated.get(), msg.get());
+  EXPECT_EQ(msg->nodes.size(), 2);
+  EXPECT_EQ(updated->nodes.size(), 3);
+  EXPECT_EQ(updated->edges.size(), 2);
+
+  // Once released, new data is appended to the cached message in place
+  msg.reset();
+  updated.reset();
+  pose_graph_.TrackNode(ros::Time(5.0), gtsam::Symbol('a', 3), gtsam::Pose3(), covariance);
+  EXPECT_EQ(pose_graph_.ToMsg()->nodes.size(), 4);
+
+  // Incremental message only holds data tracked since the last clear
+  pose_graph_.ClearIncrementalMessages();
+  pose_graph_.TrackNode(ros::Time(6.0), gtsam::Symbol('a', 4), gtsam::Pose3(), covariance);
+  GraphMsgPtr incremental = pose_graph_.ToIncrementalMsg();
+  EXPECT_EQ(incremental->nodes.size(), 1);
+  EXPECT_EQ(incremental->edges.size(), 0);
+  EXPECT_EQ(pose_graph_.ToMsg()->nodes.size(), 5);
+}
+
 
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
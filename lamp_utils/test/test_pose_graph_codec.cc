@@ -0,0 +1,177 @@
+/**
+ *  @brief Testing the compact pose graph encoding
+ *
+ */
+
+#include <cmath>
+
+#include <gtest/gtest.h>
+
+#include <gtsam/inference/Symbol.h>
+#include <ros/ros.h>
+#include <ros/serialization.h>
+
+#include <lamp_utils/PoseGraphCodec.h>
+
+namespace lamp_utils {
+
+class TestPoseGraphCodec : public ::testing::Test {
+public:
+  TestPoseGraphCodec() {
+    graph_.header.frame_id = "world";
+    graph_.header.stamp = ros::Time(100, 0);
+    graph_.incremental = true;
+
+    boost::array<double, 36> covariance;
+    covariance.fill(0.0);
+    for (int i = 0; i < 6; i++) {
+      covariance[7 * i] = 0.01 * (i + 1);
+    }
+
+    // An odometry chain with a loop closure
+    for (int i = 0; i < 50; i++) {
+      pose_graph_msgs::PoseGraphNode node;
+      node.header.frame_id = "world";
+      node.header.stamp = ros::Time(100 + i, 1000 * i);
+      node.key = gtsam::Symbol('a', i);
+      node.pose.position.x = 0.5 * i + 0.01234;
+      node.pose.position.y = std::sin(0.1 * i);
+      node.pose.position.z = -0.001 * i;
+      node.pose.orientation.z = std::sin(0.05 * i);
+      node.pose.orientation.w = -std::cos(0.05 * i);
+      node.covariance = covariance;
+      graph_.nodes.push_back(node);
+
+      if (i == 0)
+        continue;
+      pose_graph_msgs::PoseGraphEdge edge;
+      edge.key_from = gtsam::Symbol('a', i - 1);
+      edge.key_to = gtsam::Symbol('a', i);
+      edge.type = pose_graph_msgs::PoseGraphEdge::ODOM;
+      edge.pose.position.x = 0.5;
+      edge.pose.orientation.w = 1.0;
+      edge.covariance = covariance;
+      graph_.edges.push_back(edge);
+    }
+
+    // Artifact in another frame, with an ID
+    pose_graph_msgs::PoseGraphNode artifact;
+    artifact.header.frame_id = "a/map";
+    artifact.header.stamp = ros::Time(90, 0);
+    artifact.key = gtsam::Symbol('A', 3);
+    artifact.ID = "a/artifact3";
+    artifact.pose.position.x = 12.0;
+    artifact.pose.orientation.w = 1.0;
+    graph_.nodes.push_back(artifact);
+
+    pose_graph_msgs::PoseGraphEdge loop;
+    loop.key_from = gtsam::Symbol('a', 40);
+    loop.key_to = gtsam::Symbol('a', 2);
+    loop.type = pose_graph_msgs::PoseGraphEdge::LOOPCLOSE;
+    loop.pose.position.x = -19.0;
+    loop.pose.orientation.x = 0.1;
+    loop.pose.orientation.w = 0.995;
+    loop.covariance[0] = 0.5;
+    loop.range = 3.5;
+    loop.range_error = 0.2;
+    graph_.edges.push_back(loop);
+  }
+  ~TestPoseGraphCodec() {}
+
+protected:
+  // Angle between the rotations of two quaternions
+  double Angle(const geometry_msgs::Quaternion& a,
+               const geometry_msgs::Quaternion& b) {
+    double dot = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    return 2.0 * std::acos(std::min(1.0, std::abs(dot)));
+  }
+
+  PoseGraphCodecParams params_;
+  pose_graph_msgs::PoseGraph graph_;
+};
+
+TEST_F(TestPoseGraphCodec, RoundTripWithinResolution) {
+  pose_graph_msgs::CompactPoseGraph compact;
+  ASSERT_TRUE(EncodePoseGraph(graph_, params_, &compact));
+  pose_graph_msgs::PoseGraph decoded;
+  ASSERT_TRUE(DecodePoseGraph(compact, &decoded));
+
+  EXPECT_EQ(graph_.header.frame_id, decoded.header.frame_id);
+  EXPECT_EQ(graph_.header.stamp, decoded.header.stamp);
+  EXPECT_EQ(graph_.incremental, decoded.incremental);
+  ASSERT_EQ(graph_.nodes.size(), decoded.nodes.size());
+  ASSERT_EQ(graph_.edges.size(), decoded.edges.size());
+
+  const double tolerance = 0.5 * params_.position_resolution + 1e-9;
+  for (size_t i = 0; i < graph_.nodes.size(); i++) {
+    const auto& a = graph_.nodes[i];
+    const auto& b = decoded.nodes[i];
+    EXPECT_EQ(a.key, b.key);
+    EXPECT_EQ(a.ID, b.ID);
+    EXPECT_EQ(a.header.frame_id, b.header.frame_id);
+    EXPECT_EQ(a.header.stamp, b.header.stamp);
+    EXPECT_NEAR(a.pose.position.x, b.pose.position.x, tolerance);
+    EXPECT_NEAR(a.pose.position.y, b.pose.position.y, tolerance);
+    EXPECT_NEAR(a.pose.position.z, b.pose.position.z, tolerance);
+    EXPECT_LT(Angle(a.pose.orientation, b.pose.orientation), 1e-4);
+    for (int j = 0; j < 36; j++) {
+      EXPECT_FLOAT_EQ(a.covariance[j], b.covariance[j]);
+    }
+  }
+  for (size_t i = 0; i < graph_.edges.size(); i++) {
+    const auto& a = graph_.edges[i];
+    const auto& b = decoded.edges[i];
+    EXPECT_EQ(a.key_from, b.key_from);
+    EXPECT_EQ(a.key_to, b.key_to);
+    EXPECT_EQ(a.type, b.type);
+    EXPECT_NEAR(a.pose.position.x, b.pose.position.x, tolerance);
+    EXPECT_LT(Angle(a.pose.orientation, b.pose.orientation), 1e-4);
+    EXPECT_EQ(a.range, b.range);
+    EXPECT_EQ(a.range_error, b.range_error);
+    for (int j = 0; j < 36; j++) {
+      EXPECT_FLOAT_EQ(a.covariance[j], b.covariance[j]);
+    }
+  }
+}
+
+TEST_F(TestPoseGraphCodec, SmallerThanPoseGraph) {
+  pose_graph_msgs::CompactPoseGraph compact;
+  ASSERT_TRUE(EncodePoseGraph(graph_, params_, &compact));
+  EXPECT_LT(4 * ros::serialization::serializationLength(compact),
+            ros::serialization::serializationLength(graph_));
+}
+
+TEST_F(TestPoseGraphCodec, ZeroQuaternion) {
+  graph_.nodes[0].pose.orientation = geometry_msgs::Quaternion();
+  pose_graph_msgs::CompactPoseGraph compact;
+  ASSERT_TRUE(EncodePoseGraph(graph_, params_, &compact));
+  pose_graph_msgs::PoseGraph decoded;
+  ASSERT_TRUE(DecodePoseGraph(compact, &decoded));
+  EXPECT_EQ(0.0, decoded.nodes[0].pose.orientation.w);
+}
+
+TEST_F(TestPoseGraphCodec, TruncatedDataFails) {
+  pose_graph_msgs::CompactPoseGraph compact;
+  ASSERT_TRUE(EncodePoseGraph(graph_, params_, &compact));
+  compact.data.resize(compact.data.size() / 2);
+  pose_graph_msgs::PoseGraph decoded;
+  EXPECT_FALSE(DecodePoseGraph(compact, &decoded));
+}
+
+TEST_F(TestPoseGraphCodec, EmptyGraph) {
+  pose_graph_msgs::PoseGraph empty;
+  pose_graph_msgs::CompactPoseGraph compact;
+  ASSERT_TRUE(EncodePoseGraph(empty, params_, &compact));
+  pose_graph_msgs::PoseGraph decoded;
+  ASSERT_TRUE(DecodePoseGraph(compact, &decoded));
+  EXPECT_TRUE(decoded.nodes.empty());
+  EXPECT_TRUE(decoded.edges.empty());
+}
+
+} // namespace lamp_utils
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "test_pose_graph_codec");
+  return RUN_ALL_TESTS();
+}
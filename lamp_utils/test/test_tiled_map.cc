@@ -0,0 +1,147 @@
+/**
+ *  @brief Testing the multi-resolution tiled map
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <gtsam/inference/Symbol.h>
+#include <ros/ros.h>
+
+#include <lamp_utils/TiledMap.h>
+
+#include "test_artifacts.h"
+
+namespace lamp_utils {
+
+class TestTiledMap : public ::testing::Test {
+public:
+  TestTiledMap() {
+    params_.tile_size = 1.0;
+    params_.resolution = 0.1;
+    params_.num_levels = 3;
+  }
+  ~TestTiledMap() {}
+
+protected:
+  // Plane of 20 x 10 points spaced by 0.1, spanning two tiles in x
+  PointCloud::Ptr GenerateTwoTilePlane() {
+    PointCloud::Ptr plane = GeneratePlane(20, 10, 0.1f, 0.1f);
+    for (auto& p : *plane) {
+      p.x += 0.05f;
+      p.y += 0.05f;
+      p.z += 0.05f;
+    }
+    return plane;
+  }
+
+  TiledMapParams params_;
+  gtsam::Pose3 origin_;
+};
+
+TEST_F(TestTiledMap, InsertAndLevels) {
+  TiledMap map(params_);
+  map.InsertScan(gtsam::Symbol('a', 0), GenerateTwoTilePlane(), origin_);
+  EXPECT_EQ(2, map.GetNumTiles());
+  EXPECT_EQ(200, map.GetNumPoints());
+
+  // Scans in the same voxels do not add finest points
+  map.InsertScan(gtsam::Symbol('a', 1), GenerateTwoTilePlane(), origin_);
+  EXPECT_EQ(200, map.GetNumPoints());
+
+  PointCloud::ConstPtr points;
+  ASSERT_TRUE(map.GetTileCloud(TileIndex{0, 0, 0}, 0, &points));
+  EXPECT_EQ(100, points->size());
+  ASSERT_TRUE(map.GetTileCloud(TileIndex{0, 0, 0}, 1, &points));
+  EXPECT_EQ(25, points->size());
+  ASSERT_TRUE(map.GetTileCloud(TileIndex{0, 0, 0}, 2, &points));
+  EXPECT_EQ(9, points->size());
+
+  EXPECT_FALSE(map.GetTileCloud(TileIndex{0, 0, 0}, 3, &points));
+  EXPECT_FALSE(map.GetTileCloud(TileIndex{5, 0, 0}, 0, &points));
+}
+
+TEST_F(TestTiledMap, Revisions) {
+  TiledMap map(params_);
+  map.InsertScan(gtsam::Symbol('a', 0), GenerateTwoTilePlane(), origin_);
+  uint32_t revision = map.GetRevision(TileIndex{1, 0, 0});
+  EXPECT_LT(0, revision);
+
+  // Only the tile receiving points changes
+  PointCloud::Ptr extra(new PointCloud);
+  Point p;
+  p.x = 1.55;
+  p.y = 0.55;
+  p.z = 0.55;
+  extra->push_back(p);
+  map.InsertScan(gtsam::Symbol('a', 1), extra, origin_);
+  EXPECT_EQ(revision, map.GetRevision(TileIndex{0, 0, 0}));
+  EXPECT_LT(revision, map.GetRevision(TileIndex{1, 0, 0}));
+
+  // Unchanged poses keep the revisions
+  revision = map.GetRevision(TileIndex{1, 0, 0});
+  EXPECT_TRUE(map.UpdatePose(gtsam::Symbol('a', 1), origin_));
+  EXPECT_EQ(revision, map.GetRevision(TileIndex{1, 0, 0}));
+
+  // Emptied tiles stay known with a new revision
+  map.Clear();
+  EXPECT_EQ(2, map.GetNumTiles());
+  EXPECT_EQ(0, map.GetNumPoints());
+  EXPECT_LT(revision, map.GetRevision(TileIndex{1, 0, 0}));
+
+  PointCloud::ConstPtr points;
+  ASSERT_TRUE(map.GetTileCloud(TileIndex{1, 0, 0}, 0, &points));
+  EXPECT_TRUE(points->empty());
+}
+
+TEST_F(TestTiledMap, MovedScansChangeTiles) {
+  TiledMap map(params_);
+  map.InsertScan(gtsam::Symbol('a', 0), GenerateTwoTilePlane(), origin_);
+  map.InsertScan(gtsam::Symbol('a', 1), GenerateTwoTilePlane(), origin_);
+  const uint32_t revision = map.GetRevision(TileIndex{0, 0, 0});
+
+  // The moved scan leaves its tiles, which keep the points of the other scan
+  const gtsam::Pose3 moved(gtsam::Rot3(), gtsam::Point3(0, 5, 0));
+  EXPECT_TRUE(map.UpdatePose(gtsam::Symbol('a', 1), moved));
+  EXPECT_EQ(4, map.GetNumTiles());
+  EXPECT_EQ(400, map.GetNumPoints());
+  EXPECT_LT(revision, map.GetRevision(TileIndex{0, 0, 0}));
+  EXPECT_LT(revision, map.GetRevision(TileIndex{0, 5, 0}));
+
+  PointCloud::ConstPtr points;
+  ASSERT_TRUE(map.GetTileCloud(TileIndex{0, 0, 0}, 0, &points));
+  EXPECT_EQ(100, points->size());
+
+  // Removing it empties the tiles it was moved to
+  EXPECT_TRUE(map.RemoveScan(gtsam::Symbol('a', 1)));
+  EXPECT_FALSE(map.RemoveScan(gtsam::Symbol('a', 1)));
+  EXPECT_EQ(200, map.GetNumPoints());
+  ASSERT_TRUE(map.GetTileCloud(TileIndex{0, 5, 0}, 0, &points));
+  EXPECT_TRUE(points->empty());
+  ASSERT_TRUE(map.GetTileCloud(TileIndex{0, 0, 0}, 0, &points));
+  EXPECT_EQ(100, points->size());
+}
+
+TEST_F(TestTiledMap, TilesInRadius) {
+  TiledMap map(params_);
+  map.InsertScan(gtsam::Symbol('a', 0), GenerateTwoTilePlane(), origin_);
+
+  std::vector<TileIndex> tiles;
+  map.GetTilesInRadius(Eigen::Vector3f(-0.5, 0.5, 0.5), 0.6, &tiles);
+  ASSERT_EQ(1, tiles.size());
+  EXPECT_EQ(0, tiles[0].x);
+
+  map.GetTilesInRadius(Eigen::Vector3f(1.0, 0.5, 0.5), 0.1, &tiles);
+  EXPECT_EQ(2, tiles.size());
+
+  map.GetTilesInRadius(Eigen::Vector3f(10.0, 0.5, 0.5), 1.0, &tiles);
+  EXPECT_TRUE(tiles.empty());
+}
+
+} // namespace lamp_utils
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "test_tiled_map");
+  return RUN_ALL_TESTS();
+}
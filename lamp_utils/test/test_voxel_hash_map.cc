@@ -0,0 +1,144 @@
+/**
+ *  @brief Testing the voxel hashed world map
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <gtsam/inference/Symbol.h>
+#include <ros/ros.h>
+
+#include <lamp_utils/VoxelHashMap.h>
+
+#include "test_artifacts.h"
+
+namespace lamp_utils {
+
+class TestVoxelHashMap : public ::testing::Test {
+public:
+  TestVoxelHashMap() {
+    params_.voxel_size = 0.1;
+    params_.max_points_per_voxel = 1;
+    // Centre the plane points inside the voxels
+    origin_ = gtsam::Pose3(gtsam::Rot3(), gtsam::Point3(0.05, 0.05, 0.05));
+    shifted_ =
+        gtsam::Pose3(gtsam::Rot3(), gtsam::Point3(10.05, 0.05, 0.05));
+  }
+  ~TestVoxelHashMap() {}
+
+protected:
+  VoxelHashMapParams params_;
+  gtsam::Pose3 origin_;
+  gtsam::Pose3 shifted_;
+  double tolerance_ = 1e-4;
+};
+
+TEST_F(TestVoxelHashMap, InsertAndDownsample) {
+  VoxelHashMap map(params_);
+  PointCloud::Ptr plane = GeneratePlane();
+
+  map.InsertScan(gtsam::Symbol('a', 0), plane, origin_);
+  EXPECT_EQ(100, map.NumVoxels());
+  EXPECT_EQ(100, map.NumPoints());
+
+  // Same points again are dropped by the full voxels
+  map.InsertScan(gtsam::Symbol('a', 1), plane, origin_);
+  EXPECT_EQ(2, map.NumScans());
+  EXPECT_EQ(100, map.NumPoints());
+
+  // Re-inserting a key replaces its points
+  map.InsertScan(gtsam::Symbol('a', 0), plane, origin_);
+  EXPECT_EQ(100, map.NumPoints());
+}
+
+TEST_F(TestVoxelHashMap, UpdatePoseMovesPoints) {
+  VoxelHashMap map(params_);
+  PointCloud::Ptr plane = GeneratePlane();
+  map.InsertScan(gtsam::Symbol('a', 0), plane, origin_);
+  map.InsertScan(gtsam::Symbol('a', 1), plane, origin_);
+
+  // Moving the scan read out in the shared voxels leaves the points of the
+  // other scan there
+  EXPECT_TRUE(map.UpdatePose(gtsam::Symbol('a', 0), shifted_));
+  EXPECT_EQ(200, map.NumPoints());
+  PointCloud points;
+  map.GetMap(&points);
+  size_t num_shifted = 0;
+  for (const auto& p : points) {
+    if (p.x > 10.0)
+      num_shifted++;
+  }
+  EXPECT_EQ(100, num_shifted);
+
+  EXPECT_TRUE(map.UpdatePose(gtsam::Symbol('a', 1), origin_));
+  EXPECT_EQ(200, map.NumPoints());
+  EXPECT_FALSE(map.UpdatePose(gtsam::Symbol('a', 2), origin_));
+
+  // Removing a scan does not leave holes either
+  EXPECT_TRUE(map.RemoveScan(gtsam::Symbol('a', 0)));
+  EXPECT_EQ(100, map.NumPoints());
+  map.GetMap(&points);
+  for (const auto& p : points) {
+    EXPECT_LT(p.x, 10.0);
+  }
+  EXPECT_FALSE(map.RemoveScan(gtsam::Symbol('a', 0)));
+
+  // Nor does moving it back into the voxels of another scan and out again
+  map.InsertScan(gtsam::Symbol('a', 0), plane, origin_);
+  EXPECT_EQ(100, map.NumPoints());
+  EXPECT_TRUE(map.UpdatePose(gtsam::Symbol('a', 1), shifted_));
+  EXPECT_EQ(200, map.NumPoints());
+}
+
+TEST_F(TestVoxelHashMap, StoredRefsAreBounded) {
+  VoxelHashMap map(params_);
+  // Many points of one scan in a single voxel
+  PointCloud::Ptr dense(new PointCloud);
+  for (int i = 0; i < 50; i++) {
+    Point p;
+    p.x = p.y = p.z = 0.001f * i;
+    dense->push_back(p);
+  }
+
+  map.InsertScan(gtsam::Symbol('a', 0), dense, origin_);
+  EXPECT_EQ(1, map.NumVoxels());
+  EXPECT_EQ(1, map.NumRefs());
+
+  // Each scan keeps its own share of the voxel
+  map.InsertScan(gtsam::Symbol('a', 1), dense, origin_);
+  EXPECT_EQ(2, map.NumRefs());
+  EXPECT_EQ(1, map.NumPoints());
+
+  // Moving and re-inserting does not grow the voxel either
+  EXPECT_TRUE(map.UpdatePose(gtsam::Symbol('a', 1), origin_));
+  map.InsertScan(gtsam::Symbol('a', 0), dense, origin_);
+  EXPECT_EQ(2, map.NumRefs());
+
+  // The other scan still shows once one leaves the voxel
+  EXPECT_TRUE(map.RemoveScan(gtsam::Symbol('a', 0)));
+  EXPECT_EQ(1, map.NumRefs());
+  EXPECT_EQ(1, map.NumPoints());
+}
+
+TEST_F(TestVoxelHashMap, CoarseReadout) {
+  VoxelHashMap map(params_);
+  PointCloud::Ptr plane = GeneratePlane();
+  map.InsertScan(gtsam::Symbol('a', 0), plane, origin_);
+  map.InsertScan(gtsam::Symbol('a', 1), plane, shifted_);
+
+  PointCloud points;
+  map.GetMap(&points, 1.0);
+  ASSERT_EQ(2, points.size());
+  for (const auto& p : points) {
+    EXPECT_NEAR(0.5, p.y, tolerance_);
+    EXPECT_NEAR(0.05, p.z, tolerance_);
+  }
+}
+
+} // namespace lamp_utils
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "test_voxel_hash_map");
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,44 @@
+/**
+ * @file   CandidateGenerator.h
+ * @brief  Interface of the candidate generators run by LoopGenerationEngine
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "loop_closure/LoopGeneration.h"
+#include "loop_closure/PoseStore.h"
+
+namespace lamp_loop_closure {
+
+class CandidateGenerator {
+public:
+  virtual ~CandidateGenerator() {}
+
+  // Loads parameters and registers the callbacks of the inputs the generator
+  // has besides the poses. Candidates found in those callbacks go to sink.
+  virtual bool Initialize(const ros::NodeHandle& n,
+                          const CandidateSink& sink) = 0;
+
+  // Called with the keys just added to the shared pose store, in parallel
+  // with the other generators. The store is not modified meanwhile.
+  virtual void
+  GenerateLoops(const PoseStore& poses,
+                const std::vector<gtsam::Key>& new_keys,
+                std::vector<pose_graph_msgs::LoopCandidate>* candidates) {}
+
+  // Candidates that skip prioritization, as the standalone node sends them
+  // straight to the prioritized candidates
+  virtual bool IsPrioritized() const {
+    return false;
+  }
+};
+
+// Generator registered under name (proximity, rssi, scan_context), null if
+// unknown
+std::unique_ptr<CandidateGenerator>
+CreateCandidateGenerator(const std::string& name);
+
+} // namespace lamp_loop_closure
@@ -0,0 +1,70 @@
+/**
+ * @file   DescriptorIndex.h
+ * @brief  Incremental nearest neighbour index of keyed descriptor vectors
+ */
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <gtsam/inference/Key.h>
+
+namespace lamp_loop_closure {
+
+// Static kd-trees of distinct power of two sizes. An insertion merges the
+// trees of the sizes below the first free one, so a descriptor is moved
+// O(log n) times and a query searches O(log n) trees.
+class DescriptorIndex {
+public:
+  explicit DescriptorIndex(size_t dimension);
+  ~DescriptorIndex();
+
+  void Insert(gtsam::Key key, const Eigen::VectorXf& descriptor);
+
+  // Up to k (squared distance, key) pairs closest first, among the keys
+  // accepted by the filter
+  std::vector<std::pair<float, gtsam::Key>>
+  Nearest(const Eigen::VectorXf& query,
+          size_t k,
+          const std::function<bool(gtsam::Key)>& accept) const;
+
+  inline size_t Size() const { return size_; }
+
+private:
+  struct Tree {
+    std::vector<gtsam::Key> keys;
+    // Descriptors in tree order, dimension_ floats each
+    std::vector<float> points;
+    // Split dimension of the node at the middle of each range
+    std::vector<int> split_dims;
+  };
+
+  typedef std::vector<std::pair<float, gtsam::Key>> Heap;
+
+  void Build(Tree* tree) const;
+  void Build(Tree* tree, std::vector<size_t>* order, size_t lo, size_t hi)
+      const;
+  void Search(const Tree& tree,
+              const float* query,
+              size_t lo,
+              size_t hi,
+              size_t k,
+              const std::function<bool(gtsam::Key)>& accept,
+              Heap* heap) const;
+  void Visit(const Tree& tree,
+             size_t i,
+             const float* query,
+             size_t k,
+             const std::function<bool(gtsam::Key)>& accept,
+             Heap* heap) const;
+
+  size_t dimension_;
+  size_t size_;
+  // Slot i holds a tree of 2^i descriptors or nothing
+  std::vector<std::unique_ptr<Tree>> trees_;
+};
+
+} // namespace lamp_loop_closure
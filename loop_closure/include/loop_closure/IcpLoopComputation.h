@@ -14,6 +14,8 @@
 #include <pcl/io/pcd_io.h>
 #include <pcl_ros/point_cloud.h>
 #include <pose_graph_msgs/KeyedScan.h>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <lamp_utils/CommonStructs.h>
 
@@ -25,6 +27,8 @@ class IcpLoopComputation : public LoopComputation {
   typedef pcl::PointCloud<pcl::Normal> Normals;
   typedef pcl::PointCloud<pcl::FPFHSignature33> Features;
   typedef pcl::search::KdTree<Point> KdTree;
+  typedef pcl::MultithreadedGeneralizedIterativeClosestPoint<Point, Point>
+      Gicp;
   friend class TestLoopComputation;
   friend class EvalIcpLoopCompute;
 
@@ -51,6 +55,8 @@ public:
 
   bool SetupICP(pcl::MultithreadedGeneralizedIterativeClosestPoint<Point, Point>& icp);
 
+  // With use_pooled_icp an engine from the pool is used instead of icp_, so
+  // that alignments can run concurrently
   bool PerformAlignment(const gtsam::Symbol& key1,
                         const gtsam::Symbol& key2,
                         const gtsam::Pose3& pose1,
@@ -58,7 +64,29 @@ public:
                         geometry_utils::Transform3* delta,
                         gtsam::Matrix66* covariance,
                         double* fitness_score,
-                        bool re_initialize_icp = false);
+                        bool use_pooled_icp = false);
+
+  // Aligns candidates that share key_from with one engine. The source scan is
+  // accumulated once and its covariances and search tree are reused for
+  // every target. Returns the loop closures found.
+  std::vector<pose_graph_msgs::PoseGraphEdge>
+  AlignCandidateGroup(const std::vector<pose_graph_msgs::LoopCandidate>& group,
+                      bool use_pooled_icp);
+
+  bool CheckAlignmentInputs(const gtsam::Symbol& key1,
+                            const gtsam::Symbol& key2) const;
+
+  PointCloud::ConstPtr PrepareSource(const gtsam::Key key);
+
+  bool AlignToTarget(Gicp& icp,
+                     const PointCloud::ConstPtr& accumulated_source,
+                     const gtsam::Symbol& key1,
+                     const gtsam::Symbol& key2,
+                     const gtsam::Pose3& pose1,
+                     const gtsam::Pose3& pose2,
+                     geometry_utils::Transform3* delta,
+                     gtsam::Matrix66* covariance,
+                     double* fitness_score);
 
   void GetSacInitialAlignment(PointCloud::ConstPtr source,
                               PointCloud::ConstPtr target,
@@ -132,6 +160,10 @@ protected:
 
   bool b_accumulate_source_;
 
+  // Keep only the lowest fitness loop closure among candidates sharing a
+  // source scan
+  bool b_keep_best_match_per_source_;
+
   enum class IcpInitMethod {
     IDENTITY,
     ODOMETRY,
@@ -148,8 +180,17 @@ protected:
   IcpCovarianceMethod icp_covariance_method_;
 
   // ICP
-  pcl::MultithreadedGeneralizedIterativeClosestPoint<Point, Point> icp_;
-
+  Gicp icp_;
+
+  // Preconfigured ICP engines for the computation pool workers. Engines are
+  // checked out for one alignment and returned, so their search trees and
+  // covariance buffers are reused across candidates.
+  Gicp* AcquireIcp();
+  void ReleaseIcp(Gicp* icp);
+  void ClearIcpPool();
+  std::vector<std::unique_ptr<Gicp>> icp_engines_;
+  std::vector<Gicp*> idle_icp_engines_;
+  std::mutex icp_engines_mutex_;
 
   ThreadPool icp_computation_pool_;
 
@@ -5,6 +5,7 @@
  */
 #pragma once
 
+#include <functional>
 #include <gtsam/geometry/Pose3.h>
 #include <map>
 #include <queue>
@@ -19,6 +20,10 @@
 
 namespace lamp_loop_closure {
 
+// Receives the candidates of a generator hosted in another node
+typedef std::function<void(const std::vector<pose_graph_msgs::LoopCandidate>&)>
+    CandidateSink;
+
 class LoopGeneration {
 public:
   LoopGeneration();
@@ -32,6 +37,11 @@ public:
 
   virtual bool RegisterCallbacks(const ros::NodeHandle& n) = 0;
 
+  // Candidates go to the sink instead of being published
+  inline void SetCandidateSink(const CandidateSink& sink) {
+    candidate_sink_ = sink;
+  }
+
 protected:
   // Key -> odometry-pose
   std::map<gtsam::Key, gtsam::Pose3> keyed_poses_;
@@ -45,9 +55,17 @@ protected:
   virtual void
   KeyedPoseCallback(const pose_graph_msgs::PoseGraph::ConstPtr& graph_msg) = 0;
 
+  inline bool HasCandidateConsumer() const {
+    return candidate_sink_ || loop_candidate_pub_.getNumSubscribers() > 0;
+  }
+
   inline void PublishLoops() const {
     if (candidates_.size() == 0)
       return;
+    if (candidate_sink_) {
+      candidate_sink_(candidates_);
+      return;
+    }
     pose_graph_msgs::LoopCandidateArray candidates_msg;
     candidates_msg.candidates = candidates_;
     loop_candidate_pub_.publish(candidates_msg);
@@ -60,6 +78,8 @@ protected:
   std::string param_ns_;
 
   bool b_check_for_loop_closures_;
+
+  CandidateSink candidate_sink_;
 };
 
 } // namespace lamp_loop_closure
\ No newline at end of file
@@ -0,0 +1,78 @@
+/**
+ * @file   LoopGenerationEngine.h
+ * @brief  Runs several candidate generators in one node on a shared pose
+ *         store and publishes their candidates without duplicates
+ */
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "loop_closure/CandidateGenerator.h"
+#include "loop_closure/LoopGeneration.h"
+#include "loop_closure/PoseStore.h"
+
+namespace lamp_loop_closure {
+
+class LoopGenerationEngine : public LoopGeneration {
+  friend class TestLoopGeneration;
+
+public:
+  LoopGenerationEngine();
+  ~LoopGenerationEngine();
+
+  bool Initialize(const ros::NodeHandle& n) override;
+
+  bool LoadParameters(const ros::NodeHandle& n) override;
+
+  bool CreatePublishers(const ros::NodeHandle& n) override;
+
+  bool RegisterCallbacks(const ros::NodeHandle& n) override;
+
+protected:
+  void KeyedPoseCallback(
+      const pose_graph_msgs::PoseGraph::ConstPtr& graph_msg) override;
+
+  // Queues the candidates of pairs that no generator proposed before,
+  // prioritized ones are published apart
+  void AddCandidates(
+      const std::vector<pose_graph_msgs::LoopCandidate>& candidates,
+      bool prioritized = false);
+
+  void PublishCandidates();
+
+private:
+  struct KeyPairHash {
+    size_t operator()(const std::pair<gtsam::Key, gtsam::Key>& p) const {
+      return std::hash<gtsam::Key>()(p.first) ^
+          (std::hash<gtsam::Key>()(p.second) * 0x9e3779b97f4a7c15ull);
+    }
+  };
+
+  std::vector<std::string> generator_names_;
+  std::vector<std::unique_ptr<CandidateGenerator>> generators_;
+
+  PoseStore poses_;
+
+  // Candidates of the generators that skip prioritization
+  ros::Publisher prioritized_candidate_pub_;
+  std::vector<pose_graph_msgs::LoopCandidate> prioritized_candidates_;
+
+  // Guards the candidates and the pairs, generators may also hand over
+  // candidates from their own callbacks
+  std::mutex candidates_mutex_;
+  // Unordered pairs (smaller key first) already proposed, the oldest are
+  // forgotten past max_proposed_pairs_
+  std::unordered_set<std::pair<gtsam::Key, gtsam::Key>, KeyPairHash>
+      proposed_pairs_;
+  std::deque<std::pair<gtsam::Key, gtsam::Key>> proposed_order_;
+  size_t max_proposed_pairs_;
+  size_t num_duplicates_;
+};
+
+} // namespace lamp_loop_closure
@@ -0,0 +1,63 @@
+/**
+ * @file   PoseStore.h
+ * @brief  Keyed poses with a spatial index, shared by candidate generators
+ */
+#pragma once
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/inference/Key.h>
+
+namespace lamp_loop_closure {
+
+class PoseStore {
+public:
+  explicit PoseStore(double cell_size = 10.0);
+  ~PoseStore();
+
+  // Adds the pose of a new key, returns false if the key is already stored
+  bool Insert(gtsam::Key key, const gtsam::Pose3& pose);
+
+  inline bool Has(gtsam::Key key) const {
+    return poses_.find(key) != poses_.end();
+  }
+  inline const gtsam::Pose3& GetPose(gtsam::Key key) const {
+    return poses_.at(key);
+  }
+  inline const std::map<gtsam::Key, gtsam::Pose3>& GetPoses() const {
+    return poses_;
+  }
+  inline size_t Size() const { return poses_.size(); }
+
+  // Keys within radius of position, in key order
+  std::vector<gtsam::Key> Radius(const gtsam::Point3& position,
+                                 double radius) const;
+
+  void Clear();
+
+private:
+  struct CellIndex {
+    int x, y, z;
+    bool operator==(const CellIndex& other) const {
+      return x == other.x && y == other.y && z == other.z;
+    }
+  };
+
+  struct CellIndexHash {
+    size_t operator()(const CellIndex& c) const {
+      return (size_t(c.x) * 73856093) ^ (size_t(c.y) * 19349669) ^
+          (size_t(c.z) * 83492791);
+    }
+  };
+
+  CellIndex ToCell(const gtsam::Point3& position) const;
+
+  double cell_size_;
+  std::map<gtsam::Key, gtsam::Pose3> poses_;
+  std::unordered_map<CellIndex, std::vector<gtsam::Key>, CellIndexHash> cells_;
+};
+
+} // namespace lamp_loop_closure
@@ -0,0 +1,45 @@
+/**
+ * @file   ProximityCandidateGenerator.h
+ * @brief  Find potential loop closures based on proximity in a pose store
+ */
+#pragma once
+
+#include <unordered_set>
+
+#include <gtsam/inference/Symbol.h>
+
+#include "loop_closure/CandidateGenerator.h"
+
+namespace lamp_loop_closure {
+
+class ProximityCandidateGenerator : public CandidateGenerator {
+public:
+  ProximityCandidateGenerator();
+  ~ProximityCandidateGenerator();
+
+  bool Initialize(const ros::NodeHandle& n,
+                  const CandidateSink& sink) override;
+
+  bool LoadParameters(const std::string& param_ns);
+
+  void GenerateLoops(
+      const PoseStore& poses,
+      const std::vector<gtsam::Key>& new_keys,
+      std::vector<pose_graph_msgs::LoopCandidate>* candidates) override;
+
+private:
+  // Candidates of one new key, with the poses within the adaptive radius
+  // that are not in later_keys
+  void GenerateLoops(const PoseStore& poses,
+                     const gtsam::Symbol& key,
+                     const std::unordered_set<gtsam::Key>& later_keys,
+                     std::vector<pose_graph_msgs::LoopCandidate>* candidates);
+
+  double proximity_threshold_max_;
+  double proximity_threshold_min_;
+  double increase_rate_;
+  int n_closest_;
+  size_t skip_recent_poses_;
+};
+
+} // namespace lamp_loop_closure
@@ -8,6 +8,8 @@
 #include <gtsam/inference/Symbol.h>
 
 #include "loop_closure/LoopGeneration.h"
+#include "loop_closure/PoseStore.h"
+#include "loop_closure/ProximityCandidateGenerator.h"
 
 namespace lamp_loop_closure {
 
@@ -35,11 +37,8 @@ protected:
   double DistanceBetweenKeys(const gtsam::Symbol& key1,
                              const gtsam::Symbol& key2) const;
 
-  double proximity_threshold_max_;
-  double proximity_threshold_min_;
-  double increase_rate_;
-  int n_closest_;
-  size_t skip_recent_poses_;
+  PoseStore poses_;
+  ProximityCandidateGenerator generator_;
 };
 
 } // namespace lamp_loop_closure
\ No newline at end of file
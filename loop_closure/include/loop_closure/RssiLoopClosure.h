@@ -10,6 +10,8 @@
 #include <silvus_msgs/SilvusStreamscape.h>
 #include <std_msgs/Float64.h>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <lamp_utils/CommonFunctions.h>
 #include <lamp_utils/PoseGraph.h>
 #include <lamp_utils/PrefixHandling.h>
@@ -30,6 +32,12 @@ struct PoseGraphNodeForLoopClosureStatus {
 using NodesAroundCommOneFlyby = std::vector<PoseGraphNodeForLoopClosureStatus>;
 using AllNodesAroundComm = std::vector<NodesAroundCommOneFlyby>;
 
+// Position of a node in all_nodes_around_comm
+struct FlybyNodeRef {
+  size_t flyby;
+  size_t index;
+};
+
 struct RssiRawInfo {
   bool b_dropped{false};
   pose_graph_msgs::CommNodeInfo comm_node_info;
@@ -37,7 +45,25 @@ struct RssiRawInfo {
   AllNodesAroundComm all_nodes_around_comm;
   int flyby_number{0};
   const uint close_keys_threshold_{20};
+  // Indexes of the flyby nodes: their keys, and a grid of their positions
+  // with cells of cell_size (no grid when 0)
+  std::unordered_set<gtsam::Key> flyby_keys;
+  double cell_size{0.0};
+  std::unordered_map<std::int64_t, std::vector<FlybyNodeRef>> flyby_cells;
+  // Nodes are only appended to the newest flyby, so the nodes before this
+  // one have already been handled by the loop generation
+  FlybyNodeRef next_unhandled{0, 0};
   bool append_node(const pose_graph_msgs::PoseGraphNode& node);
+  // Moves to the next node that has not been handled, false when there is none
+  bool next_unhandled_node(FlybyNodeRef* ref);
+  // Nodes of the flybys before before_flyby within radius of position,
+  // ordered by flyby and index. Needs the grid
+  std::vector<FlybyNodeRef> neighbours(const geometry_msgs::Point& position,
+                                       double radius,
+                                       size_t before_flyby) const;
+  void index_node(const pose_graph_msgs::PoseGraphNode& node,
+                  const FlybyNodeRef& ref);
+  std::int64_t cell_key(std::int64_t x, std::int64_t y, std::int64_t z) const;
   // if pose has key 0 it means that node haven't been found; if keys
   // are the same means that the robot doesn't move and is in the same
   // place what the comm node has a pose, and check if the same pose was
@@ -82,6 +108,9 @@ private:
   float measured_path_loss_dB_{55.0f};
   uint close_keys_threshold_{20};
   std::string radio_loop_closure_method_{"radio_to_nodes"};
+  // Radius of the flyby nodes paired with a new node, all previous flyby nodes
+  // when 0
+  double flyby_neighbour_radius_{0.0};
 
   // variable of params
   std::string node_name_;
@@ -97,6 +126,8 @@ private:
   std::map<gtsam::Key, float> lowest_distance_;
   std::map<unsigned char, std::map<double, pose_graph_msgs::PoseGraphNode>>
       robots_trajectory_;
+  // Stamp of each key in robots_trajectory_
+  std::unordered_map<gtsam::Key, double> key_stamps_;
 
   // const
   const int ANTENAS_NUMBER_IN_ROBOT{2};
@@ -138,9 +169,8 @@ private:
       const ros::Time& stamp,
       double time_threshold = 2.0,
       bool check_threshold = false) const;
-  pose_graph_msgs::PoseGraphNode GetPoseGraphNodeFromKey(
-      const std::map<double, pose_graph_msgs::PoseGraphNode>& robot_trajectory,
-      const gtsam::Symbol& key) const;
+  pose_graph_msgs::PoseGraphNode
+  GetPoseGraphNodeFromKey(const gtsam::Symbol& key) const;
   bool is_robot_radio(const std::string& hostname) const;
 
   //*************Math*******************/
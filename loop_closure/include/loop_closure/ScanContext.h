@@ -0,0 +1,45 @@
+/**
+ * @file   ScanContext.h
+ * @brief  Global place descriptor of a keyed scan: a polar grid of the
+ *         highest point per cell and a rotation invariant ring key
+ */
+#pragma once
+
+#include <Eigen/Core>
+
+#include <lamp_utils/PointCloudTypes.h>
+
+namespace lamp_loop_closure {
+
+struct ScanContextParams {
+  int num_rings = 20;
+  int num_sectors = 60;
+  // Points further away from the sensor are ignored (m)
+  double max_radius = 80.0;
+  // Added to the point heights so that cells with points are non-zero (m)
+  double sensor_height = 2.0;
+  // Sectors searched on each side of the coarse alignment
+  int search_sectors = 3;
+};
+
+struct ScanContext {
+  // num_rings x num_sectors, zero for empty cells
+  Eigen::MatrixXf grid;
+  // Share of occupied cells per ring
+  Eigen::VectorXf ring_key;
+  // Mean height per sector, for the coarse alignment
+  Eigen::VectorXf sector_key;
+};
+
+void ComputeScanContext(const PointCloud& scan,
+                        const ScanContextParams& params,
+                        ScanContext* descriptor);
+
+// Mean cosine distance of the grid columns in [0, 1] at the best sector
+// shift of b, which is returned in shift if given
+double ScanContextDistance(const ScanContext& a,
+                           const ScanContext& b,
+                           const ScanContextParams& params,
+                           int* shift = nullptr);
+
+} // namespace lamp_loop_closure
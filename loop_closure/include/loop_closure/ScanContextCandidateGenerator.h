@@ -0,0 +1,71 @@
+/**
+ * @file   ScanContextCandidateGenerator.h
+ * @brief  Find potential loop closures by matching global place descriptors
+ *         of the keyed scans, independently of the pose drift
+ */
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+
+#include <gtsam/inference/Symbol.h>
+#include <pose_graph_msgs/KeyedScan.h>
+
+#include "loop_closure/CandidateGenerator.h"
+#include "loop_closure/DescriptorIndex.h"
+#include "loop_closure/ScanContext.h"
+
+namespace lamp_loop_closure {
+
+class ScanContextCandidateGenerator : public CandidateGenerator {
+  friend class TestLoopGeneration;
+
+public:
+  ScanContextCandidateGenerator();
+  ~ScanContextCandidateGenerator();
+
+  bool Initialize(const ros::NodeHandle& n,
+                  const CandidateSink& sink) override;
+
+  bool LoadParameters(const std::string& param_ns);
+
+  void GenerateLoops(
+      const PoseStore& poses,
+      const std::vector<gtsam::Key>& new_keys,
+      std::vector<pose_graph_msgs::LoopCandidate>* candidates) override;
+
+private:
+  void KeyedScanCallback(const pose_graph_msgs::KeyedScan::ConstPtr& scan_msg);
+
+  void AddDescriptor(gtsam::Key key, const PointCloud& scan);
+
+  // Candidates of one key against the indexed descriptors
+  void GenerateLoops(const PoseStore& poses,
+                     const gtsam::Symbol& key,
+                     const ScanContext& descriptor,
+                     std::vector<pose_graph_msgs::LoopCandidate>* candidates);
+
+  ScanContextParams params_;
+  // Candidates above this descriptor distance are dropped
+  double max_distance_;
+  // Ring key neighbours compared on the full descriptor
+  size_t num_nearest_;
+  // Candidates kept per key, best first
+  size_t n_best_;
+  // Keys of the same robot closer than this in index are not compared
+  int skip_recent_keys_;
+
+  ros::Subscriber keyed_scans_sub_;
+
+  std::mutex descriptors_mutex_;
+  std::unordered_map<gtsam::Key, ScanContext> descriptors_;
+
+  // Keys in the pose store waiting for their scan, oldest first. Past
+  // max_pending_keys_ the oldest are dropped, their scan may never come.
+  std::vector<gtsam::Key> pending_keys_;
+  size_t max_pending_keys_;
+  // Ring keys of the keys compared so far, sized once the parameters are in
+  std::unique_ptr<DescriptorIndex> index_;
+};
+
+} // namespace lamp_loop_closure
@@ -0,0 +1,50 @@
+/**
+ * @file   CandidateGenerator.cc
+ * @brief  Interface of the candidate generators run by LoopGenerationEngine
+ */
+
+#include "loop_closure/CandidateGenerator.h"
+#include "loop_closure/ProximityCandidateGenerator.h"
+#include "loop_closure/RssiLoopClosure.h"
+#include "loop_closure/ScanContextCandidateGenerator.h"
+
+namespace lamp_loop_closure {
+
+namespace {
+
+// Radio signal candidates come from the radio callbacks of a hosted
+// RssiLoopClosure, which keeps its own stamp ordered trajectories
+class RssiCandidateGenerator : public CandidateGenerator {
+public:
+  bool Initialize(const ros::NodeHandle& n,
+                  const CandidateSink& sink) override {
+    rssi_.SetCandidateSink(sink);
+    return rssi_.Initialize(n);
+  }
+
+  // Radio candidates are sent directly to the prioritized candidates, as by
+  // the rssi_loop_generation_node
+  bool IsPrioritized() const override {
+    return true;
+  }
+
+private:
+  RssiLoopClosure rssi_;
+};
+
+} // namespace
+
+std::unique_ptr<CandidateGenerator>
+CreateCandidateGenerator(const std::string& name) {
+  if (name == "proximity") {
+    return std::unique_ptr<CandidateGenerator>(new ProximityCandidateGenerator);
+  } else if (name == "rssi") {
+    return std::unique_ptr<CandidateGenerator>(new RssiCandidateGenerator);
+  } else if (name == "scan_context") {
+    return std::unique_ptr<CandidateGenerator>(
+        new ScanContextCandidateGenerator);
+  }
+  return std::unique_ptr<CandidateGenerator>();
+}
+
+} // namespace lamp_loop_closure
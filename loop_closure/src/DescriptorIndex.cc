@@ -0,0 +1,179 @@
+/**
+ * @file   DescriptorIndex.cc
+ * @brief  Incremental nearest neighbour index of keyed descriptor vectors
+ */
+
+#include <algorithm>
+#include <limits>
+
+#include "loop_closure/DescriptorIndex.h"
+
+namespace lamp_loop_closure {
+
+namespace {
+// Ranges of at most this many descriptors are searched linearly
+const size_t kLeafSize = 8;
+
+bool HeapCompare(const std::pair<float, gtsam::Key>& a,
+                 const std::pair<float, gtsam::Key>& b) {
+  return a.first < b.first;
+}
+} // namespace
+
+DescriptorIndex::DescriptorIndex(size_t dimension)
+  : dimension_(dimension), size_(0) {}
+DescriptorIndex::~DescriptorIndex() {}
+
+void DescriptorIndex::Insert(gtsam::Key key,
+                             const Eigen::VectorXf& descriptor) {
+  std::unique_ptr<Tree> tree(new Tree);
+  tree->keys.push_back(key);
+  tree->points.assign(descriptor.data(), descriptor.data() + dimension_);
+
+  // Merge with the trees of the occupied slots below the first free one
+  size_t slot = 0;
+  for (; slot < trees_.size() && trees_[slot]; slot++) {
+    const Tree& other = *trees_[slot];
+    tree->keys.insert(tree->keys.end(), other.keys.begin(), other.keys.end());
+    tree->points.insert(
+        tree->points.end(), other.points.begin(), other.points.end());
+    trees_[slot].reset();
+  }
+  if (slot == trees_.size())
+    trees_.emplace_back();
+  Build(tree.get());
+  trees_[slot] = std::move(tree);
+  size_++;
+}
+
+void DescriptorIndex::Build(Tree* tree) const {
+  const size_t n = tree->keys.size();
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) {
+    order[i] = i;
+  }
+  tree->split_dims.assign(n, 0);
+  Build(tree, &order, 0, n);
+
+  // Store the descriptors in tree order
+  std::vector<gtsam::Key> keys(n);
+  std::vector<float> points(n * dimension_);
+  for (size_t i = 0; i < n; i++) {
+    keys[i] = tree->keys[order[i]];
+    std::copy(tree->points.begin() + order[i] * dimension_,
+              tree->points.begin() + (order[i] + 1) * dimension_,
+              points.begin() + i * dimension_);
+  }
+  tree->keys.swap(keys);
+  tree->points.swap(points);
+}
+
+void DescriptorIndex::Build(Tree* tree,
+                            std::vector<size_t>* order,
+                            size_t lo,
+                            size_t hi) const {
+  if (hi - lo <= kLeafSize)
+    return;
+
+  // Split along the dimension of largest spread
+  int split_dim = 0;
+  float largest_spread = -1.0f;
+  for (size_t d = 0; d < dimension_; d++) {
+    float min = std::numeric_limits<float>::max();
+    float max = std::numeric_limits<float>::lowest();
+    for (size_t i = lo; i < hi; i++) {
+      const float value = tree->points[(*order)[i] * dimension_ + d];
+      min = std::min(min, value);
+      max = std::max(max, value);
+    }
+    if (max - min > largest_spread) {
+      largest_spread = max - min;
+      split_dim = d;
+    }
+  }
+
+  const size_t mid = (lo + hi) / 2;
+  const std::vector<float>& points = tree->points;
+  const size_t dimension = dimension_;
+  std::nth_element(order->begin() + lo,
+                   order->begin() + mid,
+                   order->begin() + hi,
+                   [&](size_t a, size_t b) {
+                     return points[a * dimension + split_dim] <
+                         points[b * dimension + split_dim];
+                   });
+  tree->split_dims[mid] = split_dim;
+  Build(tree, order, lo, mid);
+  Build(tree, order, mid + 1, hi);
+}
+
+std::vector<std::pair<float, gtsam::Key>>
+DescriptorIndex::Nearest(const Eigen::VectorXf& query,
+                         size_t k,
+                         const std::function<bool(gtsam::Key)>& accept) const {
+  Heap heap;
+  if (k == 0)
+    return heap;
+  for (const auto& tree : trees_) {
+    if (tree)
+      Search(*tree, query.data(), 0, tree->keys.size(), k, accept, &heap);
+  }
+  std::sort_heap(heap.begin(), heap.end(), HeapCompare);
+  return heap;
+}
+
+void DescriptorIndex::Search(const Tree& tree,
+                             const float* query,
+                             size_t lo,
+                             size_t hi,
+                             size_t k,
+                             const std::function<bool(gtsam::Key)>& accept,
+                             Heap* heap) const {
+  if (hi - lo <= kLeafSize) {
+    for (size_t i = lo; i < hi; i++) {
+      Visit(tree, i, query, k, accept, heap);
+    }
+    return;
+  }
+
+  const size_t mid = (lo + hi) / 2;
+  const int split_dim = tree.split_dims[mid];
+  const float diff =
+      query[split_dim] - tree.points[mid * dimension_ + split_dim];
+  Visit(tree, mid, query, k, accept, heap);
+  if (diff < 0.0f) {
+    Search(tree, query, lo, mid, k, accept, heap);
+    if (heap->size() < k || diff * diff < heap->front().first)
+      Search(tree, query, mid + 1, hi, k, accept, heap);
+  } else {
+    Search(tree, query, mid + 1, hi, k, accept, heap);
+    if (heap->size() < k || diff * diff < heap->front().first)
+      Search(tree, query, lo, mid, k, accept, heap);
+  }
+}
+
+void DescriptorIndex::Visit(const Tree& tree,
+                            size_t i,
+                            const float* query,
+                            size_t k,
+                            const std::function<bool(gtsam::Key)>& accept,
+                            Heap* heap) const {
+  const float* point = &tree.points[i * dimension_];
+  float distance = 0.0f;
+  for (size_t d = 0; d < dimension_; d++) {
+    const float diff = query[d] - point[d];
+    distance += diff * diff;
+  }
+  if (heap->size() == k && distance >= heap->front().first)
+    return;
+  if (accept && !accept(tree.keys[i]))
+    return;
+  if (heap->size() == k) {
+    std::pop_heap(heap->begin(), heap->end(), HeapCompare);
+    heap->pop_back();
+  }
+  heap->emplace_back(distance, tree.keys[i]);
+  std::push_heap(heap->begin(), heap->end(), HeapCompare);
+}
+
+} // namespace lamp_loop_closure
@@ -4,7 +4,10 @@
  * @author Yun Chang
  */
 #include <Eigen/LU>
+#include <algorithm>
 #include <cmath>
+#include <functional>
+#include <limits>
 #include <geometry_utils/GeometryUtilsROS.h>
 #include <parameter_utils/ParameterUtils.h>
 #include <pcl/registration/ia_ransac.h>
@@ -22,6 +25,11 @@ namespace gu = geometry_utils;
 
 namespace lamp_loop_closure {
 
+namespace {
+// Neighbours used for the GICP point covariances
+const int kGicpCorrespondences = 20;
+} // namespace
+
 IcpLoopComputation::IcpLoopComputation()
   : icp_computation_pool_(0), b_accumulate_source_(false) {}
 IcpLoopComputation::~IcpLoopComputation() {}
@@ -85,6 +93,9 @@ bool IcpLoopComputation::LoadParameters(const ros::NodeHandle& n) {
     return false;
   if (!pu::Get(param_ns_ + "/icp_lc/max_rotation", icp_max_rotation_))
     return false;
+  if (!pu::Get(param_ns_ + "/icp_lc/keep_best_match_per_source",
+               b_keep_best_match_per_source_))
+    return false;
 
   // Load SAC parameters
   if (!pu::Get(param_ns_ + "/sac_ia/iterations", sac_iterations_))
@@ -145,6 +156,7 @@ bool IcpLoopComputation::LoadParameters(const ros::NodeHandle& n) {
   icp_covariance_method_ = IcpCovarianceMethod(icp_covar_method);
 
   SetupICP(icp_);
+  ClearIcpPool();
 
   // Hard coded covariances
   if (!pu::Get("laser_lc_rot_sigma", laser_lc_rot_sigma_))
@@ -198,10 +210,38 @@ bool IcpLoopComputation::SetupICP(pcl::MultithreadedGeneralizedIterativeClosestP
   icp.setRANSACIterations(0);
   icp.setMaximumOptimizerIterations(50);
   icp.setNumThreads(icp_threads_);
+  icp.setCorrespondenceRandomness(kGicpCorrespondences);
   icp.enableTimingOutput(true);
   return true;
 }
 
+IcpLoopComputation::Gicp* IcpLoopComputation::AcquireIcp() {
+  std::lock_guard<std::mutex> lock(icp_engines_mutex_);
+  if (idle_icp_engines_.empty()) {
+    icp_engines_.emplace_back(new Gicp);
+    SetupICP(*icp_engines_.back());
+    ROS_DEBUG_STREAM("Created ICP engine " << icp_engines_.size()
+                                           << " for the computation pool");
+    return icp_engines_.back().get();
+  }
+  Gicp* icp = idle_icp_engines_.back();
+  idle_icp_engines_.pop_back();
+  return icp;
+}
+
+void IcpLoopComputation::ReleaseIcp(Gicp* icp) {
+  std::lock_guard<std::mutex> lock(icp_engines_mutex_);
+  idle_icp_engines_.push_back(icp);
+}
+
+void IcpLoopComputation::ClearIcpPool() {
+  // Only called while no alignment is running, engines are recreated with
+  // the current parameters when needed
+  std::lock_guard<std::mutex> lock(icp_engines_mutex_);
+  idle_icp_engines_.clear();
+  icp_engines_.clear();
+}
+
 bool IcpLoopComputation::CheckReclosingDistance(gtsam::Key key_from,
                                                 gtsam::Key key_to) const {
 
@@ -244,126 +284,143 @@ void IcpLoopComputation::ComputeTransforms() {
   // First make copy of input queue
   size_t n = input_queue_.size();
 
-  if (number_of_threads_in_icp_computation_pool_ == 1){
-      //If we have decided to not use the thread pool
-      // Iterate and compute transforms
-      for (size_t i = 0; i < n; i++) {
-          auto candidate = input_queue_.front();
-          input_queue_.pop();
-
-          // Keyed scans do not exist
-          if (keyed_scans_.find(candidate.key_from) == keyed_scans_.end() ||
-              keyed_scans_.find(candidate.key_to) == keyed_scans_.end()) {
-              if ((ros::Time::now() - candidate.header.stamp).toSec() <
-                  keyed_scans_max_delay_)
-                  input_queue_.push(candidate);
-              if (keyed_scans_.find(candidate.key_from) == keyed_scans_.end()){
-                  ROS_INFO_STREAM("Missing Candidate for " << candidate.key_from);
-              }
-
-              if (keyed_scans_.find(candidate.key_to) == keyed_scans_.end()) {
-                  ROS_INFO_STREAM("Missing Candidate for " << candidate.key_to);
-              }
-              continue;
-
-          }
-
-          gtsam::Key key_from = candidate.key_from;
-          gtsam::Key key_to = candidate.key_to;
-
-          if (!CheckReclosingDistance(key_from, key_to)) {
-            continue;
-          }
-          gtsam::Pose3 pose_from = lamp_utils::ToGtsam(candidate.pose_from);
-          gtsam::Pose3 pose_to = lamp_utils::ToGtsam(candidate.pose_to);
-
-          gu::Transform3 transform;
-          gtsam::Matrix66 covariance;
-          double icp_fitness;
-          if (!PerformAlignment(key_from,
-                                key_to,
-                                pose_from,
-                                pose_to,
-                                &transform,
-                                &covariance,
-                                &icp_fitness,
-                                false))
-            continue;
-
-          // If aligned create PoseGraphEdge msg
-          pose_graph_msgs::PoseGraphEdge loop_closure =
-                  CreateLoopClosureEdge(key_from, key_to, transform, covariance);
-          closed_keyes_.insert(key_from);
-          closed_keyes_.insert(key_to);
-          loop_closure.range_error = icp_fitness;
-          output_queue_.push_back(loop_closure);
+  // Group the candidates by source scan, in order of first appearance, so
+  // that each source is prepared once for all of its targets
+  std::vector<std::vector<pose_graph_msgs::LoopCandidate>> groups;
+  std::unordered_map<gtsam::Key, size_t> group_index;
+  for (size_t i = 0; i < n; i++) {
+    auto candidate = input_queue_.front();
+    input_queue_.pop();
+
+    // Keyed scans do not exist
+    if (keyed_scans_.find(candidate.key_from) == keyed_scans_.end() ||
+        keyed_scans_.find(candidate.key_to) == keyed_scans_.end()) {
+      if ((ros::Time::now() - candidate.header.stamp).toSec() <
+          keyed_scans_max_delay_)
+        input_queue_.push(candidate);
+      if (keyed_scans_.find(candidate.key_from) == keyed_scans_.end()) {
+        ROS_INFO_STREAM("Missing Candidate for " << candidate.key_from);
       }
+
+      if (keyed_scans_.find(candidate.key_to) == keyed_scans_.end()) {
+        ROS_INFO_STREAM("Missing Candidate for " << candidate.key_to);
+      }
+      continue;
+    }
+
+    auto group = group_index.find(candidate.key_from);
+    if (group == group_index.end()) {
+      group_index[candidate.key_from] = groups.size();
+      groups.emplace_back(1, candidate);
+    } else {
+      groups[group->second].push_back(candidate);
+    }
+  }
+  ROS_DEBUG_STREAM("Aligning " << n << " candidates from " << groups.size()
+                               << " source scans");
+
+  if (number_of_threads_in_icp_computation_pool_ == 1) {
+    // If we have decided to not use the thread pool
+    for (const auto& group : groups) {
+      std::vector<pose_graph_msgs::PoseGraphEdge> loop_closures =
+          AlignCandidateGroup(group, false);
+      output_queue_.insert(
+          output_queue_.end(), loop_closures.begin(), loop_closures.end());
+    }
   } else {
     ROS_DEBUG_STREAM("Threaded, Queue Size " << n);
-    std::vector<std::future<std::pair<bool, pose_graph_msgs::PoseGraphEdge>>>
+    std::vector<std::future<std::vector<pose_graph_msgs::PoseGraphEdge>>>
         futures;
-    // Iterate and compute transforms
-    for (size_t i = 0; i < n; i++) {
-      auto candidate = input_queue_.front();
-      input_queue_.pop();
-      // Keyed scans do not exist
-      if (keyed_scans_.find(candidate.key_from) == keyed_scans_.end() ||
-          keyed_scans_.find(candidate.key_to) == keyed_scans_.end()) {
-        if ((ros::Time::now() - candidate.header.stamp).toSec() <
-            keyed_scans_max_delay_)
-          input_queue_.push(candidate);
-        if (keyed_scans_.find(candidate.key_from) == keyed_scans_.end()) {
-          ROS_INFO_STREAM("Missing Candidate for " << candidate.key_from);
-        }
-
-        if (keyed_scans_.find(candidate.key_to) == keyed_scans_.end()) {
-          ROS_INFO_STREAM("Missing Candidate for " << candidate.key_to);
-        }
-        continue;
-      }
+    for (const auto& group : groups) {
+      futures.emplace_back(icp_computation_pool_.enqueue(
+          [this, group]() { return AlignCandidateGroup(group, true); }));
+    }
+    // Workers read closed_keyes_, so it is only updated once all are done
+    size_t n_closed = output_queue_.size();
+    for (auto& future : futures) {
+      std::vector<pose_graph_msgs::PoseGraphEdge> loop_closures = future.get();
+      output_queue_.insert(
+          output_queue_.end(), loop_closures.begin(), loop_closures.end());
+    }
+    for (size_t i = n_closed; i < output_queue_.size(); i++) {
+      closed_keyes_.insert(output_queue_[i].key_from);
+      closed_keyes_.insert(output_queue_[i].key_to);
+    }
+  }
+}
 
-      // pose_graph_msgs::LoopCandidate* candidate_ptr = new
-      // pose_graph_msgs::LoopCandidate(candidate);
-      futures.emplace_back(icp_computation_pool_.enqueue([&, candidate]() {
-        gtsam::Key key_from = candidate.key_from;
-        gtsam::Key key_to = candidate.key_to;
-        gtsam::Pose3 pose_from = lamp_utils::ToGtsam(candidate.pose_from);
-        gtsam::Pose3 pose_to = lamp_utils::ToGtsam(candidate.pose_to);
-
-        if (!CheckReclosingDistance(key_from, key_to)) {
-          return std::make_pair(false, pose_graph_msgs::PoseGraphEdge());
-        }
-
-        gu::Transform3 transform;
-        gtsam::Matrix66 covariance;
-        double icp_fitness;
-        if (!PerformAlignment(key_from,
-                              key_to,
-                              pose_from,
-                              pose_to,
-                              &transform,
-                              &covariance,
-                              &icp_fitness,
-                              true))
-          return std::make_pair(false, pose_graph_msgs::PoseGraphEdge());
-        // If aligned create PoseGraphEdge msg
-        pose_graph_msgs::PoseGraphEdge loop_closure =
-            CreateLoopClosureEdge(key_from, key_to, transform, covariance);
-        closed_keyes_.insert(key_from);
-        closed_keyes_.insert(key_to);
-        loop_closure.range_error = icp_fitness;
-        return std::make_pair(true, loop_closure);
-      }));
-      }
-      for (auto &future : futures) {
-          future.wait();
-          auto result = future.get();
-          bool alignment_was_successful = result.first;
-          if (alignment_was_successful) {
-              output_queue_.push_back(result.second);
-          }
-      }
+std::vector<pose_graph_msgs::PoseGraphEdge>
+IcpLoopComputation::AlignCandidateGroup(
+    const std::vector<pose_graph_msgs::LoopCandidate>& group,
+    bool use_pooled_icp) {
+  std::vector<pose_graph_msgs::PoseGraphEdge> loop_closures;
+  if (group.empty())
+    return loop_closures;
+
+  // Pooled engines go back to the pool on every return path
+  std::unique_ptr<Gicp, std::function<void(Gicp*)>> pooled_icp(
+      use_pooled_icp ? AcquireIcp() : nullptr,
+      [this](Gicp* icp) { ReleaseIcp(icp); });
+  Gicp* icp = pooled_icp ? pooled_icp.get() : &icp_;
+
+  // The source and its covariances and search tree are shared by all targets
+  PointCloudConstPtr source;
+  for (const auto& candidate : group) {
+    gtsam::Key key_from = candidate.key_from;
+    gtsam::Key key_to = candidate.key_to;
+
+    if (!CheckReclosingDistance(key_from, key_to))
+      continue;
+    if (!CheckAlignmentInputs(key_from, key_to))
+      continue;
+    if (source == nullptr)
+      source = PrepareSource(key_from);
+
+    gu::Transform3 transform;
+    gtsam::Matrix66 covariance;
+    double icp_fitness;
+    if (!AlignToTarget(*icp,
+                       source,
+                       key_from,
+                       key_to,
+                       lamp_utils::ToGtsam(candidate.pose_from),
+                       lamp_utils::ToGtsam(candidate.pose_to),
+                       &transform,
+                       &covariance,
+                       &icp_fitness))
+      continue;
+
+    // If aligned create PoseGraphEdge msg
+    pose_graph_msgs::PoseGraphEdge loop_closure =
+        CreateLoopClosureEdge(key_from, key_to, transform, covariance);
+    loop_closure.range_error = icp_fitness;
+    loop_closures.push_back(loop_closure);
+
+    // Without the pool, later candidates see this loop closure right away.
+    // Pooled results are recorded once collected.
+    if (!use_pooled_icp && !b_keep_best_match_per_source_) {
+      closed_keyes_.insert(key_from);
+      closed_keyes_.insert(key_to);
+    }
+  }
+
+  if (b_keep_best_match_per_source_ && loop_closures.size() > 1) {
+    auto best = std::min_element(
+        loop_closures.begin(),
+        loop_closures.end(),
+        [](const pose_graph_msgs::PoseGraphEdge& a,
+           const pose_graph_msgs::PoseGraphEdge& b) {
+          return a.range_error < b.range_error;
+        });
+    loop_closures = {*best};
   }
+  if (!use_pooled_icp && b_keep_best_match_per_source_) {
+    for (const auto& loop_closure : loop_closures) {
+      closed_keyes_.insert(loop_closure.key_from);
+      closed_keyes_.insert(loop_closure.key_to);
+    }
+  }
+  return loop_closures;
 }
 
 void IcpLoopComputation::ProcessTimerCallback(const ros::TimerEvent& ev) {
@@ -424,16 +481,29 @@ bool IcpLoopComputation::PerformAlignment(const gtsam::Symbol& key1,
                                           gu::Transform3* delta,
                                           gtsam::Matrix66* covariance,
                                           double* fitness_score,
-                                          bool re_initialize_icp) {
-  ROS_DEBUG_STREAM("Performing alignment between "
-                   << gtsam::DefaultKeyFormatter(key1) << " and "
-                   << gtsam::DefaultKeyFormatter(key2));
-
-  if (delta == NULL || covariance == NULL) {
-    ROS_ERROR("PerformAlignment: Output pointers are null.");
+                                          bool use_pooled_icp) {
+  if (!CheckAlignmentInputs(key1, key2))
     return false;
-  }
 
+  // Pooled engines go back to the pool on every return path
+  std::unique_ptr<Gicp, std::function<void(Gicp*)>> pooled_icp(
+      use_pooled_icp ? AcquireIcp() : nullptr,
+      [this](Gicp* icp) { ReleaseIcp(icp); });
+  Gicp* icp = pooled_icp ? pooled_icp.get() : &icp_;
+
+  return AlignToTarget(*icp,
+                       PrepareSource(key1),
+                       key1,
+                       key2,
+                       pose1,
+                       pose2,
+                       delta,
+                       covariance,
+                       fitness_score);
+}
+
+bool IcpLoopComputation::CheckAlignmentInputs(const gtsam::Symbol& key1,
+                                              const gtsam::Symbol& key2) const {
   // Check for available information
   if (!keyed_scans_.count(key1) || !keyed_scans_.count(key2)) {
     ROS_WARN(
@@ -463,31 +533,52 @@ bool IcpLoopComputation::PerformAlignment(const gtsam::Symbol& key1,
     ROS_ERROR("PerformAlignment: empty point clouds.");
     return false;
   }
+  return true;
+}
 
-  PointCloud::Ptr accumulated_target(new PointCloud);
-  *accumulated_target = *scan2;
-  AccumulateScans(key2, accumulated_target);
-
+PointCloudConstPtr IcpLoopComputation::PrepareSource(const gtsam::Key key) {
   PointCloud::Ptr accumulated_source(new PointCloud);
-  *accumulated_source = *scan1;
+  *accumulated_source = *keyed_scans_.at(key);
 
   if (b_accumulate_source_) {
-    AccumulateScans(key1, accumulated_source);
+    AccumulateScans(key, accumulated_source);
   }
+  return accumulated_source;
+}
 
-  pcl::MultithreadedGeneralizedIterativeClosestPoint<Point, Point>* icp;
-  if (re_initialize_icp){
-    icp = new  pcl::MultithreadedGeneralizedIterativeClosestPoint<Point, Point>();
-    SetupICP(*icp);
-  } else {
-      icp = &icp_;
-  }
-  icp->setInputSource(accumulated_source);
-  icp->setInputTarget(accumulated_target);
-  if (accumulated_source->size() < 20) {
-    icp->setCorrespondenceRandomness(accumulated_source->size());
+bool IcpLoopComputation::AlignToTarget(
+    Gicp& icp,
+    const PointCloudConstPtr& accumulated_source,
+    const gtsam::Symbol& key1,
+    const gtsam::Symbol& key2,
+    const gtsam::Pose3& pose1,
+    const gtsam::Pose3& pose2,
+    gu::Transform3* delta,
+    gtsam::Matrix66* covariance,
+    double* fitness_score) {
+  ROS_DEBUG_STREAM("Performing alignment between "
+                   << gtsam::DefaultKeyFormatter(key1) << " and "
+                   << gtsam::DefaultKeyFormatter(key2));
+
+  if (delta == NULL || covariance == NULL) {
+    ROS_ERROR("PerformAlignment: Output pointers are null.");
+    return false;
   }
 
+  const PointCloudConstPtr scan1 = keyed_scans_.at(key1.key());
+  const PointCloudConstPtr scan2 = keyed_scans_.at(key2.key());
+
+  PointCloud::Ptr accumulated_target(new PointCloud);
+  *accumulated_target = *scan2;
+  AccumulateScans(key2, accumulated_target);
+
+  // Setting the same source again keeps its covariances and search tree
+  icp.setInputSourceCached(accumulated_source);
+  icp.setInputTarget(accumulated_target);
+  // Engines are reused, so set the neighbourhood size for every alignment
+  icp.setCorrespondenceRandomness(std::min<int>(
+      kGicpCorrespondences, static_cast<int>(accumulated_source->size())));
+
   ///// ICP initialization scheme
   // Default is to initialize by identity. Other options include
   // initializing with odom measurement
@@ -544,24 +635,29 @@ bool IcpLoopComputation::PerformAlignment(const gtsam::Symbol& key1,
 
   // Perform ICP_.
   PointCloud::Ptr icp_result(new PointCloud);
-  icp->align(*icp_result, initial_guess);
+  icp.align(*icp_result, initial_guess);
 
   // Get resulting transform.
-  const Eigen::Matrix4f T = icp->getFinalTransformation();
+  const Eigen::Matrix4f T = icp.getFinalTransformation();
 
-  // Get the correspondence indices
+  // Get the correspondence indices found by GICP at the final transform
   std::vector<size_t> correspondences;
   if (icp_covariance_method_ == IcpCovarianceMethod::POINT2PLANE) {
-    KdTree::Ptr search_tree = icp->getSearchMethodTarget();
-    for (auto point : icp_result->points) {
-      // Catch nan of infs in icp result
+    // Catch nan of infs in icp result
+    for (const auto& point : icp_result->points) {
       if (!pcl::isFinite(point))
         return false;
+    }
 
-      std::vector<int> matched_indices;
-      std::vector<float> matched_distances;
-      search_tree->nearestKSearch(point, 1, matched_indices, matched_distances);
-      correspondences.push_back(matched_indices[0]);
+    const std::vector<int>& matches = icp.getFinalCorrespondences();
+    if (matches.size() != icp_result->size())
+      return false;
+    // Unmatched points are out of range and skipped by the covariance
+    correspondences.reserve(matches.size());
+    for (const int match : matches) {
+      correspondences.push_back(match < 0
+                                    ? std::numeric_limits<size_t>::max()
+                                    : static_cast<size_t>(match));
     }
   }
 
@@ -577,17 +673,17 @@ bool IcpLoopComputation::PerformAlignment(const gtsam::Symbol& key1,
                              T(2, 2));
 
   // Is the transform good?
-  if (!icp->hasConverged()) {
+  if (!icp.hasConverged()) {
     ROS_DEBUG_STREAM(
-        "ICP: Not converged, score is: " << icp->getFitnessScore());
+        "ICP: Not converged, score is: " << icp.getFitnessScore());
     return false;
   }
 
-  *fitness_score = icp->getFitnessScore();
+  *fitness_score = icp.getFitnessScore();
 
   if (*fitness_score > max_tolerable_fitness_) {
     ROS_INFO_STREAM("ICP: Converged or max iterations reached, but score: "
-                    << icp->getFitnessScore()
+                    << icp.getFitnessScore()
                     << ", Exceeds threshold: " << max_tolerable_fitness_);
     return false;
   }
@@ -710,17 +806,9 @@ bool IcpLoopComputation::ComputeICPCovariancePointPlane(
     const std::vector<size_t>& correspondences,
     const Eigen::Matrix4f& T,
     Eigen::Matrix<double, 6, 6>* covariance) {
-  // Get normals
-  Normals::Ptr reference_normals(new Normals);      // pc with normals
-  PointCloud::Ptr query_normalized(new PointCloud); // pc whose points have
-                                                    // been rearranged.
   Eigen::Matrix<double, 6, 6> Ap;
-
-  lamp_utils::ExtractNormals(reference_cloud, reference_normals);
-  lamp_utils::NormalizePCloud(query_cloud, query_normalized);
-
   lamp_utils::ComputeAp_ForPoint2PlaneICP(
-      query_normalized, reference_normals, correspondences, T, Ap);
+      query_cloud, reference_cloud, correspondences, T, icp_threads_, Ap);
   // If matrix not invertible, use fixed
   if (Ap.determinant() == 0) {
     for (int i = 0; i < 3; ++i)
@@ -793,93 +881,93 @@ bool IcpLoopComputation::ComputeICPCovariancePointPoint(
   double p = ICP_transformation.rotation.Pitch();
   double y = ICP_transformation.rotation.Yaw();
 
-  // Symbolic expression of the Jacobian matrix
-  double J11, J12, J13, J14, J15, J16, J21, J22, J23, J24, J25, J26, J31, J32,
-      J33, J34, J35, J36;
+  // The angles are fixed for all points
+  const double sr = sin(r), cr = cos(r);
+  const double sp = sin(p), cp = cos(p);
+  const double sy = sin(y), cy = cos(y);
 
-  Eigen::Matrix<double, 6, 6> H;
-  H = Eigen::MatrixXd::Zero(6, 6);
-
-  // Compute the entries of Jacobian
+  // Compute the entries of Jacobian and sum J'XJ (6X6) over all the points
+  // in the point cloud
   // Entries of Jacobian matrix are obtained from MATLAB Symbolic Toolbox
-  for (size_t i = 0; i < pointCloud->points.size(); ++i) {
-    double p_x = pointCloud->points[i].x;
-    double p_y = pointCloud->points[i].y;
-    double p_z = pointCloud->points[i].z;
-
-    J11 = 0.0;
-    J12 = -2.0 *
-        (p_z * sin(p) + p_x * cos(p) * cos(y) - p_y * cos(p) * sin(y)) *
-        (t_x - p_x + p_z * cos(p) - p_x * cos(y) * sin(p) +
-         p_y * sin(p) * sin(y));
-    J13 = 2.0 * (p_y * cos(y) * sin(p) + p_x * sin(p) * sin(y)) *
-        (t_x - p_x + p_z * cos(p) - p_x * cos(y) * sin(p) +
-         p_y * sin(p) * sin(y));
-    J14 = 2.0 * t_x - 2.0 * p_x + 2.0 * p_z * cos(p) -
-        2.0 * p_x * cos(y) * sin(p) + 2.0 * p_y * sin(p) * sin(y);
-    J15 = 0.0;
-    J16 = 0.0;
-
-    J21 = 2.0 *
-        (p_x * (cos(r) * sin(y) + cos(p) * cos(y) * sin(r)) +
-         p_y * (cos(r) * cos(y) - cos(p) * sin(r) * sin(y)) +
-         p_z * sin(p) * sin(r)) *
-        (p_y - t_y + p_x * (sin(r) * sin(y) - cos(p) * cos(r) * cos(y)) +
-         p_y * (cos(y) * sin(r) + cos(p) * cos(r) * sin(y)) -
-         p_z * cos(r) * sin(p));
-    J22 = -2.0 *
-        (p_z * cos(p) * cos(r) - p_x * cos(r) * cos(y) * sin(p) +
-         p_y * cos(r) * sin(p) * sin(y)) *
-        (p_y - t_y + p_x * (sin(r) * sin(y) - cos(p) * cos(r) * cos(y)) +
-         p_y * (cos(y) * sin(r) + cos(p) * cos(r) * sin(y)) -
-         p_z * cos(r) * sin(p));
-    J23 = 2.0 *
-        (p_x * (cos(y) * sin(r) + cos(p) * cos(r) * sin(y)) -
-         p_y * (sin(r) * sin(y) - cos(p) * cos(r) * cos(y))) *
-        (p_y - t_y + p_x * (sin(r) * sin(y) - cos(p) * cos(r) * cos(y)) +
-         p_y * (cos(y) * sin(r) + cos(p) * cos(r) * sin(y)) -
-         p_z * cos(r) * sin(p));
-    J24 = 0.0;
-    J25 = 2.0 * t_y - 2.0 * p_y -
-        2.0 * p_x * (sin(r) * sin(y) - cos(p) * cos(r) * cos(y)) -
-        2.0 * p_y * (cos(y) * sin(r) + cos(p) * cos(r) * sin(y)) +
-        2.0 * p_z * cos(r) * sin(p);
-    J26 = 0.0;
-
-    J31 = -2.0 *
-        (p_x * (sin(r) * sin(y) - cos(p) * cos(r) * cos(y)) +
-         p_y * (cos(y) * sin(r) + cos(p) * cos(r) * sin(y)) -
-         p_z * cos(r) * sin(p)) *
-        (t_z - p_z + p_x * (cos(r) * sin(y) + cos(p) * cos(y) * sin(r)) +
-         p_y * (cos(r) * cos(y) - cos(p) * sin(r) * sin(y)) +
-         p_z * sin(p) * sin(r));
-    J32 = 2.0 *
-        (p_z * cos(p) * sin(r) - p_x * cos(y) * sin(p) * sin(r) +
-         p_y * sin(p) * sin(r) * sin(y)) *
-        (t_z - p_z + p_x * (cos(r) * sin(y) + cos(p) * cos(y) * sin(r)) +
-         p_y * (cos(r) * cos(y) - cos(p) * sin(r) * sin(y)) +
-         p_z * sin(p) * sin(r));
-    J33 = 2.0 *
-        (p_x * (cos(r) * cos(y) - cos(p) * sin(r) * sin(y)) -
-         p_y * (cos(r) * sin(y) + cos(p) * cos(y) * sin(r))) *
-        (t_z - p_z + p_x * (cos(r) * sin(y) + cos(p) * cos(y) * sin(r)) +
-         p_y * (cos(r) * cos(y) - cos(p) * sin(r) * sin(y)) +
-         p_z * sin(p) * sin(r));
-    J34 = 0.0;
-    J35 = 0.0;
-    J36 = 2.0 * t_z - 2.0 * p_z +
-        2.0 * p_x * (cos(r) * sin(y) + cos(p) * cos(y) * sin(r)) +
-        2.0 * p_y * (cos(r) * cos(y) - cos(p) * sin(r) * sin(y)) +
-        2.0 * p_z * sin(p) * sin(r);
-
-    // Form the 3X6 Jacobian matrix
-    Eigen::Matrix<double, 3, 6> J;
-    J << J11, J12, J13, J14, J15, J16, J21, J22, J23, J24, J25, J26, J31, J32,
-        J33, J34, J35, J36;
-    // Compute J'XJ (6X6) matrix and keep adding for all the points in the point
-    // cloud
-    H += J.transpose() * J;
-  }
+  const Eigen::Matrix<double, 6, 6> H = lamp_utils::ReduceInformationMatrix(
+      pointCloud->points.size(),
+      icp_threads_,
+      [&](size_t i, Eigen::Matrix<double, 6, 6>* local) {
+        const double p_x = pointCloud->points[i].x;
+        const double p_y = pointCloud->points[i].y;
+        const double p_z = pointCloud->points[i].z;
+
+        const double J11 = 0.0;
+        const double J12 = -2.0 *
+            (p_z * sp + p_x * cp * cy - p_y * cp * sy) *
+            (t_x - p_x + p_z * cp - p_x * cy * sp +
+             p_y * sp * sy);
+        const double J13 = 2.0 * (p_y * cy * sp + p_x * sp * sy) *
+            (t_x - p_x + p_z * cp - p_x * cy * sp +
+             p_y * sp * sy);
+        const double J14 = 2.0 * t_x - 2.0 * p_x + 2.0 * p_z * cp -
+            2.0 * p_x * cy * sp + 2.0 * p_y * sp * sy;
+        const double J15 = 0.0;
+        const double J16 = 0.0;
+
+        const double J21 = 2.0 *
+            (p_x * (cr * sy + cp * cy * sr) +
+             p_y * (cr * cy - cp * sr * sy) +
+             p_z * sp * sr) *
+            (p_y - t_y + p_x * (sr * sy - cp * cr * cy) +
+             p_y * (cy * sr + cp * cr * sy) -
+             p_z * cr * sp);
+        const double J22 = -2.0 *
+            (p_z * cp * cr - p_x * cr * cy * sp +
+             p_y * cr * sp * sy) *
+            (p_y - t_y + p_x * (sr * sy - cp * cr * cy) +
+             p_y * (cy * sr + cp * cr * sy) -
+             p_z * cr * sp);
+        const double J23 = 2.0 *
+            (p_x * (cy * sr + cp * cr * sy) -
+             p_y * (sr * sy - cp * cr * cy)) *
+            (p_y - t_y + p_x * (sr * sy - cp * cr * cy) +
+             p_y * (cy * sr + cp * cr * sy) -
+             p_z * cr * sp);
+        const double J24 = 0.0;
+        const double J25 = 2.0 * t_y - 2.0 * p_y -
+            2.0 * p_x * (sr * sy - cp * cr * cy) -
+            2.0 * p_y * (cy * sr + cp * cr * sy) +
+            2.0 * p_z * cr * sp;
+        const double J26 = 0.0;
+
+        const double J31 = -2.0 *
+            (p_x * (sr * sy - cp * cr * cy) +
+             p_y * (cy * sr + cp * cr * sy) -
+             p_z * cr * sp) *
+            (t_z - p_z + p_x * (cr * sy + cp * cy * sr) +
+             p_y * (cr * cy - cp * sr * sy) +
+             p_z * sp * sr);
+        const double J32 = 2.0 *
+            (p_z * cp * sr - p_x * cy * sp * sr +
+             p_y * sp * sr * sy) *
+            (t_z - p_z + p_x * (cr * sy + cp * cy * sr) +
+             p_y * (cr * cy - cp * sr * sy) +
+             p_z * sp * sr);
+        const double J33 = 2.0 *
+            (p_x * (cr * cy - cp * sr * sy) -
+             p_y * (cr * sy + cp * cy * sr)) *
+            (t_z - p_z + p_x * (cr * sy + cp * cy * sr) +
+             p_y * (cr * cy - cp * sr * sy) +
+             p_z * sp * sr);
+        const double J34 = 0.0;
+        const double J35 = 0.0;
+        const double J36 = 2.0 * t_z - 2.0 * p_z +
+            2.0 * p_x * (cr * sy + cp * cy * sr) +
+            2.0 * p_y * (cr * cy - cp * sr * sy) +
+            2.0 * p_z * sp * sr;
+
+        // Form the 3X6 Jacobian matrix
+        Eigen::Matrix<double, 3, 6> J;
+        J << J11, J12, J13, J14, J15, J16, J21, J22, J23, J24, J25, J26, J31,
+            J32, J33, J34, J35, J36;
+        local->selfadjointView<Eigen::Upper>().rankUpdate(J.transpose());
+      });
   covariance = H.inverse() * icp_fitness;
 
   // Here bound the covariance using eigen values
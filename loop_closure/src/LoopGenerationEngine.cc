@@ -0,0 +1,184 @@
+/**
+ * @file   LoopGenerationEngine.cc
+ * @brief  Runs several candidate generators in one node on a shared pose
+ *         store and publishes their candidates without duplicates
+ */
+
+#include <algorithm>
+
+#include <gtsam/inference/Symbol.h>
+#include <parameter_utils/ParameterUtils.h>
+#include <lamp_utils/CommonFunctions.h>
+
+#include "loop_closure/LoopGenerationEngine.h"
+
+namespace pu = parameter_utils;
+
+namespace lamp_loop_closure {
+
+LoopGenerationEngine::LoopGenerationEngine()
+  : LoopGeneration(), max_proposed_pairs_(100000), num_duplicates_(0) {}
+LoopGenerationEngine::~LoopGenerationEngine() {}
+
+bool LoopGenerationEngine::Initialize(const ros::NodeHandle& n) {
+  std::string name =
+      ros::names::append(n.getNamespace(), "LoopGenerationEngine");
+  if (!LoadParameters(n)) {
+    ROS_ERROR("%s: Failed to load parameters.", name.c_str());
+    return false;
+  }
+
+  // Publishers before the generators, which may hand over candidates as soon
+  // as their callbacks are registered
+  if (!CreatePublishers(n)) {
+    ROS_ERROR("%s: Failed to create publishers.", name.c_str());
+    return false;
+  }
+
+  for (const auto& generator_name : generator_names_) {
+    std::unique_ptr<CandidateGenerator> generator =
+        CreateCandidateGenerator(generator_name);
+    if (!generator) {
+      ROS_ERROR("%s: Unknown candidate generator %s.",
+                name.c_str(),
+                generator_name.c_str());
+      return false;
+    }
+    const bool prioritized = generator->IsPrioritized();
+    CandidateSink sink =
+        [this, prioritized](
+            const std::vector<pose_graph_msgs::LoopCandidate>& candidates) {
+          AddCandidates(candidates, prioritized);
+          PublishCandidates();
+        };
+    if (!generator->Initialize(n, sink)) {
+      ROS_ERROR("%s: Failed to initialize candidate generator %s.",
+                name.c_str(),
+                generator_name.c_str());
+      return false;
+    }
+    generators_.push_back(std::move(generator));
+  }
+
+  if (!RegisterCallbacks(n)) {
+    ROS_ERROR("%s: Failed to register callbacks.", name.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool LoopGenerationEngine::LoadParameters(const ros::NodeHandle& n) {
+  if (!LoopGeneration::LoadParameters(n))
+    return false;
+
+  if (!pu::Get(param_ns_ + "/generation_engine/generators", generator_names_))
+    return false;
+
+  // Optional
+  double cell_size = 10.0;
+  pu::Get(param_ns_ + "/generation_engine/cell_size", cell_size);
+  poses_ = PoseStore(cell_size);
+  int max_proposed_pairs = max_proposed_pairs_;
+  pu::Get(param_ns_ + "/generation_engine/max_proposed_pairs",
+          max_proposed_pairs);
+  max_proposed_pairs_ = std::max(1, max_proposed_pairs);
+  return true;
+}
+
+bool LoopGenerationEngine::CreatePublishers(const ros::NodeHandle& n) {
+  if (!LoopGeneration::CreatePublishers(n))
+    return false;
+  ros::NodeHandle nl(n);
+  prioritized_candidate_pub_ =
+      nl.advertise<pose_graph_msgs::LoopCandidateArray>(
+          "prioritized_loop_candidates", 10, false);
+  return true;
+}
+
+bool LoopGenerationEngine::RegisterCallbacks(const ros::NodeHandle& n) {
+  ros::NodeHandle nl(n);
+  keyed_poses_sub_ = nl.subscribe<pose_graph_msgs::PoseGraph>(
+      "pose_graph_incremental",
+      100000,
+      &LoopGenerationEngine::KeyedPoseCallback,
+      this);
+  return true;
+}
+
+void LoopGenerationEngine::KeyedPoseCallback(
+    const pose_graph_msgs::PoseGraph::ConstPtr& graph_msg) {
+  std::vector<gtsam::Key> new_keys;
+  for (const auto& node_msg : graph_msg->nodes) {
+    gtsam::Symbol new_key = gtsam::Symbol(node_msg.key);
+    if (!lamp_utils::IsRobotPrefix(new_key.chr()))
+      continue;
+    // Poses are kept as first received, like in the other generation nodes
+    if (!poses_.Insert(new_key, lamp_utils::ToGtsam(node_msg.pose)))
+      continue;
+    new_keys.push_back(new_key);
+  }
+
+  // Loop closure off. No candidates generated
+  if (!b_check_for_loop_closures_ || new_keys.empty())
+    return;
+
+  // Generators only read the store, each one runs on its own thread
+  std::vector<std::vector<pose_graph_msgs::LoopCandidate>> generated(
+      generators_.size());
+#pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < generators_.size(); i++) {
+    generators_[i]->GenerateLoops(poses_, new_keys, &generated[i]);
+  }
+
+  // Earlier generators in the list win for pairs found by several
+  for (const auto& candidates : generated) {
+    AddCandidates(candidates);
+  }
+  PublishCandidates();
+}
+
+void LoopGenerationEngine::AddCandidates(
+    const std::vector<pose_graph_msgs::LoopCandidate>& candidates,
+    bool prioritized) {
+  std::lock_guard<std::mutex> lock(candidates_mutex_);
+  for (const auto& candidate : candidates) {
+    const auto pair =
+        std::make_pair(std::min(candidate.key_from, candidate.key_to),
+                       std::max(candidate.key_from, candidate.key_to));
+    if (!proposed_pairs_.insert(pair).second) {
+      num_duplicates_++;
+      continue;
+    }
+    proposed_order_.push_back(pair);
+    if (proposed_order_.size() > max_proposed_pairs_) {
+      proposed_pairs_.erase(proposed_order_.front());
+      proposed_order_.pop_front();
+    }
+    if (prioritized) {
+      prioritized_candidates_.push_back(candidate);
+    } else {
+      candidates_.push_back(candidate);
+    }
+  }
+}
+
+void LoopGenerationEngine::PublishCandidates() {
+  std::lock_guard<std::mutex> lock(candidates_mutex_);
+  if (loop_candidate_pub_.getNumSubscribers() > 0 && candidates_.size() > 0) {
+    ROS_DEBUG_STREAM("Publishing " << candidates_.size()
+                                   << " loop candidates, dropped "
+                                   << num_duplicates_ << " duplicates so far");
+    PublishLoops();
+    ClearLoops();
+  }
+  if (prioritized_candidate_pub_.getNumSubscribers() > 0 &&
+      prioritized_candidates_.size() > 0) {
+    pose_graph_msgs::LoopCandidateArray candidates_msg;
+    candidates_msg.candidates = prioritized_candidates_;
+    prioritized_candidate_pub_.publish(candidates_msg);
+    prioritized_candidates_.clear();
+  }
+}
+
+} // namespace lamp_loop_closure
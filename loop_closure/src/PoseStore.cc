@@ -0,0 +1,56 @@
+/**
+ * @file   PoseStore.cc
+ * @brief  Keyed poses with a spatial index, shared by candidate generators
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "loop_closure/PoseStore.h"
+
+namespace lamp_loop_closure {
+
+PoseStore::PoseStore(double cell_size) : cell_size_(cell_size) {}
+PoseStore::~PoseStore() {}
+
+PoseStore::CellIndex PoseStore::ToCell(const gtsam::Point3& position) const {
+  return CellIndex{static_cast<int>(std::floor(position.x() / cell_size_)),
+                   static_cast<int>(std::floor(position.y() / cell_size_)),
+                   static_cast<int>(std::floor(position.z() / cell_size_))};
+}
+
+bool PoseStore::Insert(gtsam::Key key, const gtsam::Pose3& pose) {
+  if (!poses_.insert({key, pose}).second)
+    return false;
+  cells_[ToCell(pose.translation())].push_back(key);
+  return true;
+}
+
+std::vector<gtsam::Key> PoseStore::Radius(const gtsam::Point3& position,
+                                          double radius) const {
+  std::vector<gtsam::Key> keys;
+  const CellIndex center = ToCell(position);
+  const int reach = static_cast<int>(std::ceil(radius / cell_size_));
+  for (int x = center.x - reach; x <= center.x + reach; x++) {
+    for (int y = center.y - reach; y <= center.y + reach; y++) {
+      for (int z = center.z - reach; z <= center.z + reach; z++) {
+        auto cell = cells_.find(CellIndex{x, y, z});
+        if (cell == cells_.end())
+          continue;
+        for (const auto& key : cell->second) {
+          if ((poses_.at(key).translation() - position).norm() <= radius)
+            keys.push_back(key);
+        }
+      }
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+  return keys;
+}
+
+void PoseStore::Clear() {
+  poses_.clear();
+  cells_.clear();
+}
+
+} // namespace lamp_loop_closure
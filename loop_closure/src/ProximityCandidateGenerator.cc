@@ -0,0 +1,140 @@
+/**
+ * @file   ProximityCandidateGenerator.cc
+ * @brief  Find potential loop closures based on proximity in a pose store
+ */
+
+#include <algorithm>
+#include <limits>
+
+#include <parameter_utils/ParameterUtils.h>
+#include <lamp_utils/CommonFunctions.h>
+
+#include "loop_closure/ProximityCandidateGenerator.h"
+
+namespace pu = parameter_utils;
+
+namespace lamp_loop_closure {
+
+ProximityCandidateGenerator::ProximityCandidateGenerator()
+  : proximity_threshold_max_(0.0),
+    proximity_threshold_min_(0.0),
+    increase_rate_(0.0),
+    n_closest_(std::numeric_limits<int>::max()),
+    skip_recent_poses_(0) {}
+ProximityCandidateGenerator::~ProximityCandidateGenerator() {}
+
+bool ProximityCandidateGenerator::Initialize(const ros::NodeHandle& n,
+                                             const CandidateSink& sink) {
+  return LoadParameters(lamp_utils::GetParamNamespace(n.getNamespace()));
+}
+
+bool ProximityCandidateGenerator::LoadParameters(const std::string& param_ns) {
+  if (!pu::Get(param_ns + "/proximity_threshold_max",
+               proximity_threshold_max_))
+    return false;
+  if (!pu::Get(param_ns + "/proximity_threshold_min",
+               proximity_threshold_min_))
+    return false;
+  if (!pu::Get(param_ns + "/increase_rate", increase_rate_))
+    return false;
+
+  if (!pu::Get(param_ns + "/n_closest", n_closest_))
+    return false;
+
+  bool b_take_n_closest;
+  if (!pu::Get(param_ns + "/b_take_n_closest", b_take_n_closest))
+    return false;
+  if (!b_take_n_closest)
+    n_closest_ = std::numeric_limits<int>::max();
+
+  double distance_to_skip_recent_poses, translation_threshold_nodes;
+  if (!pu::Get(param_ns + "/translation_threshold_nodes",
+               translation_threshold_nodes))
+    return false;
+  if (!pu::Get(param_ns + "/distance_to_skip_recent_poses",
+               distance_to_skip_recent_poses))
+    return false;
+
+  skip_recent_poses_ =
+      (int)(distance_to_skip_recent_poses / translation_threshold_nodes);
+  return true;
+}
+
+void ProximityCandidateGenerator::GenerateLoops(
+    const PoseStore& poses,
+    const std::vector<gtsam::Key>& new_keys,
+    std::vector<pose_graph_msgs::LoopCandidate>* candidates) {
+  // Each new key is only compared with the keys stored before it
+  std::unordered_set<gtsam::Key> later_keys(new_keys.begin(), new_keys.end());
+  for (const auto& new_key : new_keys) {
+    later_keys.erase(new_key);
+    GenerateLoops(poses, new_key, later_keys, candidates);
+  }
+}
+
+void ProximityCandidateGenerator::GenerateLoops(
+    const PoseStore& poses,
+    const gtsam::Symbol& key,
+    const std::unordered_set<gtsam::Key>& later_keys,
+    std::vector<pose_graph_msgs::LoopCandidate>* candidates) {
+  const gtsam::Pose3& pose = poses.GetPose(key);
+  std::vector<pose_graph_msgs::LoopCandidate> potential_candidates;
+  // The adaptive radius is at most the maximum threshold
+  for (const gtsam::Symbol other_key :
+       poses.Radius(pose.translation(), proximity_threshold_max_)) {
+    // Don't self-check.
+    if (key == other_key || later_keys.count(other_key))
+      continue;
+
+    // Don't compare against poses that were recently collected.
+    if (lamp_utils::IsKeyFromSameRobot(key, other_key) &&
+        std::llabs(key.index() - other_key.index()) < skip_recent_poses_)
+      continue;
+
+    const gtsam::Pose3& other_pose = poses.GetPose(other_key);
+    double distance = pose.between(other_pose).translation().norm();
+    double radius;
+    if (lamp_utils::IsKeyFromSameRobot(key, other_key)) {
+      radius = std::max(
+          0.0,
+          std::min(proximity_threshold_max_,
+                   (key.index() - other_key.index()) * increase_rate_));
+    } else {
+      radius = std::max(
+          proximity_threshold_min_,
+          std::min(proximity_threshold_max_, key.index() * increase_rate_));
+    }
+
+    if (distance > radius) {
+      continue;
+    }
+
+    pose_graph_msgs::LoopCandidate candidate;
+    candidate.header.stamp = ros::Time::now();
+    candidate.key_from = key;
+    candidate.key_to = other_key;
+    candidate.pose_from = lamp_utils::GtsamToRosMsg(pose);
+    candidate.pose_to = lamp_utils::GtsamToRosMsg(other_pose);
+    candidate.type = pose_graph_msgs::LoopCandidate::PROXIMITY;
+    candidate.value = distance;
+
+    potential_candidates.push_back(candidate);
+  }
+  if (potential_candidates.size() < n_closest_) {
+    candidates->insert(candidates->end(),
+                       potential_candidates.begin(),
+                       potential_candidates.end());
+  } else {
+    std::sort(potential_candidates.begin(),
+              potential_candidates.end(),
+              [](const pose_graph_msgs::LoopCandidate& lhs,
+                 const pose_graph_msgs::LoopCandidate& rhs) {
+                return lhs.value < rhs.value;
+              });
+    candidates->insert(candidates->end(),
+                       potential_candidates.begin(),
+                       potential_candidates.begin() + n_closest_);
+  }
+}
+
+} // namespace lamp_loop_closure
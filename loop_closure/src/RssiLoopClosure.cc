@@ -1,5 +1,8 @@
 #include <loop_closure/RssiLoopClosure.h>
 
+#include <algorithm>
+#include <cmath>
+
 namespace lamp_loop_closure {
 RssiLoopClosure::RssiLoopClosure() {}
 
@@ -72,6 +75,10 @@ bool RssiLoopClosure::LoadRssiParameters(const ros::NodeHandle& n) {
     return false;
   ROS_INFO_STREAM("radio_loop_closure_method: " << radio_loop_closure_method_);
 
+  // Optional, pairs new flyby nodes with all previous ones by default
+  pu::Get("flyby_neighbour_radius", flyby_neighbour_radius_);
+  ROS_INFO_STREAM("flyby_neighbour_radius: " << flyby_neighbour_radius_);
+
   return true;
 }
 
@@ -113,6 +120,7 @@ void RssiLoopClosure::KeyedPoseCallback(
     // append to the trajectory with time stamp
     robots_trajectory_[new_key.chr()].insert(
         {node_msg.header.stamp.toSec(), node_msg});
+    key_stamps_.insert({node_msg.key, node_msg.header.stamp.toSec()});
     // if (Debug) // FOR DEBUGGING PURPOSES
     //    {
     //    if (keyed_poses_.count(new_key) > 0) {
@@ -163,9 +171,7 @@ void RssiLoopClosure::CommNodeAggregatedStatusCallback(
       // Looking for the closest node in the trajectory of the robot that was
       // dropping the radio
       auto the_closest_pose =
-          GetPoseGraphNodeFromKey(robots_trajectory_[lamp_utils::GetRobotPrefix(
-                                      rssi_comm_dropped.robot_name)],
-                                  rssi_comm_dropped.pose_graph_key);
+          GetPoseGraphNodeFromKey(rssi_comm_dropped.pose_graph_key);
 
       // if key is 0 it means the pose hasn't been found therefore we try to
       // add the radio to rssi_node_drooped_list_ in next callback
@@ -183,6 +189,8 @@ void RssiLoopClosure::CommNodeAggregatedStatusCallback(
       rssi_scom_dropped_list_[rssi_comm_dropped.hostname].b_dropped = true;
       rssi_scom_dropped_list_[rssi_comm_dropped.hostname].pose_graph_node =
           the_closest_pose;
+      rssi_scom_dropped_list_[rssi_comm_dropped.hostname].cell_size =
+          flyby_neighbour_radius_;
       VisualizeRssi(rssi_comm_dropped.hostname,
                     rssi_scom_dropped_list_[rssi_comm_dropped.hostname]);
 
@@ -371,10 +379,21 @@ pose_graph_msgs::PoseGraphNode RssiLoopClosure::GetClosestPoseAtTime(
   return pose_out;
 }
 
-pose_graph_msgs::PoseGraphNode RssiLoopClosure::GetPoseGraphNodeFromKey(
-    const std::map<double, pose_graph_msgs::PoseGraphNode>& robot_trajectory,
-    const gtsam::Symbol& key) const {
-  for (const auto& robot_pose : robot_trajectory) {
+pose_graph_msgs::PoseGraphNode
+RssiLoopClosure::GetPoseGraphNodeFromKey(const gtsam::Symbol& key) const {
+  auto stamp = key_stamps_.find(key);
+  auto robot_trajectory = robots_trajectory_.find(key.chr());
+  if (stamp == key_stamps_.end() ||
+      robot_trajectory == robots_trajectory_.end()) {
+    return pose_graph_msgs::PoseGraphNode();
+  }
+  auto robot_pose = robot_trajectory->second.find(stamp->second);
+  if (robot_pose != robot_trajectory->second.end() &&
+      robot_pose->second.key == key) {
+    return robot_pose->second;
+  }
+  // Another node of the robot has the same stamp
+  for (const auto& robot_pose : robot_trajectory->second) {
     if (robot_pose.second.key == key) {
       return robot_pose.second;
     }
@@ -397,7 +416,7 @@ void RssiLoopClosure::GenerateLoops() {
                     "since the method doesn't exist. ");
   }
 
-  if (loop_candidate_pub_.getNumSubscribers() > 0 && candidates_.size() > 0) {
+  if (HasCandidateConsumer() && candidates_.size() > 0) {
     ROS_INFO_STREAM("Sending potential loop closures: " << candidates_.size());
     PublishLoops();
     ClearLoops();
@@ -408,58 +427,49 @@ void RssiLoopClosure::GenerateLoops() {
 //[[deprecated]]
 void RssiLoopClosure::RadioToNodesLoopClosure() {
   for (auto& rssi_node_dropped : rssi_scom_dropped_list_) {
-    for (size_t i = 0;
-         i < rssi_node_dropped.second.all_nodes_around_comm.size();
-         i++) {
-      if (i == 0)
+    RssiRawInfo& info = rssi_node_dropped.second;
+    FlybyNodeRef ref;
+    while (info.next_unhandled_node(&ref)) {
+      if (ref.flyby == 0)
         continue;
-      for (auto& flyby_node :
-           rssi_node_dropped.second.all_nodes_around_comm[i]) {
-        if (flyby_node.was_sent == true) {
-          continue;
-        }
-        pose_graph_msgs::LoopCandidate candidate;
-        candidate.header.stamp = ros::Time::now();
-        candidate.key_from = rssi_node_dropped.second.pose_graph_node.key;
-        candidate.key_to = flyby_node.candidate_pose.key;
-        candidate.pose_from = rssi_node_dropped.second.pose_graph_node.pose;
-        candidate.pose_to = flyby_node.candidate_pose.pose;
-        candidate.type = pose_graph_msgs::LoopCandidate::MANUAL;
-        candidate.value = 0.0;
-        candidates_.push_back(candidate);
-        flyby_node.was_sent = true;
-
-        VisualizeEdgesForPotentialLoopClosure(
-            rssi_node_dropped.second.pose_graph_node,
-            flyby_node.candidate_pose);
-      }
+      auto& flyby_node = info.all_nodes_around_comm[ref.flyby][ref.index];
+      pose_graph_msgs::LoopCandidate candidate;
+      candidate.header.stamp = ros::Time::now();
+      candidate.key_from = info.pose_graph_node.key;
+      candidate.key_to = flyby_node.candidate_pose.key;
+      candidate.pose_from = info.pose_graph_node.pose;
+      candidate.pose_to = flyby_node.candidate_pose.pose;
+      candidate.type = pose_graph_msgs::LoopCandidate::MANUAL;
+      candidate.value = 0.0;
+      candidates_.push_back(candidate);
+      flyby_node.was_sent = true;
+
+      VisualizeEdgesForPotentialLoopClosure(info.pose_graph_node,
+                                            flyby_node.candidate_pose);
     }
   }
 }
 void RssiLoopClosure::NodesToNodesLoopClosures() {
   // for every scom-{number} dropped
   for (auto& rssi_node_dropped : rssi_scom_dropped_list_) {
-    // for every flyby of the robot by the node (so basically the robot was
-    // close to the node)
-    for (size_t flyby_i = 0;
-         flyby_i < rssi_node_dropped.second.all_nodes_around_comm.size();
-         flyby_i++) {
+    RssiRawInfo& info = rssi_node_dropped.second;
+    // for every node added since the last call, they are all in the newest
+    // flybys of the robot by the node (so basically the robot was close to
+    // the node)
+    FlybyNodeRef ref;
+    while (info.next_unhandled_node(&ref)) {
       // if it's first flyby for the dropped node there is no sense to look
       // for loop proposal
-
-      if (flyby_i == 0) {
+      if (ref.flyby == 0) {
         // if it's first flyby but there was nodes around we check whether this
         // is the "close" flyby or maybe we haven't detected nearest nodes
         // during dropping procedure
         auto node_a =
-            gtsam::Symbol(
-                rssi_node_dropped.second.comm_node_info.pose_graph_key)
-                .index();
+            gtsam::Symbol(info.comm_node_info.pose_graph_key).index();
         // compare with the first node of flyby
-        auto node_b = gtsam::Symbol(rssi_node_dropped.second
-                                        .all_nodes_around_comm[flyby_i][0]
-                                        .candidate_pose.key)
-                          .index();
+        auto node_b =
+            gtsam::Symbol(info.all_nodes_around_comm[0][0].candidate_pose.key)
+                .index();
         std::uint64_t diff_index;
         if (node_a > node_b) {
           diff_index = node_a - node_b;
@@ -470,59 +480,59 @@ void RssiLoopClosure::NodesToNodesLoopClosures() {
         if (!conditional_loops_)
           continue;
       }
-      // for every node from the i-th flyby
-      for (auto& flyby_node :
-           rssi_node_dropped.second.all_nodes_around_comm[flyby_i]) {
-        // if it was sent as a loop proposal then it's fine
-        if (flyby_node.was_sent == true) {
-          continue;
-        }
-        // do loop closure proposal to the comm node pose (scom-{number} pose
-        // that is associated with node from the robot's trajectory)
-        pose_graph_msgs::LoopCandidate candidate_to_comm;
-        candidate_to_comm.header.stamp = ros::Time::now();
-        candidate_to_comm.key_from =
-            rssi_node_dropped.second.pose_graph_node.key;
-        candidate_to_comm.key_to = flyby_node.candidate_pose.key;
-        candidate_to_comm.pose_from =
-            rssi_node_dropped.second.pose_graph_node.pose;
-        candidate_to_comm.pose_to = flyby_node.candidate_pose.pose;
-        candidate_to_comm.type = pose_graph_msgs::LoopCandidate::MANUAL;
-        candidate_to_comm.value =
-            0.0; // as far as i understand Yun's it's not neeeded right now
-        candidates_.push_back(candidate_to_comm);
-        flyby_node.was_sent = true;
-
-        // visualize loop proposal for node - to scom-{number} node associated
-        // with robot pose
-        VisualizeEdgesForPotentialLoopClosure(
-            rssi_node_dropped.second.pose_graph_node,
-            flyby_node.candidate_pose);
-
-        // iterate over previous flybys to have more loop proposals to
-        // "previous nodes" from different robots or from different times for
-        // the same robot, flyby_j < flyby_i because we can't be more far away
-        // than we are
-        for (size_t flyby_j = 0; flyby_j < flyby_i; flyby_j++) {
-          // for each node in each previous flyby generate loop proposal
-          for (const auto& flyby_j_node :
-               rssi_node_dropped.second.all_nodes_around_comm[flyby_j]) {
-            pose_graph_msgs::LoopCandidate candidate;
-            candidate.header.stamp = ros::Time::now();
-            candidate.key_from = flyby_j_node.candidate_pose.key;
-            candidate.key_to = flyby_node.candidate_pose.key;
-            candidate.pose_from = flyby_j_node.candidate_pose.pose;
-            candidate.pose_to = flyby_node.candidate_pose.pose;
-            candidate.type = pose_graph_msgs::LoopCandidate::MANUAL;
-            candidate.value = 0.0;
-            candidates_.push_back(candidate);
-            // visualize loop proposal for given node from the previous nodes
-            // that are nearby scom-{number}
-            VisualizeEdgesForPotentialLoopClosure(flyby_j_node.candidate_pose,
-                                                  flyby_node.candidate_pose);
+      auto& flyby_node = info.all_nodes_around_comm[ref.flyby][ref.index];
+      // do loop closure proposal to the comm node pose (scom-{number} pose
+      // that is associated with node from the robot's trajectory)
+      pose_graph_msgs::LoopCandidate candidate_to_comm;
+      candidate_to_comm.header.stamp = ros::Time::now();
+      candidate_to_comm.key_from = info.pose_graph_node.key;
+      candidate_to_comm.key_to = flyby_node.candidate_pose.key;
+      candidate_to_comm.pose_from = info.pose_graph_node.pose;
+      candidate_to_comm.pose_to = flyby_node.candidate_pose.pose;
+      candidate_to_comm.type = pose_graph_msgs::LoopCandidate::MANUAL;
+      candidate_to_comm.value =
+          0.0; // as far as i understand Yun's it's not neeeded right now
+      candidates_.push_back(candidate_to_comm);
+      flyby_node.was_sent = true;
+
+      // visualize loop proposal for node - to scom-{number} node associated
+      // with robot pose
+      VisualizeEdgesForPotentialLoopClosure(info.pose_graph_node,
+                                            flyby_node.candidate_pose);
+
+      // nodes of previous flybys give more loop proposals to "previous nodes"
+      // from different robots or from different times for the same robot,
+      // only the nearby ones when a radius is set
+      std::vector<FlybyNodeRef> previous;
+      if (flyby_neighbour_radius_ > 0.0) {
+        previous = info.neighbours(flyby_node.candidate_pose.pose.position,
+                                   flyby_neighbour_radius_,
+                                   ref.flyby);
+      } else {
+        for (size_t flyby_j = 0; flyby_j < ref.flyby; flyby_j++) {
+          for (size_t j = 0; j < info.all_nodes_around_comm[flyby_j].size();
+               j++) {
+            previous.push_back(FlybyNodeRef{flyby_j, j});
           }
         }
       }
+      for (const auto& previous_ref : previous) {
+        const auto& flyby_j_node =
+            info.all_nodes_around_comm[previous_ref.flyby][previous_ref.index];
+        pose_graph_msgs::LoopCandidate candidate;
+        candidate.header.stamp = ros::Time::now();
+        candidate.key_from = flyby_j_node.candidate_pose.key;
+        candidate.key_to = flyby_node.candidate_pose.key;
+        candidate.pose_from = flyby_j_node.candidate_pose.pose;
+        candidate.pose_to = flyby_node.candidate_pose.pose;
+        candidate.type = pose_graph_msgs::LoopCandidate::MANUAL;
+        candidate.value = 0.0;
+        candidates_.push_back(candidate);
+        // visualize loop proposal for given node from the previous nodes
+        // that are nearby scom-{number}
+        VisualizeEdgesForPotentialLoopClosure(flyby_j_node.candidate_pose,
+                                              flyby_node.candidate_pose);
+      }
     }
   }
 }
@@ -696,6 +706,7 @@ bool RssiRawInfo::append_node(const pose_graph_msgs::PoseGraphNode& node) {
     // create first flyby container
     NodesAroundCommOneFlyby one_flyby;
     one_flyby.emplace_back(PoseGraphNodeForLoopClosureStatus{false, node});
+    index_node(node, FlybyNodeRef{0, 0});
     ROS_GREEN_STREAM("Appending to  comm: "
                      << comm_node_info.hostname
                      << " node stamp: " << node.header.stamp << " frame id: "
@@ -737,6 +748,7 @@ bool RssiRawInfo::append_node(const pose_graph_msgs::PoseGraphNode& node) {
     new_flyby.emplace_back(PoseGraphNodeForLoopClosureStatus{false, node});
     all_nodes_around_comm.emplace_back(new_flyby);
     flyby_number++;
+    index_node(node, FlybyNodeRef{all_nodes_around_comm.size() - 1, 0});
     return true;
   }
   ROS_GREEN_STREAM("Appending to  comm: "
@@ -745,21 +757,18 @@ bool RssiRawInfo::append_node(const pose_graph_msgs::PoseGraphNode& node) {
                    << " pose: " << node.pose);
   all_nodes_around_comm[flyby_number].emplace_back(
       PoseGraphNodeForLoopClosureStatus{false, node});
+  index_node(node,
+             FlybyNodeRef{static_cast<size_t>(flyby_number),
+                          all_nodes_around_comm[flyby_number].size() - 1});
 
   return true;
 }
 
 bool RssiRawInfo::is_node_exist(const pose_graph_msgs::PoseGraphNode& node) {
-  for (const auto& one_flyby_nodes : all_nodes_around_comm)
-    for (const auto& flyby_node : one_flyby_nodes) {
-      {
-        if (flyby_node.candidate_pose.key == node.key) {
-          ROS_INFO_STREAM("key: " << flyby_node.candidate_pose.key << " vs "
-                                  << flyby_node.candidate_pose.key);
-          return true;
-        }
-      }
-    }
+  if (flyby_keys.count(node.key)) {
+    ROS_INFO_STREAM("key: " << node.key << " is in the flybys");
+    return true;
+  }
   return false;
 }
 bool RssiRawInfo::is_node_same_as_comm(
@@ -778,4 +787,82 @@ bool RssiRawInfo::has_node_pose(const pose_graph_msgs::PoseGraphNode& node) {
   return false;
 }
 
+bool RssiRawInfo::next_unhandled_node(FlybyNodeRef* ref) {
+  while (next_unhandled.flyby < all_nodes_around_comm.size()) {
+    if (next_unhandled.index <
+        all_nodes_around_comm[next_unhandled.flyby].size()) {
+      *ref = next_unhandled;
+      next_unhandled.index++;
+      return true;
+    }
+    // Stay in the newest flyby, it may still grow
+    if (next_unhandled.flyby + 1 == all_nodes_around_comm.size())
+      return false;
+    next_unhandled.flyby++;
+    next_unhandled.index = 0;
+  }
+  return false;
+}
+
+std::int64_t
+RssiRawInfo::cell_key(std::int64_t x, std::int64_t y, std::int64_t z) const {
+  // 21 bits per axis
+  const std::int64_t mask = (1 << 21) - 1;
+  return ((x & mask) << 42) | ((y & mask) << 21) | (z & mask);
+}
+
+void RssiRawInfo::index_node(const pose_graph_msgs::PoseGraphNode& node,
+                             const FlybyNodeRef& ref) {
+  flyby_keys.insert(node.key);
+  if (cell_size <= 0.0)
+    return;
+  const auto& p = node.pose.position;
+  flyby_cells[cell_key(std::floor(p.x / cell_size),
+                       std::floor(p.y / cell_size),
+                       std::floor(p.z / cell_size))]
+      .push_back(ref);
+}
+
+std::vector<FlybyNodeRef>
+RssiRawInfo::neighbours(const geometry_msgs::Point& position,
+                        double radius,
+                        size_t before_flyby) const {
+  std::vector<FlybyNodeRef> result;
+  if (cell_size <= 0.0)
+    return result;
+  const std::int64_t reach = std::ceil(radius / cell_size);
+  const std::int64_t cx = std::floor(position.x / cell_size);
+  const std::int64_t cy = std::floor(position.y / cell_size);
+  const std::int64_t cz = std::floor(position.z / cell_size);
+  for (std::int64_t x = cx - reach; x <= cx + reach; x++) {
+    for (std::int64_t y = cy - reach; y <= cy + reach; y++) {
+      for (std::int64_t z = cz - reach; z <= cz + reach; z++) {
+        auto cell = flyby_cells.find(cell_key(x, y, z));
+        if (cell == flyby_cells.end())
+          continue;
+        for (const auto& ref : cell->second) {
+          if (ref.flyby >= before_flyby)
+            continue;
+          const auto& p =
+              all_nodes_around_comm[ref.flyby][ref.index].candidate_pose.pose
+                  .position;
+          double dx = p.x - position.x;
+          double dy = p.y - position.y;
+          double dz = p.z - position.z;
+          if (dx * dx + dy * dy + dz * dz <= radius * radius) {
+            result.push_back(ref);
+          }
+        }
+      }
+    }
+  }
+  std::sort(result.begin(),
+            result.end(),
+            [](const FlybyNodeRef& a, const FlybyNodeRef& b) {
+              return a.flyby < b.flyby ||
+                  (a.flyby == b.flyby && a.index < b.index);
+            });
+  return result;
+}
+
 } // namespace lamp_loop_closure
@@ -0,0 +1,99 @@
+/**
+ * @file   ScanContext.cc
+ * @brief  Global place descriptor of a keyed scan: a polar grid of the
+ *         highest point per cell and a rotation invariant ring key
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "loop_closure/ScanContext.h"
+
+namespace lamp_loop_closure {
+
+void ComputeScanContext(const PointCloud& scan,
+                        const ScanContextParams& params,
+                        ScanContext* descriptor) {
+  descriptor->grid = Eigen::MatrixXf::Zero(params.num_rings, params.num_sectors);
+  for (const auto& point : scan.points) {
+    const double range = std::hypot(point.x, point.y);
+    if (!std::isfinite(range) || range >= params.max_radius)
+      continue;
+    const int ring = static_cast<int>(range / params.max_radius *
+                                      params.num_rings);
+    int sector = static_cast<int>((std::atan2(point.y, point.x) + M_PI) /
+                                  (2.0 * M_PI) * params.num_sectors);
+    sector = std::min(sector, params.num_sectors - 1);
+    const float height =
+        std::max(0.0f, point.z + static_cast<float>(params.sensor_height));
+    float& cell = descriptor->grid(ring, sector);
+    cell = std::max(cell, height);
+  }
+
+  descriptor->ring_key =
+      (descriptor->grid.array() > 0.0f).cast<float>().rowwise().mean();
+  descriptor->sector_key = descriptor->grid.colwise().mean().transpose();
+}
+
+namespace {
+
+// Sector shift of b that best matches the sector key of a
+int CoarseShift(const ScanContext& a, const ScanContext& b) {
+  const int n = a.sector_key.size();
+  int best_shift = 0;
+  float best_error = std::numeric_limits<float>::max();
+  for (int shift = 0; shift < n; shift++) {
+    float error = 0.0f;
+    for (int i = 0; i < n; i++) {
+      const float d = a.sector_key(i) - b.sector_key((i + shift) % n);
+      error += d * d;
+    }
+    if (error < best_error) {
+      best_error = error;
+      best_shift = shift;
+    }
+  }
+  return best_shift;
+}
+
+double ShiftedDistance(const ScanContext& a, const ScanContext& b, int shift) {
+  const int n = a.grid.cols();
+  double sum = 0.0;
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    const auto col_a = a.grid.col(i);
+    const auto col_b = b.grid.col((i + shift) % n);
+    const float norm = col_a.norm() * col_b.norm();
+    if (norm == 0.0f)
+      continue;
+    sum += col_a.dot(col_b) / norm;
+    count++;
+  }
+  if (count == 0)
+    return 1.0;
+  return 1.0 - sum / count;
+}
+
+} // namespace
+
+double ScanContextDistance(const ScanContext& a,
+                           const ScanContext& b,
+                           const ScanContextParams& params,
+                           int* shift) {
+  const int n = params.num_sectors;
+  const int coarse = CoarseShift(a, b);
+  double best = std::numeric_limits<double>::max();
+  for (int s = -params.search_sectors; s <= params.search_sectors; s++) {
+    const int candidate = ((coarse + s) % n + n) % n;
+    const double distance = ShiftedDistance(a, b, candidate);
+    if (distance < best) {
+      best = distance;
+      if (shift)
+        *shift = candidate;
+    }
+  }
+  return best;
+}
+
+} // namespace lamp_loop_closure
@@ -0,0 +1,188 @@
+/**
+ * @file   ScanContextCandidateGenerator.cc
+ * @brief  Find potential loop closures by matching global place descriptors
+ *         of the keyed scans, independently of the pose drift
+ */
+
+#include <algorithm>
+
+#include <parameter_utils/ParameterUtils.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <lamp_utils/CommonFunctions.h>
+
+#include "loop_closure/ScanContextCandidateGenerator.h"
+
+namespace pu = parameter_utils;
+
+namespace lamp_loop_closure {
+
+ScanContextCandidateGenerator::ScanContextCandidateGenerator()
+  : max_distance_(0.2),
+    num_nearest_(10),
+    n_best_(1),
+    skip_recent_keys_(50),
+    max_pending_keys_(1000),
+    index_(new DescriptorIndex(params_.num_rings)) {}
+ScanContextCandidateGenerator::~ScanContextCandidateGenerator() {}
+
+bool ScanContextCandidateGenerator::Initialize(const ros::NodeHandle& n,
+                                               const CandidateSink& sink) {
+  if (!LoadParameters(lamp_utils::GetParamNamespace(n.getNamespace())))
+    return false;
+
+  ros::NodeHandle nl(n);
+  keyed_scans_sub_ = nl.subscribe<pose_graph_msgs::KeyedScan>(
+      "keyed_scans",
+      100000,
+      &ScanContextCandidateGenerator::KeyedScanCallback,
+      this);
+  return true;
+}
+
+bool ScanContextCandidateGenerator::LoadParameters(
+    const std::string& param_ns) {
+  if (!pu::Get(param_ns + "/scan_context/num_rings", params_.num_rings))
+    return false;
+  if (!pu::Get(param_ns + "/scan_context/num_sectors", params_.num_sectors))
+    return false;
+  if (!pu::Get(param_ns + "/scan_context/max_radius", params_.max_radius))
+    return false;
+  if (!pu::Get(param_ns + "/scan_context/sensor_height",
+               params_.sensor_height))
+    return false;
+  if (!pu::Get(param_ns + "/scan_context/search_sectors",
+               params_.search_sectors))
+    return false;
+  if (!pu::Get(param_ns + "/scan_context/max_distance", max_distance_))
+    return false;
+
+  int num_nearest, n_best;
+  if (!pu::Get(param_ns + "/scan_context/num_nearest", num_nearest))
+    return false;
+  if (!pu::Get(param_ns + "/scan_context/n_best", n_best))
+    return false;
+  num_nearest_ = std::max(0, num_nearest);
+  n_best_ = std::max(0, n_best);
+
+  if (!pu::Get(param_ns + "/scan_context/skip_recent_keys", skip_recent_keys_))
+    return false;
+
+  // Optional
+  int max_pending_keys = max_pending_keys_;
+  pu::Get(param_ns + "/scan_context/max_pending_keys", max_pending_keys);
+  max_pending_keys_ = std::max(0, max_pending_keys);
+
+  if (params_.num_rings <= 0 || params_.num_sectors <= 0 ||
+      params_.max_radius <= 0.0) {
+    ROS_ERROR("ScanContextCandidateGenerator: Invalid descriptor size.");
+    return false;
+  }
+  index_.reset(new DescriptorIndex(params_.num_rings));
+  return true;
+}
+
+void ScanContextCandidateGenerator::KeyedScanCallback(
+    const pose_graph_msgs::KeyedScan::ConstPtr& scan_msg) {
+  PointCloud scan;
+  pcl::fromROSMsg(scan_msg->scan, scan);
+  AddDescriptor(scan_msg->key, scan);
+}
+
+void ScanContextCandidateGenerator::AddDescriptor(gtsam::Key key,
+                                                  const PointCloud& scan) {
+  {
+    std::lock_guard<std::mutex> lock(descriptors_mutex_);
+    if (descriptors_.count(key)) {
+      ROS_DEBUG_STREAM("KeyedScanCallback: Key "
+                       << gtsam::DefaultKeyFormatter(key)
+                       << " already has a descriptor. Not adding.");
+      return;
+    }
+  }
+
+  // Only the compact descriptor is kept, not the scan
+  ScanContext descriptor;
+  ComputeScanContext(scan, params_, &descriptor);
+  std::lock_guard<std::mutex> lock(descriptors_mutex_);
+  descriptors_.emplace(key, std::move(descriptor));
+}
+
+void ScanContextCandidateGenerator::GenerateLoops(
+    const PoseStore& poses,
+    const std::vector<gtsam::Key>& new_keys,
+    std::vector<pose_graph_msgs::LoopCandidate>* candidates) {
+  // Keys are compared and indexed in the order their scans became available
+  std::vector<gtsam::Key> keys;
+  keys.swap(pending_keys_);
+  keys.insert(keys.end(), new_keys.begin(), new_keys.end());
+  for (const auto& key : keys) {
+    ScanContext descriptor;
+    {
+      std::lock_guard<std::mutex> lock(descriptors_mutex_);
+      auto it = descriptors_.find(key);
+      if (it == descriptors_.end()) {
+        pending_keys_.push_back(key);
+        continue;
+      }
+      descriptor = it->second;
+    }
+    GenerateLoops(poses, key, descriptor, candidates);
+    index_->Insert(key, descriptor.ring_key);
+  }
+
+  if (pending_keys_.size() > max_pending_keys_) {
+    const size_t num_dropped = pending_keys_.size() - max_pending_keys_;
+    ROS_WARN_STREAM("ScanContextCandidateGenerator: Dropping "
+                    << num_dropped << " keys still waiting for their scan.");
+    pending_keys_.erase(pending_keys_.begin(),
+                        pending_keys_.begin() + num_dropped);
+  }
+}
+
+void ScanContextCandidateGenerator::GenerateLoops(
+    const PoseStore& poses,
+    const gtsam::Symbol& key,
+    const ScanContext& descriptor,
+    std::vector<pose_graph_msgs::LoopCandidate>* candidates) {
+  // Ring keys are rotation invariant, so the index narrows the search to a
+  // few places that are then aligned on the full grid
+  const auto nearest = index_->Nearest(
+      descriptor.ring_key, num_nearest_, [&](gtsam::Key other) {
+        const gtsam::Symbol other_key(other);
+        // Don't compare against keys that were recently collected.
+        return !lamp_utils::IsKeyFromSameRobot(key, other_key) ||
+            std::llabs(key.index() - other_key.index()) >= skip_recent_keys_;
+      });
+
+  std::vector<std::pair<double, gtsam::Key>> matches;
+  for (const auto& neighbour : nearest) {
+    const gtsam::Key other_key = neighbour.second;
+    double distance;
+    {
+      std::lock_guard<std::mutex> lock(descriptors_mutex_);
+      distance = ScanContextDistance(
+          descriptor, descriptors_.at(other_key), params_);
+    }
+    if (distance <= max_distance_)
+      matches.emplace_back(distance, other_key);
+  }
+  std::sort(matches.begin(), matches.end());
+  if (matches.size() > n_best_)
+    matches.resize(n_best_);
+
+  const gtsam::Pose3& pose = poses.GetPose(key);
+  for (const auto& match : matches) {
+    pose_graph_msgs::LoopCandidate candidate;
+    candidate.header.stamp = ros::Time::now();
+    candidate.key_from = key;
+    candidate.key_to = match.second;
+    candidate.pose_from = lamp_utils::GtsamToRosMsg(pose);
+    candidate.pose_to =
+        lamp_utils::GtsamToRosMsg(poses.GetPose(match.second));
+    candidate.type = pose_graph_msgs::LoopCandidate::DESCRIPTOR;
+    candidate.value = match.first;
+    candidates->push_back(candidate);
+  }
+}
+
+} // namespace lamp_loop_closure
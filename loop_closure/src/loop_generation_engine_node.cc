@@ -0,0 +1,24 @@
+/**
+ * @file   loop_generation_engine_node.cc
+ * @brief  Loop candidate generation with all configured generators in one node
+ */
+
+#include <loop_closure/LoopGenerationEngine.h>
+#include <ros/ros.h>
+
+namespace lc = lamp_loop_closure;
+
+int main(int argc, char** argv) {
+  ros::init(argc, argv, "loop_generation_engine");
+  ros::NodeHandle n("~");
+
+  lc::LoopGenerationEngine loop_gen;
+  if (!loop_gen.Initialize(n)) {
+    ROS_ERROR("%s: Failed to initialize Loop Generation Engine. ",
+              ros::this_node::getName().c_str());
+    return EXIT_FAILURE;
+  }
+  ros::spin();
+
+  return EXIT_SUCCESS;
+}
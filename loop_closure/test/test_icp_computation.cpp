@@ -161,6 +161,69 @@ TEST_F(TestICPComputation, TestThreadedEqualsNonThreaded) {
     }
 }
 
+TEST_F(TestICPComputation, FloatKernelMatchesDouble) {
+    PointCloud::Ptr target = GenerateBox();
+    PointCloud::Ptr source(new PointCloud);
+    Eigen::Matrix4f offset = Eigen::Matrix4f::Identity();
+    offset.block<3, 3>(0, 0) =
+        Eigen::AngleAxisf(0.05, Eigen::Vector3f::UnitZ()).toRotationMatrix();
+    offset(0, 3) = 0.1;
+    offset(1, 3) = -0.05;
+    pcl::transformPointCloud(*target, *source, offset);
+
+    Eigen::Matrix4f results[2];
+    for (int use_float = 0; use_float < 2; ++use_float) {
+        pcl::MultithreadedGeneralizedIterativeClosestPoint<Point, Point> gicp;
+        gicp.setUseFloatKernel(use_float == 1);
+        gicp.setMaximumIterations(100);
+        gicp.setMaxCorrespondenceDistance(1.0);
+        gicp.setInputSource(source);
+        gicp.setInputTarget(target);
+        PointCloud aligned;
+        gicp.align(aligned);
+        ASSERT_TRUE(gicp.hasConverged());
+        results[use_float] = gicp.getFinalTransformation();
+    }
+
+    // Same alignment from the float and the double evaluation, and both undo
+    // the offset
+    EXPECT_TRUE(results[1].isApprox(results[0], 1e-3));
+    EXPECT_TRUE((results[1] * offset).isIdentity(1e-2));
+}
+
+TEST_F(TestICPComputation, FinalCorrespondencesMatchNearestNeighbours) {
+    PointCloud::Ptr target = GenerateBox();
+    PointCloud::Ptr source(new PointCloud);
+    Eigen::Matrix4f offset = Eigen::Matrix4f::Identity();
+    offset(0, 3) = 0.1;
+    pcl::transformPointCloud(*target, *source, offset);
+
+    pcl::MultithreadedGeneralizedIterativeClosestPoint<Point, Point> gicp;
+    gicp.setMaximumIterations(100);
+    gicp.setMaxCorrespondenceDistance(1.0);
+    gicp.setInputSource(source);
+    gicp.setInputTarget(target);
+    PointCloud::Ptr aligned(new PointCloud);
+    gicp.align(*aligned);
+    ASSERT_TRUE(gicp.hasConverged());
+
+    const std::vector<int>& matches = gicp.getFinalCorrespondences();
+    const std::vector<float>& distances =
+        gicp.getFinalCorrespondenceDistances();
+    ASSERT_EQ(source->size(), matches.size());
+    ASSERT_EQ(source->size(), distances.size());
+
+    // The matches are the nearest neighbours of the aligned cloud
+    pcl::search::KdTree<Point> tree;
+    tree.setInputCloud(target);
+    for (size_t i = 0; i < aligned->size(); ++i) {
+        std::vector<int> nn_indices;
+        std::vector<float> nn_distances;
+        tree.nearestKSearch(aligned->points[i], 1, nn_indices, nn_distances);
+        ASSERT_GE(matches[i], 0);
+        EXPECT_NEAR(nn_distances[0], distances[i], 1e-6);
+    }
+}
 
 int main(int argc, char** argv) {
     testing::InitGoogleTest(&argc, argv);
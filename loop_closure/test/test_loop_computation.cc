@@ -51,6 +51,26 @@ class TestLoopComputation : public ::testing::Test {
         key1, key2, pose1, pose2, delta, covariance, &fitness_score);
   }
 
+  bool performPooledAlignment(const gtsam::Symbol& key1,
+                              const gtsam::Symbol& key2,
+                              const gtsam::Pose3& pose1,
+                              const gtsam::Pose3& pose2,
+                              geometry_utils::Transform3* delta,
+                              gtsam::Matrix66* covariance) {
+    double fitness_score;
+    return icp_compute_.PerformAlignment(
+        key1, key2, pose1, pose2, delta, covariance, &fitness_score, true);
+  }
+
+  size_t numIcpEngines() const { return icp_compute_.icp_engines_.size(); }
+
+  std::vector<pose_graph_msgs::PoseGraphEdge> alignCandidateGroup(
+      const std::vector<pose_graph_msgs::LoopCandidate>& group,
+      bool keep_best) {
+    icp_compute_.b_keep_best_match_per_source_ = keep_best;
+    return icp_compute_.AlignCandidateGroup(group, true);
+  }
+
   void getSacInitialAlignment(PointCloud::ConstPtr source,
                               PointCloud::ConstPtr target,
                               Eigen::Matrix4f* tf_out,
@@ -181,6 +201,120 @@ TEST_F(TestLoopComputation, PerformAlignment) {
       gtsam::assert_equal(lamp_utils::ToGtsam(tf_exp), lamp_utils::ToGtsam(tf), 1e-3));
 }
 
+TEST_F(TestLoopComputation, PooledAlignmentReusesEngine) {
+  ros::NodeHandle nh;
+  icp_compute_.Initialize(nh);
+
+  PointCloud::Ptr corner = GenerateCorner();
+  PointCloud::Ptr corner_moved(new PointCloud);
+  Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+  T(0, 3) = 1;
+  pcl::transformPointCloudWithNormals(*corner, *corner_moved, T, true);
+
+  pose_graph_msgs::KeyedScan::Ptr ks0(new pose_graph_msgs::KeyedScan);
+  *ks0 = PointCloudToKeyedScan(corner, gtsam::Symbol('a', 0));
+  pose_graph_msgs::KeyedScan::Ptr ks100(new pose_graph_msgs::KeyedScan);
+  *ks100 = PointCloudToKeyedScan(corner_moved, gtsam::Symbol('a', 100));
+  keyedScanCallback(ks0);
+  keyedScanCallback(ks100);
+
+  pose_graph_msgs::PoseGraph::Ptr kp(new pose_graph_msgs::PoseGraph);
+  pose_graph_msgs::PoseGraphNode kp0, kp100;
+  kp0.key = gtsam::Symbol('a', 0);
+  kp100.key = gtsam::Symbol('a', 100);
+  kp100.pose.position.x = -0.9;
+  kp->nodes.push_back(kp0);
+  kp->nodes.push_back(kp100);
+  keyedPoseCallback(kp);
+  gtsam::Pose3 p0 = lamp_utils::ToGtsam(kp0.pose);
+  gtsam::Pose3 p100 = lamp_utils::ToGtsam(kp100.pose);
+
+  geometry_utils::Transform3 tf_first, tf_second;
+  gtsam::Matrix66 covar;
+  EXPECT_TRUE(performPooledAlignment(gtsam::Symbol('a', 100),
+                                     gtsam::Symbol('a', 0),
+                                     p100,
+                                     p0,
+                                     &tf_first,
+                                     &covar));
+  EXPECT_TRUE(performPooledAlignment(gtsam::Symbol('a', 100),
+                                     gtsam::Symbol('a', 0),
+                                     p100,
+                                     p0,
+                                     &tf_second,
+                                     &covar));
+
+  // Sequential alignments share one engine and give the same result
+  EXPECT_EQ(1, numIcpEngines());
+  EXPECT_TRUE(gtsam::assert_equal(lamp_utils::ToGtsam(tf_first),
+                                  lamp_utils::ToGtsam(tf_second),
+                                  1e-6));
+}
+
+TEST_F(TestLoopComputation, AlignCandidateGroup) {
+  ros::NodeHandle nh;
+  icp_compute_.Initialize(nh);
+
+  PointCloud::Ptr corner = GenerateCorner();
+  PointCloud::Ptr corner_near(new PointCloud);
+  PointCloud::Ptr corner_far(new PointCloud);
+  Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+  T(0, 3) = 0.5;
+  pcl::transformPointCloudWithNormals(*corner, *corner_near, T, true);
+  T(0, 3) = 1;
+  pcl::transformPointCloudWithNormals(*corner, *corner_far, T, true);
+
+  pose_graph_msgs::KeyedScan::Ptr ks0(new pose_graph_msgs::KeyedScan);
+  *ks0 = PointCloudToKeyedScan(corner, gtsam::Symbol('a', 0));
+  pose_graph_msgs::KeyedScan::Ptr ks50(new pose_graph_msgs::KeyedScan);
+  *ks50 = PointCloudToKeyedScan(corner_near, gtsam::Symbol('a', 50));
+  pose_graph_msgs::KeyedScan::Ptr ks100(new pose_graph_msgs::KeyedScan);
+  *ks100 = PointCloudToKeyedScan(corner_far, gtsam::Symbol('a', 100));
+  keyedScanCallback(ks0);
+  keyedScanCallback(ks50);
+  keyedScanCallback(ks100);
+
+  pose_graph_msgs::PoseGraph::Ptr kp(new pose_graph_msgs::PoseGraph);
+  pose_graph_msgs::PoseGraphNode kp0, kp50, kp100;
+  kp0.key = gtsam::Symbol('a', 0);
+  kp50.key = gtsam::Symbol('a', 50);
+  kp50.pose.position.x = -0.45;
+  kp100.key = gtsam::Symbol('a', 100);
+  kp100.pose.position.x = -0.9;
+  kp->nodes.push_back(kp0);
+  kp->nodes.push_back(kp50);
+  kp->nodes.push_back(kp100);
+  keyedPoseCallback(kp);
+
+  // Both candidates share the source scan a0
+  std::vector<pose_graph_msgs::LoopCandidate> group(2);
+  group[0].key_from = gtsam::Symbol('a', 0);
+  group[0].key_to = gtsam::Symbol('a', 50);
+  group[0].pose_from = kp0.pose;
+  group[0].pose_to = kp50.pose;
+  group[1].key_from = gtsam::Symbol('a', 0);
+  group[1].key_to = gtsam::Symbol('a', 100);
+  group[1].pose_from = kp0.pose;
+  group[1].pose_to = kp100.pose;
+
+  std::vector<pose_graph_msgs::PoseGraphEdge> all =
+      alignCandidateGroup(group, false);
+  ASSERT_EQ(2, all.size());
+  EXPECT_EQ(gtsam::Symbol('a', 50), all[0].key_to);
+  EXPECT_EQ(gtsam::Symbol('a', 100), all[1].key_to);
+  EXPECT_NEAR(0.5, std::abs(all[0].pose.position.x), 0.05);
+  EXPECT_NEAR(1.0, std::abs(all[1].pose.position.x), 0.05);
+
+  std::vector<pose_graph_msgs::PoseGraphEdge> best =
+      alignCandidateGroup(group, true);
+  ASSERT_EQ(1, best.size());
+  // The kept candidate is the one with the smaller range error
+  const pose_graph_msgs::PoseGraphEdge& smaller =
+      all[0].range_error <= all[1].range_error ? all[0] : all[1];
+  EXPECT_EQ(smaller.key_to, best[0].key_to);
+  EXPECT_NEAR(smaller.range_error, best[0].range_error, 1e-6);
+}
+
 }  // namespace lamp_loop_closure
 
 int main(int argc, char** argv) {
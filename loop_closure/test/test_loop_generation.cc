@@ -4,9 +4,15 @@
  */
 
 #include <gtest/gtest.h>
+#include <random>
 
+#include "loop_closure/DescriptorIndex.h"
 #include "loop_closure/LoopGeneration.h"
+#include "loop_closure/LoopGenerationEngine.h"
+#include "loop_closure/PoseStore.h"
 #include "loop_closure/ProximityLoopGeneration.h"
+#include "loop_closure/ScanContext.h"
+#include "loop_closure/ScanContextCandidateGenerator.h"
 
 namespace lamp_loop_closure {
 class TestLoopGeneration : public ::testing::Test {
@@ -38,9 +44,67 @@ class TestLoopGeneration : public ::testing::Test {
     return proximity_lc_.DistanceBetweenKeys(key1, key2);
   }
 
+  void engineKeyedPoseCallback(
+      const pose_graph_msgs::PoseGraph::ConstPtr& graph_msg) {
+    engine_.KeyedPoseCallback(graph_msg);
+  }
+
+  void engineAddCandidates(
+      const std::vector<pose_graph_msgs::LoopCandidate>& candidates,
+      bool prioritized = false) {
+    engine_.AddCandidates(candidates, prioritized);
+  }
+
+  std::vector<pose_graph_msgs::LoopCandidate> getEngineCandidates() {
+    return engine_.candidates_;
+  }
+
+  std::vector<pose_graph_msgs::LoopCandidate> getEnginePrioritizedCandidates() {
+    return engine_.prioritized_candidates_;
+  }
+
+  void setEngineMaxProposedPairs(size_t max_pairs) {
+    engine_.max_proposed_pairs_ = max_pairs;
+  }
+
+  void scanContextAddDescriptor(const gtsam::Key& key,
+                                const PointCloud& scan) {
+    scan_context_.AddDescriptor(key, scan);
+  }
+
+  std::vector<gtsam::Key> getScanContextPendingKeys() {
+    return scan_context_.pending_keys_;
+  }
+
+  void setScanContextMaxPendingKeys(size_t max_keys) {
+    scan_context_.max_pending_keys_ = max_keys;
+  }
+
   ProximityLoopGeneration proximity_lc_;
+  LoopGenerationEngine engine_;
+  ScanContextCandidateGenerator scan_context_;
 };
 
+// Scan of random pillars around the place, rotated by yaw
+PointCloud MakeScan(int place, double yaw) {
+  std::mt19937 generator(place);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  PointCloud scan;
+  for (int i = 0; i < 40; i++) {
+    const double range = 2.0 + 70.0 * uniform(generator);
+    const double bearing = 2.0 * M_PI * uniform(generator) + yaw;
+    const double height = 10.0 * uniform(generator);
+    for (double z = -1.5; z < height; z += 0.2) {
+      Point point;
+      point.x = range * std::cos(bearing);
+      point.y = range * std::sin(bearing);
+      point.z = z;
+      scan.push_back(point);
+    }
+  }
+  return scan;
+}
+
 TEST_F(TestLoopGeneration, TestInitialize) {
   ros::NodeHandle nh;
   bool init = proximity_lc_.Initialize(nh);
@@ -164,6 +228,219 @@ TEST_F(TestLoopGeneration, TestAdaptiveRadius) {
   EXPECT_EQ(1, candidates.size());
 }
 
+TEST(PoseStore, TestRadius) {
+  PoseStore poses(2.0);
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(poses.Insert(gtsam::Symbol('a', i),
+                             gtsam::Pose3(gtsam::Rot3(),
+                                          gtsam::Point3(i - 5.0, 0.5, 0))));
+  }
+  EXPECT_FALSE(poses.Insert(gtsam::Symbol('a', 0), gtsam::Pose3()));
+  EXPECT_EQ(10, poses.Size());
+
+  std::vector<gtsam::Key> keys = poses.Radius(gtsam::Point3(0, 0, 0), 1.2);
+  ASSERT_EQ(3, keys.size());
+  EXPECT_EQ(gtsam::Symbol('a', 4), keys[0]);
+  EXPECT_EQ(gtsam::Symbol('a', 5), keys[1]);
+  EXPECT_EQ(gtsam::Symbol('a', 6), keys[2]);
+  EXPECT_TRUE(poses.Radius(gtsam::Point3(0, 50, 0), 10.0).empty());
+}
+
+TEST_F(TestLoopGeneration, TestEngineSameAsProximity) {
+  ros::NodeHandle nh;
+  ros::param::set("base/b_take_n_closest", false);
+  std::vector<std::string> generators{"proximity"};
+  ros::param::set("base/generation_engine/generators", generators);
+  ASSERT_TRUE(proximity_lc_.Initialize(nh));
+  ASSERT_TRUE(engine_.Initialize(nh));
+  pose_graph_msgs::PoseGraph::Ptr graph_msg(new pose_graph_msgs::PoseGraph);
+  pose_graph_msgs::PoseGraphNode node1, node2, node3, node4, node5;
+  node1.key = gtsam::Symbol('a', 0);
+  node2.key = gtsam::Symbol('b', 0);
+  node3.key = gtsam::Symbol('c', 0);
+  node4.key = gtsam::Symbol('a', 1);
+  node5.key = gtsam::Symbol('a', 100);
+  node2.pose.position.x = 3;
+  node3.pose.position.x = 1000;
+  node4.pose.position.x = 2;
+  node5.pose.position.x = 2;
+  graph_msg->nodes.push_back(node1);
+  graph_msg->nodes.push_back(node2);
+  graph_msg->nodes.push_back(node3);
+  graph_msg->nodes.push_back(node4);
+  graph_msg->nodes.push_back(node5);
+
+  keyedPoseCallback(graph_msg);
+  engineKeyedPoseCallback(graph_msg);
+
+  std::vector<pose_graph_msgs::LoopCandidate> expected = getCandidates();
+  std::vector<pose_graph_msgs::LoopCandidate> candidates =
+      getEngineCandidates();
+  ASSERT_EQ(expected.size(), candidates.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_EQ(expected[i].key_from, candidates[i].key_from);
+    EXPECT_EQ(expected[i].key_to, candidates[i].key_to);
+  }
+}
+
+TEST_F(TestLoopGeneration, TestEngineDropsDuplicates) {
+  pose_graph_msgs::LoopCandidate candidate;
+  candidate.key_from = gtsam::Symbol('a', 10);
+  candidate.key_to = gtsam::Symbol('b', 3);
+  pose_graph_msgs::LoopCandidate reversed = candidate;
+  reversed.key_from = candidate.key_to;
+  reversed.key_to = candidate.key_from;
+  pose_graph_msgs::LoopCandidate other = candidate;
+  other.key_to = gtsam::Symbol('b', 4);
+
+  engineAddCandidates({candidate, reversed});
+  engineAddCandidates({candidate, other});
+  std::vector<pose_graph_msgs::LoopCandidate> candidates =
+      getEngineCandidates();
+  ASSERT_EQ(2, candidates.size());
+  EXPECT_EQ(candidate.key_to, candidates[0].key_to);
+  EXPECT_EQ(other.key_to, candidates[1].key_to);
+}
+
+TEST_F(TestLoopGeneration, TestEngineForgetsOldPairs) {
+  setEngineMaxProposedPairs(1);
+  pose_graph_msgs::LoopCandidate candidate;
+  candidate.key_from = gtsam::Symbol('a', 10);
+  candidate.key_to = gtsam::Symbol('b', 3);
+  pose_graph_msgs::LoopCandidate other = candidate;
+  other.key_to = gtsam::Symbol('b', 4);
+
+  // The second pair pushes the first one out
+  engineAddCandidates({candidate, other});
+  engineAddCandidates({other, candidate});
+  std::vector<pose_graph_msgs::LoopCandidate> candidates =
+      getEngineCandidates();
+  ASSERT_EQ(3, candidates.size());
+  EXPECT_EQ(candidate.key_to, candidates[2].key_to);
+}
+
+TEST_F(TestLoopGeneration, TestEngineKeepsPrioritizedApart) {
+  pose_graph_msgs::LoopCandidate candidate;
+  candidate.key_from = gtsam::Symbol('a', 10);
+  candidate.key_to = gtsam::Symbol('b', 3);
+  pose_graph_msgs::LoopCandidate other = candidate;
+  other.key_to = gtsam::Symbol('b', 4);
+
+  engineAddCandidates({candidate}, true);
+  // Pairs are shared by both routes
+  engineAddCandidates({candidate, other});
+  ASSERT_EQ(1, getEnginePrioritizedCandidates().size());
+  EXPECT_EQ(candidate.key_to, getEnginePrioritizedCandidates()[0].key_to);
+  ASSERT_EQ(1, getEngineCandidates().size());
+  EXPECT_EQ(other.key_to, getEngineCandidates()[0].key_to);
+}
+
+TEST(DescriptorIndex, TestNearestSameAsBruteForce) {
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  DescriptorIndex index(5);
+  std::vector<Eigen::VectorXf> descriptors;
+  for (int i = 0; i < 1000; i++) {
+    Eigen::VectorXf descriptor(5);
+    for (int d = 0; d < 5; d++) {
+      descriptor(d) = uniform(generator);
+    }
+    descriptors.push_back(descriptor);
+    index.Insert(i, descriptor);
+  }
+  EXPECT_EQ(1000, index.Size());
+
+  auto accept = [](gtsam::Key key) { return key % 3 != 0; };
+  for (int q = 0; q < 20; q++) {
+    Eigen::VectorXf query(5);
+    for (int d = 0; d < 5; d++) {
+      query(d) = uniform(generator);
+    }
+    std::vector<std::pair<float, gtsam::Key>> expected;
+    for (size_t i = 0; i < descriptors.size(); i++) {
+      if (accept(i))
+        expected.emplace_back((descriptors[i] - query).squaredNorm(), i);
+    }
+    std::sort(expected.begin(), expected.end());
+
+    auto nearest = index.Nearest(query, 7, accept);
+    ASSERT_EQ(7, nearest.size());
+    for (size_t i = 0; i < nearest.size(); i++) {
+      EXPECT_EQ(expected[i].second, nearest[i].second);
+      EXPECT_FLOAT_EQ(expected[i].first, nearest[i].first);
+    }
+  }
+}
+
+TEST(ScanContext, TestRotationInvariance) {
+  ScanContextParams params;
+  ScanContext scan, rotated, other;
+  ComputeScanContext(MakeScan(0, 0.0), params, &scan);
+  // Yaw of a whole number of sectors
+  ComputeScanContext(MakeScan(0, 2.0 * M_PI * 7 / 60), params, &rotated);
+  ComputeScanContext(MakeScan(1, 0.0), params, &other);
+
+  int shift = -1;
+  EXPECT_NEAR(0.0, ScanContextDistance(scan, rotated, params, &shift), 1e-3);
+  EXPECT_EQ(7, shift);
+  EXPECT_NEAR(0.0, (scan.ring_key - rotated.ring_key).norm(), 1e-3);
+  EXPECT_LT(0.5, ScanContextDistance(scan, other, params));
+}
+
+TEST_F(TestLoopGeneration, TestScanContextRevisit) {
+  PoseStore poses(10.0);
+  std::vector<gtsam::Key> keys;
+  for (int i = 0; i < 100; i++) {
+    const gtsam::Key key = gtsam::Symbol('a', i);
+    poses.Insert(key,
+                 gtsam::Pose3(gtsam::Rot3(), gtsam::Point3(i * 2.0, 0, 0)));
+    keys.push_back(key);
+    // Back to the first places with another heading at the end
+    scanContextAddDescriptor(
+        key, i < 90 ? MakeScan(i, 0.0) : MakeScan(i - 90, M_PI / 2));
+  }
+  // The scan of the last key comes after its pose
+  const gtsam::Key late_key = gtsam::Symbol('a', 100);
+  poses.Insert(late_key, gtsam::Pose3());
+  keys.push_back(late_key);
+
+  std::vector<pose_graph_msgs::LoopCandidate> candidates;
+  scan_context_.GenerateLoops(poses, keys, &candidates);
+  ASSERT_EQ(10, candidates.size());
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(gtsam::Symbol('a', 90 + i), candidates[i].key_from);
+    EXPECT_EQ(gtsam::Symbol('a', i), candidates[i].key_to);
+    EXPECT_EQ(pose_graph_msgs::LoopCandidate::DESCRIPTOR,
+              candidates[i].type);
+  }
+
+  candidates.clear();
+  scanContextAddDescriptor(late_key, MakeScan(10, 0.0));
+  scan_context_.GenerateLoops(poses, {}, &candidates);
+  ASSERT_EQ(1, candidates.size());
+  EXPECT_EQ(late_key, candidates[0].key_from);
+  EXPECT_EQ(gtsam::Symbol('a', 10), candidates[0].key_to);
+}
+
+TEST_F(TestLoopGeneration, TestScanContextDropsOldPendingKeys) {
+  setScanContextMaxPendingKeys(2);
+  PoseStore poses(10.0);
+  std::vector<gtsam::Key> keys;
+  for (int i = 0; i < 3; i++) {
+    keys.push_back(gtsam::Symbol('a', i));
+    poses.Insert(keys.back(), gtsam::Pose3());
+  }
+
+  // None of the scans came, the oldest key is dropped
+  std::vector<pose_graph_msgs::LoopCandidate> candidates;
+  scan_context_.GenerateLoops(poses, keys, &candidates);
+  std::vector<gtsam::Key> pending = getScanContextPendingKeys();
+  ASSERT_EQ(2, pending.size());
+  EXPECT_EQ(gtsam::Symbol('a', 1), pending[0]);
+  EXPECT_EQ(gtsam::Symbol('a', 2), pending[1]);
+  EXPECT_TRUE(candidates.empty());
+}
+
 }  // namespace lamp_loop_closure
 
 int main(int argc, char** argv) {
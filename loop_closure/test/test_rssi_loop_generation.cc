@@ -71,10 +71,9 @@ protected:
     return rssi_lc_.rssi_scom_dropped_list_;
   }
 
-  pose_graph_msgs::PoseGraphNode getPoseGraphNodeFromKey(
-      const std::map<double, pose_graph_msgs::PoseGraphNode>& robot_trajectory,
-      const gtsam::Symbol& key) {
-    return rssi_lc_.GetPoseGraphNodeFromKey(robot_trajectory, key);
+  pose_graph_msgs::PoseGraphNode
+  getPoseGraphNodeFromKey(const gtsam::Symbol& key) {
+    return rssi_lc_.GetPoseGraphNodeFromKey(key);
   }
 
   RssiLoopClosure rssi_lc_;
@@ -329,10 +328,12 @@ TEST_F(TestRSSILoopGeneration, TestGetPoseGraphNodeFromKey) {
   graph_msg->nodes.push_back(node6);
   keyedPoseCallback(graph_msg);
 
-  auto result = getPoseGraphNodeFromKey(getRobotTrajectory('a'), node1.key);
+  auto result = getPoseGraphNodeFromKey(node1.key);
   EXPECT_EQ(result.key, node1.key);
-  auto result2 = getPoseGraphNodeFromKey(getRobotTrajectory('a'), 5430543034);
+  auto result2 = getPoseGraphNodeFromKey(5430543034);
   EXPECT_EQ(result2.key, 0);
+  auto result3 = getPoseGraphNodeFromKey(node5.key);
+  EXPECT_EQ(result3.key, node5.key);
 }
 TEST_F(TestRSSILoopGeneration, CommNodeAggregatedStatusCallback) {
   ros::NodeHandle nh;
@@ -562,6 +563,57 @@ TEST(RssiRawInfo, TestAppendNode) {
   EXPECT_EQ(rssi_raw_info.has_node_pose(node1), true);
 }
 
+TEST(RssiRawInfo, TestFlybyIndexes) {
+  RssiRawInfo rssi_raw_info;
+  rssi_raw_info.cell_size = 2.0;
+  pose_graph_msgs::PoseGraphNode comm;
+  comm.key = gtsam::Symbol('a', 0);
+  rssi_raw_info.pose_graph_node = comm;
+
+  // Two flybys of robot a, 100 keys apart
+  for (int i = 0; i < 5; i++) {
+    pose_graph_msgs::PoseGraphNode node;
+    node.key = gtsam::Symbol('a', 10 + i);
+    node.pose.position.x = i;
+    EXPECT_TRUE(rssi_raw_info.append_node(node));
+  }
+  for (int i = 0; i < 5; i++) {
+    pose_graph_msgs::PoseGraphNode node;
+    node.key = gtsam::Symbol('a', 110 + i);
+    node.pose.position.x = 4 - i;
+    node.pose.position.y = 0.5;
+    EXPECT_TRUE(rssi_raw_info.append_node(node));
+  }
+  ASSERT_EQ(rssi_raw_info.all_nodes_around_comm.size(), 2);
+  EXPECT_FALSE(rssi_raw_info.append_node(
+      rssi_raw_info.all_nodes_around_comm[0][2].candidate_pose));
+
+  // Only the first flyby, within the radius
+  auto neighbours = rssi_raw_info.neighbours(
+      rssi_raw_info.all_nodes_around_comm[1][0].candidate_pose.pose.position,
+      1.2,
+      1);
+  ASSERT_EQ(neighbours.size(), 2);
+  EXPECT_EQ(neighbours[0].flyby, 0);
+  EXPECT_EQ(neighbours[0].index, 3);
+  EXPECT_EQ(neighbours[1].index, 4);
+
+  // Every node is handled once, new nodes of the newest flyby after that
+  FlybyNodeRef ref;
+  int handled = 0;
+  while (rssi_raw_info.next_unhandled_node(&ref)) {
+    handled++;
+  }
+  EXPECT_EQ(handled, 10);
+  EXPECT_FALSE(rssi_raw_info.next_unhandled_node(&ref));
+  pose_graph_msgs::PoseGraphNode node;
+  node.key = gtsam::Symbol('a', 115);
+  EXPECT_TRUE(rssi_raw_info.append_node(node));
+  ASSERT_TRUE(rssi_raw_info.next_unhandled_node(&ref));
+  EXPECT_EQ(ref.flyby, 1);
+  EXPECT_EQ(ref.index, 5);
+}
+
 } // namespace lamp_loop_closure
 
 int main(int argc, char** argv) {
@@ -65,7 +65,12 @@
 #include <tf/transform_broadcaster.h>
 #include <visualization_msgs/Marker.h>
 
+#include <chrono>
+#include <condition_variable>
 #include <limits>
+#include <mutex>
+#include <set>
+#include <thread>
 #include <pcl/ModelCoefficients.h>
 #include <pcl/filters/extract_indices.h>
 #include <pcl/sample_consensus/method_types.h>
@@ -127,6 +132,25 @@ public:
   void PublishIncrementalPointCloud();
 
 private:
+  // Refresh scheduler state handed from the callbacks to the worker
+  struct PendingScan {
+    gtsam::Pose3 pose;
+    PointCloud::ConstPtr scan;
+    int level;
+  };
+  struct LevelOutput {
+    ros::Publisher pub;
+    tf::StampedTransform tf;
+    std::set<gtsam::Key> keys;
+  };
+  // World-frame cloud of a robot, each scan stored once as a contiguous
+  // range of points
+  struct RobotCloud {
+    PointCloud points;
+    // First point and number of points of each scan
+    std::map<gtsam::Key, std::pair<size_t, size_t>> ranges;
+  };
+
   PoseGraph pose_graph_;
   // Node initialization.
   bool LoadParameters(const ros::NodeHandle& n);
@@ -148,6 +172,26 @@ private:
   void VisualizePointCloud();
   void PoseGraphCallback(const pose_graph_msgs::PoseGraph::ConstPtr& msg);
 
+  // Refresh scheduler. Pose updates are coalesced over refresh_window_ and
+  // only the scans of new keys or of keys that moved are transformed again,
+  // on a worker thread that overwrites just their points in the robot clouds
+  // and republishes the robot and level clouds holding them. Scans of keys
+  // that left the graph are dropped. Levels are selected once per key and
+  // cached.
+  void ScheduleRefresh(const pose_graph_msgs::PoseGraph::ConstPtr& msg);
+  void RefreshWorker();
+  // Applies a batch to the robot clouds and collects the robots and levels
+  // whose clouds changed
+  void ApplyRefresh(const std::map<gtsam::Key, PendingScan>& batch,
+                    const std::set<gtsam::Key>& removed,
+                    std::set<unsigned char>* robots,
+                    std::set<int>* levels);
+  void StopRefreshWorker();
+  static bool PoseMoved(const gtsam::Pose3& from,
+                        const gtsam::Pose3& to,
+                        double translation_threshold,
+                        double rotation_threshold);
+
   bool GetTransformedPointCloudWorld(const gtsam::Symbol key,
                                      PointCloud* points);
   bool CombineKeyedScansWorld(PointCloud* points);
@@ -207,6 +251,32 @@ private:
   tf::TransformBroadcaster broadcaster_;
   int current_level = 0; // todo: delete
 
+  // Refresh scheduler settings
+  bool b_refresh_scheduler_{false};
+  double refresh_window_{1.0};
+  double refresh_translation_threshold_{0.05};
+  double refresh_rotation_threshold_{0.01};
+
+  // Pose each scan was last placed at and its level (-1 when in none),
+  // owned by the callbacks
+  std::map<gtsam::Key, gtsam::Pose3> placed_poses_;
+  std::map<gtsam::Key, int> key_level_;
+  size_t num_levels_sent_{0};
+
+  // Handed from the callbacks to the worker
+  std::mutex refresh_mutex_;
+  std::condition_variable refresh_cv_;
+  std::map<gtsam::Key, PendingScan> pending_scans_;
+  std::set<gtsam::Key> pending_removals_;
+  std::vector<LevelOutput> pending_levels_;
+  std::chrono::steady_clock::time_point first_pending_;
+  bool b_refresh_running_{false};
+  std::thread refresh_thread_;
+
+  // Owned by the worker
+  std::map<unsigned char, RobotCloud> robot_clouds_;
+  std::vector<LevelOutput> level_outputs_;
+
   // Test class fixtures
   friend class TestPointCloudVisualizer;
 };
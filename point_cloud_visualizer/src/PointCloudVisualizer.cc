@@ -35,6 +35,7 @@
  *
  */
 
+#include <algorithm>
 #include <numeric>
 #include <parameter_utils/ParameterUtils.h>
 #include <pcl/filters/extract_indices.h>
@@ -51,7 +52,9 @@ PointCloudVisualizer::PointCloudVisualizer() {
   incremental_points_.reset(new PointCloud);
 }
 
-PointCloudVisualizer::~PointCloudVisualizer() {}
+PointCloudVisualizer::~PointCloudVisualizer() {
+  StopRefreshWorker();
+}
 
 bool PointCloudVisualizer::Initialize(const ros::NodeHandle& n) {
   name_ = ros::names::append(n.getNamespace(), "PointCloudVisualizer");
@@ -72,6 +75,11 @@ bool PointCloudVisualizer::Initialize(const ros::NodeHandle& n) {
         lamp_utils::ROBOT_PREFIXES.at(robot), new PointCloud));
   }
 
+  if (b_refresh_scheduler_) {
+    b_refresh_running_ = true;
+    refresh_thread_ = std::thread(&PointCloudVisualizer::RefreshWorker, this);
+  }
+
   return true;
 }
 
@@ -93,6 +101,14 @@ bool PointCloudVisualizer::LoadParameters(const ros::NodeHandle& n) {
     }
   }
 
+  // Optional, scans are placed once as they arrive by default
+  pu::Get("visualizer/refresh/b_enable", b_refresh_scheduler_);
+  pu::Get("visualizer/refresh/window", refresh_window_);
+  pu::Get("visualizer/refresh/translation_threshold",
+          refresh_translation_threshold_);
+  pu::Get("visualizer/refresh/rotation_threshold",
+          refresh_rotation_threshold_);
+
   return true;
 }
 
@@ -237,6 +253,10 @@ double point2planedistnaceWithSign(const gu::Transform3 pose,
 
 void PointCloudVisualizer::PoseGraphCallback(
     const pose_graph_msgs::PoseGraph::ConstPtr& msg) {
+  if (b_refresh_scheduler_) {
+    ScheduleRefresh(msg);
+    return;
+  }
   if (msg->nodes.size() != pose_graph_.GetValues().size()) {
     pose_graph_.UpdateFromMsg(msg);
     for (const auto& keyed_scan : key_scans_to_update_) {
@@ -251,6 +271,240 @@ void PointCloudVisualizer::PoseGraphCallback(
     key_scans_to_update_.clear();
   }
 }
+bool PointCloudVisualizer::PoseMoved(const gtsam::Pose3& from,
+                                     const gtsam::Pose3& to,
+                                     double translation_threshold,
+                                     double rotation_threshold) {
+  const gtsam::Pose3 delta = from.between(to);
+  return delta.translation().norm() > translation_threshold ||
+      gtsam::Rot3::Logmap(delta.rotation()).norm() > rotation_threshold;
+}
+
+void PointCloudVisualizer::ScheduleRefresh(
+    const pose_graph_msgs::PoseGraph::ConstPtr& msg) {
+  pose_graph_.UpdateFromMsg(msg);
+  std::map<gtsam::Key, PendingScan> updates;
+
+  // Placed scans whose key left the graph
+  std::set<gtsam::Key> in_graph;
+  for (const auto& node : msg->nodes) {
+    in_graph.insert(node.key);
+  }
+  std::set<gtsam::Key> removed;
+  for (auto it = placed_poses_.begin(); it != placed_poses_.end();) {
+    if (in_graph.count(it->first)) {
+      ++it;
+      continue;
+    }
+    removed.insert(it->first);
+    key_level_.erase(it->first);
+    pose_graph_.keyed_scans.erase(gtsam::Symbol(it->first));
+    it = placed_poses_.erase(it);
+  }
+
+  // New scans, their level is selected once. Scans of keys that are not in
+  // the graph yet wait for a later message.
+  for (auto it = key_scans_to_update_.begin();
+       it != key_scans_to_update_.end();) {
+    const gtsam::Symbol key = it->first;
+    if (!pose_graph_.HasKey(key)) {
+      ++it;
+      continue;
+    }
+    size_t level = SelectLevelForNode2(key);
+    int member =
+        levels_[level].init_nodes_.size() > 15 ? static_cast<int>(level) : -1;
+    const gtsam::Pose3 pose = pose_graph_.GetPose(key);
+    key_level_[key] = member;
+    placed_poses_[key] = pose;
+    updates[key] = PendingScan{pose, it->second, member};
+    it = key_scans_to_update_.erase(it);
+  }
+
+  // Placed scans whose node moved
+  for (const auto& node : msg->nodes) {
+    auto placed = placed_poses_.find(node.key);
+    if (placed == placed_poses_.end() || updates.count(node.key))
+      continue;
+    const gtsam::Pose3 pose = pose_graph_.GetPose(node.key);
+    if (!PoseMoved(placed->second,
+                   pose,
+                   refresh_translation_threshold_,
+                   refresh_rotation_threshold_))
+      continue;
+    auto scan = pose_graph_.keyed_scans.find(node.key);
+    if (scan == pose_graph_.keyed_scans.end())
+      continue;
+    placed->second = pose;
+    updates[node.key] = PendingScan{pose, scan->second, key_level_[node.key]};
+  }
+
+  if (updates.empty() && removed.empty() &&
+      num_levels_sent_ == levels_.size())
+    return;
+  ROS_DEBUG_STREAM("Queued " << updates.size() << " scans for refresh and "
+                             << removed.size() << " for removal");
+
+  std::lock_guard<std::mutex> lock(refresh_mutex_);
+  if (pending_scans_.empty() && pending_removals_.empty() &&
+      pending_levels_.empty())
+    first_pending_ = std::chrono::steady_clock::now();
+  for (const auto& key : removed) {
+    pending_scans_.erase(key);
+    pending_removals_.insert(key);
+  }
+  // Later poses replace queued ones
+  for (const auto& update : updates) {
+    pending_scans_[update.first] = update.second;
+  }
+  for (; num_levels_sent_ < levels_.size(); num_levels_sent_++) {
+    const Level& level = levels_[num_levels_sent_];
+    pending_levels_.push_back(
+        LevelOutput{level.pub_, level.tf_, std::set<gtsam::Key>()});
+  }
+  refresh_cv_.notify_all();
+}
+
+void PointCloudVisualizer::ApplyRefresh(
+    const std::map<gtsam::Key, PendingScan>& batch,
+    const std::set<gtsam::Key>& removed,
+    std::set<unsigned char>* robots,
+    std::set<int>* levels) {
+  // Drops the points of a scan and moves the scans behind it forward
+  auto erase_range = [](RobotCloud& robot, gtsam::Key key) {
+    auto range = robot.ranges.find(key);
+    if (range == robot.ranges.end())
+      return false;
+    const size_t first = range->second.first;
+    const size_t count = range->second.second;
+    robot.points.erase(robot.points.begin() + first,
+                       robot.points.begin() + first + count);
+    robot.ranges.erase(range);
+    for (auto& other : robot.ranges) {
+      if (other.second.first > first)
+        other.second.first -= count;
+    }
+    return true;
+  };
+
+  for (const auto& key : removed) {
+    const unsigned char prefix = gtsam::Symbol(key).chr();
+    auto robot = robot_clouds_.find(prefix);
+    if (robot != robot_clouds_.end() && erase_range(robot->second, key))
+      robots->insert(prefix);
+    for (size_t i = 0; i < level_outputs_.size(); i++) {
+      if (level_outputs_[i].keys.erase(key))
+        levels->insert(static_cast<int>(i));
+    }
+  }
+
+  for (const auto& entry : batch) {
+    PointCloud world;
+    pcl::transformPointCloud(
+        *entry.second.scan, world, entry.second.pose.matrix());
+
+    // A moved scan is overwritten in place
+    const unsigned char prefix = gtsam::Symbol(entry.first).chr();
+    RobotCloud& robot = robot_clouds_[prefix];
+    auto range = robot.ranges.find(entry.first);
+    if (range != robot.ranges.end() && range->second.second == world.size()) {
+      std::copy(world.begin(),
+                world.end(),
+                robot.points.begin() + range->second.first);
+    } else {
+      erase_range(robot, entry.first);
+      robot.ranges[entry.first] =
+          std::make_pair(robot.points.size(), world.size());
+      robot.points += world;
+    }
+    robots->insert(prefix);
+
+    const int level = entry.second.level;
+    if (level >= 0 && level < static_cast<int>(level_outputs_.size())) {
+      level_outputs_[level].keys.insert(entry.first);
+      levels->insert(level);
+    }
+  }
+}
+
+void PointCloudVisualizer::RefreshWorker() {
+  while (true) {
+    std::map<gtsam::Key, PendingScan> batch;
+    std::set<gtsam::Key> removed;
+    std::vector<LevelOutput> new_levels;
+    {
+      std::unique_lock<std::mutex> lock(refresh_mutex_);
+      refresh_cv_.wait(lock, [this] {
+        return !b_refresh_running_ || !pending_scans_.empty() ||
+            !pending_removals_.empty() || !pending_levels_.empty();
+      });
+      // Let the updates of the window accumulate
+      const auto deadline = first_pending_ +
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(refresh_window_));
+      while (b_refresh_running_ &&
+             std::chrono::steady_clock::now() < deadline) {
+        refresh_cv_.wait_until(lock, deadline);
+      }
+      if (!b_refresh_running_)
+        return;
+      batch.swap(pending_scans_);
+      removed.swap(pending_removals_);
+      new_levels.swap(pending_levels_);
+    }
+
+    level_outputs_.insert(
+        level_outputs_.end(), new_levels.begin(), new_levels.end());
+
+    std::set<unsigned char> robots;
+    std::set<int> levels;
+    ApplyRefresh(batch, removed, &robots, &levels);
+
+    // Republish only the clouds holding a changed scan
+    const ros::Time stamp = ros::Time::now();
+    for (const unsigned char prefix : robots) {
+      auto pub = publishers_robots_point_clouds_.find(prefix);
+      if (pub == publishers_robots_point_clouds_.end() ||
+          pub->second.getNumSubscribers() == 0)
+        continue;
+      sensor_msgs::PointCloud2 cloud_msg;
+      pcl::toROSMsg(robot_clouds_[prefix].points, cloud_msg);
+      cloud_msg.header.stamp = stamp;
+      cloud_msg.header.frame_id = fixed_frame_id_;
+      pub->second.publish(cloud_msg);
+    }
+    for (const int i : levels) {
+      LevelOutput& level = level_outputs_[i];
+      if (level.pub.getNumSubscribers() == 0)
+        continue;
+      PointCloud::Ptr cloud(new PointCloud);
+      for (const auto& key : level.keys) {
+        const RobotCloud& robot = robot_clouds_[gtsam::Symbol(key).chr()];
+        auto range = robot.ranges.find(key);
+        if (range == robot.ranges.end())
+          continue;
+        auto first = robot.points.begin() + range->second.first;
+        cloud->insert(cloud->end(), first, first + range->second.second);
+      }
+      cloud->header.frame_id = level.tf.child_frame_id_;
+      level.tf.stamp_ = stamp;
+      broadcaster_.sendTransform(level.tf);
+      level.pub.publish(cloud);
+    }
+  }
+}
+
+void PointCloudVisualizer::StopRefreshWorker() {
+  {
+    std::lock_guard<std::mutex> lock(refresh_mutex_);
+    b_refresh_running_ = false;
+    refresh_cv_.notify_all();
+  }
+  if (refresh_thread_.joinable()) {
+    refresh_thread_.join();
+  }
+}
+
 geometry_msgs::Point
 PointCloudVisualizer::GetPositionMsg(gtsam::Key key) const {
   geometry_msgs::Point p;
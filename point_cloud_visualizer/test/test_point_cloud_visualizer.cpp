@@ -25,6 +25,53 @@ protected:
                                     const gu::Transform3 pose) {
     return pc_vis_.IsPointInsideTheNegativeCone(current_pose, pose);
   }
+  bool poseMoved(const gtsam::Pose3& from, const gtsam::Pose3& to) {
+    return PointCloudVisualizer::PoseMoved(from, to, 0.05, 0.01);
+  }
+
+  // Body-frame scan of num_points points along x
+  PointCloud::ConstPtr makeScan(size_t num_points) {
+    PointCloud::Ptr scan(new PointCloud);
+    for (size_t i = 0; i < num_points; i++) {
+      Point p;
+      p.x = i;
+      p.y = 0;
+      p.z = 0;
+      scan->push_back(p);
+    }
+    return scan;
+  }
+  void placeScan(gtsam::Key key,
+                 const gtsam::Pose3& pose,
+                 const PointCloud::ConstPtr& scan) {
+    std::map<gtsam::Key, PointCloudVisualizer::PendingScan> batch;
+    batch[key] = PointCloudVisualizer::PendingScan{pose, scan, -1};
+    std::set<unsigned char> robots;
+    std::set<int> levels;
+    pc_vis_.ApplyRefresh(batch, std::set<gtsam::Key>(), &robots, &levels);
+  }
+  void removeScan(gtsam::Key key) {
+    std::set<unsigned char> robots;
+    std::set<int> levels;
+    std::map<gtsam::Key, PointCloudVisualizer::PendingScan> batch;
+    pc_vis_.ApplyRefresh(batch, std::set<gtsam::Key>{key}, &robots, &levels);
+  }
+  const PointCloud& robotCloud(unsigned char prefix) {
+    return pc_vis_.robot_clouds_[prefix].points;
+  }
+  void setPlaced(gtsam::Key key, const gtsam::Pose3& pose) {
+    pc_vis_.placed_poses_[key] = pose;
+    pc_vis_.key_level_[key] = -1;
+  }
+  void scheduleRefresh(const pose_graph_msgs::PoseGraph::ConstPtr& msg) {
+    pc_vis_.ScheduleRefresh(msg);
+  }
+  bool isPlaced(gtsam::Key key) {
+    return pc_vis_.placed_poses_.count(key) > 0;
+  }
+  bool isPendingRemoval(gtsam::Key key) {
+    return pc_vis_.pending_removals_.count(key) > 0;
+  }
 };
 
 // TEST_F(TestPointCloudVisualizer, TestSetInitialPositionNoParam) {
@@ -69,6 +116,72 @@ TEST_F(TestPointCloudVisualizer, TestNegative) {
   }
 }
 
+TEST_F(TestPointCloudVisualizer, TestPoseMoved) {
+  gtsam::Pose3 from(gtsam::Rot3::Yaw(0.5), gtsam::Point3(1, 2, 3));
+  gtsam::Pose3 small_step(gtsam::Rot3(), gtsam::Point3(0.04, 0, 0));
+  gtsam::Pose3 large_step(gtsam::Rot3(), gtsam::Point3(0, 0.06, 0));
+  gtsam::Pose3 small_turn(gtsam::Rot3::Roll(0.005), gtsam::Point3());
+  gtsam::Pose3 large_turn(gtsam::Rot3::Roll(0.02), gtsam::Point3());
+  EXPECT_FALSE(poseMoved(from, from));
+  EXPECT_FALSE(poseMoved(from, from.compose(small_step)));
+  EXPECT_TRUE(poseMoved(from, from.compose(large_step)));
+  EXPECT_FALSE(poseMoved(from, from.compose(small_turn)));
+  EXPECT_TRUE(poseMoved(from, from.compose(large_turn)));
+}
+
+TEST_F(TestPointCloudVisualizer, TestRemovedScansLeaveRobotCloud) {
+  const gtsam::Symbol a0('a', 0), a1('a', 1), a2('a', 2);
+  placeScan(a0, gtsam::Pose3(), makeScan(2));
+  placeScan(a1, gtsam::Pose3(), makeScan(3));
+  placeScan(a2, gtsam::Pose3(), makeScan(1));
+  ASSERT_EQ(6, robotCloud('a').size());
+
+  // A moved scan is overwritten in place
+  const gtsam::Pose3 up(gtsam::Rot3(), gtsam::Point3(0, 0, 1));
+  placeScan(a1, up, makeScan(3));
+  ASSERT_EQ(6, robotCloud('a').size());
+  EXPECT_FLOAT_EQ(0, robotCloud('a').points[1].z);
+  EXPECT_FLOAT_EQ(1, robotCloud('a').points[2].z);
+  EXPECT_FLOAT_EQ(1, robotCloud('a').points[4].z);
+  EXPECT_FLOAT_EQ(0, robotCloud('a').points[5].z);
+
+  // Its points are dropped and the scans behind it move forward
+  removeScan(a1);
+  ASSERT_EQ(3, robotCloud('a').size());
+  for (const auto& p : robotCloud('a').points) {
+    EXPECT_FLOAT_EQ(0, p.z);
+  }
+
+  // The scan behind is still found at its new place
+  const gtsam::Pose3 down(gtsam::Rot3(), gtsam::Point3(0, 0, -1));
+  placeScan(a2, down, makeScan(1));
+  ASSERT_EQ(3, robotCloud('a').size());
+  EXPECT_FLOAT_EQ(0, robotCloud('a').points[1].z);
+  EXPECT_FLOAT_EQ(-1, robotCloud('a').points[2].z);
+
+  // Removing a key without a scan changes nothing
+  removeScan(a1);
+  EXPECT_EQ(3, robotCloud('a').size());
+}
+
+TEST_F(TestPointCloudVisualizer, TestKeysLeavingGraphAreQueuedForRemoval) {
+  const gtsam::Symbol a0('a', 0), a1('a', 1);
+  setPlaced(a0, gtsam::Pose3());
+  setPlaced(a1, gtsam::Pose3());
+
+  pose_graph_msgs::PoseGraph::Ptr msg(new pose_graph_msgs::PoseGraph);
+  pose_graph_msgs::PoseGraphNode node;
+  node.key = a0;
+  node.pose.orientation.w = 1;
+  msg->nodes.push_back(node);
+  scheduleRefresh(msg);
+
+  EXPECT_TRUE(isPlaced(a0));
+  EXPECT_FALSE(isPendingRemoval(a0));
+  EXPECT_FALSE(isPlaced(a1));
+  EXPECT_TRUE(isPendingRemoval(a1));
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
   ros::init(argc, argv, "PointCloudVisualizerTest");
@@ -22,6 +22,11 @@
 #include <lamp_utils/PrefixHandling.h>
 
 #include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <boost/functional/hash.hpp>
 
 #include <Eigen/Eigen>
 #include <eigen_conversions/eigen_msg.h>
@@ -30,6 +35,19 @@
 typedef pose_graph_msgs::PoseGraphNode GraphNode;
 typedef pose_graph_msgs::PoseGraphEdge GraphEdge;
 
+// Edges are unique by <key_from, key_to, type>
+typedef std::tuple<gtsam::Key, gtsam::Key, int> EdgeId;
+
+struct EdgeIdHash {
+  std::size_t operator()(const EdgeId& id) const {
+    std::size_t seed = 0;
+    boost::hash_combine(seed, std::get<0>(id));
+    boost::hash_combine(seed, std::get<1>(id));
+    boost::hash_combine(seed, std::get<2>(id));
+    return seed;
+  }
+};
+
 class Merger {
 public:
   Merger();
@@ -47,13 +65,14 @@ public:
   void ClearNodes();
   void InsertNewEdges(const pose_graph_msgs::PoseGraphConstPtr& msg);
   bool IsEdgeNew(const pose_graph_msgs::PoseGraphEdge& msg);
+  void TrackFastEdge(const pose_graph_msgs::PoseGraphEdge& edge);
 
 
   std::set<char> GetNewRobots(const pose_graph_msgs::PoseGraphConstPtr& msg);
 
   // Utility functions
   void CleanUpMap(const ros::Time& stamp);
-  pose_graph_msgs::PoseGraph GetCurrentGraph();
+  const pose_graph_msgs::PoseGraph& GetCurrentGraph() const;
   void NormalizeNodeOrientation(pose_graph_msgs::PoseGraphNode & msg);
 
   geometry_utils::Transform3 GetPoseAtTime(const ros::Time& stamp);
@@ -81,14 +100,30 @@ private:
   ros::Publisher mergedGraphPub;
   ros::Publisher mergedPosePub;
 
-  // unique edges stored in the graph, tracked by <key_from, key_to, type>
-  std::set< std::tuple<gtsam::Key, gtsam::Key, int> > unique_edges_;
+  // unique edges stored in the graph, mapped to their index in the edges
+  // vector
+  std::unordered_map<EdgeId, size_t, EdgeIdHash> merged_graph_EdgeToIndex_;
 
   // Robots included in the merged graph, specified by prefix char
   std::set<char> robots_;
 
   // Storing map from key to the index in the nodes vector
-  std::map<long unsigned int, int> merged_graph_KeyToIndex_;
+  std::unordered_map<gtsam::Key, size_t> merged_graph_KeyToIndex_;
+
+  // Fast graph state kept across messages so it does not have to be rebuilt
+  // from the whole fast graph on every call: the edge used to place each
+  // node (odometry preferred). Robot nodes are dropped once the slow graph
+  // has placed them. The fast graph stamps are kept in the merged nodes.
+  std::unordered_map<gtsam::Key, GraphEdge> fast_in_edges_;
+
+  // Highest robot key per prefix that has been fused from the fast graph.
+  // Robot nodes at or below it that are already merged are skipped.
+  std::unordered_map<char, gtsam::Key> fast_watermark_;
+
+  // Keys placed by slow graphs and the highest one per robot. Incremental
+  // slow graphs only carry changed nodes and are applied on top of these.
+  std::unordered_set<gtsam::Key> slow_keys_;
+  std::unordered_map<char, gtsam::Key> slow_latest_;
 
   pose_graph_msgs::PoseGraph merged_graph_;
 
@@ -1,5 +1,7 @@
 #include <pose_graph_merger/merger.h>
 
+#include <algorithm>
+
 namespace gu = geometry_utils;
 
 Merger::Merger()
@@ -15,63 +17,32 @@ void Merger::InsertNewEdges(const pose_graph_msgs::PoseGraphConstPtr& msg) {
     return;
   }
 
-  // New edges that we want to update with
-  std::map<std::tuple<gtsam::Key, gtsam::Key, int>,
-           pose_graph_msgs::PoseGraphEdge>
-      updated_artifact_edges;
-
-  // Add new edges and skip existing edges
+  // Add new edges, replace repeated artifact edges in place and skip other
+  // existing edges
   for (const GraphEdge& edge : msg->edges) {
-    std::tuple<gtsam::Key, gtsam::Key, int> id =
-        std::make_tuple(edge.key_from, edge.key_to, edge.type);
-    if (IsEdgeNew(edge)){
-      // Add to the merged graph
+    EdgeId id = std::make_tuple(edge.key_from, edge.key_to, edge.type);
+    auto found = merged_graph_EdgeToIndex_.find(id);
+    if (found == merged_graph_EdgeToIndex_.end()) {
+      // Add to the merged graph and track where it is stored
+      merged_graph_EdgeToIndex_.emplace(id, merged_graph_.edges.size());
       merged_graph_.edges.push_back(edge);
-
-      // Add to stored set of edges
-      unique_edges_.insert(id);
     } else if (edge.type == pose_graph_msgs::PoseGraphEdge::ARTIFACT) {
       ROS_DEBUG_STREAM("\nMerger: Repeated artifact edge with key to "
                        << gtsam::DefaultKeyFormatter(edge.key_to));
-      updated_artifact_edges[id] = edge;
-    }
-  }
-
-  // Replace the existing artifact edges with updated_artifact_edges
-  pose_graph_msgs::PoseGraph new_graph;
-
-  auto e = merged_graph_.edges.begin();
-  while (e != merged_graph_.edges.end()) {
-    auto edge_itr = *e;
-    if (edge_itr.type == pose_graph_msgs::PoseGraphEdge::ARTIFACT) {
-      std::tuple<gtsam::Key, gtsam::Key, int> id =
-          std::make_tuple(edge_itr.key_from, edge_itr.key_to, edge_itr.type);
-      if (updated_artifact_edges.find(id) != updated_artifact_edges.end()) {
-        e++;
-        continue;
-      }
+      merged_graph_.edges[found->second] = edge;
     }
-    new_graph.edges.push_back(edge_itr);
-    e++;
-  }
-
-  auto itr = updated_artifact_edges.begin();
-  while (itr != updated_artifact_edges.end()) {
-    new_graph.edges.push_back(itr->second);
-    itr++;
   }
-  merged_graph_.edges = new_graph.edges;
 }
 
 void Merger::InsertNode(const pose_graph_msgs::PoseGraphNode& node) {
   // Just update the node if it is already exist
-  if (merged_graph_KeyToIndex_.find(node.key) !=
-      merged_graph_KeyToIndex_.end()) {
-    merged_graph_.nodes[merged_graph_KeyToIndex_[node.key]] = node;
+  auto found = merged_graph_KeyToIndex_.find(node.key);
+  if (found != merged_graph_KeyToIndex_.end()) {
+    merged_graph_.nodes[found->second] = node;
     ROS_DEBUG_STREAM(
         "\n[Insert Node] key to index mapping already exists, with key: "
         << gtsam::DefaultKeyFormatter(node.key) << " and index "
-        << merged_graph_KeyToIndex_[node.key]);
+        << found->second);
     return;
   }
 
@@ -79,7 +50,7 @@ void Merger::InsertNode(const pose_graph_msgs::PoseGraphNode& node) {
   ROS_DEBUG_STREAM("\nAdding new key to index mapping, with key: "
                    << gtsam::DefaultKeyFormatter(node.key) << " and index "
                    << merged_graph_.nodes.size());
-  merged_graph_KeyToIndex_[node.key] = merged_graph_.nodes.size();
+  merged_graph_KeyToIndex_.emplace(node.key, merged_graph_.nodes.size());
 
   // Add the node to the graph
   merged_graph_.nodes.push_back(node);
@@ -92,14 +63,41 @@ void Merger::InsertNode(const pose_graph_msgs::PoseGraphNode& node) {
 }
 
 void Merger::ClearNodes() {
+  // clear() keeps the allocated capacity for the next graph
   merged_graph_.nodes.clear();
   merged_graph_KeyToIndex_.clear();
 }
 
 bool Merger::IsEdgeNew(const pose_graph_msgs::PoseGraphEdge& msg) {
   // Checks to see if an edge is new
-  std::tuple<gtsam::Key, gtsam::Key, int> id = std::make_tuple(msg.key_from, msg.key_to, msg.type);
-  return unique_edges_.count(id) == 0;
+  EdgeId id = std::make_tuple(msg.key_from, msg.key_to, msg.type);
+  return merged_graph_EdgeToIndex_.count(id) == 0;
+}
+
+void Merger::TrackFastEdge(const pose_graph_msgs::PoseGraphEdge& edge) {
+  // Robot nodes placed by the slow graph no longer need their fast edge
+  if (lamp_utils::IsRobotPrefix(gtsam::Symbol(edge.key_to).chr()) &&
+      slow_keys_.count(edge.key_to)) {
+    return;
+  }
+
+  auto found = fast_in_edges_.find(edge.key_to);
+  if (found == fast_in_edges_.end()) {
+    fast_in_edges_.emplace(edge.key_to, edge);
+    return;
+  }
+
+  // Place nodes along odometry where possible and keep artifact edges up to
+  // date with the latest observation
+  GraphEdge& tracked = found->second;
+  if (edge.type == pose_graph_msgs::PoseGraphEdge::ODOM &&
+      tracked.type != pose_graph_msgs::PoseGraphEdge::ODOM) {
+    tracked = edge;
+  } else if (edge.type == pose_graph_msgs::PoseGraphEdge::ARTIFACT &&
+             tracked.type == pose_graph_msgs::PoseGraphEdge::ARTIFACT &&
+             edge.key_from == tracked.key_from) {
+    tracked = edge;
+  }
 }
 
 std::set<char> Merger::GetNewRobots(const pose_graph_msgs::PoseGraphConstPtr& msg) {
@@ -124,12 +122,66 @@ std::set<char> Merger::GetNewRobots(const pose_graph_msgs::PoseGraphConstPtr& ms
 void Merger::OnSlowGraphMsg(const pose_graph_msgs::PoseGraphConstPtr& msg) {
   ROS_DEBUG_STREAM("Received slow graph, size " << msg->nodes.size());
 
-  // Clear existing nodes
-  ClearNodes();
+  // An incremental slow graph only holds the nodes that changed, the full
+  // one replaces all nodes
+  bool incremental = msg->incremental && !merged_graph_.nodes.empty();
+
+  // Nodes of the previous merged graph, which hold the fast graph stamps
+  std::vector<GraphNode> previous_nodes;
+  std::unordered_map<gtsam::Key, size_t> previous_index;
+  if (!incremental) {
+    // Clear existing nodes
+    previous_nodes.swap(merged_graph_.nodes);
+    previous_index.swap(merged_graph_KeyToIndex_);
+    ClearNodes();
+    slow_keys_.clear();
+    slow_latest_.clear();
+  }
+  const std::vector<GraphNode>& stamped_nodes =
+      incremental ? merged_graph_.nodes : previous_nodes;
+  const std::unordered_map<gtsam::Key, size_t>& stamped_index =
+      incremental ? merged_graph_KeyToIndex_ : previous_index;
 
   // Insert all Nodes - slow graph should be the most accurate and up to date
+  std::set<char> updated_robots;
   for (const GraphNode& node : msg->nodes) {
+    // Keep the stamp from the fast graph (most correct)
+    std_msgs::Header header = node.header;
+    auto stamped = stamped_index.find(node.key);
+    if (stamped != stamped_index.end()) {
+      header = stamped_nodes[stamped->second].header;
+    }
+
     InsertNode(node);
+    merged_graph_.nodes[merged_graph_KeyToIndex_[node.key]].header = header;
+    slow_keys_.insert(node.key);
+
+    char prefix = gtsam::Symbol(node.key).chr();
+    if (lamp_utils::IsRobotPrefix(prefix)) {
+      gtsam::Key& latest = slow_latest_[prefix];
+      latest = std::max(latest, gtsam::Key(node.key));
+      updated_robots.insert(prefix);
+
+      // Placed by the slow graph from now on
+      fast_in_edges_.erase(node.key);
+    }
+  }
+
+  // Fast nodes beyond the end of the slow graph were placed relative to the
+  // previous slow graph and have to be placed again
+  auto watermark = fast_watermark_.begin();
+  while (watermark != fast_watermark_.end()) {
+    if (incremental && !updated_robots.count(watermark->first)) {
+      ++watermark;
+      continue;
+    }
+    auto latest = slow_latest_.find(watermark->first);
+    if (latest == slow_latest_.end()) {
+      watermark = fast_watermark_.erase(watermark);
+      continue;
+    }
+    watermark->second = std::min(watermark->second, latest->second);
+    ++watermark;
   }
 
   InsertNewEdges(msg);
@@ -142,6 +194,23 @@ void Merger::OnFastGraphMsg(const pose_graph_msgs::PoseGraphConstPtr& msg) {
 
   std::set<char> new_robots = GetNewRobots(msg);
 
+  // Update the persistent edges used to place fast nodes
+  for (const GraphEdge& edge : msg->edges) {
+    TrackFastEdge(edge);
+  }
+
+  // Marks a robot node as fused so later fast graphs can skip it
+  auto advance_watermark = [this](gtsam::Key key) {
+    char prefix = gtsam::Symbol(key).chr();
+    if (!lamp_utils::IsRobotPrefix(prefix))
+      return;
+    auto watermark = fast_watermark_.find(prefix);
+    if (watermark == fast_watermark_.end())
+      fast_watermark_.emplace(prefix, key);
+    else
+      watermark->second = std::max(watermark->second, key);
+  };
+
   // If no slow graph (or an empty slow graph only) has been received, merged
   // graph is the fast graph only
   if (merged_graph_.nodes.size() == 0 || new_robots.size() > 0) {
@@ -149,6 +218,7 @@ void Merger::OnFastGraphMsg(const pose_graph_msgs::PoseGraphConstPtr& msg) {
 
     for (const GraphNode& node : msg->nodes) {
       InsertNode(node);
+      advance_watermark(node.key);
     }
 
     InsertNewEdges(msg);
@@ -161,63 +231,80 @@ void Merger::OnFastGraphMsg(const pose_graph_msgs::PoseGraphConstPtr& msg) {
   // Get header from the fastGraph - most recent graph
   merged_graph_.header = msg->header;
 
-  std::map<long unsigned int, std::set<const GraphEdge*>> fastOutAdjList;
-  std::map<long unsigned int, std::set<const GraphEdge*>> fastInAdjList;
-  for (const GraphEdge& edge : msg->edges) {
-    fastOutAdjList[edge.key_from].insert(&edge);
-    fastInAdjList[edge.key_to].insert(&edge);
-  }
-
-  // use map to order the new fast nodes by the order they were created in
-  // std::map<unsigned int, const GraphNode*> newFastNodes;
-  std::map<long unsigned int, const GraphNode*> fastKeyToNode;
+  // Fast nodes to add to the merged graph
+  std::vector<const GraphNode*> new_fast_nodes;
 
   for (const GraphNode& node : msg->nodes) {
-    if (merged_graph_KeyToIndex_.count(node.key) != 0) {
+    auto index = merged_graph_KeyToIndex_.find(node.key);
+    if (index != merged_graph_KeyToIndex_.end()) {
+      // Robot nodes below the watermark have already been fused
+      auto watermark = fast_watermark_.find(gtsam::Symbol(node.key).chr());
+      if (watermark != fast_watermark_.end() &&
+          node.key <= watermark->second) {
+        continue;
+      }
+
+      // Robot nodes kept from fast graphs through incremental slow graphs
+      // are placed again
+      if (lamp_utils::IsRobotPrefix(gtsam::Symbol(node.key).chr()) &&
+          !slow_keys_.count(node.key)) {
+        new_fast_nodes.push_back(&node);
+        continue;
+      }
+
       // Replace the stamp with the fast graph stamp (most correct)
-      merged_graph_.nodes[merged_graph_KeyToIndex_[node.key]].header =
-          node.header;
-      // TODO 1: we want to add the artifact anyway
-      // if artifact node -> add that
-
-      if (fastInAdjList.find(node.key) != fastInAdjList.end()) {
-        const GraphEdge* edge_to_check = *fastInAdjList[node.key].begin();
-        if (edge_to_check->type == pose_graph_msgs::PoseGraphEdge::ARTIFACT) {
-          ROS_DEBUG_STREAM(
-              "\nDebug Merger: Adding the reobserved artifact to newfastnode "
-              << gtsam::DefaultKeyFormatter(node.key));
-          // newFastNodes[node.header.seq] = &node;
-          fastKeyToNode[node.key] = &node;
-        }
+      merged_graph_.nodes[index->second].header = node.header;
+
+      // Re-add reobserved artifacts
+      auto in_edge = fast_in_edges_.find(node.key);
+      if (in_edge != fast_in_edges_.end() &&
+          in_edge->second.type == pose_graph_msgs::PoseGraphEdge::ARTIFACT) {
+        ROS_DEBUG_STREAM(
+            "\nDebug Merger: Adding the reobserved artifact to newfastnode "
+            << gtsam::DefaultKeyFormatter(node.key));
+        new_fast_nodes.push_back(&node);
+      } else {
+        advance_watermark(node.key);
       }
-      //
       continue; // Then skip
     }
 
-    // newFastNodes[node.header.seq] = &node;
-    fastKeyToNode[node.key] = &node;
+    new_fast_nodes.push_back(&node);
     // ROS_INFO_STREAM("Added new fast node, key " << node.key);
   }
 
+  // Add the nodes in key order so each node is placed after its predecessor,
+  // a repeated key keeps the order it was received in
+  std::stable_sort(new_fast_nodes.begin(),
+            new_fast_nodes.end(),
+            [](const GraphNode* lhs, const GraphNode* rhs) {
+              return lhs->key < rhs->key;
+            });
+
   // for each node in the fast graph which is not in the graph
-  for (auto kv : fastKeyToNode) {
+  for (const GraphNode* fastNode : new_fast_nodes) {
     // ROS_INFO_STREAM("Adding new node");
-    // the fast node to add to the merged_graph_
-    const GraphNode* fastNode = kv.second;
-    // TODO 2: we skip the artifact edge if there is no edge. Find == end
+    // create a copy of the fast node to add to the merged_graph_
+    GraphNode new_merged_graph_node = *fastNode;
 
     // edge in the fast graph to this fast node
-    const GraphEdge* edgeToFastNode = *fastInAdjList[fastNode->key].begin();
-
-    // create a copy of the fast node and edge to add to the merged_graph_
-    GraphNode new_merged_graph_node = *fastNode;
-    GraphEdge new_merged_graph_edge = *edgeToFastNode;
+    auto in_edge = fast_in_edges_.find(fastNode->key);
+    if (in_edge == fast_in_edges_.end()) {
+      ROS_WARN_STREAM("[FastGraph] No edge to node "
+                      << gtsam::DefaultKeyFormatter(fastNode->key)
+                      << ". Using current robot-graph value.");
+      InsertNode(new_merged_graph_node);
+      advance_watermark(fastNode->key);
+      continue;
+    }
+    const GraphEdge& new_merged_graph_edge = in_edge->second;
 
     // find the node in the merged_graph_ corresponding to previous node in fast
     // graph
-    long unsigned int prevFastKey = edgeToFastNode->key_from;
+    gtsam::Key prevFastKey = new_merged_graph_edge.key_from;
+    auto prev_index = merged_graph_KeyToIndex_.find(prevFastKey);
     // Check if the prior node exists
-    if (merged_graph_KeyToIndex_.count(prevFastKey) == 0) {
+    if (prev_index == merged_graph_KeyToIndex_.end()) {
       // Prior node doesn't exist - don't adjust
       ROS_WARN_STREAM("[FastGraph] Have missing node with an edge-from. Key: "
                       << gtsam::DefaultKeyFormatter(prevFastKey)
@@ -230,11 +317,12 @@ void Merger::OnFastGraphMsg(const pose_graph_msgs::PoseGraphConstPtr& msg) {
                        << ", with edge from "
                        << gtsam::DefaultKeyFormatter(prevFastKey));
       InsertNode(new_merged_graph_node);
+      advance_watermark(fastNode->key);
       continue;
     }
 
     const GraphNode* merged_graph_PrevNode =
-        &merged_graph_.nodes[merged_graph_KeyToIndex_[prevFastKey]];
+        &merged_graph_.nodes[prev_index->second];
 
     // calculate the pose of the new merged graph node by applying the edge
     // transformation to the previous node
@@ -259,6 +347,7 @@ void Merger::OnFastGraphMsg(const pose_graph_msgs::PoseGraphConstPtr& msg) {
                      << ", with edge from "
                      << gtsam::DefaultKeyFormatter(prevFastKey));
     InsertNode(new_merged_graph_node);
+    advance_watermark(fastNode->key);
   }
 
   ROS_DEBUG_STREAM("Finished merging graph, size "
@@ -379,6 +468,6 @@ void Merger::CleanUpMap(const ros::Time& stamp) {
                   << timestamped_poses_.size());
 }
 
-pose_graph_msgs::PoseGraph Merger::GetCurrentGraph() {
+const pose_graph_msgs::PoseGraph& Merger::GetCurrentGraph() const {
   return merged_graph_;
 }
@@ -27,6 +27,10 @@ public:
 
   Merger merger;
 
+  size_t NumFastInEdges() const {
+    return merger.fast_in_edges_.size();
+  }
+
 protected:
   // Tolerance on EXPECT_NEAR assertions
   double tolerance_ = 1e-5;
@@ -728,6 +732,247 @@ TEST_F(TestMerger, MergeWithArtifactInFastGraph) {
   EXPECT_NEAR(0.0, z, tolerance_);
 }
 
+TEST_F(TestMerger, RepeatedFastGraphs) {
+  ros::NodeHandle nh, pnh("~");
+
+  // Slow graph with a rotated second node
+  pose_graph_msgs::PoseGraph g;
+  pose_graph_msgs::PoseGraphNode n0, n1, n2, n3;
+  pose_graph_msgs::PoseGraphEdge e0, e1, e2;
+
+  n0.key = gtsam::Symbol('a', 0);
+  n0.pose.orientation.w = 1.0;
+
+  n1.key = gtsam::Symbol('a', 1);
+  n1.pose.position.y = 1.0;
+  n1.pose.orientation.z = sqrt(0.5);
+  n1.pose.orientation.w = sqrt(0.5);
+
+  g.nodes.push_back(n0);
+  g.nodes.push_back(n1);
+
+  pose_graph_msgs::PoseGraphConstPtr slow_graph(
+      new pose_graph_msgs::PoseGraph(g));
+
+  // Fast graphs that grow by one node each
+  n1.pose = pose_graph_msgs::PoseGraphNode().pose;
+  n1.pose.position.x = 1.0;
+  n1.pose.orientation.w = 1.0;
+
+  n2.key = gtsam::Symbol('a', 2);
+  n2.pose.position.x = 3.0;
+  n2.pose.orientation.w = 1.0;
+
+  n3.key = gtsam::Symbol('a', 3);
+  n3.pose.position.x = 4.0;
+  n3.pose.orientation.w = 1.0;
+
+  e0.key_from = n0.key;
+  e0.key_to = n1.key;
+  e0.pose.position.x = 1.0;
+  e0.pose.orientation.w = 1.0;
+  e0.type = pose_graph_msgs::PoseGraphEdge::ODOM;
+
+  e1.key_from = n1.key;
+  e1.key_to = n2.key;
+  e1.pose.position.x = 2.0;
+  e1.pose.orientation.w = 1.0;
+  e1.type = pose_graph_msgs::PoseGraphEdge::ODOM;
+
+  e2.key_from = n2.key;
+  e2.key_to = n3.key;
+  e2.pose.position.x = 1.0;
+  e2.pose.orientation.w = 1.0;
+  e2.type = pose_graph_msgs::PoseGraphEdge::ODOM;
+
+  g = pose_graph_msgs::PoseGraph();
+  g.nodes.push_back(n0);
+  g.nodes.push_back(n1);
+  g.nodes.push_back(n2);
+  g.edges.push_back(e0);
+  g.edges.push_back(e1);
+  pose_graph_msgs::PoseGraphConstPtr fast_graph_1(
+      new pose_graph_msgs::PoseGraph(g));
+
+  g.nodes.push_back(n3);
+  g.edges.push_back(e2);
+  pose_graph_msgs::PoseGraphConstPtr fast_graph_2(
+      new pose_graph_msgs::PoseGraph(g));
+
+  merger.OnSlowGraphMsg(slow_graph);
+  merger.OnFastGraphMsg(fast_graph_1);
+  merger.OnFastGraphMsg(fast_graph_1);
+  merger.OnFastGraphMsg(fast_graph_2);
+
+  const pose_graph_msgs::PoseGraph& current_graph = merger.GetCurrentGraph();
+  EXPECT_EQ(4, current_graph.nodes.size());
+  EXPECT_EQ(3, current_graph.edges.size());
+
+  // New nodes are chained onto the slow graph
+  for (const GraphNode& node : current_graph.nodes) {
+    if (node.key == gtsam::Symbol('a', 2)) {
+      EXPECT_NEAR(0.0, node.pose.position.x, tolerance_);
+      EXPECT_NEAR(3.0, node.pose.position.y, tolerance_);
+    } else if (node.key == gtsam::Symbol('a', 3)) {
+      EXPECT_NEAR(0.0, node.pose.position.x, tolerance_);
+      EXPECT_NEAR(4.0, node.pose.position.y, tolerance_);
+    }
+  }
+
+  // A new slow graph moves the nodes beyond its end along with it
+  g = pose_graph_msgs::PoseGraph();
+  n1 = pose_graph_msgs::PoseGraphNode();
+  n1.key = gtsam::Symbol('a', 1);
+  n1.pose.position.x = -1.0;
+  n1.pose.orientation.w = 1.0;
+  g.nodes.push_back(n0);
+  g.nodes.push_back(n1);
+  merger.OnSlowGraphMsg(
+      pose_graph_msgs::PoseGraphConstPtr(new pose_graph_msgs::PoseGraph(g)));
+  merger.OnFastGraphMsg(fast_graph_2);
+
+  EXPECT_EQ(4, merger.GetCurrentGraph().nodes.size());
+  for (const GraphNode& node : merger.GetCurrentGraph().nodes) {
+    if (node.key == gtsam::Symbol('a', 3)) {
+      EXPECT_NEAR(2.0, node.pose.position.x, tolerance_);
+      EXPECT_NEAR(0.0, node.pose.position.y, tolerance_);
+    }
+  }
+}
+
+TEST_F(TestMerger, IncrementalSlowGraph) {
+  ros::NodeHandle nh, pnh("~");
+
+  // Slow graph a0, a1 and fast graph a0 - a3 along x
+  pose_graph_msgs::PoseGraph g;
+  pose_graph_msgs::PoseGraphNode n0, n1, n2, n3;
+  pose_graph_msgs::PoseGraphEdge e0, e1, e2;
+
+  n0.key = gtsam::Symbol('a', 0);
+  n0.pose.orientation.w = 1.0;
+  n1.key = gtsam::Symbol('a', 1);
+  n1.pose.position.x = 1.0;
+  n1.pose.orientation.w = 1.0;
+  n2.key = gtsam::Symbol('a', 2);
+  n2.pose.position.x = 2.0;
+  n2.pose.orientation.w = 1.0;
+  n3.key = gtsam::Symbol('a', 3);
+  n3.pose.position.x = 3.0;
+  n3.pose.orientation.w = 1.0;
+
+  e0.key_from = n0.key;
+  e0.key_to = n1.key;
+  e1.key_from = n1.key;
+  e1.key_to = n2.key;
+  e2.key_from = n2.key;
+  e2.key_to = n3.key;
+  for (auto e : {&e0, &e1, &e2}) {
+    e->pose.position.x = 1.0;
+    e->pose.orientation.w = 1.0;
+    e->type = pose_graph_msgs::PoseGraphEdge::ODOM;
+  }
+
+  g.nodes.push_back(n0);
+  g.nodes.push_back(n1);
+  g.edges.push_back(e0);
+  merger.OnSlowGraphMsg(
+      pose_graph_msgs::PoseGraphConstPtr(new pose_graph_msgs::PoseGraph(g)));
+
+  g.nodes.push_back(n2);
+  g.nodes.push_back(n3);
+  g.edges.push_back(e1);
+  g.edges.push_back(e2);
+  pose_graph_msgs::PoseGraphConstPtr fast_graph(
+      new pose_graph_msgs::PoseGraph(g));
+  merger.OnFastGraphMsg(fast_graph);
+  EXPECT_EQ(4, merger.GetCurrentGraph().nodes.size());
+
+  // Incremental slow graph that only moves a1
+  g = pose_graph_msgs::PoseGraph();
+  g.incremental = true;
+  n1.pose.position.y = 1.0;
+  g.nodes.push_back(n1);
+  merger.OnSlowGraphMsg(
+      pose_graph_msgs::PoseGraphConstPtr(new pose_graph_msgs::PoseGraph(g)));
+  merger.OnFastGraphMsg(fast_graph);
+
+  // a0 is kept, a1 moved and the fast nodes are chained onto it again
+  const pose_graph_msgs::PoseGraph& current_graph = merger.GetCurrentGraph();
+  EXPECT_EQ(4, current_graph.nodes.size());
+  EXPECT_EQ(3, current_graph.edges.size());
+  for (const GraphNode& node : current_graph.nodes) {
+    gtsam::Symbol key(node.key);
+    double expected_y = key.index() == 0 ? 0.0 : 1.0;
+    EXPECT_NEAR(key.index(), node.pose.position.x, tolerance_);
+    EXPECT_NEAR(expected_y, node.pose.position.y, tolerance_);
+  }
+}
+
+TEST_F(TestMerger, SlowGraphPrunesFastState) {
+  ros::NodeHandle nh, pnh("~");
+
+  // Fast graph a0 - a2 along x with stamps, slow graph a0 only
+  pose_graph_msgs::PoseGraph g;
+  pose_graph_msgs::PoseGraphNode n0, n1, n2;
+  pose_graph_msgs::PoseGraphEdge e0, e1;
+
+  n0.key = gtsam::Symbol('a', 0);
+  n1.key = gtsam::Symbol('a', 1);
+  n2.key = gtsam::Symbol('a', 2);
+  for (auto n : {&n0, &n1, &n2}) {
+    n->pose.position.x = gtsam::Symbol(n->key).index();
+    n->pose.orientation.w = 1.0;
+  }
+
+  e0.key_from = n0.key;
+  e0.key_to = n1.key;
+  e1.key_from = n1.key;
+  e1.key_to = n2.key;
+  for (auto e : {&e0, &e1}) {
+    e->pose.position.x = 1.0;
+    e->pose.orientation.w = 1.0;
+    e->type = pose_graph_msgs::PoseGraphEdge::ODOM;
+  }
+
+  g.nodes.push_back(n0);
+  merger.OnSlowGraphMsg(
+      pose_graph_msgs::PoseGraphConstPtr(new pose_graph_msgs::PoseGraph(g)));
+
+  g = pose_graph_msgs::PoseGraph();
+  g.nodes.push_back(n0);
+  g.nodes.push_back(n1);
+  g.nodes.push_back(n2);
+  g.edges.push_back(e0);
+  g.edges.push_back(e1);
+  for (auto& node : g.nodes) {
+    node.header.stamp = ros::Time(10.0 + gtsam::Symbol(node.key).index());
+  }
+  pose_graph_msgs::PoseGraphConstPtr fast_graph(
+      new pose_graph_msgs::PoseGraph(g));
+  merger.OnFastGraphMsg(fast_graph);
+  EXPECT_EQ(3, merger.GetCurrentGraph().nodes.size());
+  EXPECT_EQ(2, NumFastInEdges());
+
+  // A full slow graph up to a1 drops the fast state of a1 but keeps the fast
+  // graph stamps
+  g = pose_graph_msgs::PoseGraph();
+  g.nodes.push_back(n0);
+  g.nodes.push_back(n1);
+  merger.OnSlowGraphMsg(
+      pose_graph_msgs::PoseGraphConstPtr(new pose_graph_msgs::PoseGraph(g)));
+  EXPECT_EQ(1, NumFastInEdges());
+  merger.OnFastGraphMsg(fast_graph);
+  EXPECT_EQ(1, NumFastInEdges());
+
+  const pose_graph_msgs::PoseGraph& current_graph = merger.GetCurrentGraph();
+  EXPECT_EQ(3, current_graph.nodes.size());
+  for (const GraphNode& node : current_graph.nodes) {
+    gtsam::Symbol key(node.key);
+    EXPECT_NEAR(10.0 + key.index(), node.header.stamp.toSec(), tolerance_);
+    EXPECT_NEAR(key.index(), node.pose.position.x, tolerance_);
+  }
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
   ros::init(argc, argv, "test_pose_graph_merger");
@@ -2,7 +2,9 @@
 #define POSE_GRAPH_VISUALIZER_H
 
 #include <functional>
+#include <map>
 #include <ros/ros.h>
+#include <set>
 #include <unordered_map>
 
 #include <pose_graph_visualizer/HighlightEdge.h>
@@ -19,6 +21,7 @@
 #include <std_msgs/String.h>
 
 #include <visualization_msgs/Marker.h>
+#include <visualization_msgs/MarkerArray.h>
 
 #include <artifact_msgs/Artifact.h>
 
@@ -112,6 +115,25 @@ private:
 
   geometry_msgs::Point GetPositionMsg(gtsam::Key key) const;
 
+  // Chunks are named by marker namespace and id
+  typedef std::pair<std::string, int> ChunkId;
+  ChunkId GetChunkId(const gtsam::Symbol& key, const std::string& type) const;
+  // Records the robot nodes and odometry edges of a message in their chunks
+  // and marks the chunks drawing them for an update
+  void TrackChunks(const pose_graph_msgs::PoseGraph& msg);
+  void TrackChunkNode(gtsam::Key key);
+  void TrackChunkEdge(const pose_graph_msgs::PoseGraphEdge& edge);
+  // Forgets the chunk contents, sent chunks are deleted on the next update
+  void ResetChunks();
+  // Rebuilds the marked chunks and collects those that changed since they
+  // were last sent, with the keys of their nodes
+  void UpdateChunks(visualization_msgs::MarkerArray* changed,
+                    std::set<gtsam::Key>* changed_keys);
+  // Publishes the chunks that changed and returns the keys of their nodes
+  void VisualizeChunks(std::set<gtsam::Key>* changed_keys);
+  // Sends all chunks to a new subscriber
+  void ChunkSubscriberCallback(const ros::SingleSubscriberPublisher& pub);
+
   bool IsArtifactBlacklisted(const std::string& parent_id) {
     if (std::find(artifact_parentID_blacklist_.begin(),
                   artifact_parentID_blacklist_.end(),
@@ -153,6 +175,7 @@ private:
   ros::Publisher artifact_marker_pub_;
   ros::Publisher artifact_id_marker_pub_;
   ros::Publisher stair_marker_pub_;
+  ros::Publisher chunk_pub_;
 
   // Subscribers.
   ros::Subscriber keyed_scan_sub_;
@@ -184,6 +207,25 @@ private:
   bool b_scale_artifacts_with_confidence_;
   float confidence_scale_{1.0};
   double artifact_confidence_limit_;
+
+  // Robot nodes and odometry edges are sent in blocks of chunk_size_
+  // consecutive keys per robot, with stable marker ids so RViz updates them
+  // in place. A block is resent only when one of its points moved by more
+  // than chunk_update_threshold_.
+  bool b_chunked_markers_{false};
+  int chunk_size_{500};
+  double chunk_update_threshold_{0.05};
+  // Last sent chunk markers
+  std::map<ChunkId, visualization_msgs::Marker> sent_chunks_;
+  // Nodes and odometry edges of each chunk, and the chunks drawing each key
+  std::map<ChunkId, std::set<gtsam::Key>> chunk_nodes_;
+  std::map<ChunkId, std::set<std::pair<gtsam::Key, gtsam::Key>>> chunk_edges_;
+  std::unordered_map<gtsam::Key, std::set<ChunkId>> key_chunks_;
+  // Chunks with a new or updated node or edge since the last update
+  std::set<ChunkId> dirty_chunks_;
+
+  // Test class fixtures
+  friend class TestPoseGraphVisualizer;
 };
 
 #endif
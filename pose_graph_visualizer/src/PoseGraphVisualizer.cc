@@ -97,6 +97,12 @@ bool PoseGraphVisualizer::LoadParameters(const ros::NodeHandle& n) {
   if (!pu::Get("artifact_confidence_limit", artifact_confidence_limit_))
     return false;
 
+  // Optional, the whole graph is sent on every update by default
+  pu::Get("chunked_markers/b_enable", b_chunked_markers_);
+  pu::Get("chunked_markers/chunk_size", chunk_size_);
+  pu::Get("chunked_markers/update_threshold", chunk_update_threshold_);
+  chunk_size_ = std::max(1, chunk_size_);
+
   // Initialize interactive marker server
   if (publish_interactive_markers_) {
     server.reset(new interactive_markers::InteractiveMarkerServer(
@@ -144,6 +150,12 @@ bool PoseGraphVisualizer::RegisterCallbacks(const ros::NodeHandle& nh_,
       pnh.advertise<visualization_msgs::Marker>("stair_markers", 10, false);
   artifact_id_marker_pub_ = pnh.advertise<visualization_msgs::Marker>(
       "artifact_id_markers", 10, true);
+  if (b_chunked_markers_) {
+    chunk_pub_ = pnh.advertise<visualization_msgs::MarkerArray>(
+        "pose_graph_chunks",
+        10,
+        boost::bind(&PoseGraphVisualizer::ChunkSubscriberCallback, this, _1));
+  }
 
   keyed_scan_sub_ = nh.subscribe<pose_graph_msgs::KeyedScan>(
       "lamp/keyed_scans", 10, &PoseGraphVisualizer::KeyedScanCallback, this);
@@ -212,9 +224,11 @@ void PoseGraphVisualizer::PoseGraphCallback(
     const pose_graph_msgs::PoseGraph::ConstPtr& msg) {
   if (!msg->incremental) {
     pose_graph_.Reset();
+    ResetChunks();
   }
   // ROS_INFO("PGV: updating pose graph from message");
   pose_graph_.UpdateFromMsg(msg);
+  TrackChunks(*msg);
   for (const pose_graph_msgs::PoseGraphNode& msg_node : msg->nodes) {
     tf::Pose pose;
     tf::poseMsgToTF(msg_node.pose, pose);
@@ -245,11 +259,13 @@ void PoseGraphVisualizer::PoseGraphCallback(
 void PoseGraphVisualizer::PoseGraphNodeCallback(
     const pose_graph_msgs::PoseGraphNode::ConstPtr& msg) {
   pose_graph_.TrackNode(*msg);
+  TrackChunkNode(msg->key);
 }
 
 void PoseGraphVisualizer::PoseGraphEdgeCallback(
     const pose_graph_msgs::PoseGraphEdge::ConstPtr& msg) {
   pose_graph_.TrackFactor(*msg);
+  TrackChunkEdge(*msg);
 }
 
 void PoseGraphVisualizer::ErasePosegraphCallback(
@@ -260,6 +276,7 @@ void PoseGraphVisualizer::ErasePosegraphCallback(
   // loading the graph
   if (erase_all == true) {
     pose_graph_.Reset();
+    ResetChunks();
     if (publish_interactive_markers_) {
       server.reset(new interactive_markers::InteractiveMarkerServer(
           "interactive_node", "", false));
@@ -538,7 +555,157 @@ void PoseGraphVisualizer::MakeMenuMarker(const gtsam::Pose3& pose,
   menu_handler.apply(*server, int_marker.name);
 }
 
+void PoseGraphVisualizer::ChunkSubscriberCallback(
+    const ros::SingleSubscriberPublisher& pub) {
+  visualization_msgs::MarkerArray chunks;
+  for (const auto& entry : sent_chunks_) {
+    chunks.markers.push_back(entry.second);
+  }
+  pub.publish(chunks);
+}
+
+PoseGraphVisualizer::ChunkId
+PoseGraphVisualizer::GetChunkId(const gtsam::Symbol& key,
+                                const std::string& type) const {
+  return std::make_pair(pose_graph_.fixed_frame_id + "/" + type + "/" +
+                            std::string(1, key.chr()),
+                        static_cast<int>(key.index() / chunk_size_));
+}
+
+void PoseGraphVisualizer::TrackChunks(const pose_graph_msgs::PoseGraph& msg) {
+  for (const auto& edge : msg.edges) {
+    TrackChunkEdge(edge);
+  }
+  for (const auto& node : msg.nodes) {
+    TrackChunkNode(node.key);
+  }
+}
+
+void PoseGraphVisualizer::TrackChunkNode(gtsam::Key key) {
+  if (!b_chunked_markers_)
+    return;
+  gtsam::Symbol sym_key(key);
+  if (sym_key.chr() == 'u' || lamp_utils::IsArtifactPrefix(sym_key.chr()))
+    return;
+  const ChunkId id = GetChunkId(sym_key, "nodes");
+  chunk_nodes_[id].insert(key);
+  std::set<ChunkId>& drawn_in = key_chunks_[key];
+  drawn_in.insert(id);
+  // The node and the odometry edges it ends may have moved
+  dirty_chunks_.insert(drawn_in.begin(), drawn_in.end());
+}
+
+void PoseGraphVisualizer::TrackChunkEdge(
+    const pose_graph_msgs::PoseGraphEdge& edge) {
+  if (!b_chunked_markers_ || edge.type != pose_graph_msgs::PoseGraphEdge::ODOM)
+    return;
+  const ChunkId id = GetChunkId(gtsam::Symbol(edge.key_from), "odometry_edges");
+  chunk_edges_[id].insert(std::make_pair(edge.key_from, edge.key_to));
+  key_chunks_[edge.key_from].insert(id);
+  key_chunks_[edge.key_to].insert(id);
+  dirty_chunks_.insert(id);
+}
+
+void PoseGraphVisualizer::ResetChunks() {
+  chunk_nodes_.clear();
+  chunk_edges_.clear();
+  key_chunks_.clear();
+  // Sent chunks that are not filled again are deleted
+  for (const auto& entry : sent_chunks_) {
+    dirty_chunks_.insert(entry.first);
+  }
+}
+
+void PoseGraphVisualizer::UpdateChunks(visualization_msgs::MarkerArray* changed,
+                                       std::set<gtsam::Key>* changed_keys) {
+  const double threshold_sq = chunk_update_threshold_ * chunk_update_threshold_;
+  for (const ChunkId& id : dirty_chunks_) {
+    auto nodes = chunk_nodes_.find(id);
+    auto edges = chunk_edges_.find(id);
+    auto sent = sent_chunks_.find(id);
+
+    // Chunks that are gone, after the graph was erased
+    if (nodes == chunk_nodes_.end() && edges == chunk_edges_.end()) {
+      if (sent == sent_chunks_.end())
+        continue;
+      visualization_msgs::Marker m = sent->second;
+      m.action = visualization_msgs::Marker::DELETE;
+      m.points.clear();
+      changed->markers.push_back(m);
+      sent_chunks_.erase(sent);
+      continue;
+    }
+
+    visualization_msgs::Marker m;
+    m.header.frame_id = pose_graph_.fixed_frame_id;
+    m.ns = id.first;
+    m.id = id.second;
+    m.action = visualization_msgs::Marker::ADD;
+    m.pose.orientation.w = 1.0;
+    if (nodes != chunk_nodes_.end()) {
+      m.type = visualization_msgs::Marker::SPHERE_LIST;
+      m.color.r = 0.3;
+      m.color.g = 0.0;
+      m.color.b = 1.0;
+      m.color.a = 0.8;
+      m.scale.x = 0.1;
+      m.scale.y = 0.1;
+      m.scale.z = 0.1;
+      for (const auto& key : nodes->second) {
+        m.points.push_back(GetPositionMsg(key));
+      }
+    } else {
+      m.type = visualization_msgs::Marker::LINE_LIST;
+      m.color.r = 1.0;
+      m.color.g = 0.0;
+      m.color.b = 0.0;
+      m.color.a = 0.8;
+      m.scale.x = 0.02;
+      for (const auto& edge : edges->second) {
+        m.points.push_back(GetPositionMsg(edge.first));
+        m.points.push_back(GetPositionMsg(edge.second));
+      }
+    }
+
+    bool b_changed = sent == sent_chunks_.end() ||
+        sent->second.points.size() != m.points.size();
+    for (size_t i = 0; !b_changed && i < m.points.size(); i++) {
+      const auto& a = sent->second.points[i];
+      const auto& b = m.points[i];
+      double dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+      b_changed = dx * dx + dy * dy + dz * dz > threshold_sq;
+    }
+    if (!b_changed)
+      continue;
+
+    changed->markers.push_back(m);
+    sent_chunks_[id] = m;
+    if (nodes != chunk_nodes_.end())
+      changed_keys->insert(nodes->second.begin(), nodes->second.end());
+  }
+  dirty_chunks_.clear();
+}
+
+void PoseGraphVisualizer::VisualizeChunks(std::set<gtsam::Key>* changed_keys) {
+  // Only the chunks holding a new or updated node or edge are rebuilt
+  const size_t num_dirty = dirty_chunks_.size();
+  visualization_msgs::MarkerArray changed;
+  UpdateChunks(&changed, changed_keys);
+
+  if (!changed.markers.empty()) {
+    ROS_DEBUG_STREAM("Sending " << changed.markers.size() << " of "
+                                << num_dirty << " updated graph chunks");
+    chunk_pub_.publish(changed);
+  }
+}
+
 void PoseGraphVisualizer::VisualizePoseGraph() {
+  // Keys of the chunks that were resent, nodes in other chunks did not move
+  std::set<gtsam::Key> changed_keys;
+  if (b_chunked_markers_) {
+    VisualizeChunks(&changed_keys);
+  }
+
   visualization_msgs::Marker odometry_edges;
   visualization_msgs::Marker loop_edges;
   visualization_msgs::Marker artifact_edges;
@@ -551,7 +718,9 @@ void PoseGraphVisualizer::VisualizePoseGraph() {
     edge_target = nullptr;
     switch (edge.type) {
     case pose_graph_msgs::PoseGraphEdge::ODOM:
-      edge_target = &odometry_edges;
+      // Sent in chunks
+      if (!b_chunked_markers_)
+        edge_target = &odometry_edges;
       break;
     case pose_graph_msgs::PoseGraphEdge::LOOPCLOSE:
       edge_target = &loop_edges;
@@ -574,7 +743,7 @@ void PoseGraphVisualizer::VisualizePoseGraph() {
   }
 
   // Publish odometry edges.
-  if (odometry_edge_pub_.getNumSubscribers() > 0) {
+  if (!b_chunked_markers_ && odometry_edge_pub_.getNumSubscribers() > 0) {
     odometry_edges.header.frame_id = pose_graph_.fixed_frame_id;
     odometry_edges.ns = pose_graph_.fixed_frame_id;
     odometry_edges.id = 0;
@@ -674,12 +843,14 @@ void PoseGraphVisualizer::VisualizePoseGraph() {
     }
 
     // Fill pose nodes (representing the robot position)
-    generic_nodes.points.push_back(GetPositionMsg(node.key));
+    if (!b_chunked_markers_) {
+      generic_nodes.points.push_back(GetPositionMsg(node.key));
+    }
     pose_keys.insert(sym_key);
   }
 
   // Publish nodes in the pose graph.
-  if (graph_node_pub_.getNumSubscribers() > 0) {
+  if (!b_chunked_markers_ && graph_node_pub_.getNumSubscribers() > 0) {
     generic_nodes.header.frame_id = pose_graph_.fixed_frame_id;
     generic_nodes.ns = pose_graph_.fixed_frame_id;
     generic_nodes.id = 4;
@@ -729,6 +900,8 @@ void PoseGraphVisualizer::VisualizePoseGraph() {
     int id_base = 100;
     int counter = 0;
     for (const auto& key : pose_keys) {
+      if (b_chunked_markers_ && !changed_keys.count(key))
+        continue;
       m.pose = lamp_utils::GtsamToRosMsg(pose_graph_.GetPose(key));
       // Display text for the node
       m.text = std::to_string(key);
@@ -875,6 +1048,8 @@ void PoseGraphVisualizer::VisualizePoseGraph() {
   if (publish_interactive_markers_) {
     for (const auto& keyed_pose :
          pose_graph_.GetNewValues()) { // TODO - just generic nodes
+      if (b_chunked_markers_ && !changed_keys.count(keyed_pose.key))
+        continue;
       gtsam::Symbol key_id = gtsam::Symbol(keyed_pose.key);
       std::string robot_id = std::string(key_id);
       MakeMenuMarker(pose_graph_.GetPose(keyed_pose.key), robot_id);
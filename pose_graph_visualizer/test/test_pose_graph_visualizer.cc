@@ -0,0 +1,170 @@
+/**
+ *  @brief Testing the chunked pose graph markers
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "pose_graph_visualizer/PoseGraphVisualizer.h"
+
+class TestPoseGraphVisualizer : public ::testing::Test {
+public:
+  TestPoseGraphVisualizer() {
+    vis_.b_chunked_markers_ = true;
+    vis_.chunk_size_ = 10;
+    vis_.chunk_update_threshold_ = 0.05;
+    vis_.pose_graph_.fixed_frame_id = "world";
+  }
+  ~TestPoseGraphVisualizer() {}
+
+protected:
+  pose_graph_msgs::PoseGraphNode Node(gtsam::Key key, double x) const {
+    pose_graph_msgs::PoseGraphNode node;
+    node.key = key;
+    node.pose.position.x = x;
+    node.pose.orientation.w = 1.0;
+    return node;
+  }
+
+  pose_graph_msgs::PoseGraphEdge Odometry(gtsam::Key from,
+                                          gtsam::Key to) const {
+    pose_graph_msgs::PoseGraphEdge edge;
+    edge.key_from = from;
+    edge.key_to = to;
+    edge.type = pose_graph_msgs::PoseGraphEdge::ODOM;
+    edge.pose.position.x = 1.0;
+    edge.pose.orientation.w = 1.0;
+    return edge;
+  }
+
+  // Incremental message moving node i of robot a to x, with the odometry
+  // edge from node i - 1 if requested
+  pose_graph_msgs::PoseGraph Step(size_t i, double x, bool b_odometry) const {
+    pose_graph_msgs::PoseGraph msg;
+    msg.incremental = true;
+    msg.nodes.push_back(Node(gtsam::Symbol('a', i), x));
+    if (b_odometry)
+      msg.edges.push_back(
+          Odometry(gtsam::Symbol('a', i - 1), gtsam::Symbol('a', i)));
+    return msg;
+  }
+
+  // Applies a message and returns the chunks to send
+  visualization_msgs::MarkerArray Update(const pose_graph_msgs::PoseGraph& msg,
+                                         std::set<gtsam::Key>* changed_keys) {
+    vis_.pose_graph_.UpdateFromMsg(msg);
+    vis_.TrackChunks(msg);
+    visualization_msgs::MarkerArray changed;
+    vis_.UpdateChunks(&changed, changed_keys);
+    return changed;
+  }
+
+  visualization_msgs::MarkerArray Reset() {
+    vis_.pose_graph_.Reset();
+    vis_.ResetChunks();
+    visualization_msgs::MarkerArray changed;
+    std::set<gtsam::Key> changed_keys;
+    vis_.UpdateChunks(&changed, &changed_keys);
+    return changed;
+  }
+
+  PoseGraphVisualizer::ChunkId GetChunkId(const gtsam::Symbol& key,
+                                          const std::string& type) const {
+    return vis_.GetChunkId(key, type);
+  }
+
+  size_t NumDirtyChunks() const { return vis_.dirty_chunks_.size(); }
+
+  // Namespaces and ids of the markers
+  std::set<PoseGraphVisualizer::ChunkId>
+  Ids(const visualization_msgs::MarkerArray& markers) const {
+    std::set<PoseGraphVisualizer::ChunkId> ids;
+    for (const auto& m : markers.markers) {
+      ids.insert(std::make_pair(m.ns, m.id));
+    }
+    return ids;
+  }
+
+  PoseGraphVisualizer vis_;
+};
+
+TEST_F(TestPoseGraphVisualizer, ChunkAssignment) {
+  EXPECT_EQ(std::make_pair(std::string("world/nodes/a"), 0),
+            GetChunkId(gtsam::Symbol('a', 0), "nodes"));
+  EXPECT_EQ(std::make_pair(std::string("world/nodes/a"), 0),
+            GetChunkId(gtsam::Symbol('a', 9), "nodes"));
+  EXPECT_EQ(std::make_pair(std::string("world/nodes/a"), 1),
+            GetChunkId(gtsam::Symbol('a', 10), "nodes"));
+  EXPECT_EQ(std::make_pair(std::string("world/odometry_edges/b"), 2),
+            GetChunkId(gtsam::Symbol('b', 25), "odometry_edges"));
+}
+
+TEST_F(TestPoseGraphVisualizer, OnlyChangedChunksAreSent) {
+  const auto nodes = [this](size_t i) {
+    return GetChunkId(gtsam::Symbol('a', i), "nodes");
+  };
+  const auto edges = [this](size_t i) {
+    return GetChunkId(gtsam::Symbol('a', i), "odometry_edges");
+  };
+
+  // a0 to a24 in three chunks of nodes and of edges
+  pose_graph_msgs::PoseGraph msg;
+  msg.incremental = true;
+  for (size_t i = 0; i < 25; i++) {
+    msg.nodes.push_back(Node(gtsam::Symbol('a', i), i));
+    if (i > 0)
+      msg.edges.push_back(
+          Odometry(gtsam::Symbol('a', i - 1), gtsam::Symbol('a', i)));
+  }
+  std::set<gtsam::Key> changed_keys;
+  auto changed = Update(msg, &changed_keys);
+  EXPECT_EQ(6, changed.markers.size());
+  EXPECT_EQ(25, changed_keys.size());
+  EXPECT_EQ(0, NumDirtyChunks());
+
+  // A new node only touches the last chunks
+  changed_keys.clear();
+  changed = Update(Step(25, 25.0, true), &changed_keys);
+  EXPECT_EQ(
+      std::set<PoseGraphVisualizer::ChunkId>({nodes(20), edges(20)}),
+      Ids(changed));
+  EXPECT_EQ(6, changed_keys.size());
+  EXPECT_EQ(1, changed_keys.count(gtsam::Symbol('a', 25)));
+
+  // A moved node resends its chunk and the edges ending in it
+  changed_keys.clear();
+  changed = Update(Step(9, 10.0, false), &changed_keys);
+  EXPECT_EQ(std::set<PoseGraphVisualizer::ChunkId>({nodes(0), edges(0)}),
+            Ids(changed));
+  EXPECT_EQ(10, changed_keys.size());
+
+  // Including the edge reaching in from the previous chunk
+  changed_keys.clear();
+  changed = Update(Step(10, 11.0, false), &changed_keys);
+  EXPECT_EQ(std::set<PoseGraphVisualizer::ChunkId>(
+                {nodes(10), edges(0), edges(10)}),
+            Ids(changed));
+
+  // Moves below the threshold are not sent
+  changed_keys.clear();
+  changed = Update(Step(15, 15.01, false), &changed_keys);
+  EXPECT_TRUE(changed.markers.empty());
+  EXPECT_TRUE(changed_keys.empty());
+  EXPECT_EQ(0, NumDirtyChunks());
+
+  // Erasing the graph deletes every sent chunk
+  changed = Reset();
+  ASSERT_EQ(6, changed.markers.size());
+  for (const auto& m : changed.markers) {
+    EXPECT_EQ(visualization_msgs::Marker::DELETE, m.action);
+  }
+  changed_keys.clear();
+  EXPECT_TRUE(Update(pose_graph_msgs::PoseGraph(), &changed_keys)
+                  .markers.empty());
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "test_pose_graph_visualizer");
+  return RUN_ALL_TESTS();
+}